@@ -0,0 +1,13 @@
+#version 330 core
+layout(location = 0) out vec4 fragment;
+in vec2 tex_coords;
+in vec4 color;
+
+uniform sampler2D tex;
+
+void main()
+{
+	// Untextured primitives sample a white texel
+	float a = texture(tex, tex_coords).r;
+	fragment = color * vec4(1.0, 1.0, 1.0, a);
+}
@@ -0,0 +1,15 @@
+#version 330 core
+
+layout (location=0) in vec4 vertex;
+layout (location=1) in vec4 vertex_color;
+out vec2 tex_coords;
+out vec4 color;
+
+uniform mat4 MP;
+
+void main()
+{
+	gl_Position = MP * vec4(vertex.xy, 0, 1);
+	tex_coords = vertex.zw;
+	color = vertex_color;
+}
@@ -106,10 +106,121 @@ vector<DirectoryItem> tools::get_directory_listing( string path )
 	return items;
 }
 
+
+
+
+tools::MappedFile::MappedFile( const string &path )
+{
+	file_handle = CreateFileA(
+		path.c_str(),
+		GENERIC_READ,
+		FILE_SHARE_READ,
+		nullptr,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+		nullptr
+	);
+	if( file_handle == INVALID_HANDLE_VALUE )
+	{
+		file_handle = nullptr;
+		throw runtime_error( "Couldn't open the file: '" + path + "'" );
+	}
+
+	LARGE_INTEGER file_size;
+	if( !GetFileSizeEx( file_handle, &file_size ) )
+	{
+		CloseHandle( file_handle );
+		throw runtime_error( "Couldn't get the size of the file: '" + path + "'" );
+	}
+
+	// Empty files can't be mapped
+	mapped_size = static_cast<size_t>( file_size.QuadPart );
+	if( !mapped_size )
+	{
+		return;
+	}
+
+	mapping_handle = CreateFileMappingA( file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr );
+	if( !mapping_handle )
+	{
+		CloseHandle( file_handle );
+		throw runtime_error( "Couldn't map the file: '" + path + "'" );
+	}
+
+	mapped_data = static_cast<const char*>( MapViewOfFile( mapping_handle, FILE_MAP_READ, 0, 0, 0 ) );
+	if( !mapped_data )
+	{
+		CloseHandle( mapping_handle );
+		CloseHandle( file_handle );
+		throw runtime_error( "Couldn't map the file: '" + path + "'" );
+	}
+}
+
+
+
+tools::MappedFile::~MappedFile()
+{
+	if( mapped_data )
+	{
+		UnmapViewOfFile( mapped_data );
+	}
+	if( mapping_handle )
+	{
+		CloseHandle( mapping_handle );
+	}
+	if( file_handle )
+	{
+		CloseHandle( file_handle );
+	}
+}
+
+
+
+void tools::replace_file( const string &from, const string &to )
+{
+	// Write through returns once the move is on the disk
+	if( !MoveFileExA( from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH ) )
+	{
+		throw runtime_error( "Couldn't replace the file: '" + to + "'" );
+	}
+}
+
+
+
+void tools::sync_file( const string &path )
+{
+	const auto file_handle = CreateFileA(
+		path.c_str(),
+		GENERIC_WRITE,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		nullptr,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		nullptr
+	);
+	if( file_handle == INVALID_HANDLE_VALUE )
+	{
+		throw runtime_error( "Couldn't open the file: '" + path + "'" );
+	}
+
+	const auto is_flushed = FlushFileBuffers( file_handle );
+	CloseHandle( file_handle );
+	if( !is_flushed )
+	{
+		throw runtime_error( "Couldn't write the file to the disk: '" + path + "'" );
+	}
+}
+
 /* NON-WINDOWS-SPECIFIC */
 #else
 
+#include <cstdio>
+#include <cerrno>
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 
 vector<DirectoryItem> tools::get_directory_listing( string path )
@@ -139,6 +250,100 @@ vector<DirectoryItem> tools::get_directory_listing( string path )
   return items;
 }
 
+
+
+tools::MappedFile::MappedFile( const string &path )
+{
+	file_descriptor = open( path.c_str(), O_RDONLY );
+	if( file_descriptor < 0 )
+	{
+		throw runtime_error( "Couldn't open the file: '" + path + "'" );
+	}
+
+	struct stat file_info;
+	if( fstat( file_descriptor, &file_info ) != 0 )
+	{
+		close( file_descriptor );
+		throw runtime_error( "Couldn't get the size of the file: '" + path + "'" );
+	}
+
+	// Empty files can't be mapped
+	mapped_size = static_cast<size_t>( file_info.st_size );
+	if( !mapped_size )
+	{
+		return;
+	}
+
+	auto mapping = mmap( nullptr, mapped_size, PROT_READ, MAP_PRIVATE, file_descriptor, 0 );
+	if( mapping == MAP_FAILED )
+	{
+		close( file_descriptor );
+		throw runtime_error( "Couldn't map the file: '" + path + "'" );
+	}
+
+	madvise( mapping, mapped_size, MADV_SEQUENTIAL );
+	mapped_data = static_cast<const char*>( mapping );
+}
+
+
+
+tools::MappedFile::~MappedFile()
+{
+	if( mapped_data )
+	{
+		munmap( const_cast<char*>( mapped_data ), mapped_size );
+	}
+	if( file_descriptor >= 0 )
+	{
+		close( file_descriptor );
+	}
+}
+
+
+
+void tools::replace_file( const string &from, const string &to )
+{
+	if( rename( from.c_str(), to.c_str() ) != 0 )
+	{
+		throw runtime_error( "Couldn't replace the file: '" + to + "'" );
+	}
+
+	// The rename is a change of the directory, which is synced on its own
+	// - File systems that can't sync directories refuse with EINVAL
+	const auto separator = to.find_last_of( '/' );
+	const auto directory = separator == string::npos ? string( "." ) : to.substr( 0, separator + 1 );
+	const auto directory_file = open( directory.c_str(), O_RDONLY );
+	if( directory_file < 0 )
+	{
+		throw runtime_error( "Couldn't open the directory: '" + directory + "'" );
+	}
+
+	const auto is_synced = fsync( directory_file ) == 0 || errno == EINVAL;
+	close( directory_file );
+	if( !is_synced )
+	{
+		throw runtime_error( "Couldn't write the directory to the disk: '" + directory + "'" );
+	}
+}
+
+
+
+void tools::sync_file( const string &path )
+{
+	const auto file = open( path.c_str(), O_RDONLY );
+	if( file < 0 )
+	{
+		throw runtime_error( "Couldn't open the file: '" + path + "'" );
+	}
+
+	const auto is_synced = fsync( file ) == 0;
+	close( file );
+	if( !is_synced )
+	{
+		throw runtime_error( "Couldn't write the file to the disk: '" + path + "'" );
+	}
+}
+
 #endif
 
 
@@ -237,6 +237,36 @@ T read_file_contents( const std::string& filename )
 }
 
 
+
+// Read-only memory mapping of a whole file
+// - Pages are read in by the OS when they are touched,
+//   so opening doesn't depend on the size of the file
+// - Throws runtime_error if the file can't be mapped
+struct MappedFile
+{
+	explicit MappedFile( const std::string &path );
+	~MappedFile();
+
+	// Delete potentially dangerous constructors and operators
+	MappedFile( const MappedFile& )            = delete;
+	MappedFile& operator=( const MappedFile& ) = delete;
+
+	const char* data() const { return mapped_data; }
+	size_t size() const { return mapped_size; }
+
+  protected:
+	const char *mapped_data = nullptr;
+	size_t      mapped_size = 0;
+
+#ifdef _WIN32
+	void *file_handle    = nullptr;
+	void *mapping_handle = nullptr;
+#else
+	int file_descriptor = -1;
+#endif
+};
+
+
 // Directory listing
 enum DirectoryItemType
 {
@@ -258,6 +288,17 @@ std::vector<DirectoryItem> get_directory_listing( std::string path );
 
 bool is_file_readable( std::string path );
 
+// Renames the file over another one in a single step, so that the other
+// file is either left as it was or replaced as a whole
+// - The rename is on the disk when this returns, the data of the file
+//   has to be put there first with sync_file()
+// - Throws runtime_error if the file couldn't be replaced
+void replace_file( const std::string &from, const std::string &to );
+
+// Blocks until the written data of the file is on the disk, not only handed to the OS
+// - Throws runtime_error if the data couldn't be written
+void sync_file( const std::string &path );
+
 // String helpers
 
 namespace str
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -23,9 +24,13 @@ using string_unicode = std::vector<uint32_t>;
 
 
 // struct to hold GL-texture and common info of an unicode code point
+// - gl_texture is the glyph atlas page the bitmap was packed to
+// - uv_rect: { u_left, v_top, u_right, v_bottom } within the page
 struct GlCharacter
 {
 	GLuint     gl_texture  = 0;
+	size_t     atlas_page  = 0;
+	glm::vec4  uv_rect     = { 0, 0, 0, 0 };
 	glm::ivec2 size        = { 0, 0 };
 	glm::ivec2 bearing     = { 0, 0 };
 	GLuint     advance     = 0;
@@ -35,29 +40,4 @@ struct GlCharacter
 
 
 
-struct FontFaceIdentity
-{
-	const FT_Face face_ptr;
-	const size_t size;
-
-	FontFaceIdentity( const FT_Face font_face_ptr )
-	: face_ptr( font_face_ptr ), size( font_face_ptr->size->metrics.height ) {}
-
-	bool operator< ( const FontFaceIdentity &other) const
-	{
-		if( face_ptr < other.face_ptr )
-		{
-			return true;
-		}
-		else if( face_ptr == other.face_ptr &&
-		         size < other.size )
-		{
-			return true;
-		}
-		else return false;
-	}
-};
-
-
-using FontFaceContents = std::map<unsigned long, GlCharacter>;
-
+using FontFacePtr = std::shared_ptr<FT_FaceRec_>;
@@ -0,0 +1,562 @@
+#include "gl_batch.hh"
+#include "gui_gl.hh"
+#include "globals.hh"
+
+#include <cstddef>
+#include <algorithm>
+#include <glm/gtc/matrix_transform.hpp>
+
+using namespace std;
+
+
+gl::Batch2D::Batch2D()
+: viewport_size( 0.f, 0.f ),
+  blending( STRAIGHT_ALPHA ),
+  current_texture( 0 ),
+  draw_calls( 0 ),
+  vao( 0 ),
+  vbo( 0 ),
+  white_texture( 0 )
+{
+}
+
+
+
+void gl::Batch2D::release()
+{
+	if( vao )
+	{
+		glDeleteVertexArrays( 1, &vao );
+		glDeleteBuffers( 1, &vbo );
+		glDeleteTextures( 1, &white_texture );
+		vao = 0;
+		vbo = 0;
+		white_texture = 0;
+	}
+}
+
+
+
+void gl::Batch2D::init_gl_objects()
+{
+	glGenVertexArrays( 1, &vao );
+	glGenBuffers( 1, &vbo );
+	if( !vao || !vbo )
+	{
+		throw runtime_error( "Couldn't create vertex buffers for the 2d batch" );
+	}
+
+	glBindVertexArray( vao );
+	glBindBuffer( GL_ARRAY_BUFFER, vbo );
+
+	const auto stride = static_cast<GLsizei>( sizeof( BatchVertex ) );
+	glEnableVertexAttribArray( 0 );
+	glVertexAttribPointer( 0, 4, GL_FLOAT, GL_FALSE, stride, nullptr );
+	glEnableVertexAttribArray( 1 );
+	glVertexAttribPointer(
+		1, 4, GL_FLOAT, GL_FALSE, stride,
+		reinterpret_cast<const void*>( offsetof( BatchVertex, r ) )
+	);
+
+	glBindBuffer( GL_ARRAY_BUFFER, 0 );
+	glBindVertexArray( 0 );
+	gui::any_gl_errors();
+
+	// Untextured primitives sample this, so that they can
+	// share the draw calls with the textured ones
+	static const GLubyte white_pixel[4] = { 255, 255, 255, 255 };
+
+	glGenTextures( 1, &white_texture );
+	if( !white_texture )
+	{
+		throw runtime_error( "Couldn't create texture" );
+	}
+	glBindTexture( GL_TEXTURE_2D, white_texture );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+	glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white_pixel );
+	glBindTexture( GL_TEXTURE_2D, 0 );
+	gui::any_gl_errors();
+}
+
+
+
+void gl::Batch2D::begin_frame( const glm::vec2 &size )
+{
+	vertices.clear();
+	current_texture = 0;
+	draw_calls = 0;
+	viewport_size = size;
+	blending = STRAIGHT_ALPHA;
+}
+
+
+
+void gl::Batch2D::set_blending( Blending new_blending )
+{
+	if( new_blending == blending )
+	{
+		return;
+	}
+
+	flush();
+	blending = new_blending;
+}
+
+
+
+void gl::Batch2D::set_viewport_size( const glm::vec2 &size )
+{
+	if( size == viewport_size )
+	{
+		return;
+	}
+
+	flush();
+	viewport_size = size;
+}
+
+
+
+void gl::Batch2D::use_texture( GLuint texture )
+{
+	if( !vao )
+	{
+		init_gl_objects();
+	}
+
+	// Untextured primitives use the white texel
+	if( !texture )
+	{
+		texture = white_texture;
+	}
+
+	if( texture == current_texture )
+	{
+		return;
+	}
+
+	if( vertices.size() )
+	{
+		flush();
+	}
+
+	current_texture = texture;
+}
+
+
+
+void gl::Batch2D::push_quad(
+	const glm::vec2 &top_left,
+	const glm::vec2 &top_right,
+	const glm::vec2 &bottom_right,
+	const glm::vec2 &bottom_left,
+	const glm::vec4 &uv_rect,
+	const glm::vec4 &color
+)
+{
+	const BatchVertex tl{ top_left.x,     top_left.y,     uv_rect.x, uv_rect.y, color.r, color.g, color.b, color.a };
+	const BatchVertex tr{ top_right.x,    top_right.y,    uv_rect.z, uv_rect.y, color.r, color.g, color.b, color.a };
+	const BatchVertex br{ bottom_right.x, bottom_right.y, uv_rect.z, uv_rect.w, color.r, color.g, color.b, color.a };
+	const BatchVertex bl{ bottom_left.x,  bottom_left.y,  uv_rect.x, uv_rect.w, color.r, color.g, color.b, color.a };
+
+	vertices.push_back( bl );
+	vertices.push_back( tl );
+	vertices.push_back( tr );
+
+	vertices.push_back( tr );
+	vertices.push_back( br );
+	vertices.push_back( bl );
+}
+
+
+
+void gl::Batch2D::add_quad(
+	glm::vec2 pos,
+	glm::vec2 size,
+	const glm::vec4 &color
+)
+{
+	use_texture( 0 );
+
+	push_quad(
+		pos,
+		{ pos.x + size.x, pos.y },
+		pos + size,
+		{ pos.x, pos.y + size.y },
+		{ 0.f, 0.f, 1.f, 1.f },
+		color
+	);
+}
+
+
+
+void gl::Batch2D::add_line(
+	glm::vec2 a,
+	glm::vec2 b,
+	const glm::vec4 &color,
+	float width
+)
+{
+	const auto diff = b - a;
+	const auto length = glm::length( diff );
+	if( length <= 0.f )
+	{
+		return;
+	}
+
+	use_texture( 0 );
+
+	// Lines are expanded to thin quads, so that they don't need
+	// a separate GL_LINES draw call
+	const auto half_width = width / 2.f;
+	const auto normal = glm::vec2{ -diff.y, diff.x } * (half_width / length);
+
+	push_quad(
+		a + normal,
+		b + normal,
+		b - normal,
+		a - normal,
+		{ 0.f, 0.f, 1.f, 1.f },
+		color
+	);
+}
+
+
+
+void gl::Batch2D::add_triangles(
+	const glm::vec2 *points,
+	size_t point_count,
+	glm::vec2 offset,
+	const glm::vec4 &color
+)
+{
+	point_count -= point_count % 3;
+	if( !point_count )
+	{
+		return;
+	}
+
+	use_texture( 0 );
+
+	const auto first = vertices.size();
+	vertices.resize( first + point_count );
+	for( size_t i = 0; i < point_count; i++ )
+	{
+		vertices[first + i] = BatchVertex{
+			points[i].x + offset.x, points[i].y + offset.y,
+			0.f, 0.f,
+			color.r, color.g, color.b, color.a
+		};
+	}
+}
+
+
+
+void gl::Batch2D::add_textured_quad(
+	GLuint texture,
+	glm::vec2 pos,
+	glm::vec2 size,
+	const glm::vec4 &uv_rect,
+	const glm::vec4 &color
+)
+{
+	if( !texture )
+	{
+		return;
+	}
+
+	use_texture( texture );
+
+	push_quad(
+		pos,
+		{ pos.x + size.x, pos.y },
+		pos + size,
+		{ pos.x, pos.y + size.y },
+		uv_rect,
+		color
+	);
+}
+
+
+
+bool gl::Batch2D::use_shader( const glm::mat4 &view )
+{
+	auto shader = Globals::shaders.find( "batch2d" );
+	if( shader == Globals::shaders.end() )
+	{
+		return false;
+	}
+
+	glUseProgram( shader->second.program );
+
+	const auto projection = glm::ortho<float>( 0, viewport_size.x, viewport_size.y, 0 ) * view;
+	glUniformMatrix4fv( shader->second.get_uniform( "MP" ), 1, GL_FALSE, &projection[0][0] );
+	glUniform1i( shader->second.get_uniform( "tex" ), 0 );
+
+	glEnable( GL_BLEND );
+	switch( blending )
+	{
+		case REPLACE:
+			glDisable( GL_BLEND );
+			break;
+
+		case STRAIGHT_ALPHA:
+			glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+			break;
+
+		case PREMULTIPLY_ALPHA:
+			glBlendFuncSeparate( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA );
+			break;
+
+		case PREMULTIPLIED_ALPHA:
+			glBlendFunc( GL_ONE, GL_ONE_MINUS_SRC_ALPHA );
+			break;
+	}
+
+	return true;
+}
+
+
+
+void gl::Batch2D::flush()
+{
+	if( !vertices.size() )
+	{
+		return;
+	}
+
+	if( !use_shader( glm::mat4( 1.f ) ) )
+	{
+		vertices.clear();
+		return;
+	}
+
+	glActiveTexture( GL_TEXTURE0 );
+	glBindTexture( GL_TEXTURE_2D, current_texture );
+
+	glBindVertexArray( vao );
+	glBindBuffer( GL_ARRAY_BUFFER, vbo );
+
+	// Orphan the previous storage so the driver doesn't have to
+	// wait for the last draw call to finish using it
+	const auto data_size = static_cast<GLsizeiptr>( vertices.size() * sizeof( BatchVertex ) );
+	glBufferData( GL_ARRAY_BUFFER, data_size, nullptr, GL_STREAM_DRAW );
+	glBufferSubData( GL_ARRAY_BUFFER, 0, data_size, vertices.data() );
+	gui::any_gl_errors();
+
+	glDrawArrays( GL_TRIANGLES, 0, static_cast<GLsizei>( vertices.size() ) );
+	gui::any_gl_errors();
+	draw_calls++;
+
+	glBindBuffer( GL_ARRAY_BUFFER, 0 );
+	glBindVertexArray( 0 );
+	glBindTexture( GL_TEXTURE_2D, 0 );
+	restore_blending();
+
+	vertices.clear();
+	current_texture = 0;
+}
+
+
+
+void gl::Batch2D::draw_mesh( const Mesh2D &mesh, const glm::mat4 &view )
+{
+	if( !mesh.vertex_count )
+	{
+		return;
+	}
+
+	flush();
+	if( !vao )
+	{
+		init_gl_objects();
+	}
+
+	if( !use_shader( view ) )
+	{
+		return;
+	}
+
+	glActiveTexture( GL_TEXTURE0 );
+	glBindTexture( GL_TEXTURE_2D, white_texture );
+
+	glBindVertexArray( mesh.vao );
+	glDrawArrays( GL_TRIANGLES, 0, static_cast<GLsizei>( mesh.vertex_count ) );
+	gui::any_gl_errors();
+	draw_calls++;
+
+	glBindVertexArray( 0 );
+	glBindTexture( GL_TEXTURE_2D, 0 );
+	restore_blending();
+}
+
+
+
+void gl::Batch2D::restore_blending()
+{
+	// Text and the other direct drawing expect blending to be enabled
+	if( blending == REPLACE )
+	{
+		glEnable( GL_BLEND );
+	}
+}
+
+
+
+gl::Mesh2D::Mesh2D()
+: vao( 0 ),
+  vbo( 0 ),
+  vertex_count( 0 ),
+  capacity( 0 )
+{
+}
+
+
+
+gl::Mesh2D::~Mesh2D()
+{
+	release();
+}
+
+
+
+gl::Mesh2D::Mesh2D( Mesh2D &&other )
+: vao( other.vao ),
+  vbo( other.vbo ),
+  vertex_count( other.vertex_count ),
+  capacity( other.capacity )
+{
+	other.vao = 0;
+	other.vbo = 0;
+	other.vertex_count = 0;
+	other.capacity = 0;
+}
+
+
+
+gl::Mesh2D& gl::Mesh2D::operator=( Mesh2D &&other )
+{
+	if( this != &other )
+	{
+		release();
+
+		vao = other.vao;
+		vbo = other.vbo;
+		vertex_count = other.vertex_count;
+		capacity = other.capacity;
+		other.vao = 0;
+		other.vbo = 0;
+		other.vertex_count = 0;
+		other.capacity = 0;
+	}
+
+	return *this;
+}
+
+
+
+void gl::Mesh2D::release()
+{
+	if( vao )
+	{
+		glDeleteVertexArrays( 1, &vao );
+		glDeleteBuffers( 1, &vbo );
+		vao = 0;
+		vbo = 0;
+	}
+
+	vertex_count = 0;
+	capacity = 0;
+}
+
+
+
+void gl::Mesh2D::upload( const vector<BatchVertex> &vertices, size_t min_capacity )
+{
+	vertex_count = vertices.size() - vertices.size() % 3;
+	if( !vertex_count && !min_capacity )
+	{
+		return;
+	}
+
+	if( !vao )
+	{
+		glGenVertexArrays( 1, &vao );
+		glGenBuffers( 1, &vbo );
+		if( !vao || !vbo )
+		{
+			throw runtime_error( "Couldn't create vertex buffers for the 2d mesh" );
+		}
+
+		glBindVertexArray( vao );
+		glBindBuffer( GL_ARRAY_BUFFER, vbo );
+
+		const auto stride = static_cast<GLsizei>( sizeof( BatchVertex ) );
+		glEnableVertexAttribArray( 0 );
+		glVertexAttribPointer( 0, 4, GL_FLOAT, GL_FALSE, stride, nullptr );
+		glEnableVertexAttribArray( 1 );
+		glVertexAttribPointer(
+			1, 4, GL_FLOAT, GL_FALSE, stride,
+			reinterpret_cast<const void*>( offsetof( BatchVertex, r ) )
+		);
+
+		glBindVertexArray( 0 );
+	}
+
+	glBindBuffer( GL_ARRAY_BUFFER, vbo );
+
+	// The storage is kept when the vertices fit, a mesh that
+	// is edited often doesn't reallocate on every upload
+	const auto data_size = static_cast<GLsizeiptr>( vertex_count * sizeof( BatchVertex ) );
+	const auto needed_capacity = max( vertex_count, min_capacity );
+	if( needed_capacity > capacity )
+	{
+		capacity = needed_capacity;
+		glBufferData( GL_ARRAY_BUFFER, static_cast<GLsizeiptr>( capacity * sizeof( BatchVertex ) ), nullptr, GL_STATIC_DRAW );
+	}
+
+	if( data_size )
+	{
+		glBufferSubData( GL_ARRAY_BUFFER, 0, data_size, vertices.data() );
+	}
+
+	glBindBuffer( GL_ARRAY_BUFFER, 0 );
+	gui::any_gl_errors();
+}
+
+
+
+bool gl::Mesh2D::update( size_t first, const BatchVertex *vertices, size_t count )
+{
+	if( !count )
+	{
+		return true;
+	}
+
+	if( !vao || first + count > capacity )
+	{
+		return false;
+	}
+
+	glBindBuffer( GL_ARRAY_BUFFER, vbo );
+	glBufferSubData(
+		GL_ARRAY_BUFFER,
+		static_cast<GLintptr>( first * sizeof( BatchVertex ) ),
+		static_cast<GLsizeiptr>( count * sizeof( BatchVertex ) ),
+		vertices
+	);
+	glBindBuffer( GL_ARRAY_BUFFER, 0 );
+	gui::any_gl_errors();
+
+	vertex_count = max( vertex_count, first + count );
+	return true;
+}
+
+
+
+void gl::Mesh2D::clear()
+{
+	vertex_count = 0;
+}
+
@@ -0,0 +1,162 @@
+#pragma once
+
+#include "common_types.hh"
+
+#include <vector>
+
+namespace gl
+{
+	// Vertex layout used by the batch2d shader
+	struct BatchVertex
+	{
+		GLfloat x, y;
+		GLfloat u, v;
+		GLfloat r, g, b, a;
+	};
+
+
+
+	// How the batched primitives are blended with the render target
+	// - PREMULTIPLY_ALPHA is for textures that are drawn later with
+	//   PREMULTIPLIED_ALPHA, the alpha of the texture stays correct
+	// - REPLACE writes the colors as they are, for colors that encode data
+	enum Blending
+	{
+		STRAIGHT_ALPHA,
+		PREMULTIPLY_ALPHA,
+		PREMULTIPLIED_ALPHA,
+		REPLACE
+	};
+
+
+
+	// Vertex buffer that stays on the GPU between the frames
+	// - The vertices are in a space of their own, Batch2D::draw_mesh()
+	//   maps them to the render target with a view matrix, so moving
+	//   the view doesn't upload anything
+	// - Drawn untextured with the batch2d shader
+	struct Mesh2D
+	{
+		Mesh2D();
+		~Mesh2D();
+
+		// Only one object may own the GL resources
+		Mesh2D( const Mesh2D& )            = delete;
+		Mesh2D& operator=( const Mesh2D& ) = delete;
+		Mesh2D( Mesh2D &&other );
+		Mesh2D& operator=( Mesh2D &&other );
+
+		// Three vertices per triangle, replaces the previous vertices
+		// - The storage is made to fit at least min_capacity vertices,
+		//   so that vertices can be added by update() later
+		void upload( const std::vector<BatchVertex> &vertices, size_t min_capacity = 0 );
+
+		// Writes over the vertices from first on, the mesh grows up to its capacity
+		// - Returns false if the vertices don't fit, nothing is written then
+		bool update( size_t first, const BatchVertex *vertices, size_t count );
+		void clear();
+
+		size_t get_vertex_count() const { return vertex_count; }
+		size_t get_capacity() const { return capacity; }
+
+	  protected:
+		friend struct Batch2D;
+
+		GLuint vao;
+		GLuint vbo;
+		size_t vertex_count;
+		size_t capacity;
+
+		void release();
+	};
+
+
+
+	// Frame scoped batch for 2d primitives
+	// - Quads, lines, triangles and textured quads are gathered into one streaming
+	//   vertex buffer and drawn with as few draw calls as possible
+	// - Positions are in window pixels, origin at the top left corner
+	// - Anything that draws with GL directly has to call flush() first,
+	//   otherwise the batched geometry would end up on top of it
+	// - The GL objects are made on first use and deleted by release(), which
+	//   has to be called while the context is current. The destructor makes
+	//   no GL calls, as the global batch outlives the context
+	struct Batch2D
+	{
+		Batch2D();
+
+		// Delete potentially dangerous constructors and operators
+		Batch2D( Batch2D& )            = delete;
+		Batch2D& operator=( Batch2D& ) = delete;
+
+		void begin_frame( const glm::vec2 &viewport_size );
+		void set_viewport_size( const glm::vec2 &viewport_size );
+
+		// begin_frame() resets the blending to STRAIGHT_ALPHA
+		void set_blending( Blending blending );
+
+		void add_quad(
+			glm::vec2 pos,
+			glm::vec2 size,
+			const glm::vec4 &color
+		);
+
+		void add_line(
+			glm::vec2 a,
+			glm::vec2 b,
+			const glm::vec4 &color,
+			float width = 1.f
+		);
+
+		// Three corners per triangle, offset is added to the corners
+		void add_triangles(
+			const glm::vec2 *points,
+			size_t point_count,
+			glm::vec2 offset,
+			const glm::vec4 &color
+		);
+
+		// uv_rect: { u_left, v_top, u_right, v_bottom }
+		void add_textured_quad(
+			GLuint texture,
+			glm::vec2 pos,
+			glm::vec2 size,
+			const glm::vec4 &uv_rect,
+			const glm::vec4 &color
+		);
+
+		void flush();
+		void release();
+
+		// Draws the mesh right away, after flushing the batched primitives
+		// - view maps the vertices of the mesh to pixels of the viewport
+		void draw_mesh( const Mesh2D &mesh, const glm::mat4 &view );
+
+		size_t get_draw_call_count() const { return draw_calls; }
+
+	  protected:
+		std::vector<BatchVertex> vertices;
+		glm::vec2 viewport_size;
+		Blending  blending;
+		GLuint    current_texture;
+		size_t    draw_calls;
+
+		GLuint vao;
+		GLuint vbo;
+		GLuint white_texture;
+
+		void init_gl_objects();
+		void use_texture( GLuint texture );
+		bool use_shader( const glm::mat4 &view );
+		void restore_blending();
+		void push_quad(
+			const glm::vec2 &top_left,
+			const glm::vec2 &top_right,
+			const glm::vec2 &bottom_right,
+			const glm::vec2 &bottom_left,
+			const glm::vec4 &uv_rect,
+			const glm::vec4 &color
+		);
+	};
+}
+
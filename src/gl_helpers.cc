@@ -1,13 +1,11 @@
 #include "gl_helpers.hh"
 #include "text_helpers.hh"
 #include "globals.hh"
-#include "mesh.hh"
+#include "gui_gl.hh"
 
 #include <iostream>
 
-#define GLM_ENABLE_EXPERIMENTAL 1
 #include <glm/gtc/matrix_transform.hpp>
-#include <glm/gtx/vector_angle.hpp>
 
 using namespace std;
 
@@ -18,6 +16,9 @@ void gl::FramebufferObject::bind()
 		return;
 	}
 
+	// Anything batched so far belongs to the previous render target
+	Globals::batch_2d.flush();
+
 	glBindFramebuffer( GL_FRAMEBUFFER, framebuffer_id );
 	glViewport( 0, 0, texture_size.x, texture_size.y );
 	gui::any_gl_errors();
@@ -40,6 +41,9 @@ void gl::FramebufferObject::resize( const glm::ivec2 size )
 	}
 	gui::any_gl_errors();
 
+	// Pending batched quads may still sample the old texture
+	Globals::batch_2d.flush();
+
 	glUseProgram( shader->second.program );
 	gui::any_gl_errors();
 
@@ -82,6 +86,39 @@ void gl::FramebufferObject::resize( const glm::ivec2 size )
 
 
 
+gl::FramebufferObject::FramebufferObject( FramebufferObject &&other )
+: framebuffer_id( other.framebuffer_id ),
+  texture_id( other.texture_id ),
+  texture_size( other.texture_size )
+{
+	other.framebuffer_id = 0;
+	other.texture_id = 0;
+}
+
+
+
+gl::FramebufferObject& gl::FramebufferObject::operator=( FramebufferObject &&other )
+{
+	if( this != &other )
+	{
+		if( framebuffer_id )
+		{
+			glDeleteFramebuffers( 1, &framebuffer_id );
+			glDeleteTextures( 1, &texture_id );
+		}
+
+		framebuffer_id = other.framebuffer_id;
+		texture_id = other.texture_id;
+		texture_size = other.texture_size;
+		other.framebuffer_id = 0;
+		other.texture_id = 0;
+	}
+
+	return *this;
+}
+
+
+
 gl::FramebufferObject::~FramebufferObject()
 {
 	if( framebuffer_id )
@@ -96,228 +133,208 @@ gl::FramebufferObject::~FramebufferObject()
 
 
 
-void gl::render_line_2d(
-	const ShaderProgram &shader,
-	const glm::vec2 &window_size,
-	glm::vec2 a,
-	glm::vec2 b
-)
+gl::PixelReadback::PixelReadback()
+: pbo( 0 ),
+  fence( nullptr ),
+  read_pos( 0, 0 ),
+  read_size( 0, 0 )
 {
-	static const GLfloat line_vertex_data[] = {
-		0.0f, 0.0f, 0.0f,
-		1.0f, 0.0f, 0.0f
-	};
+}
 
-	glUseProgram( shader.program );
 
-	static Mesh line;
-	static const float step90 = 1.57079633f;
-	static const float step180 = step90 * 2;
 
-	if( !line.vao )
+gl::PixelReadback::~PixelReadback()
+{
+	discard();
+	if( pbo )
 	{
-		line = create_mesh( shader, line_vertex_data, sizeof( line_vertex_data ) );
+		glDeleteBuffers( 1, &pbo );
+		pbo = 0;
 	}
+}
 
-	auto diff = b - a;
 
-	glm::mat4 model = glm::ortho<float>( 0, window_size.x, window_size.y, 0 );
-	model = glm::translate( model, glm::vec3( a, 0.0f ) );
 
-	// Horizontal line
-	if( diff.y == 0.0 )
+void gl::PixelReadback::discard()
+{
+	if( fence )
 	{
-		if( diff.x < 0 ) model = glm::rotate( model, step180, glm::vec3{ 0.f, 0.f, 1.f } );
+		glDeleteSync( fence );
+		fence = nullptr;
 	}
+}
+
 
-	// Vertical line
-	else if( diff.x == 0.0 )
+
+void gl::PixelReadback::start( GLuint framebuffer_id, glm::ivec2 pos, glm::ivec2 size )
+{
+	discard();
+	if( size.x <= 0 || size.y <= 0 )
 	{
-		if( diff.y > 0 ) model = glm::rotate( model, step90, glm::vec3{ 0.f, 0.f, 1.f } );
-		else model = glm::rotate( model, -step90, glm::vec3{ 0.f, 0.f, 1.f } );
+		return;
 	}
 
-	// Non-trivial line
-	else
+	if( !pbo )
 	{
-		auto horizontal = glm::vec2( 1.f, 0.f );
-		auto angle = glm::orientedAngle( horizontal, glm::normalize(diff) );
-		model = glm::rotate( model, angle, glm::vec3{ 0.f, 0.f, 1.f } );
+		glGenBuffers( 1, &pbo );
+		if( !pbo )
+		{
+			throw runtime_error( "Couldn't create pixel buffer" );
+		}
 	}
 
-	float length = glm::length( diff );
-	model = glm::scale( model, { length, 1.f, 1.f } );
-	auto mp = model;
-
-	glBindVertexArray( line.vao );
-	glBindBuffer( GL_ARRAY_BUFFER, line.vbo );
-
-	auto mpUniform = shader.get_uniform( "MP" );
-	glUniformMatrix4fv( mpUniform, 1, GL_FALSE, &mp[0][0] );
-
-	auto texturedUniform = shader.get_uniform( "textured" );
-	glUniform1i( texturedUniform, 0 );
-	
-	glDrawArrays( GL_LINES, 0, line.vertex_count );
-	glBindVertexArray( 0 );
+	read_pos  = pos;
+	read_size = size;
+
+	// With a pack buffer bound glReadPixels() only queues the copy
+	glBindFramebuffer( GL_READ_FRAMEBUFFER, framebuffer_id );
+	glBindBuffer( GL_PIXEL_PACK_BUFFER, pbo );
+	glBufferData( GL_PIXEL_PACK_BUFFER, static_cast<GLsizeiptr>( size.x ) * size.y * 4, nullptr, GL_STREAM_READ );
+	glPixelStorei( GL_PACK_ALIGNMENT, 4 );
+	glReadPixels( pos.x, pos.y, size.x, size.y, GL_RGBA, GL_UNSIGNED_BYTE, nullptr );
+	glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+	glBindFramebuffer( GL_READ_FRAMEBUFFER, 0 );
+
+	// The fence is flushed so that it gets signaled without more GL calls
+	fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+	glFlush();
 	gui::any_gl_errors();
 }
 
 
 
-void gl::render_quad_2d( const ShaderProgram &shader, const glm::vec2 &window_size, glm::vec2 pos, glm::vec2 size )
+bool gl::PixelReadback::take( vector<uint8_t> &pixels )
 {
-	static const GLfloat quad_vertex_data[] = {
-		0.0f, 1.0f, 0.0f,
-		0.0f, 0.0f, 0.0f,
-		1.0f, 0.0f, 0.0f,
-		1.0f, 0.0f, 0.0f,
-		1.0f, 1.0f, 0.0f,
-		0.0f, 1.0f, 0.0f
-	};
+	if( !fence )
+	{
+		return false;
+	}
 
-	glUseProgram( shader.program );
+	const auto status = glClientWaitSync( fence, 0, 0 );
+	if( status == GL_TIMEOUT_EXPIRED )
+	{
+		return false;
+	}
 
-	static Mesh quad;
+	discard();
+	if( status == GL_WAIT_FAILED )
+	{
+		return false;
+	}
 
-	if( !quad.vao )
+	const auto data_size = static_cast<size_t>( read_size.x ) * read_size.y * 4;
+	glBindBuffer( GL_PIXEL_PACK_BUFFER, pbo );
+	const auto data = glMapBufferRange( GL_PIXEL_PACK_BUFFER, 0, static_cast<GLsizeiptr>( data_size ), GL_MAP_READ_BIT );
+	if( data )
 	{
-		quad = create_mesh( shader, &quad_vertex_data[0], sizeof( quad_vertex_data ) );
+		const auto bytes = static_cast<const uint8_t*>( data );
+		pixels.assign( bytes, bytes + data_size );
+		glUnmapBuffer( GL_PIXEL_PACK_BUFFER );
 	}
+	glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+	gui::any_gl_errors();
 
-	glm::mat4 model = glm::ortho<float>(0, window_size.x, 0, window_size.y);
-	model = glm::translate( model, glm::vec3( pos.x, window_size.y - pos.y, 0.0f ) );
-	model = glm::scale( model, glm::vec3( size.x, -size.y, 1.0f ) );
-	auto mp = model;
+	return data != nullptr;
+}
 
-	glBindVertexArray( quad.vao );
-	glBindBuffer( GL_ARRAY_BUFFER, quad.vbo );
 
-	auto mpUniform = shader.get_uniform( "MP" );
-	glUniformMatrix4fv( mpUniform, 1, GL_FALSE, &mp[0][0] );
 
-	auto texturedUniform = shader.get_uniform( "textured" );
-	glUniform1i( texturedUniform, 0 );
-	
-	glDrawArrays( GL_TRIANGLES, 0, quad.vertex_count );
-	glBindVertexArray( 0 );
-	gui::any_gl_errors();
+void gl::render_line_2d(
+	const glm::vec2 &window_size,
+	glm::vec2 a,
+	glm::vec2 b,
+	const glm::vec4 &color
+)
+{
+	Globals::batch_2d.set_viewport_size( window_size );
+	Globals::batch_2d.add_line( a, b, color );
 }
 
 
 
-size_t gl::render_text_2d(
-	const ShaderProgram &shader,
+void gl::render_quad_2d(
 	const glm::vec2 &window_size,
-	const string_u8 &text,
 	glm::vec2 pos,
-	glm::vec2 scale,
-	FT_Face face,
-	size_t font_size )
+	glm::vec2 size,
+	const glm::vec4 &color
+)
 {
-	static GLuint vao;
-	static GLuint vbo;
+	Globals::batch_2d.set_viewport_size( window_size );
+	Globals::batch_2d.add_quad( pos, size, color );
+}
 
-	glEnable( GL_BLEND );
-	glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
-	gui::any_gl_errors();
 
-	glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
 
-	if( !vao )
-	{
-		glGenVertexArrays( 1, &vao );
-		glGenBuffers( 1, &vbo );
-		glBindVertexArray( vao );
-		glBindBuffer( GL_ARRAY_BUFFER, vbo );
-		glBufferData( GL_ARRAY_BUFFER, sizeof( GLfloat ) * 6 * 4, nullptr, GL_DYNAMIC_DRAW );
-		glEnableVertexAttribArray( 0 );
-		glVertexAttribPointer( 0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof( GLfloat ), 0 );
-		glBindBuffer( GL_ARRAY_BUFFER, 0 );
-		glBindVertexArray( 0 );
-		gui::any_gl_errors();
-	}
+void gl::render_triangles_2d(
+	const glm::vec2 &window_size,
+	const glm::vec2 *points,
+	size_t point_count,
+	glm::vec2 offset,
+	const glm::vec4 &color
+)
+{
+	Globals::batch_2d.set_viewport_size( window_size );
+	Globals::batch_2d.add_triangles( points, point_count, offset, color );
+}
 
-	const auto projection = glm::ortho<float>( 0, window_size.x, 0, window_size.y );
-	const auto tex_uniform = shader.get_uniform( "tex" );
-	const auto mp_uniform = shader.get_uniform( "MP" );
-	const auto color_uniform = shader.get_uniform( "color" );
-	const auto textured_uniform = shader.get_uniform( "textured" );
 
-	glUniformMatrix4fv( mp_uniform, 1, 0, &projection[0][0] );
-	glUniform4f( color_uniform, 1.0, 1.0, 1.0, 1.0 );
-	glUniform1i( textured_uniform, 1 );
-	glUniform1i( tex_uniform, 0 );
-	gui::any_gl_errors();
 
+size_t gl::render_text_2d(
+	const glm::vec2 &window_size,
+	const string_u8 &text,
+	glm::vec2 pos,
+	glm::vec2 scale,
+	FT_Face face,
+	size_t font_size )
+{
 	float caret_pos_x = pos.x;
 
-	glBindVertexArray( vao );
-	glBindBuffer( GL_ARRAY_BUFFER, vbo );
-	gui::any_gl_errors();
-
-	glActiveTexture( GL_TEXTURE0 );
-	gui::any_gl_errors();
-
 	GlCharacter previous_character{};
+	FontFacePtr previous_face;
+
+	Globals::batch_2d.set_viewport_size( window_size );
 
 	auto unicode_str = u8_to_unicode( text );
 	for( const auto code_point : unicode_str )
 	{
 		// Find or create the character
-		auto result = Globals::font_face_manager.get_character( face, code_point );
+		auto result = Globals::font_face_manager.get_character( face, static_cast<unsigned>( font_size ), code_point );
 		auto c = result.first;
 		auto used_face = result.second;
 
-		// Get kerning
+		// Get kerning, glyphs from different fallback faces aren't kerned
 		FT_Vector kerning{0,0};
-		auto has_kerning = FT_HAS_KERNING( face );
-		if( has_kerning && previous_character.glyph )
+		if( previous_character.glyph && used_face && previous_face == used_face )
 		{
-			FT_Get_Kerning(
-				face,
+			kerning = Globals::font_face_manager.get_kerning(
+				used_face.get(),
+				static_cast<unsigned>( font_size ),
 				previous_character.glyph,
-				c.glyph,
-				FT_KERNING_DEFAULT,
-				&kerning
+				c.glyph
 			);
 			kerning.x >>= 6;
 			kerning.y >>= 6;
 		}
 
-		// Render
+		// Render, the batch has y-axis pointing down
 		const GLfloat pos_x = caret_pos_x * scale.x + kerning.x;
 		const GLfloat pos_y = pos.y - (c.size.y - c.bearing.y) + kerning.y;
 		const GLfloat w = c.size.x * scale.x;
 		const GLfloat h = c.size.y * scale.y;
 
-		GLfloat vertices[6][4] = {
-			{ pos_x,     pos_y + h, 0.0f, 0.0f },
-			{ pos_x,     pos_y,     0.0f, 1.0f },
-			{ pos_x + w, pos_y,     1.0f, 1.0f },
-
-			{ pos_x,     pos_y + h, 0.0f, 0.0f },
-			{ pos_x + w, pos_y,     1.0f, 1.0f },
-			{ pos_x + w, pos_y + h, 1.0f, 0.0f }
-		};
-
-		glBindTexture( GL_TEXTURE_2D, c.gl_texture );
+		Globals::batch_2d.add_textured_quad(
+			c.gl_texture,
+			{ pos_x, window_size.y - pos_y - h },
+			{ w, h },
+			c.uv_rect,
+			{ 1.f, 1.f, 1.f, 1.f }
+		);
 
-		glBufferSubData( GL_ARRAY_BUFFER, 0, sizeof( vertices ), &vertices[0][0] );
-		gui::any_gl_errors();
-
-		glDrawArrays( GL_TRIANGLES, 0, 6 );
-		
 		// Bitshift by 6 to get pixels
 		caret_pos_x += (c.advance >> 6) * scale.x + kerning.x;
 		previous_character = c;
+		previous_face = used_face;
 	}
 
-	glBindBuffer( GL_ARRAY_BUFFER, 0 );
-	glBindTexture( GL_TEXTURE_2D, 0 );
-	glBindVertexArray( 0 );
-	gui::any_gl_errors();
-
 	return static_cast<size_t>( caret_pos_x - pos.x );
 }
-
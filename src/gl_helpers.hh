@@ -5,6 +5,9 @@
 #include "gui.hh"
 #include "common_types.hh"
 
+#include <vector>
+#include <cstdint>
+
 #include <ft2build.h>
 #include FT_FREETYPE_H
 
@@ -16,34 +19,88 @@ namespace gl
 		GLuint     texture_id=0;
 		glm::ivec2 texture_size={0, 0};
 
+		FramebufferObject() = default;
+		~FramebufferObject();
+
+		// Only one object may own the GL resources
+		FramebufferObject( const FramebufferObject& )            = delete;
+		FramebufferObject& operator=( const FramebufferObject& ) = delete;
+		FramebufferObject( FramebufferObject &&other );
+		FramebufferObject& operator=( FramebufferObject &&other );
+
 		void bind();
 		void resize( const glm::ivec2 size );
-		~FramebufferObject();
 	};
 
 
 
+	// Reads pixels of a framebuffer without waiting for the GPU
+	// - start() queues the read into a pixel buffer object, take() gets the
+	//   pixels a frame or more later, once the GPU has drawn and copied them
+	// - The pixels are RGBA bytes, rows from the bottom up like in GL
+	struct PixelReadback
+	{
+		PixelReadback();
+		~PixelReadback();
+
+		// Delete potentially dangerous constructors and operators
+		PixelReadback( PixelReadback& )            = delete;
+		PixelReadback& operator=( PixelReadback& ) = delete;
+
+		// Replaces a read that hasn't been taken yet
+		void start( GLuint framebuffer_id, glm::ivec2 pos, glm::ivec2 size );
+
+		// Returns false while the read is pending or if there is none
+		bool take( std::vector<uint8_t> &pixels );
+
+		bool is_pending() const { return fence != nullptr; }
+		glm::ivec2 get_pos() const  { return read_pos; }
+		glm::ivec2 get_size() const { return read_size; }
+
+	  protected:
+		GLuint     pbo;
+		GLsync     fence;
+		glm::ivec2 read_pos;
+		glm::ivec2 read_size;
+
+		void discard();
+	};
+
+
+
+	// Line, quad and triangle helpers submit to Globals::batch_2d,
+	// they are drawn when the batch gets flushed
 	void render_line_2d(
-		const ShaderProgram &shader,
 		const glm::vec2 &window_size,
 		glm::vec2 a,
-		glm::vec2 b
+		glm::vec2 b,
+		const glm::vec4 &color
 	);
 
 
 
 	void render_quad_2d(
-		const ShaderProgram &shader,
 		const glm::vec2 &window_size,
 		glm::vec2 pos,
-		glm::vec2 size
+		glm::vec2 size,
+		const glm::vec4 &color
+	);
+
+
+
+	// Three corners per triangle, offset is added to the corners
+	void render_triangles_2d(
+		const glm::vec2 &window_size,
+		const glm::vec2 *points,
+		size_t point_count,
+		glm::vec2 offset,
+		const glm::vec4 &color
 	);
 
 
 
 	// Renders text and returns the width of rendered string
 	size_t render_text_2d(
-		const ShaderProgram &shader,
 		const glm::vec2 &window_size,
 		const string_u8 &text,
 		glm::vec2 pos,
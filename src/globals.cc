@@ -14,3 +14,5 @@ mutex Globals::freetype_mutex{};
 FT_Library Globals::freetype;
 FontFaceManager Globals::font_face_manager{};
 
+gl::Batch2D Globals::batch_2d{};
+
@@ -4,6 +4,7 @@
 #include "window.hh"
 #include "shaderProgram.hh"
 #include "text_helpers.hh"
+#include "gl_batch.hh"
 
 #include <map>
 #include <mutex>
@@ -27,5 +28,7 @@ struct Globals
 	static FT_Library freetype;
 
 	static FontFaceManager font_face_manager;
+
+	static gl::Batch2D batch_2d;
 };
 
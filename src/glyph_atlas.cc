@@ -0,0 +1,254 @@
+#include "glyph_atlas.hh"
+#include "gui_gl.hh"
+#include "globals.hh"
+#include "common_tools.hh"
+
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+	// Empty space left around glyphs to keep
+	// the linear filtering from bleeding
+	const int glyph_padding = 1;
+}
+
+
+
+GlyphAtlas::GlyphAtlas( int page_size, size_t max_pages )
+: page_size( page_size ),
+  max_pages( max_pages ? max_pages : 1 ),
+  use_counter( 0 ),
+  last_used( new atomic<uint64_t>[this->max_pages] )
+{
+	for( size_t i = 0; i < this->max_pages; i++ )
+	{
+		last_used[i].store( 0, memory_order_relaxed );
+	}
+}
+
+
+
+size_t GlyphAtlas::create_page()
+{
+	Page page;
+
+	glGenTextures( 1, &page.texture );
+	if( !page.texture )
+	{
+		throw runtime_error( "Couldn't create texture for glyph atlas" );
+	}
+
+	glBindTexture( GL_TEXTURE_2D, page.texture );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+
+	// Start with a cleared page so the padding stays empty
+	const vector<unsigned char> empty_page( page_size * page_size, 0 );
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+	glTexImage2D(
+		GL_TEXTURE_2D,
+		0,
+		GL_RED,
+		page_size,
+		page_size,
+		0,
+		GL_RED,
+		GL_UNSIGNED_BYTE,
+		empty_page.data()
+	);
+	glBindTexture( GL_TEXTURE_2D, 0 );
+	gui::any_gl_errors();
+
+	pages.push_back( page );
+	return pages.size() - 1;
+}
+
+
+
+void GlyphAtlas::reset_page( Page &page )
+{
+	page.shelves.clear();
+	page.used_height = 0;
+
+	const vector<unsigned char> empty_page( page_size * page_size, 0 );
+	glBindTexture( GL_TEXTURE_2D, page.texture );
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+	glTexSubImage2D(
+		GL_TEXTURE_2D,
+		0,
+		0, 0,
+		page_size, page_size,
+		GL_RED,
+		GL_UNSIGNED_BYTE,
+		empty_page.data()
+	);
+	glBindTexture( GL_TEXTURE_2D, 0 );
+	gui::any_gl_errors();
+}
+
+
+
+bool GlyphAtlas::find_space( Page &page, int width, int height, glm::ivec2 &pos )
+{
+	// Pick the lowest shelf the glyph fits on
+	Shelf *best_shelf = nullptr;
+	for( auto &shelf : page.shelves )
+	{
+		if( shelf.height < height ||
+		    shelf.used_width + width > page_size )
+		{
+			continue;
+		}
+
+		if( !best_shelf || shelf.height < best_shelf->height )
+		{
+			best_shelf = &shelf;
+		}
+	}
+
+	// Don't waste tall shelves for short glyphs if there's room for a new one
+	const auto fits_new_shelf = page.used_height + height <= page_size;
+	if( best_shelf && (best_shelf->height <= height * 2 || !fits_new_shelf) )
+	{
+		pos = { best_shelf->used_width, best_shelf->y };
+		best_shelf->used_width += width;
+		return true;
+	}
+
+	if( !fits_new_shelf || width > page_size )
+	{
+		return false;
+	}
+
+	page.shelves.push_back( { page.used_height, height, width } );
+	pos = { 0, page.used_height };
+	page.used_height += height;
+	return true;
+}
+
+
+
+GlyphAtlasRegion GlyphAtlas::add(
+	int width,
+	int height,
+	const unsigned char *bitmap,
+	int pitch,
+	size_t &evicted_page
+)
+{
+	evicted_page = no_page;
+
+	const auto padded_width  = width + glyph_padding;
+	const auto padded_height = height + glyph_padding;
+
+	if( padded_width > page_size || padded_height > page_size )
+	{
+		throw runtime_error( "Glyph doesn't fit in the glyph atlas" );
+	}
+
+	size_t page_index = no_page;
+	glm::ivec2 pos;
+
+	for( size_t i = 0; i < pages.size(); i++ )
+	{
+		if( find_space( pages[i], padded_width, padded_height, pos ) )
+		{
+			page_index = i;
+			break;
+		}
+	}
+
+	if( page_index == no_page && pages.size() < max_pages )
+	{
+		page_index = create_page();
+		find_space( pages[page_index], padded_width, padded_height, pos );
+	}
+
+	if( page_index == no_page )
+	{
+		// Evict the least recently used page
+		page_index = 0;
+		for( size_t i = 1; i < pages.size(); i++ )
+		{
+			if( last_used[i].load( memory_order_relaxed ) < last_used[page_index].load( memory_order_relaxed ) )
+			{
+				page_index = i;
+			}
+		}
+
+		// Batched text may still be sampling the old contents
+		Globals::batch_2d.flush();
+
+		reset_page( pages[page_index] );
+		evicted_page = page_index;
+		find_space( pages[page_index], padded_width, padded_height, pos );
+	}
+
+	auto &page = pages[page_index];
+	touch( page_index );
+
+	if( width > 0 && height > 0 && bitmap )
+	{
+		// FreeType rows may be padded
+		glBindTexture( GL_TEXTURE_2D, page.texture );
+		glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+		glPixelStorei( GL_UNPACK_ROW_LENGTH, pitch > width ? pitch : 0 );
+		glTexSubImage2D(
+			GL_TEXTURE_2D,
+			0,
+			pos.x, pos.y,
+			width, height,
+			GL_RED,
+			GL_UNSIGNED_BYTE,
+			bitmap
+		);
+		glPixelStorei( GL_UNPACK_ROW_LENGTH, 0 );
+		glBindTexture( GL_TEXTURE_2D, 0 );
+		gui::any_gl_errors();
+	}
+
+	const auto size = tools::int_to_float( page_size );
+
+	GlyphAtlasRegion region;
+	region.texture = page.texture;
+	region.page    = page_index;
+	region.uv_rect = {
+		pos.x / size,
+		pos.y / size,
+		(pos.x + width) / size,
+		(pos.y + height) / size
+	};
+
+	return region;
+}
+
+
+
+void GlyphAtlas::touch( size_t page )
+{
+	if( page < max_pages )
+	{
+		last_used[page].store( ++use_counter, memory_order_relaxed );
+	}
+}
+
+
+
+void GlyphAtlas::clear()
+{
+	for( auto &page : pages )
+	{
+		if( page.texture )
+		{
+			glDeleteTextures( 1, &page.texture );
+			page.texture = 0;
+		}
+	}
+
+	pages.clear();
+}
+
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "common_types.hh"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+
+// Region of an atlas page that holds a single glyph bitmap
+struct GlyphAtlasRegion
+{
+	GLuint    texture = 0;
+	size_t    page    = 0;
+	glm::vec4 uv_rect = { 0, 0, 0, 0 };
+};
+
+
+
+// Packs glyph bitmaps to a few large single channel textures
+// - Every page is filled shelf by shelf, glyphs of similar
+//   height end up sharing the shelves
+// - When all pages are full, the least recently used page
+//   gets cleared and reused
+// - clear() deletes the textures and has to be called while the context
+//   is current. The destructor makes no GL calls, the atlas of the global
+//   font face manager outlives the context
+struct GlyphAtlas
+{
+	static const int default_page_size = 1024;
+	static const size_t default_max_pages = 4;
+
+	GlyphAtlas(
+		int page_size = default_page_size,
+		size_t max_pages = default_max_pages
+	);
+
+	// Delete potentially dangerous constructors and operators
+	GlyphAtlas( GlyphAtlas& )            = delete;
+	GlyphAtlas& operator=( GlyphAtlas& ) = delete;
+
+	// Copies the bitmap to the atlas. If a page had to be evicted to make
+	// room for it, its index is written to evicted_page, otherwise
+	// evicted_page is set to no_page
+	GlyphAtlasRegion add(
+		int width,
+		int height,
+		const unsigned char *bitmap,
+		int pitch,
+		size_t &evicted_page
+	);
+
+	// Marks the page used, so it won't be the first one to be evicted
+	// - Doesn't lock, can be called while another thread adds glyphs
+	void touch( size_t page );
+
+	void clear();
+
+	static const size_t no_page = static_cast<size_t>( -1 );
+
+  protected:
+	struct Shelf
+	{
+		int y;
+		int height;
+		int used_width;
+	};
+
+	struct Page
+	{
+		GLuint             texture     = 0;
+		int                used_height = 0;
+		std::vector<Shelf> shelves;
+	};
+
+	int page_size;
+	size_t max_pages;
+	std::atomic<uint64_t> use_counter;
+	std::vector<Page> pages;
+
+	// Kept apart from the pages, so that touching a page
+	// never races with the page vector growing
+	std::unique_ptr<std::atomic<uint64_t>[]> last_used;
+
+	bool find_space( Page &page, int width, int height, glm::ivec2 &pos );
+	size_t create_page();
+	void reset_page( Page &page );
+};
+
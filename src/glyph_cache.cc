@@ -0,0 +1,357 @@
+#include "glyph_cache.hh"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace
+{
+	const size_t initial_capacity = 1024;
+
+	// Bit layout of the keys
+	const uint64_t code_point_bits = 21;
+	const uint64_t pixel_size_bits = 16;
+	const uint64_t face_bits       = 8;
+}
+
+
+
+GlyphCache::Table::Table( size_t capacity )
+: capacity( capacity ),
+  slots( new Slot[capacity] )
+{
+	for( size_t i = 0; i < capacity; i++ )
+	{
+		slots[i].key.store( 0, memory_order_relaxed );
+		slots[i].entry.store( nullptr, memory_order_relaxed );
+	}
+}
+
+
+
+GlyphCache::Latin1Page::Latin1Page()
+{
+	for( auto &entry : entries )
+	{
+		entry.store( nullptr, memory_order_relaxed );
+	}
+}
+
+
+
+GlyphCache::GlyphCache()
+: latin1_pages( new atomic<Latin1Page*>[max_faces * max_direct_size] ),
+  table( nullptr ),
+  used_slots( 0 ),
+  active_readers( 0 )
+{
+	for( size_t i = 0; i < max_faces * max_direct_size; i++ )
+	{
+		latin1_pages[i].store( nullptr, memory_order_relaxed );
+	}
+
+	tables.emplace_back( new Table( initial_capacity ) );
+	table.store( tables.back().get(), memory_order_release );
+}
+
+
+
+GlyphCache::~GlyphCache()
+{
+}
+
+
+
+uint64_t GlyphCache::make_key( size_t face_index, unsigned pixel_size, uint32_t code_point )
+{
+	// Face index is offset by one, so that zero never is a valid key
+	return (static_cast<uint64_t>( face_index + 1 ) << (code_point_bits + pixel_size_bits))
+	     | (static_cast<uint64_t>( pixel_size ) << code_point_bits)
+	     | static_cast<uint64_t>( code_point );
+}
+
+
+
+size_t GlyphCache::hash_key( uint64_t key )
+{
+	// splitmix64 finalizer
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ULL;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebULL;
+	key ^= key >> 31;
+	return static_cast<size_t>( key );
+}
+
+
+
+bool GlyphCache::is_direct( size_t face_index, unsigned pixel_size, uint32_t code_point )
+{
+	return code_point < 256 &&
+	       face_index < max_faces &&
+	       pixel_size < max_direct_size;
+}
+
+
+
+bool GlyphCache::find(
+	size_t face_index,
+	unsigned pixel_size,
+	uint32_t code_point,
+	GlyphCacheEntry &found
+) const
+{
+	// Either the writer sees this reader as active, or
+	// this reader sees the entries the writer unpublished gone
+	active_readers.fetch_add( 1, memory_order_seq_cst );
+	atomic_thread_fence( memory_order_seq_cst );
+
+	const auto entry = find_entry( face_index, pixel_size, code_point );
+	if( entry )
+	{
+		found = *entry;
+	}
+
+	active_readers.fetch_sub( 1, memory_order_release );
+	return entry != nullptr;
+}
+
+
+
+const GlyphCacheEntry *GlyphCache::find_entry( size_t face_index, unsigned pixel_size, uint32_t code_point ) const
+{
+	if( face_index >= (1u << face_bits) - 1 ||
+	    pixel_size >= (1u << pixel_size_bits) ||
+	    code_point >= (1u << code_point_bits) )
+	{
+		return nullptr;
+	}
+
+	if( is_direct( face_index, pixel_size, code_point ) )
+	{
+		const auto page = latin1_pages[face_index * max_direct_size + pixel_size].load( memory_order_acquire );
+		return page ? page->entries[code_point].load( memory_order_acquire ) : nullptr;
+	}
+
+	const auto key = make_key( face_index, pixel_size, code_point );
+	const auto current = table.load( memory_order_acquire );
+	const auto mask = current->capacity - 1;
+
+	for( auto i = hash_key( key ) & mask; ; i = (i + 1) & mask )
+	{
+		const auto &slot = current->slots[i];
+		const auto slot_key = slot.key.load( memory_order_acquire );
+		if( slot_key == key )
+		{
+			return slot.entry.load( memory_order_acquire );
+		}
+		else if( !slot_key )
+		{
+			return nullptr;
+		}
+	}
+}
+
+
+
+const GlyphCacheEntry *GlyphCache::insert_to_table( Table &target, uint64_t key, const GlyphCacheEntry *entry )
+{
+	const auto mask = target.capacity - 1;
+
+	for( auto i = hash_key( key ) & mask; ; i = (i + 1) & mask )
+	{
+		auto &slot = target.slots[i];
+		const auto slot_key = slot.key.load( memory_order_relaxed );
+		if( slot_key == key )
+		{
+			return slot.entry.exchange( entry, memory_order_acq_rel );
+		}
+		else if( !slot_key )
+		{
+			// Publish the entry before the key, so that
+			// readers never see a key without its entry
+			slot.entry.store( entry, memory_order_release );
+			slot.key.store( key, memory_order_release );
+			used_slots++;
+			return nullptr;
+		}
+	}
+}
+
+
+
+void GlyphCache::grow()
+{
+	const auto current = table.load( memory_order_relaxed );
+	unique_ptr<Table> grown{ new Table( current->capacity * 2 ) };
+
+	used_slots = 0;
+	for( size_t i = 0; i < current->capacity; i++ )
+	{
+		const auto key = current->slots[i].key.load( memory_order_relaxed );
+		const auto entry = current->slots[i].entry.load( memory_order_relaxed );
+		if( key && entry )
+		{
+			insert_to_table( *grown, key, entry );
+		}
+	}
+
+	// The old table stays alive for the readers still using it
+	table.store( grown.get(), memory_order_release );
+	tables.push_back( move( grown ) );
+}
+
+
+
+const GlyphCacheEntry *GlyphCache::insert(
+	size_t face_index,
+	unsigned pixel_size,
+	uint32_t code_point,
+	GlyphCacheEntry entry
+)
+{
+	if( face_index >= (1u << face_bits) - 1 ||
+	    pixel_size >= (1u << pixel_size_bits) ||
+	    code_point >= (1u << code_point_bits) )
+	{
+		return nullptr;
+	}
+
+	free_retired();
+	unique_ptr<StoredEntry> stored_entry{ new StoredEntry() };
+	static_cast<GlyphCacheEntry&>( *stored_entry ) = move( entry );
+	stored_entry->storage_index = entries.size();
+	const GlyphCacheEntry *stored = stored_entry.get();
+	entries.push_back( move( stored_entry ) );
+
+	if( is_direct( face_index, pixel_size, code_point ) )
+	{
+		auto &page_ptr = latin1_pages[face_index * max_direct_size + pixel_size];
+		auto page = page_ptr.load( memory_order_relaxed );
+		if( !page )
+		{
+			pages.emplace_back( new Latin1Page() );
+			page = pages.back().get();
+			page_ptr.store( page, memory_order_release );
+		}
+
+		retire( page->entries[code_point].exchange( stored, memory_order_acq_rel ) );
+		return stored;
+	}
+
+	// Keep the load factor under a half to keep the probe sequences short
+	if( (used_slots + 1) * 2 > table.load( memory_order_relaxed )->capacity )
+	{
+		grow();
+	}
+
+	retire( insert_to_table( *table.load( memory_order_relaxed ), make_key( face_index, pixel_size, code_point ), stored ) );
+	return stored;
+}
+
+
+
+void GlyphCache::erase_if( function<bool( const GlyphCacheEntry& )> predicate )
+{
+	// Removed entries leave their keys behind as tombstones,
+	// the entries themselves are retired once they are unpublished
+	for( auto &page : pages )
+	{
+		for( auto &slot : page->entries )
+		{
+			const auto entry = slot.load( memory_order_relaxed );
+			if( entry && predicate( *entry ) )
+			{
+				slot.store( nullptr, memory_order_release );
+			}
+		}
+	}
+
+	const auto current = table.load( memory_order_relaxed );
+	for( size_t i = 0; i < current->capacity; i++ )
+	{
+		auto &slot = current->slots[i];
+		const auto entry = slot.entry.load( memory_order_relaxed );
+		if( entry && predicate( *entry ) )
+		{
+			slot.entry.store( nullptr, memory_order_release );
+		}
+	}
+
+	for( size_t i = 0; i < entries.size(); )
+	{
+		if( predicate( *entries[i] ) )
+		{
+			retire_at( i );
+		}
+		else
+		{
+			i++;
+		}
+	}
+
+	free_retired();
+}
+
+
+
+void GlyphCache::retire( const GlyphCacheEntry *entry )
+{
+	// Only stored entries are ever published
+	if( entry )
+	{
+		retire_at( static_cast<const StoredEntry*>( entry )->storage_index );
+	}
+}
+
+
+
+void GlyphCache::retire_at( size_t storage_index )
+{
+	// The last entry takes the place of the retired one
+	retired_entries.push_back( move( entries[storage_index] ) );
+	if( storage_index + 1 < entries.size() )
+	{
+		entries[storage_index] = move( entries.back() );
+		entries[storage_index]->storage_index = storage_index;
+	}
+	entries.pop_back();
+}
+
+
+
+void GlyphCache::free_retired()
+{
+	// The entries were unpublished before the fence, readers
+	// that come after it can't find them
+	if( retired_entries.empty() )
+	{
+		return;
+	}
+
+	atomic_thread_fence( memory_order_seq_cst );
+	if( active_readers.load( memory_order_seq_cst ) == 0 )
+	{
+		retired_entries.clear();
+	}
+}
+
+
+
+void GlyphCache::clear()
+{
+	for( size_t i = 0; i < max_faces * max_direct_size; i++ )
+	{
+		latin1_pages[i].store( nullptr, memory_order_relaxed );
+	}
+
+	tables.clear();
+	tables.emplace_back( new Table( initial_capacity ) );
+	table.store( tables.back().get(), memory_order_release );
+	used_slots = 0;
+
+	pages.clear();
+	entries.clear();
+	retired_entries.clear();
+}
+
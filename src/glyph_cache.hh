@@ -0,0 +1,118 @@
+#pragma once
+
+#include "common_types.hh"
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <functional>
+
+
+// Cached glyph and the font face it was actually found from
+// - Entries are immutable once they have been published
+struct GlyphCacheEntry
+{
+	GlCharacter character;
+	FontFacePtr face;
+};
+
+
+
+// Glyph lookup table keyed by (face index, pixel size, code point)
+// - Open addressing with linear probing, readers never lock
+// - Latin-1 code points of the common sizes are directly indexed
+// - Writers have to be serialized by the caller
+// - Readers copy the entries out while they are counted as active. Removed
+//   and replaced entries are retired, and freed by a later insert or erase
+//   once no reader is active, so readers never see freed entries
+// - Replaced tables are kept alive until clear(). clear() must not race with readers
+struct GlyphCache
+{
+	static const size_t max_faces = 16;
+	static const unsigned max_direct_size = 256;
+
+	GlyphCache();
+	~GlyphCache();
+
+	// Delete potentially dangerous constructors and operators
+	GlyphCache( GlyphCache& )            = delete;
+	GlyphCache& operator=( GlyphCache& ) = delete;
+
+	// Copies the entry to found, returns false if there is none
+	bool find(
+		size_t face_index,
+		unsigned pixel_size,
+		uint32_t code_point,
+		GlyphCacheEntry &found
+	) const;
+
+	// Returns the stored entry, valid until the next insert, erase_if or clear
+	const GlyphCacheEntry *insert(
+		size_t face_index,
+		unsigned pixel_size,
+		uint32_t code_point,
+		GlyphCacheEntry entry
+	);
+
+	void erase_if( std::function<bool( const GlyphCacheEntry& )> predicate );
+	void clear();
+
+  protected:
+	struct Slot
+	{
+		std::atomic<uint64_t>               key;
+		std::atomic<const GlyphCacheEntry*> entry;
+	};
+
+	struct Table
+	{
+		size_t                  capacity;
+		std::unique_ptr<Slot[]> slots;
+		explicit Table( size_t capacity );
+	};
+
+	struct Latin1Page
+	{
+		std::atomic<const GlyphCacheEntry*> entries[256];
+		Latin1Page();
+	};
+
+	// Direct index for Latin-1: [face][pixel size] -> page
+	std::unique_ptr<std::atomic<Latin1Page*>[]> latin1_pages;
+
+	std::atomic<Table*> table;
+	size_t used_slots;
+
+	// Entries know where they are stored, so that they are retired without a search
+	struct StoredEntry : GlyphCacheEntry
+	{
+		size_t storage_index;
+	};
+
+	std::vector<std::unique_ptr<Table>>       tables;
+	std::vector<std::unique_ptr<Latin1Page>>  pages;
+	std::vector<std::unique_ptr<StoredEntry>> entries;
+
+	// Entries that readers may still be copying, and the count of those readers
+	std::vector<std::unique_ptr<StoredEntry>> retired_entries;
+	mutable std::atomic<size_t>               active_readers;
+
+	static uint64_t make_key( size_t face_index, unsigned pixel_size, uint32_t code_point );
+	static size_t   hash_key( uint64_t key );
+	static bool     is_direct( size_t face_index, unsigned pixel_size, uint32_t code_point );
+
+	const GlyphCacheEntry *find_entry( size_t face_index, unsigned pixel_size, uint32_t code_point ) const;
+
+	void grow();
+
+	// Returns the entry that was replaced, or nullptr
+	const GlyphCacheEntry *insert_to_table( Table &target, uint64_t key, const GlyphCacheEntry *entry );
+
+	// Moves a published entry to the retired ones, nullptr is ignored
+	void retire( const GlyphCacheEntry *entry );
+	void retire_at( size_t storage_index );
+	void free_retired();
+};
+
@@ -0,0 +1,301 @@
+#include "glyph_metrics.hh"
+
+using namespace std;
+
+namespace
+{
+	const size_t page_count               = 0x110000 / 256;
+	const size_t initial_kerning_capacity = 256;
+
+	uint64_t make_pair_key( FT_UInt left, FT_UInt right )
+	{
+		// Glyph zero is never kerned, so zero never is a valid key
+		return (static_cast<uint64_t>( left ) << 32) | static_cast<uint64_t>( right );
+	}
+
+
+
+	uint64_t pack_kerning( FT_Vector kerning )
+	{
+		return static_cast<uint64_t>( static_cast<uint32_t>( kerning.x ) )
+		     | (static_cast<uint64_t>( static_cast<uint32_t>( kerning.y ) ) << 32);
+	}
+
+
+
+	FT_Vector unpack_kerning( uint64_t packed )
+	{
+		FT_Vector kerning;
+		kerning.x = static_cast<int32_t>( static_cast<uint32_t>( packed ) );
+		kerning.y = static_cast<int32_t>( static_cast<uint32_t>( packed >> 32 ) );
+		return kerning;
+	}
+
+
+
+	size_t hash_pair( uint64_t key )
+	{
+		// splitmix64 finalizer
+		key ^= key >> 30;
+		key *= 0xbf58476d1ce4e5b9ULL;
+		key ^= key >> 27;
+		key *= 0x94d049bb133111ebULL;
+		key ^= key >> 31;
+		return static_cast<size_t>( key );
+	}
+}
+
+
+
+GlyphMetricsCache::GlyphPage::GlyphPage()
+{
+	for( auto &known : is_known )
+	{
+		known.store( false, memory_order_relaxed );
+	}
+}
+
+
+
+GlyphMetricsCache::KerningTable::KerningTable( size_t capacity )
+: capacity( capacity ),
+  used_slots( 0 ),
+  slots( new KerningSlot[capacity] )
+{
+	for( size_t i = 0; i < capacity; i++ )
+	{
+		slots[i].pair.store( 0, memory_order_relaxed );
+		slots[i].kerning.store( 0, memory_order_relaxed );
+	}
+}
+
+
+
+GlyphMetricsCache::SizeMetrics::SizeMetrics()
+: pages( new atomic<GlyphPage*>[page_count] ),
+  kerning( nullptr )
+{
+	for( size_t i = 0; i < page_count; i++ )
+	{
+		pages[i].store( nullptr, memory_order_relaxed );
+	}
+
+	kerning_tables.emplace_back( new KerningTable( initial_kerning_capacity ) );
+	kerning.store( kerning_tables.back().get(), memory_order_release );
+}
+
+
+
+GlyphMetricsCache::GlyphMetricsCache()
+: sizes( new atomic<SizeMetrics*>[max_faces * max_pixel_size] )
+{
+	for( size_t i = 0; i < max_faces * max_pixel_size; i++ )
+	{
+		sizes[i].store( nullptr, memory_order_relaxed );
+	}
+}
+
+
+
+GlyphMetricsCache::~GlyphMetricsCache()
+{
+}
+
+
+
+bool GlyphMetricsCache::is_cached( size_t face_index, unsigned pixel_size )
+{
+	return face_index < max_faces && pixel_size < max_pixel_size;
+}
+
+
+
+const GlyphMetricsCache::SizeMetrics *GlyphMetricsCache::find_size( size_t face_index, unsigned pixel_size ) const
+{
+	if( !is_cached( face_index, pixel_size ) )
+	{
+		return nullptr;
+	}
+
+	return sizes[face_index * max_pixel_size + pixel_size].load( memory_order_acquire );
+}
+
+
+
+GlyphMetricsCache::SizeMetrics &GlyphMetricsCache::get_size( size_t face_index, unsigned pixel_size )
+{
+	auto &size_ptr = sizes[face_index * max_pixel_size + pixel_size];
+	auto size = size_ptr.load( memory_order_relaxed );
+	if( !size )
+	{
+		owned_sizes.emplace_back( new SizeMetrics() );
+		size = owned_sizes.back().get();
+		size_ptr.store( size, memory_order_release );
+	}
+
+	return *size;
+}
+
+
+
+const GlyphMetrics *GlyphMetricsCache::find_glyph( size_t face_index, unsigned pixel_size, uint32_t code_point ) const
+{
+	const auto size = find_size( face_index, pixel_size );
+	if( !size || code_point >= 0x110000 )
+	{
+		return nullptr;
+	}
+
+	const auto page = size->pages[code_point / 256].load( memory_order_acquire );
+	if( !page || !page->is_known[code_point % 256].load( memory_order_acquire ) )
+	{
+		return nullptr;
+	}
+
+	return &page->metrics[code_point % 256];
+}
+
+
+
+void GlyphMetricsCache::insert_glyph(
+	size_t face_index,
+	unsigned pixel_size,
+	uint32_t code_point,
+	const GlyphMetrics &metrics )
+{
+	if( !is_cached( face_index, pixel_size ) || code_point >= 0x110000 )
+	{
+		return;
+	}
+
+	auto &size = get_size( face_index, pixel_size );
+	auto &page_ptr = size.pages[code_point / 256];
+	auto page = page_ptr.load( memory_order_relaxed );
+	if( !page )
+	{
+		size.owned_pages.emplace_back( new GlyphPage() );
+		page = size.owned_pages.back().get();
+		page_ptr.store( page, memory_order_release );
+	}
+
+	// Known metrics never change, readers may be using them
+	auto &is_known = page->is_known[code_point % 256];
+	if( is_known.load( memory_order_relaxed ) )
+	{
+		return;
+	}
+
+	page->metrics[code_point % 256] = metrics;
+	is_known.store( true, memory_order_release );
+}
+
+
+
+bool GlyphMetricsCache::find_kerning(
+	size_t face_index,
+	unsigned pixel_size,
+	FT_UInt left,
+	FT_UInt right,
+	FT_Vector &kerning ) const
+{
+	const auto size = find_size( face_index, pixel_size );
+	if( !size || !left || !right )
+	{
+		return false;
+	}
+
+	const auto key = make_pair_key( left, right );
+	const auto table = size->kerning.load( memory_order_acquire );
+	const auto mask = table->capacity - 1;
+
+	for( auto i = hash_pair( key ) & mask; ; i = (i + 1) & mask )
+	{
+		const auto &slot = table->slots[i];
+		const auto slot_pair = slot.pair.load( memory_order_acquire );
+		if( slot_pair == key )
+		{
+			kerning = unpack_kerning( slot.kerning.load( memory_order_relaxed ) );
+			return true;
+		}
+		else if( !slot_pair )
+		{
+			return false;
+		}
+	}
+}
+
+
+
+void GlyphMetricsCache::insert_to_table( KerningTable &target, uint64_t pair, uint64_t kerning )
+{
+	const auto mask = target.capacity - 1;
+
+	for( auto i = hash_pair( pair ) & mask; ; i = (i + 1) & mask )
+	{
+		auto &slot = target.slots[i];
+		const auto slot_pair = slot.pair.load( memory_order_relaxed );
+		if( slot_pair == pair )
+		{
+			return;
+		}
+		else if( !slot_pair )
+		{
+			// Publish the kerning before the pair
+			slot.kerning.store( kerning, memory_order_relaxed );
+			slot.pair.store( pair, memory_order_release );
+			target.used_slots++;
+			return;
+		}
+	}
+}
+
+
+
+void GlyphMetricsCache::insert_kerning(
+	size_t face_index,
+	unsigned pixel_size,
+	FT_UInt left,
+	FT_UInt right,
+	FT_Vector kerning )
+{
+	if( !is_cached( face_index, pixel_size ) || !left || !right )
+	{
+		return;
+	}
+
+	auto &size = get_size( face_index, pixel_size );
+	auto table = size.kerning.load( memory_order_relaxed );
+
+	// Keep the load factor under a half, the old table
+	// stays alive for the readers still using it
+	if( (table->used_slots + 1) * 2 > table->capacity )
+	{
+		unique_ptr<KerningTable> grown{ new KerningTable( table->capacity * 2 ) };
+		for( size_t i = 0; i < table->capacity; i++ )
+		{
+			const auto pair = table->slots[i].pair.load( memory_order_relaxed );
+			if( pair )
+			{
+				insert_to_table( *grown, pair, table->slots[i].kerning.load( memory_order_relaxed ) );
+			}
+		}
+
+		table = grown.get();
+		size.kerning.store( table, memory_order_release );
+		size.kerning_tables.push_back( move( grown ) );
+	}
+
+	insert_to_table( *table, make_pair_key( left, right ), pack_kerning( kerning ) );
+}
+
+
+
+void GlyphMetricsCache::clear()
+{
+	for( size_t i = 0; i < max_faces * max_pixel_size; i++ )
+	{
+		sizes[i].store( nullptr, memory_order_relaxed );
+	}
+
+	owned_sizes.clear();
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "common_types.hh"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+
+// Layout metrics of a glyph, without its bitmap
+// - face_index is the face the glyph was actually found from
+struct GlyphMetrics
+{
+	glm::ivec2 size        = { 0, 0 };
+	glm::ivec2 bearing     = { 0, 0 };
+	GLuint     advance     = 0;
+	FT_UInt    glyph       = 0;
+	GLuint     font_height = 0;
+	size_t     face_index  = 0;
+};
+
+
+
+// Glyph metrics and kerning pairs per (face index, pixel size)
+// - Code points are kept in dense pages of 256, allocated when first
+//   used, kerning pairs in an own hash table for each face size
+// - Readers never lock, writers have to be serialized by the caller
+// - Nothing is freed before clear(), which must not race with readers
+struct GlyphMetricsCache
+{
+	static const size_t   max_faces      = 16;
+	static const unsigned max_pixel_size = 256;
+
+	GlyphMetricsCache();
+	~GlyphMetricsCache();
+
+	// Delete potentially dangerous constructors and operators
+	GlyphMetricsCache( const GlyphMetricsCache& )            = delete;
+	GlyphMetricsCache& operator=( const GlyphMetricsCache& ) = delete;
+
+	// Other faces and sizes aren't cached
+	static bool is_cached( size_t face_index, unsigned pixel_size );
+
+	const GlyphMetrics *find_glyph( size_t face_index, unsigned pixel_size, uint32_t code_point ) const;
+	void insert_glyph( size_t face_index, unsigned pixel_size, uint32_t code_point, const GlyphMetrics &metrics );
+
+	// Kerning in 26.6 pixels between two glyphs of the face
+	bool find_kerning( size_t face_index, unsigned pixel_size, FT_UInt left, FT_UInt right, FT_Vector &kerning ) const;
+	void insert_kerning( size_t face_index, unsigned pixel_size, FT_UInt left, FT_UInt right, FT_Vector kerning );
+
+	void clear();
+
+  protected:
+	struct GlyphPage
+	{
+		GlyphMetrics      metrics[256];
+		std::atomic<bool> is_known[256];
+		GlyphPage();
+	};
+
+	struct KerningSlot
+	{
+		std::atomic<uint64_t> pair;
+		std::atomic<uint64_t> kerning;
+	};
+
+	struct KerningTable
+	{
+		size_t                         capacity;
+		size_t                         used_slots;
+		std::unique_ptr<KerningSlot[]> slots;
+		explicit KerningTable( size_t capacity );
+	};
+
+	struct SizeMetrics
+	{
+		// Indexed by code point / 256
+		std::unique_ptr<std::atomic<GlyphPage*>[]> pages;
+		std::atomic<KerningTable*>                 kerning;
+
+		std::vector<std::unique_ptr<GlyphPage>>    owned_pages;
+		std::vector<std::unique_ptr<KerningTable>> kerning_tables;
+
+		SizeMetrics();
+	};
+
+	// Indexed by [face][pixel size]
+	std::unique_ptr<std::atomic<SizeMetrics*>[]> sizes;
+	std::vector<std::unique_ptr<SizeMetrics>>    owned_sizes;
+
+	const SizeMetrics *find_size( size_t face_index, unsigned pixel_size ) const;
+	SizeMetrics &get_size( size_t face_index, unsigned pixel_size );
+
+	static void insert_to_table( KerningTable &target, uint64_t pair, uint64_t kerning );
+};
@@ -171,13 +171,8 @@ void GuiElement::render() const
 	const auto color_bg = style.get( style_state ).color_bg;
 	if( color_bg.a > 0.f )
 	{
-		auto shader = Globals::shaders.find( "2d" );
-		glUseProgram( shader->second.program );
-		auto colorUniform = shader->second.get_uniform( "color" );
-		glUniform4f( colorUniform, color_bg.r, color_bg.g, color_bg.b, color_bg.a );
 		auto window_size = get_root()->size;
-		gl::render_quad_2d( shader->second, window_size.to_gl_vec(), pos.to_gl_vec(), size.to_gl_vec() );
-		gui::any_gl_errors();
+		gl::render_quad_2d( window_size.to_gl_vec(), pos.to_gl_vec(), size.to_gl_vec(), color_bg );
 	}
 
 	for( auto& child : children )
@@ -446,15 +446,14 @@ void SplitLayout::handle_event( const GuiEvent &e )
 
 
 
-void render_line( int x1, int y1, int x2, int y2 )
+void render_line( int x1, int y1, int x2, int y2, const glm::vec4 &color )
 {
 	auto windowSize = Globals::windows[0].size;
-	auto shader = Globals::shaders.find("2d");
 
 	glm::vec2 a = { x1, y1 };
 	glm::vec2 b = { x2, y2 };
 
-	gl::render_line_2d( shader->second, { windowSize.w, windowSize.h }, a, b );
+	gl::render_line_2d( { windowSize.w, windowSize.h }, a, b, color );
 }
 
 
@@ -463,21 +462,17 @@ void SplitLayout::render() const
 {
 	GuiElement::render();
 
-	auto shader = Globals::shaders.find( "2d" );
-	glUseProgram( shader->second.program );
-	auto colorUniform = shader->second.get_uniform( "color" );
-	auto texturedUniform = shader->second.get_uniform( "textured" );
-	glUniform1i( texturedUniform, 0 );
+	glm::vec4 color;
 
 	if( is_layout_splitted )
 	{
 		if( split_bar.is_hilighted )
 		{
-			glUniform4f( colorUniform, 0, 1.0, 0, 0.5 );
+			color = { 0, 1.0, 0, 0.5 };
 		}
 		else
 		{
-			glUniform4f( colorUniform, 1.0, 0.5, 0, 1.0 );
+			color = { 1.0, 0.5, 0, 1.0 };
 		}
 
 		if( split_bar.axis == VERTICAL )
@@ -486,7 +481,8 @@ void SplitLayout::render() const
 				pos.x + split_bar.offset,
 				pos.y,
 				pos.x + split_bar.offset,
-				pos.y + size.h
+				pos.y + size.h,
+				color
 			);
 		}
 		else
@@ -495,14 +491,15 @@ void SplitLayout::render() const
 				pos.x,
 				pos.y + split_bar.offset,
 				pos.x + size.w,
-				pos.y + split_bar.offset
+				pos.y + split_bar.offset,
+				color
 			);
 		}
 	}
 
 	else if( split_bar.is_visible )
 	{
-		glUniform4f( colorUniform, 1.0, 1.0, 1.0, 0.5 );
+		color = { 1.0, 1.0, 1.0, 0.5 };
 
 		if( split_bar.axis == VERTICAL )
 		{
@@ -510,7 +507,8 @@ void SplitLayout::render() const
 				pos.x + split_bar.offset,
 				pos.y,
 				pos.x + split_bar.offset,
-				pos.y + size.h
+				pos.y + size.h,
+				color
 			);
 		}
 		else
@@ -519,7 +517,8 @@ void SplitLayout::render() const
 				pos.x,
 				pos.y + split_bar.offset,
 				pos.x + size.w,
-				pos.y + split_bar.offset
+				pos.y + split_bar.offset,
+				color
 			);
 		}
 	}
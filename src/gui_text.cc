@@ -17,107 +17,69 @@ using namespace gui;
 
 
 void gui::render_unicode(
-	const ShaderProgram &shader,
 	const string_unicode &text,
 	const gui::GuiVec2 position,
 	const gui::GuiVec2 viewport_size,
 	FT_Face face,
+	unsigned font_size,
 	const glm::vec4 color,
 	float scale )
 {
-	// OpenGL vertex array and buffer objects for text rendering
-	// TODO: Figure out a better place for these
-	static GLuint vao;
-	static GLuint vbo;
-
 	if( !viewport_size.x || !viewport_size.y )
 	{
 		return;
 	}
 
-	glEnable( GL_BLEND );
-	glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
-	any_gl_errors();
-
-	glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
-	if( !vao )
+	// The height of the line is known from the metrics, without adding the glyphs to the atlas
+	unsigned max_used_height = 0;
+	for( auto c : text )
 	{
-		glGenVertexArrays( 1, &vao );
-		glGenBuffers( 1, &vbo );
-		glBindVertexArray( vao );
-		glBindBuffer( GL_ARRAY_BUFFER, vbo );
-		glBufferData( GL_ARRAY_BUFFER, sizeof( GLfloat ) * 6 * 4, nullptr, GL_DYNAMIC_DRAW );
-		glEnableVertexAttribArray( 0 );
-		glVertexAttribPointer( 0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof( GLfloat ), 0 );
-		glBindBuffer( GL_ARRAY_BUFFER, 0 );
-		glBindVertexArray( 0 );
-		gui::any_gl_errors();
+		const auto metrics = Globals::font_face_manager.get_glyph_metrics( face, font_size, c );
+		max_used_height = max<unsigned>( max_used_height, metrics.font_height );
 	}
 
-	const auto projection = glm::ortho<float>(
-		0, tools::int_to_float(viewport_size.w),
-		0, tools::int_to_float(viewport_size.h)
-	);
-
-	const auto tex_uniform = shader.get_uniform( "tex" );
-	const auto mp_uniform = shader.get_uniform( "MP" );
-	const auto color_uniform = shader.get_uniform( "color" );
-	const auto textured_uniform = shader.get_uniform( "textured" );
-
-	glUniformMatrix4fv( mp_uniform, 1, 0, &projection[0][0] );
-	glUniform4fv( color_uniform, 1, &color[0] );
-	glUniform1i( textured_uniform, 1 );
-	glUniform1i( tex_uniform, 0 );
-	any_gl_errors();
-
-	glBindVertexArray( vao );
-	glBindBuffer( GL_ARRAY_BUFFER, vbo );
-	any_gl_errors();
-
-	auto pen_pos_x = position.x;
+	// The glyphs are positioned with y-axis pointing up,
+	// but the batch expects it to point down
+	const auto viewport_h = tools::int_to_float( viewport_size.h );
+	Globals::batch_2d.set_viewport_size( viewport_size.to_gl_vec() );
 
 	GlCharacter previous_character{};
+	FT_Face previous_face = nullptr;
+	auto pen_pos_x = position.x;
 
-	vector<pair<GlCharacter, FT_Vector>> characters{ text.size() };
-	unsigned max_used_height = 0;
+	// Each glyph is submitted right after it's fetched. Adding a glyph may evict
+	// an atlas page, which flushes the quads submitted so far while the page
+	// still has their glyphs, and the glyphs fetched after it are in the new page
 	for( auto c : text )
 	{
-		auto result = Globals::font_face_manager.get_character( face, c );
-		auto current_character = result.first;
-		auto used_face = result.second;
-		auto face_ptr = used_face.get();
+		auto result = Globals::font_face_manager.get_character( face, font_size, c );
+		const auto &current_character = result.first;
+		auto face_ptr = result.second.get();
 		if( !face_ptr )
 		{
 			face_ptr = face;
 		}
 
+		// Glyphs from different fallback faces aren't kerned
 		FT_Vector kerning{0,0};
-		auto has_kerning = FT_HAS_KERNING( face );
-		if( has_kerning && previous_character.glyph )
+		if( previous_character.glyph && previous_face == face_ptr )
 		{
-			FT_Get_Kerning(
+			kerning = Globals::font_face_manager.get_kerning(
 				face_ptr,
+				font_size,
 				previous_character.glyph,
-				current_character.glyph,
-				FT_KERNING_DEFAULT,
-				&kerning
+				current_character.glyph
 			);
 			kerning.x >>= 6;
 			kerning.y >>= 6;
 		}
 
-		max_used_height = max<unsigned>( max_used_height, current_character.font_height );
-
-		characters.emplace_back( current_character, kerning );
-	}
+		previous_character = current_character;
+		previous_face = face_ptr;
 
-	for( auto glyph_info : characters )
-	{
-		auto &current_character = glyph_info.first;
-		auto &kerning = glyph_info.second;
+		pen_pos_x += kerning.x;
 
-		// Render
-		const auto x_adjust = current_character.bearing.x + kerning.x;
+		const auto x_adjust = current_character.bearing.x;
 		const auto y_adjust = current_character.size.y - current_character.bearing.y
 		                    - kerning.y - max_used_height/4.f;
 		const GLfloat pos_x = (pen_pos_x + x_adjust) * scale;
@@ -125,27 +87,17 @@ void gui::render_unicode(
 		const GLfloat w = current_character.size.x * scale;
 		const GLfloat h = current_character.size.y * scale;
 
-		const GLfloat vertices[6][4] = {
-			{ pos_x,     pos_y + h, 0.0, 0.0 },
-			{ pos_x,     pos_y,     0.0, 1.0 },
-			{ pos_x + w, pos_y,     1.0, 1.0 },
-
-			{ pos_x,     pos_y + h, 0.0, 0.0 },
-			{ pos_x + w, pos_y,     1.0, 1.0 },
-			{ pos_x + w, pos_y + h, 1.0, 0.0 }
-		};
-
-		glBindTexture( GL_TEXTURE_2D, current_character.gl_texture );
-
-		glBufferSubData( GL_ARRAY_BUFFER, 0, sizeof( vertices ), &vertices[0][0] );
-		gui::any_gl_errors();
+		// Glyphs from the same atlas page end up in the same draw call
+		Globals::batch_2d.add_textured_quad(
+			current_character.gl_texture,
+			{ pos_x, viewport_h - pos_y - h },
+			{ w, h },
+			current_character.uv_rect,
+			color
+		);
 
-		glDrawArrays( GL_TRIANGLES, 0, 6 );
-		gui::any_gl_errors();
-		
 		// Bitshift by 6 to get pixels
 		pen_pos_x += tools::float_to_int( (current_character.advance >> 6) * scale );
-		previous_character = current_character;
 	}
 }
 
@@ -160,38 +112,30 @@ vector<glm::vec4> gui::get_text_chararacter_rects(
 )
 {
 	vector<glm::vec4> rects;
+	rects.reserve( text.size() );
 
-	Globals::font_face_manager.sync_font_face_sizes( font_size );
-
-	GlCharacter previous_character{};
+	// Only the cached metrics are needed, not the glyph bitmaps
+	GlyphMetrics previous_character{};
 	auto offset_x = 0;
 
 	for( auto c : text )
 	{
-		auto result = Globals::font_face_manager.get_character( face, c );
-		auto current_character = result.first;
-		auto used_face = result.second;
-		auto face_ptr = used_face.get();
-		if( !face_ptr )
-		{
-			face_ptr = face;
-		}
+		auto current_character = Globals::font_face_manager.get_glyph_metrics( face, font_size, c );
 
 		// Get kerning
 		FT_Vector kerning{0,0};
-		auto has_kerning = FT_HAS_KERNING( face );
-		if( has_kerning && previous_character.glyph )
+		if( previous_character.glyph )
 		{
-			FT_Get_Kerning(
-				face,
-				previous_character.glyph,
-				current_character.glyph,
-				FT_KERNING_DEFAULT,
-				&kerning
+			kerning = Globals::font_face_manager.get_kerning(
+				previous_character,
+				current_character,
+				font_size
 			);
 			kerning.x >>= 6;
 		}
 
+		previous_character = current_character;
+
 		if( current_character.size.x == 0 )
 		{
 			current_character.size.x = static_cast<int>(font_size / 2);
@@ -242,38 +186,6 @@ GuiVec2 gui::get_text_bounding_box(
 }
 
 
-string_unicode find_unsplit_text(
-	FT_Face face,
-	const string_unicode &text,
-	const unsigned font_size,
-	const float max_width
-)
-{
-	string_unicode fit_text{};
-	fit_text.reserve( text.size() );
-
-	size_t index = 0;
-
-	// TODO: find a good width from the face data
-	const auto static_char_width = font_size;
-
-	const auto rects = get_text_chararacter_rects( face, text, font_size );
-	for( const auto& rect : rects )
-	{
-		const auto code_point = text[index++];
-		const auto right_side = rect.x + static_char_width;
-
-		if( right_side <= max_width )
-		{
-			fit_text.push_back( code_point );
-		}
-	}
-
-	return fit_text;
-}
-
-
-
 TextTexture::TextTexture( string_unicode text, unsigned font_size, GuiVec2 texture_size )
 : content(text),
   font_size(font_size),
@@ -320,7 +232,7 @@ void TextTexture::reset_texture()
 
 void TextTexture::update_texture()
 {
-	auto shader = Globals::shaders.find( "2d" );
+	auto shader = Globals::shaders.find( "batch2d" );
 	if( shader == Globals::shaders.end() )
 	{
 		return;
@@ -330,15 +242,18 @@ void TextTexture::update_texture()
 
 	framebuffer.bind();
 	render_unicode(
-		shader->second,
 		content,
 		{ 0, 0 },
 		{ texture_size.x, texture_size.y },
 		font_face.get(),
+		font_size,
 		{ 1.f, 1.f, 1.f, 1.f },
 		1.f
 	);
 
+	// Draw the batched glyphs while the framebuffer is still bound
+	Globals::batch_2d.flush();
+
 	glBindFramebuffer( GL_FRAMEBUFFER, 0 );
 	gui::any_gl_errors();
 }
@@ -351,78 +266,20 @@ void TextTexture::render(
 	const glm::vec4 color
 ) const
 {
-	auto shader = Globals::shaders.find( "2d" );
-	if( shader == Globals::shaders.end() )
-	{
-		return;
-	}
-
-	glUseProgram( shader->second.program );
-
-	static GLuint vao;
-	static GLuint vbo;
-
-	glEnable( GL_BLEND );
-	glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
-	any_gl_errors();
-
-	glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
-	if( !vao )
-	{
-		glGenVertexArrays( 1, &vao );
-		glGenBuffers( 1, &vbo );
-		glBindVertexArray( vao );
-		glBindBuffer( GL_ARRAY_BUFFER, vbo );
-		glBufferData( GL_ARRAY_BUFFER, sizeof( GLfloat ) * 6 * 4, nullptr, GL_DYNAMIC_DRAW );
-		glEnableVertexAttribArray( 0 );
-		glVertexAttribPointer( 0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof( GLfloat ), 0 );
-		glBindBuffer( GL_ARRAY_BUFFER, 0 );
-		glBindVertexArray( 0 );
-		gui::any_gl_errors();
-	}
-
-	const auto projection = glm::ortho<float>(
-		0, tools::int_to_float(viewport_size.w),
-		tools::int_to_float(viewport_size.h), 0
-	);
-
-	const auto tex_uniform = shader->second.get_uniform( "tex" );
-	const auto mp_uniform = shader->second.get_uniform( "MP" );
-	const auto color_uniform = shader->second.get_uniform( "color" );
-	const auto textured_uniform = shader->second.get_uniform( "textured" );
-
-	glUniformMatrix4fv( mp_uniform, 1, 0, &projection[0][0] );
-	glUniform4fv( color_uniform, 1, &color[0] );
-	glUniform1i( textured_uniform, 1 );
-	glUniform1i( tex_uniform, 0 );
-	any_gl_errors();
-
-	glBindVertexArray( vao );
-	glBindBuffer( GL_ARRAY_BUFFER, vbo );
-	any_gl_errors();
-
 	const auto pos_x = tools::int_to_float( position.x );
 	const auto pos_y = tools::int_to_float( viewport_size.h - position.y - texture_size.y );
 	const auto w = tools::int_to_float( texture_size.x );
 	const auto h = tools::int_to_float( texture_size.y );
 
-	const GLfloat vertices[6][4] = {
-		{ pos_x,     pos_y + h, 0.0, 0.0 },
-		{ pos_x,     pos_y,     0.0, 1.0 },
-		{ pos_x + w, pos_y,     1.0, 1.0 },
-
-		{ pos_x,     pos_y + h, 0.0, 0.0 },
-		{ pos_x + w, pos_y,     1.0, 1.0 },
-		{ pos_x + w, pos_y + h, 1.0, 0.0 }
-	};
-
-	glBindTexture( GL_TEXTURE_2D, framebuffer.texture_id );
-
-	glBufferSubData( GL_ARRAY_BUFFER, 0, sizeof( vertices ), &vertices[0][0] );
-	gui::any_gl_errors();
-
-	glDrawArrays( GL_TRIANGLES, 0, 6 );
-	gui::any_gl_errors();
+	// The framebuffer texture is upside down compared to the window
+	Globals::batch_2d.set_viewport_size( viewport_size.to_gl_vec() );
+	Globals::batch_2d.add_textured_quad(
+		framebuffer.texture_id,
+		{ pos_x, pos_y },
+		{ w, h },
+		{ 0.f, 1.f, 1.f, 0.f },
+		color
+	);
 }
 
 
@@ -526,8 +383,6 @@ void GuiLabel::refresh()
 		}
 	}
 
-	Globals::font_face_manager.sync_font_face_sizes( used_font_size );
-
 	auto shader = Globals::shaders.find( "2d" );
 	if( shader == Globals::shaders.end() )
 	{
@@ -537,6 +392,7 @@ void GuiLabel::refresh()
 	glUseProgram( shader->second.program );
 
 	content_size = get_text_bounding_box( font_face.get(), content, used_font_size );
+	text_texture.set_font_size( used_font_size );
 	text_texture.set_texture_size( content_size );
 	text_texture.reset_texture();
 }
@@ -624,14 +480,6 @@ void GuiTextField::render() const
 			throw runtime_error( "No window found" );
 		}
 
-		auto shader = Globals::shaders.find( "2d" );
-		if( shader == Globals::shaders.end() )
-		{
-			throw runtime_error( "No shader found" );
-		}
-
-		glUseProgram( shader->second.program );
-
 		const auto color = style.get( style_state ).color_text;
 		const auto padding = style.get( style_state ).padding;
 		const auto font_face = Globals::font_face_manager.get_default_font_face();
@@ -647,8 +495,6 @@ void GuiTextField::render() const
 			}
 		}
 
-		Globals::font_face_manager.sync_font_face_sizes( used_font_size );
-
 		auto text_pos = GuiVec2(
 			tools::float_to_int( pos.x + padding.x ),
 			tools::float_to_int( window->size.h - pos.y - padding.y - used_font_size )
@@ -678,32 +524,32 @@ void GuiTextField::render() const
 			const auto text_before_selection_width = get_text_bounding_box(
 				font_face.get(),
 				text_before_selection,
-				font_size
+				used_font_size
 			).w;
 
 			const auto selected_text_width = get_text_bounding_box(
 				font_face.get(),
 				selected_text,
-				font_size
+				used_font_size
 			).w;
 
 			if( text_before_selection.size() )
 			{
-				render_unicode( shader->second, text_before_selection, text_pos, window->size, font_face.get(), color );
+				render_unicode( text_before_selection, text_pos, window->size, font_face.get(), used_font_size, color );
 				text_pos.x += text_before_selection_width;
 			}
 
-			render_unicode( shader->second, selected_text, text_pos, window->size, font_face.get(), hilight_color );
+			render_unicode( selected_text, text_pos, window->size, font_face.get(), used_font_size, hilight_color );
 
 			if( text_after_selection.size() )
 			{
 				text_pos.x += selected_text_width;
-				render_unicode( shader->second, text_after_selection, text_pos, window->size, font_face.get(), color );
+				render_unicode( text_after_selection, text_pos, window->size, font_face.get(), used_font_size, color );
 			}
 		}
 		else
 		{
-			render_unicode( shader->second, content, text_pos, window->size, font_face.get(), color );
+			render_unicode( content, text_pos, window->size, font_face.get(), used_font_size, color );
 		}
 
 		if( is_active && text_info.cursor.is_shown )
@@ -714,10 +560,10 @@ void GuiTextField::render() const
 			);
 
 			gl::render_line_2d(
-				shader->second,
 				window->size.to_gl_vec(),
 				{ cursor_pos.x, cursor_pos.y },
-				{ cursor_pos.x, cursor_pos.y + size.h / 2 }
+				{ cursor_pos.x, cursor_pos.y + size.h / 2 },
+				color
 			);
 		}
 	}
@@ -1149,56 +995,115 @@ void GuiTextField::update_content()
 
 
 
-TextLine::TextLine( string_unicode text ) : content{text}
+void TextLine::mark_dirty( size_t first_changed )
+{
+	is_dirty = true;
+	dirty_from = min( dirty_from, first_changed );
+}
+
+
+
+bool TextLine::needs_update( const int row_max_width, const unsigned font_size ) const
 {
+	return is_dirty || row_max_width != wrapped_width || font_size != wrapped_font_size;
 }
 
+
+
 void TextLine::update(
+	const string_unicode &content,
 	const int row_max_width,
 	const unsigned font_size
 )
 {
 	const auto font_face = Globals::font_face_manager.get_default_font_face().get();
 
-	// For now all textures get deleted
-	textures.clear();
+	// Measurements of another size can't be reused
+	if( font_size != wrapped_font_size )
+	{
+		wrapped_font_size = font_size;
+		dirty_from = 0;
+		textures.clear();
+	}
+
+	if( row_max_width != wrapped_width )
+	{
+		wrapped_width = row_max_width;
+		textures.clear();
+	}
 
-	// Split the line by how it should be wrapped
 	// TODO: Check if wrapping is enabled
-	const auto lines = tools::split<string_unicode>(
-		content,
-		[font_face, font_size, row_max_width]( const string_unicode &vec, size_t offset) -> size_t
+	// Measured from the cached metrics, without touching the glyph atlas
+	auto &font_face_manager = Globals::font_face_manager;
+	GlyphMetrics previous_glyph{};
+	auto previous_i = content.size();
+	const auto get_width = [&]( size_t i )
+	{
+		if( !font_face )
 		{
-			const auto remaining_text = string_unicode{ vec.cbegin() + offset, vec.cend() };
-			const auto next_line = find_unsplit_text( font_face, remaining_text, font_size, row_max_width );
-			return offset + next_line.size();
+			return 0.f;
 		}
-	);
 
-	for( auto& line : lines )
-	{
-		textures.emplace_back(
-			line,
-			font_size,
-			GuiVec2{ row_max_width, 2 * static_cast<const int>(font_size) }
-		);
-	}
+		if( i > 0 && previous_i != i - 1 )
+		{
+			previous_glyph = font_face_manager.get_glyph_metrics( font_face, font_size, content[i - 1] );
+		}
 
-	// Create an empty texture if there are no lines
-	if( !lines.size() )
-	{
-		textures.push_back(
-			TextTexture{ content, font_size, { row_max_width, 2 * static_cast<const int>(font_size) } }
-		);
+		// The kerning goes to the glyph after the pair, bitshift by 6 to get pixels
+		const auto glyph = font_face_manager.get_glyph_metrics( font_face, font_size, content[i] );
+		auto width = static_cast<int>( glyph.advance >> 6 );
+		if( i > 0 && previous_glyph.glyph )
+		{
+			width += static_cast<int>( font_face_manager.get_kerning( previous_glyph, glyph, font_size ).x >> 6 );
+		}
 
-		textures[0].reset_texture();
-	}
+		previous_glyph = glyph;
+		previous_i = i;
+		return tools::int_to_float( width );
+	};
+
+	wrap.measure( content.size(), get_width, dirty_from );
+	const auto first_changed_row = wrap.wrap( tools::int_to_float( row_max_width ), dirty_from );
+	dirty_from = content.size();
+	is_dirty = false;
+
+	textures.erase( textures.lower_bound( first_changed_row ), textures.end() );
+}
+
+
+
+size_t TextLine::get_row_count() const
+{
+	return wrap.get_row_count();
+}
+
+
+
+const TextWrap& TextLine::get_wrap() const
+{
+	return wrap;
 }
 
 
+
 GuiTextArea::GuiTextArea()
 {
-	lines.emplace_back();
+}
+
+
+
+void GuiTextArea::set_text( const string_unicode &text )
+{
+	loader.reset();
+	buffer = TextBuffer{ text };
+
+	visible_lines.clear();
+	scroll.line = 0;
+	scroll.segment = 0;
+	scroll.row = 0;
+
+	text_state = TextState{};
+	update_content();
 }
 
 
@@ -1209,6 +1114,62 @@ GuiTextArea::~GuiTextArea()
 
 
 
+void GuiTextArea::open_file( const string &path )
+{
+	set_text( {} );
+
+	loader.reset( new TextFileLoader( path ) );
+	append_loaded_chunks();
+}
+
+
+
+float GuiTextArea::get_load_progress() const
+{
+	return loader ? loader->get_progress() : 1.f;
+}
+
+
+
+void GuiTextArea::append_loaded_chunks()
+{
+	if( !loader )
+	{
+		return;
+	}
+
+	const auto chunks = loader->take_chunks();
+	if( chunks.size() )
+	{
+		// The last line may continue in the new chunks
+		const auto last_line = buffer.get_line_count() - 1;
+		mark_line_dirty( last_line, buffer.get_line_length( last_line ) );
+
+		const auto file = loader->get_file();
+		for( const auto &chunk : chunks )
+		{
+			buffer.append_mapped( file, chunk.byte_begin, chunk.byte_end, chunk.code_points, chunk.line_breaks );
+		}
+
+		update_content();
+	}
+
+	if( loader->is_done() )
+	{
+		loader.reset();
+	}
+}
+
+
+
+void GuiTextArea::update()
+{
+	GuiElement::update();
+	append_loaded_chunks();
+}
+
+
+
 void GuiTextArea::render() const
 {
 	try
@@ -1234,34 +1195,48 @@ void GuiTextArea::render() const
 			tools::float_to_int( window->size.h - pos.y - font_size - padding.w * 2 )
 		);
 
-		//render_unicode( shader->second, content, cursor_pos, window->size, font_face.get() );
+		// Loading progress of the opened file
+		if( loader )
+		{
+			gl::render_quad_2d(
+				window->size.to_gl_vec(),
+				pos.to_gl_vec(),
+				{ size.w * get_load_progress(), 2.f },
+				{ 1.f, 1.f, 1.f, 0.5f }
+			);
+		}
 
-		const auto texture_vecs = tools::map_vector<
-			const vector<TextLine>&,
-			vector<const TextTexture*>,
-			const TextLine&
-		>
-		(
-			lines,
-			[]( const TextLine& line ) -> vector<const TextTexture*>
-			{
-				vector<const TextTexture*> ptrs;
-				ptrs.reserve( line.textures.size() ) ;
-				for( const auto& texture : line.textures )
-				{
-					ptrs.push_back( &texture );
-				}
-				return ptrs;
-			}
-		);
+		// Only the rows starting from the scroll position are drawn,
+		// the overscan rows above and below just keep their textures
+		const auto bottom = tools::float_to_int( window->size.h - pos.y - size.h );
 
-		const auto textures = tools::flatten( texture_vecs );
+		const auto scroll_segment = make_pair( scroll.line, scroll.segment );
 
 		auto render_pos = cursor_pos;
-		for( auto& line_texture : textures )
+		for( const auto& visible_line : visible_lines )
 		{
-			line_texture->render( render_pos, window->size, { 1.f, 1.f, 1.f, 1.f } );
-			render_pos.y -= font_size;
+			if( visible_line.first < scroll_segment )
+			{
+				continue;
+			}
+
+			const auto& line = visible_line.second;
+			const auto first_row = visible_line.first == scroll_segment ? scroll.row : 0;
+
+			for( auto row = first_row; row < line.get_row_count(); row++ )
+			{
+				if( render_pos.y + static_cast<int>(font_size) < bottom )
+				{
+					return;
+				}
+
+				const auto texture = line.textures.find( row );
+				if( texture != line.textures.end() )
+				{
+					texture->second.render( render_pos, window->size, { 1.f, 1.f, 1.f, 1.f } );
+				}
+				render_pos.y -= font_size;
+			}
 		}
 	}
 	catch( runtime_error &e )
@@ -1295,8 +1270,6 @@ void GuiTextArea::handle_event( const GuiEvent &e )
 		);
 		*/
 
-		auto& line = lines[text_state.cursor.row];
-
 		/*
 		if( text_state.selection.is_active )
 		{
@@ -1310,18 +1283,18 @@ void GuiTextArea::handle_event( const GuiEvent &e )
 
 		text_state.selection.is_active = false;
 
-		line.content.insert(
-			line.content.begin() + text_state.cursor.col,
-			new_input.cbegin(),
-			new_input.cend()
+		buffer.insert(
+			buffer.get_offset( text_state.cursor.row, text_state.cursor.col ),
+			new_input
 		);
 
-		line.is_dirty = true;
+		mark_line_dirty( text_state.cursor.row, text_state.cursor.col );
 		do_update = true;
 
 		// Update cursor position
-		text_state.cursor.col++;
+		text_state.cursor.col += new_input.size();
 		text_state.cursor.target_col = text_state.cursor.col;
+		scroll_to_cursor();
 	}
 
 	else if( e.type == GuiEventType::TEXT_EDIT )
@@ -1341,25 +1314,14 @@ void GuiTextArea::handle_event( const GuiEvent &e )
 		if( e.key.button.scancode == SDL_SCANCODE_RETURN &&
 		    e.key.state == GuiButtonState::PRESSED )
 		{
-			auto& current_line = lines[text_state.cursor.row];
-
-			const auto rest_of_line = string_unicode{
-				current_line.content.begin() + text_state.cursor.col,
-				current_line.content.end()
-			};
-
-			current_line.content.erase(
-				current_line.content.begin() + text_state.cursor.col,
-				current_line.content.end()
+			// Rest of the line moves to a new line
+			buffer.insert(
+				buffer.get_offset( text_state.cursor.row, text_state.cursor.col ),
+				{ TextBuffer::line_break }
 			);
-			current_line.update( size.w, font_size );
 
-			lines.insert(
-				lines.begin() + text_state.cursor.row + 1,
-				rest_of_line
-			);
-
-			lines[text_state.cursor.row + 1].is_dirty = true;
+			mark_line_dirty( text_state.cursor.row, text_state.cursor.col );
+			shift_lines( text_state.cursor.row, 1 );
 
 			text_state.cursor.row++;
 			text_state.cursor.col = 0;
@@ -1370,30 +1332,23 @@ void GuiTextArea::handle_event( const GuiEvent &e )
 		else if( e.key.button.scancode == SDL_SCANCODE_BACKSPACE &&
 		         e.key.state == GuiButtonState::PRESSED )
 		{
+			const auto offset = buffer.get_offset( text_state.cursor.row, text_state.cursor.col );
+
 			if( text_state.cursor.col > 0 )
 			{
-				auto& current_line = lines[text_state.cursor.row];
-				auto it = current_line.content.begin() + text_state.cursor.col - 1;
-				current_line.content.erase( it );
-				current_line.is_dirty = true;
+				buffer.erase( offset - 1, 1 );
+				mark_line_dirty( text_state.cursor.row, text_state.cursor.col - 1 );
 
 				text_state.cursor.col--;
 			}
 			else if( text_state.cursor.row > 0 )
 			{
-				const auto& current_line  = lines[text_state.cursor.row];
-				auto&       previous_line = lines[text_state.cursor.row-1];
-				const auto previous_line_length = lines[text_state.cursor.row-1].content.size();
-
-				previous_line.content.insert(
-					previous_line.content.end(),
-					current_line.content.cbegin(),
-					current_line.content.cend()
-				);
-				previous_line.update( size.w, font_size );
+				const auto previous_line_length = buffer.get_line_length( text_state.cursor.row-1 );
 
-				// Destroys the current_line
-				lines.erase(lines.begin() + text_state.cursor.row);
+				// Joins the line to the previous one
+				buffer.erase( offset - 1, 1 );
+				mark_line_dirty( text_state.cursor.row-1, previous_line_length );
+				shift_lines( text_state.cursor.row-1, -1 );
 
 				text_state.cursor.row--;
 				text_state.cursor.col = previous_line_length;
@@ -1412,8 +1367,7 @@ void GuiTextArea::handle_event( const GuiEvent &e )
 			}
 			else if( text_state.cursor.row > 0 )
 			{
-				auto& previous_line = lines[text_state.cursor.row-1];
-				text_state.cursor.col = previous_line.content.size();
+				text_state.cursor.col = buffer.get_line_length( text_state.cursor.row-1 );
 				text_state.cursor.row--;
 
 			}
@@ -1431,8 +1385,7 @@ void GuiTextArea::handle_event( const GuiEvent &e )
 			}
 			else if( text_state.cursor.row > 0 )
 			{
-				auto& previous_line = lines[text_state.cursor.row-1];
-				text_state.cursor.col = previous_line.content.size();
+				text_state.cursor.col = buffer.get_line_length( text_state.cursor.row-1 );
 				text_state.cursor.row--;
 
 			}
@@ -1444,8 +1397,8 @@ void GuiTextArea::handle_event( const GuiEvent &e )
 		else if( e.key.button.scancode == SDL_SCANCODE_RIGHT &&
 		         e.key.state == GuiButtonState::PRESSED )
 		{
-			const auto line_count = lines.size();
-			const auto current_line_length = lines[text_state.cursor.row].content.size();
+			const auto line_count = buffer.get_line_count();
+			const auto current_line_length = buffer.get_line_length( text_state.cursor.row );
 
 			if( text_state.cursor.col < current_line_length )
 			{
@@ -1470,10 +1423,10 @@ void GuiTextArea::handle_event( const GuiEvent &e )
 			}
 
 			text_state.cursor.col = text_state.cursor.target_col;
-			const auto& tgt_line = lines[text_state.cursor.row];
-			if( tgt_line.content.size() <= text_state.cursor.col )
+			const auto target_line_length = buffer.get_line_length( text_state.cursor.row );
+			if( target_line_length <= text_state.cursor.col )
 			{
-				text_state.cursor.col = tgt_line.content.size();
+				text_state.cursor.col = target_line_length;
 			}
 
 			do_update = true;
@@ -1482,16 +1435,16 @@ void GuiTextArea::handle_event( const GuiEvent &e )
 		else if( e.key.button.scancode == SDL_SCANCODE_DOWN &&
 		         e.key.state == GuiButtonState::PRESSED )
 		{
-			if( text_state.cursor.row < lines.size()-1 )
+			if( text_state.cursor.row < buffer.get_line_count()-1 )
 			{
 				text_state.cursor.row++;
 			}
 
 			text_state.cursor.col = text_state.cursor.target_col;
-			const auto& tgt_line = lines[text_state.cursor.row];
-			if( tgt_line.content.size() <= text_state.cursor.col )
+			const auto target_line_length = buffer.get_line_length( text_state.cursor.row );
+			if( target_line_length <= text_state.cursor.col )
 			{
-				text_state.cursor.col = tgt_line.content.size();
+				text_state.cursor.col = target_line_length;
 			}
 
 			do_update = true;
@@ -1500,48 +1453,44 @@ void GuiTextArea::handle_event( const GuiEvent &e )
 		else if( e.key.button.scancode == SDL_SCANCODE_DELETE &&
 		         e.key.state == GuiButtonState::PRESSED )
 		{
-			const auto line_count = lines.size();
-			const auto current_line_length = lines[text_state.cursor.row].content.size();
-
-			auto& current_line = lines[text_state.cursor.row];
+			const auto line_count = buffer.get_line_count();
+			const auto current_line_length = buffer.get_line_length( text_state.cursor.row );
+			const auto offset = buffer.get_offset( text_state.cursor.row, text_state.cursor.col );
 
 			if( text_state.cursor.col < current_line_length )
 			{
-				current_line.content.erase( current_line.content.begin() + text_state.cursor.col );
-				current_line.is_dirty = true;
+				buffer.erase( offset, 1 );
+				mark_line_dirty( text_state.cursor.row, text_state.cursor.col );
 			}
 			else if( text_state.cursor.row < line_count-1 )
 			{
-				auto&       current_line = lines[text_state.cursor.row];
-				const auto& next_line    = lines[text_state.cursor.row+1];
-
-				current_line.content.insert(
-					current_line.content.end(),
-					next_line.content.cbegin(),
-					next_line.content.cend()
-				);
-				current_line.update( size.w, font_size );
-
-				// Destroys next_line
-				lines.erase( lines.begin() + text_state.cursor.row + 1 );
+				// Joins the next line to this one
+				buffer.erase( offset, 1 );
+				mark_line_dirty( text_state.cursor.row, current_line_length );
+				shift_lines( text_state.cursor.row, -1 );
 			}
 
 			text_state.cursor.target_col = text_state.cursor.col;
 			do_update = true;
 		}
+
+		scroll_to_cursor();
+	}
+	else if( e.type == GuiEventType::MOUSE_SCROLL )
+	{
+		const auto rows = e.mouse_scroll.value * scroll_step_rows;
+		scroll_by( e.mouse_scroll.direction == NORTH ? -rows : rows );
+		do_update = true;
 	}
 	else
 	{
 		GuiElement::handle_event( e );
 	}
 
+	// Lines get wrapped again for the new width when they are laid out
 	if( e.type == RESIZE )
 	{
 		do_update = true;
-		for( auto& line : lines )
-		{
-			line.is_dirty = true;
-		}
 	}
 	
 	if( do_update )
@@ -1552,15 +1501,309 @@ void GuiTextArea::handle_event( const GuiEvent &e )
 
 
 
-void GuiTextArea::update_content()
+void GuiTextArea::mark_line_dirty( size_t line, size_t first_changed )
+{
+	// Lines out of the view get laid out from scratch anyway
+	const auto segment = first_changed / segment_length;
+	const auto text_line = visible_lines.find( { line, segment } );
+	if( text_line != visible_lines.end() )
+	{
+		text_line->second.mark_dirty( first_changed - segment * segment_length );
+	}
+
+	// The text after the change moves over the borders of the later segments
+	visible_lines.erase(
+		visible_lines.upper_bound( { line, segment } ),
+		visible_lines.lower_bound( { line + 1, 0 } )
+	);
+}
+
+
+
+void GuiTextArea::shift_lines( size_t after_line, int count )
+{
+	// Lines after after_line were inserted or removed,
+	// only the lines in view need their indices fixed
+	map<pair<size_t, size_t>, TextLine> shifted;
+	for( auto& text_line : visible_lines )
+	{
+		const auto line = text_line.first.first;
+		if( line <= after_line )
+		{
+			shifted.emplace( text_line.first, move( text_line.second ) );
+		}
+		else if( count >= 0 || line > after_line - count )
+		{
+			shifted.emplace( make_pair( line + count, text_line.first.second ), move( text_line.second ) );
+		}
+	}
+	visible_lines = move( shifted );
+
+	if( scroll.line > after_line )
+	{
+		if( count < 0 && scroll.line <= after_line - count )
+		{
+			scroll.line = after_line;
+			scroll.segment = 0;
+			scroll.row = 0;
+		}
+		else
+		{
+			scroll.line += count;
+		}
+	}
+}
+
+
+
+size_t GuiTextArea::get_segment_count( size_t line ) const
+{
+	const auto length = buffer.get_line_length( line );
+	return max<size_t>( (length + segment_length - 1) / segment_length, 1 );
+}
+
+
+
+size_t GuiTextArea::get_segment_of( size_t line, size_t col ) const
+{
+	// The end of a line belongs to its last segment
+	return min( col / segment_length, get_segment_count( line ) - 1 );
+}
+
+
+
+TextLine& GuiTextArea::layout_segment( size_t line, size_t segment )
+{
+	auto& text_line = visible_lines[{ line, segment }];
+	if( text_line.needs_update( size.w, font_size ) )
+	{
+		// Only the text of the segment is decoded and measured
+		const auto first = segment * segment_length;
+		const auto length = buffer.get_line_length( line );
+		const auto last = min( first + segment_length, length );
+		const auto count = first < last ? last - first : 0;
+		text_line.update( buffer.get_text( buffer.get_line_start( line ) + first, count ), size.w, font_size );
+	}
+
+	return text_line;
+}
+
+
+
+void GuiTextArea::step_rows( size_t &line, size_t &segment, size_t &row, long long rows )
 {
-	for( auto& text_line : lines )
+	while( rows < 0 )
 	{
-		if( text_line.is_dirty )
+		if( row > 0 )
 		{
-			text_line.update( size.w, font_size );
-	text_line.is_dirty = false;
+			const auto step = min<long long>( row, -rows );
+			row -= static_cast<size_t>( step );
+			rows += step;
 		}
+		else if( segment > 0 )
+		{
+			segment--;
+			row = layout_segment( line, segment ).get_row_count();
+		}
+		else if( line > 0 )
+		{
+			line--;
+			segment = get_segment_count( line ) - 1;
+			row = layout_segment( line, segment ).get_row_count();
+		}
+		else break;
+	}
+
+	while( rows > 0 )
+	{
+		const auto row_count = layout_segment( line, segment ).get_row_count();
+		const auto rows_left = static_cast<long long>( row_count - min( row, row_count ) );
+		if( rows < rows_left )
+		{
+			row += static_cast<size_t>( rows );
+			rows = 0;
+		}
+		else if( segment + 1 < get_segment_count( line ) )
+		{
+			rows -= rows_left;
+			segment++;
+			row = 0;
+		}
+		else if( line + 1 < buffer.get_line_count() )
+		{
+			rows -= rows_left;
+			line++;
+			segment = 0;
+			row = 0;
+		}
+		else
+		{
+			row = row_count;
+			break;
+		}
+	}
+}
+
+
+
+size_t GuiTextArea::get_visible_row_count() const
+{
+	if( !font_size || size.h <= 0 )
+	{
+		return 1;
+	}
+
+	return (size.h + font_size - 1) / font_size;
+}
+
+
+
+void GuiTextArea::scroll_by( long long rows )
+{
+	step_rows( scroll.line, scroll.segment, scroll.row, rows );
+
+	// Keep at least the last row in view
+	const auto row_count = layout_segment( scroll.line, scroll.segment ).get_row_count();
+	if( scroll.row >= row_count )
+	{
+		scroll.row = row_count ? row_count - 1 : 0;
+	}
+}
+
+
+
+void GuiTextArea::scroll_to_cursor()
+{
+	const auto cursor_line = text_state.cursor.row;
+	const auto cursor_segment = get_segment_of( cursor_line, text_state.cursor.col );
+	const auto cursor_row = layout_segment( cursor_line, cursor_segment ).get_wrap().get_row_of(
+		text_state.cursor.col - cursor_segment * segment_length
+	);
+	const auto cursor = make_tuple( cursor_line, cursor_segment, cursor_row );
+
+	if( cursor < make_tuple( scroll.line, scroll.segment, scroll.row ) )
+	{
+		tie( scroll.line, scroll.segment, scroll.row ) = cursor;
+		return;
+	}
+
+	auto last_line = scroll.line;
+	auto last_segment = scroll.segment;
+	auto last_row = scroll.row;
+	const auto visible_rows = static_cast<long long>( get_visible_row_count() );
+	step_rows( last_line, last_segment, last_row, visible_rows - 1 );
+
+	if( cursor > make_tuple( last_line, last_segment, last_row ) )
+	{
+		tie( scroll.line, scroll.segment, scroll.row ) = cursor;
+		step_rows( scroll.line, scroll.segment, scroll.row, 1 - visible_rows );
 	}
 }
 
+
+
+void GuiTextArea::update_content()
+{
+	if( scroll.line >= buffer.get_line_count() )
+	{
+		scroll.line = buffer.get_line_count() - 1;
+		scroll.segment = 0;
+		scroll.row = 0;
+	}
+
+	// Edits may have shortened the line in view
+	const auto segment_count = get_segment_count( scroll.line );
+	if( scroll.segment >= segment_count )
+	{
+		scroll.segment = segment_count - 1;
+		scroll.row = 0;
+	}
+
+	// Rows in view plus the overscan on both sides
+	auto first_line = scroll.line;
+	auto first_segment = scroll.segment;
+	auto first_row = scroll.row;
+	step_rows( first_line, first_segment, first_row, -static_cast<long long>( overscan_rows ) );
+
+	auto last_line = scroll.line;
+	auto last_segment = scroll.segment;
+	auto last_row = scroll.row;
+	step_rows( last_line, last_segment, last_row, static_cast<long long>( get_visible_row_count() + overscan_rows ) );
+
+	// Everything else gives their textures away
+	visible_lines.erase( visible_lines.begin(), visible_lines.lower_bound( { first_line, first_segment } ) );
+	visible_lines.erase( visible_lines.upper_bound( { last_line, last_segment } ), visible_lines.end() );
+
+	const auto texture_size = GuiVec2{ size.w, 2 * static_cast<const int>(font_size) };
+
+	for( auto line = first_line; line <= last_line; line++ )
+	{
+		const auto segment_begin = line == first_line ? first_segment : 0;
+		const auto segment_end = line == last_line ? last_segment + 1 : get_segment_count( line );
+
+		// Start of the line is looked up only when a row needs a texture
+		auto line_start = buffer.size();
+		for( auto segment = segment_begin; segment < segment_end; segment++ )
+		{
+			const auto is_first = line == first_line && segment == first_segment;
+			const auto is_last = line == last_line && segment == last_segment;
+
+			auto& text_line = layout_segment( line, segment );
+			const auto& wrap = text_line.get_wrap();
+			const auto row_begin = is_first ? first_row : 0;
+			const auto row_end = is_last ? last_row : text_line.get_row_count();
+
+			auto& textures = text_line.textures;
+			textures.erase( textures.begin(), textures.lower_bound( row_begin ) );
+			textures.erase( textures.lower_bound( max( row_begin, row_end ) ), textures.end() );
+
+			// Rows without textures are decoded in one go, only
+			// the code points of those rows are read from the buffer
+			auto missing_begin = row_end;
+			auto missing_end = row_begin;
+			for( auto row = row_begin; row < row_end; row++ )
+			{
+				if( !textures.count( row ) )
+				{
+					missing_begin = min( missing_begin, row );
+					missing_end = row + 1;
+				}
+			}
+
+			if( missing_begin >= missing_end )
+			{
+				continue;
+			}
+
+			if( line_start == buffer.size() )
+			{
+				line_start = buffer.get_line_start( line );
+			}
+
+			const auto text_begin = wrap.get_row( missing_begin ).first;
+			const auto text = buffer.get_text(
+				line_start + segment * segment_length + text_begin,
+				wrap.get_row( missing_end - 1 ).second - text_begin
+			);
+
+			// An empty line still gets a single empty row
+			for( auto row = missing_begin; row < missing_end; row++ )
+			{
+				if( textures.count( row ) )
+				{
+					continue;
+				}
+
+				const auto range = wrap.get_row( row );
+				textures.emplace(
+					row,
+					TextTexture{
+						string_unicode( text.begin() + (range.first - text_begin), text.begin() + (range.second - text_begin) ),
+						font_size,
+						texture_size
+					}
+				);
+			}
+		}
+	}
+}
@@ -3,17 +3,25 @@
 #include "gui.hh"
 #include "gui_gl.hh"
 #include "gl_helpers.hh"
+#include "text_wrap.hh"
+#include "text_buffer.hh"
+#include "text_file_loader.hh"
 #include "window.hh"
 #include "common_types.hh"
 
+#include <map>
+#include <tuple>
+#include <utility>
+
 namespace gui
 {
+	// Submits the glyphs to Globals::batch_2d
 	void render_unicode(
-		const ShaderProgram &shader,
 		const string_unicode &text,
 		const gui::GuiVec2 position,
 		const gui::GuiVec2 viewport_size,
 		FT_Face face,
+		unsigned font_size,
 		const glm::vec4 color = glm::vec4{ 1.f },
 		float scale = 1.f
 	);
@@ -68,28 +76,44 @@ namespace gui
 
 
 
-	// A "conceptual" line of text, which can
-	// actually be wrapped on multiple lines,
+	// Rendered rows of a "conceptual" line of text,
+	// which can actually be wrapped on multiple lines,
 	// depending on how much room there is to
-	// display it.
+	// display it. The text itself lives in a TextBuffer.
+	// Long lines are laid out in segments, one TextLine each
 	struct TextLine
 	{
-		string_unicode content{};
-		std::vector<TextTexture> textures;
-		bool is_dirty;
+		// Textures of the wrapped rows that are in view
+		std::map<size_t, TextTexture> textures;
+		bool is_dirty{ true };
+
+		// Content has changed starting from the code point
+		void mark_dirty( size_t first_changed = 0 );
 
-		TextLine( string_unicode text={} );
+		bool needs_update( const int row_max_width, const unsigned font_size ) const;
 
+		// Wraps the line again starting from the first changed row,
+		// the rows before it keep their textures
 		void update(
+			const string_unicode &content,
 			const int row_max_width,
 			const unsigned font_size
 		);
 
+		size_t get_row_count() const;
+		const TextWrap& get_wrap() const;
+
 		void render(
 			const GuiVec2 position,
 			const GuiVec2 viewport_size,
 			const glm::vec4 color
 		) const;
+
+	  protected:
+		TextWrap wrap;
+		size_t dirty_from{ 0 };
+		unsigned wrapped_font_size{ 0 };
+		int wrapped_width{ 0 };
 	};
 
 
@@ -200,21 +224,70 @@ namespace gui
 
 
 
+	// Only the lines in view are wrapped and only the rows in view,
+	// plus a few rows of overscan, own textures. The cost of the
+	// view depends on its size instead of the size of the text
+	// - Lines are wrapped in segments of segment_length code points, a row
+	//   never crosses the end of a segment. Only the segments in view are
+	//   decoded and measured, so a huge line costs as much as a short one
 	struct GuiTextArea : GuiElement
 	{
+		static const size_t overscan_rows = 2;
+		static const int scroll_step_rows = 3;
+		static const size_t segment_length = 16384;
+
 		unsigned font_size;
 
-		std::vector<TextLine> lines{};
+		TextBuffer buffer;
 		TextState text_state;
 
 		GuiTextArea();
 		virtual ~GuiTextArea();
 
+		void set_text( const string_unicode &text );
+
+		// Maps the file and shows its beginning right away,
+		// the rest gets appended as it's indexed
+		// - Only the segments and the rows in view are decoded from
+		//   the mapped file, even if it has no line breaks at all
+		void open_file( const std::string &path );
+
+		// Share of the opened file available so far, from 0 to 1
+		float get_load_progress() const;
+
+		virtual void update() override;
 		virtual void render() const override;
 		virtual void handle_event( const GuiEvent &e ) override;
 
 	  protected:
+		std::unique_ptr<TextFileLoader> loader;
+
+		// First row in view, as a line, a segment of it and a wrapped row of the segment
+		struct
+		{
+			size_t line{ 0 };
+			size_t segment{ 0 };
+			size_t row{ 0 };
+		} scroll;
+
+		// Laid out segments by their lines and their indices in the lines
+		std::map<std::pair<size_t, size_t>, TextLine> visible_lines;
+
 		void update_content();
+		void append_loaded_chunks();
+		void mark_line_dirty( size_t line, size_t first_changed );
+		void shift_lines( size_t after_line, int count );
+
+		// An empty line has a single empty segment
+		size_t get_segment_count( size_t line ) const;
+		size_t get_segment_of( size_t line, size_t col ) const;
+		TextLine& layout_segment( size_t line, size_t segment );
+
+		// Moves the position by rows, wrapping the segments passed on the way
+		void step_rows( size_t &line, size_t &segment, size_t &row, long long rows );
+		size_t get_visible_row_count() const;
+		void scroll_by( long long rows );
+		void scroll_to_cursor();
 	};
 }
 
@@ -154,6 +154,7 @@ void init_graphics()
 	map<string, string> shader_list;
 	shader_list["default"] = "data/shader";
 	shader_list["2d"] = "data/2d";
+	shader_list["batch2d"] = "data/batch2d";
 
 	gui::any_gl_errors();
 
@@ -345,6 +346,21 @@ int main( int argc, char **argv )
 		Globals::windows.clear();
 	} );
 
+	// The globals outlive the GL context, their GL objects are released before it
+	auto defer_release_gl_objects = tools::make_defer( []()
+	{
+		{
+			lock_guard<mutex> windows_lock{ Globals::windows_mutex };
+			if( Globals::windows.size() && Globals::windows[0].gl_context )
+			{
+				SDL_GL_MakeCurrent( Globals::windows[0].window.get(), Globals::windows[0].gl_context );
+			}
+		}
+
+		Globals::font_face_manager.clear_glyphs();
+		Globals::batch_2d.release();
+	} );
+
 
 #ifdef  _WIN32
 #ifndef _DEBUG
@@ -357,13 +373,47 @@ int main( int argc, char **argv )
 	{
 		auto split_layout = make_shared<gui::SplitLayout>();
 
-		split_layout->create_children = []
+		// A text file, an SVG image or a document can be given on the command line
+		const string file_to_open = argc > 1 ? argv[1] : "";
+
+		split_layout->create_children = [file_to_open]
 		{
 			auto text_area = make_shared<gui::GuiTextArea>();
 			text_area->font_size = 12;
+			auto vector_editor = make_shared<VectorGraphicsEditor>();
+
+			// An image opened from the command line replaces the image of the last session
+			auto has_image = false;
+			if( file_to_open.size() )
+			{
+				try
+				{
+					if( VectorGraphicsEditor::can_open( file_to_open ) )
+					{
+						vector_editor->open_file( file_to_open );
+						has_image = true;
+					}
+					else
+					{
+						text_area->open_file( file_to_open );
+					}
+				}
+				catch( runtime_error &e )
+				{
+					LOG( ERRORS, string_u8{ "Exception: " } + e.what() );
+				}
+			}
+
+			// Only one editor saves to the autosave file
+			static auto has_autosave = false;
+			if( !has_autosave )
+			{
+				vector_editor->enable_autosave( "autosave.vdr", !has_image );
+				has_autosave = true;
+			}
 
 			return gui::GuiElementPtrPair(
-				make_shared<VectorGraphicsEditor>(),
+				vector_editor,
 				text_area
 			);
 		};
@@ -0,0 +1,596 @@
+#include "text_buffer.hh"
+#include "utf8.hh"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+using namespace gui;
+
+namespace
+{
+	// Small chunks keep the copied leaves cheap on edits,
+	// while keeping the tree shallow
+	const size_t max_leaf_size = 512;
+}
+
+
+
+struct gui::TextBuffer::Node
+{
+	NodePtr        left;
+	NodePtr        right;
+	string_unicode text;
+
+	// Mapped leaves have no text of their own
+	std::shared_ptr<const tools::MappedFile> file;
+	size_t byte_begin = 0;
+	size_t byte_end   = 0;
+
+	size_t length      = 0;
+	size_t line_breaks = 0;
+	int    height      = 0;
+
+	bool is_leaf() const
+	{
+		return !left && !right;
+	}
+};
+
+
+
+namespace
+{
+	template<typename NodePtr>
+	size_t length_of( const NodePtr &node )
+	{
+		return node ? node->length : 0;
+	}
+
+
+
+	template<typename NodePtr>
+	size_t line_breaks_of( const NodePtr &node )
+	{
+		return node ? node->line_breaks : 0;
+	}
+
+
+
+	template<typename NodePtr>
+	int height_of( const NodePtr &node )
+	{
+		return node ? node->height : -1;
+	}
+
+
+
+	// Whether the byte starts a code point, like the decoder counts them. Continuation
+	// bytes after ASCII or at the start of the text are code points of their own
+	bool starts_code_point( char byte, bool &is_stray )
+	{
+		if( (byte & 0xc0) == 0x80 )
+		{
+			return is_stray;
+		}
+
+		is_stray = static_cast<unsigned char>( byte ) < 0x80;
+		return true;
+	}
+
+
+
+	// Start of the code point count code points after c
+	const char* skip_code_points( const char *c, const char *last, size_t count )
+	{
+		auto is_stray = true;
+		for( ; c < last; c++ )
+		{
+			if( starts_code_point( *c, is_stray ) && count-- == 0 )
+			{
+				return c;
+			}
+		}
+
+		return last;
+	}
+}
+
+
+
+TextBuffer::NodePtr TextBuffer::make_leaf( string_unicode text )
+{
+	if( text.empty() )
+	{
+		return nullptr;
+	}
+
+	auto leaf = make_shared<Node>();
+	leaf->length = text.size();
+	leaf->line_breaks = static_cast<size_t>( count( text.begin(), text.end(), line_break ) );
+	leaf->text = move( text );
+	return leaf;
+}
+
+
+
+TextBuffer::NodePtr TextBuffer::make_mapped_leaf(
+	std::shared_ptr<const tools::MappedFile> file,
+	size_t byte_begin,
+	size_t byte_end )
+{
+	const auto first = file->data() + byte_begin;
+	const auto last = file->data() + byte_end;
+
+	const auto length = utf8::count_code_points( first, last );
+	if( !length )
+	{
+		return nullptr;
+	}
+
+	auto leaf = make_shared<Node>();
+	leaf->length = length;
+	leaf->line_breaks = static_cast<size_t>( count( first, last, static_cast<char>( line_break ) ) );
+	leaf->file = move( file );
+	leaf->byte_begin = byte_begin;
+	leaf->byte_end = byte_end;
+	return leaf;
+}
+
+
+
+void TextBuffer::append_leaf_text( const Node &leaf, size_t offset, size_t count, string_unicode &text )
+{
+	count = min( count, leaf.length - min( offset, leaf.length ) );
+	if( !count )
+	{
+		return;
+	}
+
+	if( !leaf.file )
+	{
+		text.insert( text.end(), leaf.text.begin() + offset, leaf.text.begin() + offset + count );
+		return;
+	}
+
+	// Decode only the asked part of the mapped text
+	const auto data_end = leaf.file->data() + leaf.byte_end;
+	const auto first = skip_code_points( leaf.file->data() + leaf.byte_begin, data_end, offset );
+	const auto last = skip_code_points( first, data_end, count );
+	utf8::decode( first, last, text );
+}
+
+
+
+size_t TextBuffer::find_line_start( const Node &leaf, size_t line )
+{
+	if( !leaf.file )
+	{
+		for( size_t i = 0; i < leaf.text.size(); i++ )
+		{
+			if( leaf.text[i] == line_break && --line == 0 )
+			{
+				return i + 1;
+			}
+		}
+
+		return leaf.length;
+	}
+
+	size_t code_points = 0;
+	auto is_stray = true;
+	const auto data = leaf.file->data();
+	for( auto i = leaf.byte_begin; i < leaf.byte_end; i++ )
+	{
+		if( !starts_code_point( data[i], is_stray ) )
+		{
+			continue;
+		}
+
+		code_points++;
+		if( data[i] == static_cast<char>( line_break ) && --line == 0 )
+		{
+			return code_points;
+		}
+	}
+
+	return leaf.length;
+}
+
+
+
+TextBuffer::NodePtr TextBuffer::make_node( NodePtr left, NodePtr right )
+{
+	if( !left )
+	{
+		return right;
+	}
+	if( !right )
+	{
+		return left;
+	}
+
+	auto node = make_shared<Node>();
+	node->length = left->length + right->length;
+	node->line_breaks = left->line_breaks + right->line_breaks;
+	node->height = max( left->height, right->height ) + 1;
+	node->left = move( left );
+	node->right = move( right );
+	return node;
+}
+
+
+
+TextBuffer::NodePtr TextBuffer::balance( NodePtr left, NodePtr right )
+{
+	// The heights differ at most by two, a single or
+	// a double rotation restores the balance
+	if( height_of( left ) > height_of( right ) + 1 )
+	{
+		if( height_of( left->left ) >= height_of( left->right ) )
+		{
+			return make_node( left->left, make_node( left->right, right ) );
+		}
+
+		return make_node(
+			make_node( left->left, left->right->left ),
+			make_node( left->right->right, right )
+		);
+	}
+
+	if( height_of( right ) > height_of( left ) + 1 )
+	{
+		if( height_of( right->right ) >= height_of( right->left ) )
+		{
+			return make_node( make_node( left, right->left ), right->right );
+		}
+
+		return make_node(
+			make_node( left, right->left->left ),
+			make_node( right->left->right, right->right )
+		);
+	}
+
+	return make_node( left, right );
+}
+
+
+
+TextBuffer::NodePtr TextBuffer::join( NodePtr left, NodePtr right )
+{
+	if( !left )
+	{
+		return right;
+	}
+	if( !right )
+	{
+		return left;
+	}
+
+	// Merge small neighbouring chunks, so that
+	// typing doesn't end up with a leaf per code point
+	if( left->is_leaf() && right->is_leaf() &&
+	    left->length + right->length <= max_leaf_size )
+	{
+		string_unicode text;
+		text.reserve( left->length + right->length );
+		append_leaf_text( *left, 0, left->length, text );
+		append_leaf_text( *right, 0, right->length, text );
+		return make_leaf( move( text ) );
+	}
+
+	if( height_of( left ) > height_of( right ) + 1 )
+	{
+		return balance( left->left, join( left->right, move( right ) ) );
+	}
+
+	if( height_of( right ) > height_of( left ) + 1 )
+	{
+		return balance( join( move( left ), right->left ), right->right );
+	}
+
+	return make_node( move( left ), move( right ) );
+}
+
+
+
+pair<TextBuffer::NodePtr, TextBuffer::NodePtr> TextBuffer::split( const NodePtr &node, size_t offset )
+{
+	if( !node )
+	{
+		return { nullptr, nullptr };
+	}
+	if( offset == 0 )
+	{
+		return { nullptr, node };
+	}
+	if( offset >= node->length )
+	{
+		return { node, nullptr };
+	}
+
+	if( node->is_leaf() && node->file )
+	{
+		const auto data = node->file->data();
+		const auto middle = skip_code_points( data + node->byte_begin, data + node->byte_end, offset );
+		const auto byte_middle = static_cast<size_t>( middle - data );
+		return {
+			make_mapped_leaf( node->file, node->byte_begin, byte_middle ),
+			make_mapped_leaf( node->file, byte_middle, node->byte_end )
+		};
+	}
+
+	if( node->is_leaf() )
+	{
+		return {
+			make_leaf( { node->text.begin(), node->text.begin() + offset } ),
+			make_leaf( { node->text.begin() + offset, node->text.end() } )
+		};
+	}
+
+	const auto left_length = node->left->length;
+	if( offset <= left_length )
+	{
+		auto parts = split( node->left, offset );
+		return { move( parts.first ), join( move( parts.second ), node->right ) };
+	}
+
+	auto parts = split( node->right, offset - left_length );
+	return { join( node->left, move( parts.first ) ), move( parts.second ) };
+}
+
+
+
+TextBuffer::NodePtr TextBuffer::build( const string_unicode &text, size_t first, size_t last )
+{
+	if( last - first <= max_leaf_size )
+	{
+		return make_leaf( { text.begin() + first, text.begin() + last } );
+	}
+
+	const auto middle = first + (last - first) / 2;
+	return make_node( build( text, first, middle ), build( text, middle, last ) );
+}
+
+
+
+TextBuffer::TextBuffer()
+{
+}
+
+
+
+TextBuffer::TextBuffer( const string_unicode &text )
+: root( build( text, 0, text.size() ) )
+{
+}
+
+
+
+size_t TextBuffer::size() const
+{
+	return length_of( root );
+}
+
+
+
+size_t TextBuffer::get_line_count() const
+{
+	return line_breaks_of( root ) + 1;
+}
+
+
+
+size_t TextBuffer::get_line_start( size_t line ) const
+{
+	if( line == 0 )
+	{
+		return 0;
+	}
+	if( line > line_breaks_of( root ) )
+	{
+		return size();
+	}
+
+	// Find the line break that ends the previous line
+	size_t offset = 0;
+	auto node = root.get();
+	while( !node->is_leaf() )
+	{
+		const auto left_breaks = line_breaks_of( node->left );
+		if( line <= left_breaks )
+		{
+			node = node->left.get();
+		}
+		else
+		{
+			line -= left_breaks;
+			offset += length_of( node->left );
+			node = node->right.get();
+		}
+	}
+
+	return offset + find_line_start( *node, line );
+}
+
+
+
+size_t TextBuffer::get_line_length( size_t line ) const
+{
+	const auto start = get_line_start( line );
+	if( line + 1 >= get_line_count() )
+	{
+		return size() - start;
+	}
+
+	return get_line_start( line + 1 ) - start - 1;
+}
+
+
+
+size_t TextBuffer::get_offset( size_t line, size_t col ) const
+{
+	return get_line_start( line ) + min( col, get_line_length( line ) );
+}
+
+
+
+uint32_t TextBuffer::at( size_t offset ) const
+{
+	if( offset >= size() )
+	{
+		throw out_of_range( "TextBuffer::at offset out of range" );
+	}
+
+	auto node = root.get();
+	while( !node->is_leaf() )
+	{
+		const auto left_length = length_of( node->left );
+		if( offset < left_length )
+		{
+			node = node->left.get();
+		}
+		else
+		{
+			offset -= left_length;
+			node = node->right.get();
+		}
+	}
+
+	string_unicode code_point;
+	append_leaf_text( *node, offset, 1, code_point );
+	return code_point.size() ? code_point[0] : 0;
+}
+
+
+
+string_unicode TextBuffer::get_line( size_t line ) const
+{
+	return get_text( get_line_start( line ), get_line_length( line ) );
+}
+
+
+
+string_unicode TextBuffer::get_text( size_t offset, size_t count ) const
+{
+	string_unicode text;
+	if( offset >= size() )
+	{
+		return text;
+	}
+
+	count = min( count, size() - offset );
+	text.reserve( count );
+
+	// Walk the leaves in order, skipping the subtrees before the offset
+	vector<const Node*> stack;
+	auto node = root.get();
+	while( node || stack.size() )
+	{
+		if( node )
+		{
+			if( offset >= node->length )
+			{
+				offset -= node->length;
+				node = nullptr;
+				continue;
+			}
+
+			if( !node->is_leaf() )
+			{
+				stack.push_back( node->right.get() );
+				node = node->left.get();
+				continue;
+			}
+
+			append_leaf_text( *node, offset, count - text.size(), text );
+			offset = 0;
+
+			if( text.size() == count )
+			{
+				break;
+			}
+		}
+
+		node = nullptr;
+		if( stack.size() )
+		{
+			node = stack.back();
+			stack.pop_back();
+		}
+	}
+
+	return text;
+}
+
+
+
+string_unicode TextBuffer::get_text() const
+{
+	return get_text( 0, size() );
+}
+
+
+
+void TextBuffer::append_mapped(
+	std::shared_ptr<const tools::MappedFile> file,
+	size_t byte_begin,
+	size_t byte_end,
+	size_t code_point_count,
+	size_t line_break_count )
+{
+	if( !code_point_count )
+	{
+		return;
+	}
+
+	auto leaf = make_shared<Node>();
+	leaf->length = code_point_count;
+	leaf->line_breaks = line_break_count;
+	leaf->file = move( file );
+	leaf->byte_begin = byte_begin;
+	leaf->byte_end = byte_end;
+
+	root = join( move( root ), move( leaf ) );
+}
+
+
+
+void TextBuffer::insert( size_t offset, const string_unicode &text )
+{
+	if( text.empty() )
+	{
+		return;
+	}
+
+	offset = min( offset, size() );
+
+	auto parts = split( root, offset );
+	root = join(
+		join( move( parts.first ), build( text, 0, text.size() ) ),
+		move( parts.second )
+	);
+}
+
+
+
+void TextBuffer::erase( size_t offset, size_t count )
+{
+	if( !count || offset >= size() )
+	{
+		return;
+	}
+
+	count = min( count, size() - offset );
+
+	auto head = split( root, offset );
+	auto tail = split( head.second, count );
+	root = join( move( head.first ), move( tail.second ) );
+}
+
+
+
+void TextBuffer::clear()
+{
+	root.reset();
+}
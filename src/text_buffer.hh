@@ -0,0 +1,77 @@
+#pragma once
+
+#include "common_types.hh"
+#include "common_tools.hh"
+
+#include <memory>
+#include <utility>
+#include <cstdint>
+
+namespace gui
+{
+	// Text stored as a rope of small immutable chunks
+	// - Inserting and erasing are O(log n), only the nodes on
+	//   the path to the edit get copied
+	// - Every node counts its line breaks, so lines are found in O(log n)
+	// - Copying the buffer is O(1), the copies share all the chunks
+	//   and can be used as snapshots of the text
+	// - Chunks can also refer to UTF-8 text of a mapped file,
+	//   they are decoded only when their text is read
+	struct TextBuffer
+	{
+		static const uint32_t line_break = '\n';
+
+		TextBuffer();
+		explicit TextBuffer( const string_unicode &text );
+
+		size_t size() const;
+		size_t get_line_count() const;
+
+		// Offset of the first code point of the line
+		size_t get_line_start( size_t line ) const;
+
+		// Length of the line without the line break
+		size_t get_line_length( size_t line ) const;
+
+		size_t get_offset( size_t line, size_t col ) const;
+
+		uint32_t at( size_t offset ) const;
+		string_unicode get_line( size_t line ) const;
+		string_unicode get_text( size_t offset, size_t count ) const;
+		string_unicode get_text() const;
+
+		// Appends UTF-8 text of the mapped file, the code points and
+		// the line breaks of the range have to be counted by the caller
+		void append_mapped(
+			std::shared_ptr<const tools::MappedFile> file,
+			size_t byte_begin,
+			size_t byte_end,
+			size_t code_point_count,
+			size_t line_break_count
+		);
+
+		void insert( size_t offset, const string_unicode &text );
+		void erase( size_t offset, size_t count );
+		void clear();
+
+	  protected:
+		struct Node;
+		using NodePtr = std::shared_ptr<const Node>;
+
+		NodePtr root;
+
+		static NodePtr make_leaf( string_unicode text );
+		static NodePtr make_mapped_leaf(
+			std::shared_ptr<const tools::MappedFile> file,
+			size_t byte_begin,
+			size_t byte_end
+		);
+		static void append_leaf_text( const Node &leaf, size_t offset, size_t count, string_unicode &text );
+		static size_t find_line_start( const Node &leaf, size_t line );
+		static NodePtr make_node( NodePtr left, NodePtr right );
+		static NodePtr balance( NodePtr left, NodePtr right );
+		static NodePtr join( NodePtr left, NodePtr right );
+		static std::pair<NodePtr, NodePtr> split( const NodePtr &node, size_t offset );
+		static NodePtr build( const string_unicode &text, size_t first, size_t last );
+	};
+}
@@ -0,0 +1,138 @@
+#include "text_file_loader.hh"
+#include "utf8.hh"
+
+#include <cstring>
+
+using namespace std;
+using namespace gui;
+
+
+const size_t TextFileLoader::chunk_size;
+
+
+
+TextFileLoader::TextFileLoader( const string &path )
+: file( make_shared<const tools::MappedFile>( path ) ),
+  indexed_bytes( 0 ),
+  stop( false )
+{
+	// Skip the byte order mark
+	const auto data = file->data();
+	if( file->size() >= 3 && !memcmp( data, "\xef\xbb\xbf", 3 ) )
+	{
+		indexed_bytes = 3;
+	}
+
+	if( indexed_bytes < file->size() )
+	{
+		const auto first_chunk = index_chunk( indexed_bytes );
+		chunks.push_back( first_chunk );
+		indexed_bytes = first_chunk.byte_end;
+	}
+
+	if( indexed_bytes < file->size() )
+	{
+		worker = thread( [this]{ index_rest(); } );
+	}
+}
+
+
+
+TextFileLoader::~TextFileLoader()
+{
+	stop = true;
+	if( worker.joinable() )
+	{
+		worker.join();
+	}
+}
+
+
+
+TextFileChunk TextFileLoader::index_chunk( size_t byte_begin ) const
+{
+	const auto data = file->data();
+	const auto size = file->size();
+
+	// Don't split UTF-8 sequences between the chunks
+	auto byte_end = min( byte_begin + chunk_size, size );
+	while( byte_end < size && (data[byte_end] & 0xc0) == 0x80 )
+	{
+		byte_end++;
+	}
+
+	TextFileChunk chunk{ byte_begin, byte_end, 0, 0 };
+	chunk.code_points = utf8::count_code_points( data + byte_begin, data + byte_end );
+
+	auto c = data + byte_begin;
+	const auto last = data + byte_end;
+	while( (c = static_cast<const char*>( memchr( c, '\n', last - c ) )) != nullptr )
+	{
+		chunk.line_breaks++;
+		c++;
+	}
+
+	return chunk;
+}
+
+
+
+void TextFileLoader::index_rest()
+{
+	auto byte_begin = indexed_bytes.load();
+
+	while( !stop && byte_begin < file->size() )
+	{
+		const auto chunk = index_chunk( byte_begin );
+		{
+			lock_guard<mutex> chunks_lock( chunks_mutex );
+			chunks.push_back( chunk );
+		}
+
+		byte_begin = chunk.byte_end;
+		indexed_bytes = byte_begin;
+	}
+}
+
+
+
+vector<TextFileChunk> TextFileLoader::take_chunks()
+{
+	lock_guard<mutex> chunks_lock( chunks_mutex );
+
+	vector<TextFileChunk> taken;
+	taken.swap( chunks );
+	return taken;
+}
+
+
+
+shared_ptr<const tools::MappedFile> TextFileLoader::get_file() const
+{
+	return file;
+}
+
+
+
+float TextFileLoader::get_progress() const
+{
+	if( !file->size() )
+	{
+		return 1.f;
+	}
+
+	return static_cast<float>( static_cast<double>( indexed_bytes.load() ) / file->size() );
+}
+
+
+
+bool TextFileLoader::is_done()
+{
+	if( indexed_bytes < file->size() )
+	{
+		return false;
+	}
+
+	lock_guard<mutex> chunks_lock( chunks_mutex );
+	return chunks.empty();
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "common_tools.hh"
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace gui
+{
+	// UTF-8 range of a mapped text file, with its code points and line breaks counted
+	struct TextFileChunk
+	{
+		size_t byte_begin;
+		size_t byte_end;
+		size_t code_points;
+		size_t line_breaks;
+	};
+
+
+
+	// Maps a text file and indexes it chunk by chunk on a worker thread
+	// - The first chunk is indexed right away, so the beginning
+	//   of the file can be shown without waiting for the rest
+	// - Chunks never split UTF-8 sequences
+	struct TextFileLoader
+	{
+		static const size_t chunk_size = 16 * 1024;
+
+		explicit TextFileLoader( const std::string &path );
+		~TextFileLoader();
+
+		// Delete potentially dangerous constructors and operators
+		TextFileLoader( const TextFileLoader& )            = delete;
+		TextFileLoader& operator=( const TextFileLoader& ) = delete;
+
+		// Hands over the chunks indexed since the last call, in file order
+		std::vector<TextFileChunk> take_chunks();
+
+		std::shared_ptr<const tools::MappedFile> get_file() const;
+
+		// Share of the file indexed so far, from 0 to 1
+		float get_progress() const;
+
+		// All the chunks have been taken
+		bool is_done();
+
+	  protected:
+		std::shared_ptr<const tools::MappedFile> file;
+
+		std::mutex chunks_mutex;
+		std::vector<TextFileChunk> chunks;
+
+		std::atomic<size_t> indexed_bytes;
+		std::atomic_bool    stop;
+		std::thread         worker;
+
+		TextFileChunk index_chunk( size_t byte_begin ) const;
+		void index_rest();
+	};
+}
@@ -3,9 +3,12 @@
 #include "gui_gl.hh"
 #include "settings.hh"
 #include "logging.hh"
+#include "utf8.hh"
 
 #include <iostream>
 
+#include FT_SIZES_H
+
 #ifdef _WIN32
 //#include <ftlcdfil.h>
 #endif
@@ -14,90 +17,29 @@ using namespace std;
 
 namespace
 {
-	size_t get_unicode_octet_count( const char byte )
+	GlyphMetrics make_glyph_metrics( const GlCharacter &character, FT_Face face )
 	{
-		if( (byte & 0b10000000) == 0 )
-		{
-			return 1;
-		}
-		else if( (byte & 0b11100000) == 0b11000000 )
-		{
-			return 2;
-		}
-		else if( (byte & 0b11110000) == 0b11100000 )
-		{
-			return 3;
-		}
-		else if( (byte & 0b11111000) == 0b11110000 )
-		{
-			return 4;
-		}
-		else return 1;
+		GlyphMetrics metrics;
+		metrics.size = character.size;
+		metrics.bearing = character.bearing;
+		metrics.advance = character.advance;
+		metrics.glyph = character.glyph;
+		metrics.font_height = character.font_height;
+		metrics.face_index = get_font_face_index( face );
+		return metrics;
 	}
+}
 
 
 
-	unsigned long u8_char_to_unicode( unsigned long c )
+size_t get_font_face_index( FT_Face face )
+{
+	if( !face )
 	{
-		unsigned long val = 0;
-
-		if( (c & 0xf8000000) == 0xf0000000 )
-		{
-			val |= (c & 0x7000000) >> 6;
-			val |= (c & 0x3f0000) >> 4;
-			val |= (c & 0x3f00) >> 2;
-			val |= (c & 0x3f);
-		}
-		else if( (c & 0xf00000) == 0xe00000 )
-		{
-			val |= (c & 0xf0000) >> 4;
-			val |= (c & 0x3f00) >> 2;
-			val |= (c & 0x3f);
-		}
-		else if( (c & 0xe000) == 0xc000 )
-		{
-			val |= (c & 0x1f00) >> 2;
-			val |= (c & 0x3f);
-		}
-		else val = c;
-
-		return val;
+		return static_cast<size_t>( -1 );
 	}
 
-
-
-	string_unicode::value_type read_next_unicode_code_point(
-		const char *str,
-		const char * const end,
-		size_t &bytes
-	)
-	{
-		unsigned long character = 0;
-
-		if( str >= end )
-		{
-			bytes = 1;
-			return 0;
-		}
-
-		auto octet_count = get_unicode_octet_count( *str );
-		if( (str + octet_count) > end )
-		{
-			octet_count = end - str;
-		}
-
-		bytes = octet_count ? octet_count : 1;
-
-		character |= str[0] & 0xff;
-		str++;
-		while( octet_count-- > 1 )
-		{
-			character <<= 8;
-			character |= str++[0] & 0xff;
-		}
-
-		return u8_char_to_unicode( character );
-	}
+	return reinterpret_cast<size_t>( face->generic.data ) - 1;
 }
 
 
@@ -114,43 +56,67 @@ FontFacePtr create_font_face( FT_Face face )
 string_unicode u8_to_unicode( const string_u8 &str )
 {
 	string_unicode unicode_str;
-	unicode_str.reserve( str.size() );
+	utf8::decode( str.data(), str.data() + str.size(), unicode_str );
+	return unicode_str;
+}
 
-	const char* str_ptr = str.data();
-	const char* const str_end = static_cast<const char*>(str.data() + str.size());
-	string_unicode::value_type code_point = 0;
-	size_t bytes_read = 0;
 
-	while( (code_point = read_next_unicode_code_point( str_ptr, str_end, bytes_read )) && bytes_read )
-	{
-		unicode_str.push_back( code_point );
-		str_ptr += bytes_read;
-	}
 
-	unicode_str.shrink_to_fit();
-	return unicode_str;
+void u8_to_unicode( const char *first, const char *last, string_unicode &unicode_str )
+{
+	utf8::decode( first, last, unicode_str );
 }
 
 
 
-pair<GlCharacter, FontFacePtr> FontFaceManager::add_character( FontFacePtr face, unsigned long c )
+size_t u8_code_point_count( const char *first, const char *last )
 {
-	auto glyph_index = FT_Get_Char_Index( face.get(), c );
+	return utf8::count_code_points( first, last );
+}
+
+
+
+string_u8 unicode_to_u8( const string_unicode &unicode_str )
+{
+	string_u8 str;
+	utf8::encode( unicode_str.data(), unicode_str.data() + unicode_str.size(), str );
+	return str;
+}
+
+
+
+pair<GlCharacter, FontFacePtr> FontFaceManager::add_character( FontFacePtr face, unsigned pixel_size, unsigned long c )
+{
+	auto face_ptr = face.get();
+	const auto face_index = get_font_face_index( face_ptr );
+
+	// The fallback faces may already have the glyph
+	GlyphCacheEntry cached;
+	if( glyph_cache.find( face_index, pixel_size, c, cached ) )
+	{
+		return { cached.character, cached.face };
+	}
+
+	auto glyph_index = FT_Get_Char_Index( face_ptr, c );
 
 	// If the glyph wasn't found, try to use the next font face
 	if( !glyph_index )
 	{
-		const auto next_face = get_next_font_face( face.get() );
+		const auto next_face = get_next_font_face( face_ptr );
 		if( next_face )
 		{
-			return add_character( next_face, c );
+			return add_character( next_face, pixel_size, c );
 		}
 		
 		// This was the last face and no glyph was found,
 		// continue and render the placeholder glyph
 	}
 
-	auto face_ptr = face.get();
+	const auto size = activate_size( face_ptr, pixel_size );
+	if( !size )
+	{
+		return {};
+	}
 
 	auto err = FT_Load_Char( face_ptr, c, FT_LOAD_RENDER );
 	if( err )
@@ -159,208 +125,289 @@ pair<GlCharacter, FontFacePtr> FontFaceManager::add_character( FontFacePtr face,
 		return {};
 	}
 
-	auto shader = Globals::shaders.find( "2d" );
-	if( shader == Globals::shaders.end() )
+	// Pack the bitmap to the glyph atlas
+	const auto &bitmap = face_ptr->glyph->bitmap;
+	auto evicted_page = GlyphAtlas::no_page;
+	GlyphAtlasRegion region;
+
+	if( bitmap.width && bitmap.rows )
 	{
-		throw runtime_error( "Couldn't find 2d shader" );
+		region = glyph_atlas.add(
+			static_cast<int>( bitmap.width ),
+			static_cast<int>( bitmap.rows ),
+			bitmap.buffer,
+			bitmap.pitch,
+			evicted_page
+		);
 	}
-	gui::any_gl_errors();
-
-	glUseProgram( shader->second.program );
-	gui::any_gl_errors();
 
-	// Generate texture
-	GLuint texture=0;
-	glGenTextures( 1, &texture );
-	if( !texture )
+	if( evicted_page != GlyphAtlas::no_page )
 	{
-		gui::any_gl_errors();
-		return{ {}, nullptr };
+		forget_atlas_page( evicted_page );
 	}
 
-	glBindTexture( GL_TEXTURE_2D, texture );
-	gui::any_gl_errors();
-
-	// Set texture options
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
-
-	glTexImage2D(
-		GL_TEXTURE_2D,
-		0,
-		GL_RED,
-		face_ptr->glyph->bitmap.width,
-		face_ptr->glyph->bitmap.rows,
-		0,
-		GL_RED,
-		GL_UNSIGNED_BYTE,
-		face_ptr->glyph->bitmap.buffer
-	);
-	gui::any_gl_errors();
-
-	glBindTexture( GL_TEXTURE_2D, 0 );
-	gui::any_gl_errors();
-
 	// Now store character for later use
 	GlCharacter character = {};
-	character.gl_texture = texture;
-	character.size = glm::ivec2( face_ptr->glyph->bitmap.width, face_ptr->glyph->bitmap.rows );
+	character.gl_texture = region.texture;
+	character.atlas_page = region.page;
+	character.uv_rect = region.uv_rect;
+	character.size = glm::ivec2( bitmap.width, bitmap.rows );
 	character.bearing = glm::ivec2( face_ptr->glyph->bitmap_left, face_ptr->glyph->bitmap_top );
 	character.advance = (GLuint)face_ptr->glyph->advance.x;
 	character.glyph = glyph_index;
-	character.font_height = (face_ptr->size->metrics.height) / 64;
+	character.font_height = (size->metrics.height) / 64;
 
-	font_face_library[FontFaceIdentity( face_ptr )].insert( { c, character } );
+	glyph_cache.insert( face_index, pixel_size, c, { character, face } );
+	glyph_metrics.insert_glyph( face_index, pixel_size, c, make_glyph_metrics( character, face_ptr ) );
 	return { character, face };
 }
 
 
 
-pair<GlCharacter, FontFacePtr> FontFaceManager::get_character( FT_Face face, unsigned long c )
+pair<GlCharacter, FontFacePtr> FontFaceManager::get_character( FT_Face face, unsigned pixel_size, unsigned long c )
 {
-	lock_guard<mutex> font_face_library_lock( font_face_mutex );
-	FontFacePtr passed_face;
+	const auto face_index = get_font_face_index( face );
 
-	for( auto &font_face : freetype_face_order )
+	// Cached glyphs are looked up without locking
+	GlyphCacheEntry entry;
+	if( glyph_cache.find( face_index, pixel_size, c, entry ) )
 	{
-		if( font_face.second.get() == face )
-		{
-			passed_face = font_face.second;
-		}
+		glyph_atlas.touch( entry.character.atlas_page );
+		return { entry.character, entry.face };
 	}
 
+	lock_guard<mutex> font_face_library_lock( font_face_mutex );
 
-	if( !character_exists( c ) )
+	// The glyph could've been added while waiting for the lock
+	if( glyph_cache.find( face_index, pixel_size, c, entry ) )
 	{
-		return add_character( passed_face, c );
+		return { entry.character, entry.face };
 	}
 
-	// Try with the given font face
-	const auto& font_face_contents = font_face_library[{face}];
-	auto character_info = font_face_contents.find( c );
-	if( character_info != font_face_contents.end() )
+	if( face_index >= freetype_face_order.size() )
 	{
-		return { character_info->second, nullptr };
+		return { {}, nullptr };
 	}
 
-	// If the given font face didn't have it, loop over all of the font faces
-	for( auto &font_face : freetype_face_order )
+	// If the glyph was found from one of the fallback faces,
+	// remember it for the requested face as well. add_character()
+	// has already cached the glyphs of the requested face
+	const auto requested_face = freetype_face_order[face_index].second;
+	const auto result = add_character( requested_face, pixel_size, c );
+	if( result.second && result.second != requested_face )
 	{
-		const auto& face_contents = font_face_library[{font_face.second.get()}];
-
-		const auto character_info = face_contents.find( c );
-		if( character_info != face_contents.end() )
-		{
-			return { character_info->second, font_face.second };
-		}
+		glyph_cache.insert( face_index, pixel_size, c, { result.first, result.second } );
+		glyph_metrics.insert_glyph( face_index, pixel_size, c, make_glyph_metrics( result.first, result.second.get() ) );
 	}
 
-	return { {}, nullptr };
+	return result;
 }
 
 
 
-GlCharacter FontFaceManager::get_basic_character_info( FT_Face face, unsigned long c )
+GlyphMetrics FontFaceManager::load_glyph_metrics( FontFacePtr face, unsigned pixel_size, unsigned long c )
 {
-	auto glyph_index = FT_Get_Char_Index( face, c );
+	auto face_ptr = face.get();
+	const auto face_index = get_font_face_index( face_ptr );
+
+	const auto cached = glyph_metrics.find_glyph( face_index, pixel_size, c );
+	if( cached )
+	{
+		return *cached;
+	}
+
+	// Glyphs already in the atlas have their metrics at hand
+	GlyphCacheEntry cached_character;
+	if( glyph_cache.find( face_index, pixel_size, c, cached_character ) )
+	{
+		return make_glyph_metrics( cached_character.character, cached_character.face.get() );
+	}
+
+	auto glyph_index = FT_Get_Char_Index( face_ptr, c );
 	if( !glyph_index )
 	{
-		const auto next_face = get_next_font_face( face );
+		const auto next_face = get_next_font_face( face_ptr );
 		if( next_face )
 		{
-			return get_basic_character_info( next_face.get(), c );
+			return load_glyph_metrics( next_face, pixel_size, c );
 		}
+	}
 
-		// This was the last face and no glyph was found,
-		// continue and render the placeholder glyph
+	const auto size = activate_size( face_ptr, pixel_size );
+	if( !size )
+	{
+		return {};
 	}
 
-	auto err = FT_Load_Char( face, c, FT_LOAD_DEFAULT );
+	// Rendered for the exact bitmap size, but the bitmap isn't kept
+	auto err = FT_Load_Char( face_ptr, c, FT_LOAD_RENDER );
 	if( err )
 	{
-		throw runtime_error( "FT_Load_Char failed for code point " + to_string( c ) );
+		LOG( ERRORS, string_u8{ "FREETYTPE: Failed to load Glyph " } + std::to_string( err ) );
+		return {};
 	}
 
-	return{};
-	/* Not needed now
-		0,
-		glm::ivec2( face->glyph->bitmap.width, face->glyph->bitmap.rows ),
-		glm::ivec2( face->glyph->bitmap_left, face->glyph->bitmap_top ),
-		(GLuint)face->glyph->advance.x,
-		glyph_index,
-		1
-	};
-	*/
+	const auto glyph = face_ptr->glyph;
+
+	GlyphMetrics metrics;
+	metrics.size = glm::ivec2( glyph->bitmap.width, glyph->bitmap.rows );
+	metrics.bearing = glm::ivec2( glyph->bitmap_left, glyph->bitmap_top );
+	metrics.advance = (GLuint)glyph->advance.x;
+	metrics.glyph = glyph_index;
+	metrics.font_height = (size->metrics.height) / 64;
+	metrics.face_index = face_index;
+
+	glyph_metrics.insert_glyph( face_index, pixel_size, c, metrics );
+	return metrics;
 }
 
 
 
-bool FontFaceManager::character_exists( unsigned long c )
+GlyphMetrics FontFaceManager::get_glyph_metrics( FT_Face face, unsigned pixel_size, unsigned long c )
 {
-	// If the given font face didn't have it, loop over all of the font faces
-	for( auto &font_face : freetype_face_order )
+	const auto face_index = get_font_face_index( face );
+
+	auto metrics = glyph_metrics.find_glyph( face_index, pixel_size, c );
+	if( metrics )
 	{
-		const auto& font_face_contents = font_face_library[{font_face.second.get()}];
-		const auto character_info = font_face_contents.find( c );
-		if( character_info != font_face_contents.end() )
-		{
-			return true;
-		}
+		return *metrics;
 	}
 
-	return false;
+	lock_guard<mutex> font_face_library_lock( font_face_mutex );
+
+	metrics = glyph_metrics.find_glyph( face_index, pixel_size, c );
+	if( metrics )
+	{
+		return *metrics;
+	}
+
+	if( face_index >= freetype_face_order.size() )
+	{
+		return {};
+	}
+
+	// Remember the glyphs found from the fallback faces for the requested face too
+	const auto result = load_glyph_metrics( freetype_face_order[face_index].second, pixel_size, c );
+	glyph_metrics.insert_glyph( face_index, pixel_size, c, result );
+	return result;
 }
 
 
 
-FontFacePtr FontFaceManager::get_next_font_face( FT_Face face )
+FT_Size FontFaceManager::activate_size( FT_Face face, unsigned pixel_size )
 {
-	auto current = freetype_face_order.begin();
-	while( current != freetype_face_order.end() )
+	const auto key = make_pair( get_font_face_index( face ), pixel_size );
+
+	auto size = font_face_sizes.find( key );
+	if( size == font_face_sizes.end() )
 	{
-		if( current->second.get() == face )
+		FT_Size new_size = nullptr;
+		if( FT_New_Size( face, &new_size ) )
 		{
-			break;
+			LOG( ERRORS, string_u8{ "FREETYPE: Failed to create size " } + to_string( pixel_size ) );
+			return nullptr;
 		}
-		else current++;
-	}
 
-	if( current     == freetype_face_order.end() ||
-		current + 1 == freetype_face_order.end() )
+		FT_Activate_Size( new_size );
+		FT_Set_Pixel_Sizes( face, 0, static_cast<FT_UInt>( pixel_size ) );
+		size = font_face_sizes.insert( { key, new_size } ).first;
+	}
+	else if( face->size != size->second )
 	{
-		return 0;
+		FT_Activate_Size( size->second );
 	}
 
-	const auto next = current + 1;
-	return next->second;
+	return size->second;
 }
 
 
 
-FontFacePtr FontFaceManager::get_default_font_face()
+FT_Vector FontFaceManager::load_kerning( size_t face_index, unsigned pixel_size, FT_UInt left_glyph, FT_UInt right_glyph )
 {
+	FT_Vector kerning{ 0, 0 };
+
 	lock_guard<mutex> font_face_library_lock( font_face_mutex );
 
-	if( !freetype_face_order.size() )
+	if( glyph_metrics.find_kerning( face_index, pixel_size, left_glyph, right_glyph, kerning ) ||
+	    face_index >= freetype_face_order.size() )
 	{
-		throw runtime_error( "No fonts to choose the default font from" );
+		return kerning;
 	}
 
-	auto font = freetype_face_order.begin();
-	return font->second;
+	// Pairs without kerning are cached too, so that they aren't looked up again
+	const auto face = freetype_face_order[face_index].second.get();
+	if( FT_HAS_KERNING( face ) && activate_size( face, pixel_size ) )
+	{
+		FT_Get_Kerning( face, left_glyph, right_glyph, FT_KERNING_DEFAULT, &kerning );
+	}
+
+	glyph_metrics.insert_kerning( face_index, pixel_size, left_glyph, right_glyph, kerning );
+	return kerning;
 }
 
 
 
-void FontFaceManager::sync_font_face_sizes( size_t font_size )
+FT_Vector FontFaceManager::get_kerning( FT_Face face, unsigned pixel_size, FT_UInt left_glyph, FT_UInt right_glyph )
+{
+	FT_Vector kerning{ 0, 0 };
+	if( !face || !FT_HAS_KERNING( face ) || !left_glyph || !right_glyph )
+	{
+		return kerning;
+	}
+
+	const auto face_index = get_font_face_index( face );
+	if( glyph_metrics.find_kerning( face_index, pixel_size, left_glyph, right_glyph, kerning ) )
+	{
+		return kerning;
+	}
+
+	return load_kerning( face_index, pixel_size, left_glyph, right_glyph );
+}
+
+
+
+FT_Vector FontFaceManager::get_kerning( const GlyphMetrics &left, const GlyphMetrics &right, unsigned pixel_size )
+{
+	FT_Vector kerning{ 0, 0 };
+	if( left.face_index != right.face_index || !left.glyph || !right.glyph )
+	{
+		return kerning;
+	}
+
+	if( glyph_metrics.find_kerning( left.face_index, pixel_size, left.glyph, right.glyph, kerning ) )
+	{
+		return kerning;
+	}
+
+	return load_kerning( left.face_index, pixel_size, left.glyph, right.glyph );
+}
+
+
+
+FontFacePtr FontFaceManager::get_next_font_face( FT_Face face )
+{
+	const auto next = get_font_face_index( face ) + 1;
+	if( next == 0 || next >= freetype_face_order.size() )
+	{
+		return 0;
+	}
+
+	return freetype_face_order[next].second;
+}
+
+
+
+FontFacePtr FontFaceManager::get_default_font_face()
 {
 	lock_guard<mutex> font_face_library_lock( font_face_mutex );
-	for( auto font : freetype_face_order )
+
+	if( !freetype_face_order.size() )
 	{
-		FT_Set_Pixel_Sizes( font.second.get(), 0, static_cast<FT_UInt>( font_size ) );
+		throw runtime_error( "No fonts to choose the default font from" );
 	}
+
+	auto font = freetype_face_order.begin();
+	return font->second;
 }
 
 
@@ -371,7 +418,9 @@ void FontFaceManager::load_font_faces()
 
 	lock_guard<mutex> font_face_library_lock( font_face_mutex );
 
-	// Clear existing font faces
+	// Clear existing font faces, the faces free their sizes
+	glyph_metrics.clear();
+	font_face_sizes.clear();
 	freetype_faces.clear();
 	freetype_face_order.clear();
 
@@ -405,6 +454,11 @@ void FontFaceManager::load_font_faces()
 		try
 		{
 			FT_New_Face( Globals::freetype, font.second.c_str(), 0, &tmp_face );
+
+			// Glyph cache refers to the faces by their index
+			tmp_face->generic.data = reinterpret_cast<void*>( freetype_face_order.size() + 1 );
+			tmp_face->generic.finalizer = nullptr;
+
 			auto face_ptr = create_font_face( tmp_face );
 			freetype_face_order.push_back( { font.first, face_ptr } );
 			freetype_faces.insert( { font.first, face_ptr } );
@@ -428,18 +482,19 @@ void FontFaceManager::clear_glyphs()
 {
 	lock_guard<mutex> font_face_library_lock( font_face_mutex );
 
-	for( auto& font_faces : font_face_library )
-	{
-		for( auto& font_face : font_faces.second )
-		{
-			if( font_face.second.gl_texture )
-			{
-				glDeleteTextures( 1, &font_face.second.gl_texture );
-			}
-		}
-	}
+	// Batched text may still refer to the atlas pages
+	Globals::batch_2d.flush();
 
-	font_face_library.clear();
+	glyph_atlas.clear();
+	glyph_cache.clear();
 }
 
 
+
+void FontFaceManager::forget_atlas_page( size_t page )
+{
+	glyph_cache.erase_if( [page]( const GlyphCacheEntry &entry )
+	{
+		return entry.character.gl_texture && entry.character.atlas_page == page;
+	} );
+}
@@ -1,22 +1,45 @@
 #pragma once
 
 #include "common_types.hh"
+#include "glyph_atlas.hh"
+#include "glyph_cache.hh"
+#include "glyph_metrics.hh"
 
 #include <mutex>
 #include <memory>
 
 string_unicode u8_to_unicode( const string_u8 &str );
 
-using FontFacePtr = std::shared_ptr<FT_FaceRec_>;
+// Decodes the UTF-8 range and appends the code points to unicode_str
+// - Every byte that isn't a continuation byte becomes exactly one code point,
+//   broken sequences become U+FFFD, so u8_code_point_count always agrees
+void u8_to_unicode( const char *first, const char *last, string_unicode &unicode_str );
+size_t u8_code_point_count( const char *first, const char *last );
+
+string_u8 unicode_to_u8( const string_unicode &unicode_str );
+
 FontFacePtr create_font_face( FT_Face face );
 
+// Index of the face in the font fallback order, set when the face is loaded
+size_t get_font_face_index( FT_Face face );
+
 
 struct FontFaceManager
 {
-	std::pair<GlCharacter, FontFacePtr> get_character( FT_Face face, unsigned long c );
+	std::pair<GlCharacter, FontFacePtr> get_character( FT_Face face, unsigned pixel_size, unsigned long c );
 	FontFacePtr get_default_font_face();
 
-	void sync_font_face_sizes( size_t font_size );
+	// Metrics of the glyph get_character would give, without adding it to the atlas
+	// - Measuring text needs no GL context, nor FreeType once the metrics are cached
+	GlyphMetrics get_glyph_metrics( FT_Face face, unsigned pixel_size, unsigned long c );
+
+	// Kerning between two glyphs of the face in 26.6 pixels
+	FT_Vector get_kerning( FT_Face face, unsigned pixel_size, FT_UInt left_glyph, FT_UInt right_glyph );
+
+	// Kerning between two measured glyphs in 26.6 pixels,
+	// glyphs from different fallback faces aren't kerned
+	FT_Vector get_kerning( const GlyphMetrics &left, const GlyphMetrics &right, unsigned pixel_size );
+
 	void load_font_faces();
 	void clear_glyphs();
 
@@ -24,12 +47,20 @@ struct FontFaceManager
   protected:
 	std::map<string_u8, FontFacePtr> freetype_faces;
 	std::vector<std::pair<string_u8, FontFacePtr>> freetype_face_order;
-	std::map<FontFaceIdentity, FontFaceContents> font_face_library;
 
-	std::pair<GlCharacter, FontFacePtr> add_character( FontFacePtr face, unsigned long c );
-	GlCharacter get_basic_character_info( FT_Face face, unsigned long c );
+	// Every face has an own FT_Size for each used pixel size,
+	// so the faces don't have to be resized between texts
+	std::map<std::pair<size_t, unsigned>, FT_Size> font_face_sizes;
+	GlyphCache        glyph_cache;
+	GlyphMetricsCache glyph_metrics;
+	GlyphAtlas        glyph_atlas;
+
+	std::pair<GlCharacter, FontFacePtr> add_character( FontFacePtr face, unsigned pixel_size, unsigned long c );
+	GlyphMetrics load_glyph_metrics( FontFacePtr face, unsigned pixel_size, unsigned long c );
+	FT_Vector load_kerning( size_t face_index, unsigned pixel_size, FT_UInt left_glyph, FT_UInt right_glyph );
+	FT_Size activate_size( FT_Face face, unsigned pixel_size );
 	FontFacePtr get_next_font_face( FT_Face face );
-	bool character_exists( unsigned long c );
+	void forget_atlas_page( size_t page );
 
 
   private:
@@ -0,0 +1,115 @@
+#include "text_wrap.hh"
+
+#include <algorithm>
+
+using namespace std;
+using namespace gui;
+
+
+void TextWrap::measure(
+	size_t text_size,
+	const GetWidth &get_width,
+	size_t first_changed )
+{
+	first_changed = min( first_changed, advances.size() - 1 );
+	first_changed = min( first_changed, text_size );
+
+	advances.resize( text_size + 1 );
+	for( auto i = first_changed; i < text_size; i++ )
+	{
+		advances[i + 1] = advances[i] + get_width( i );
+	}
+}
+
+
+
+size_t TextWrap::find_row_end( size_t row_start ) const
+{
+	const auto text_size = advances.size() - 1;
+	if( row_start >= text_size )
+	{
+		return text_size;
+	}
+
+	// Last code point whose right side still fits on the row,
+	// every row gets at least one code point
+	const auto limit = advances[row_start] + row_max_width;
+	const auto past_limit = upper_bound( advances.begin() + row_start + 1, advances.end(), limit );
+	const auto row_end = static_cast<size_t>( past_limit - advances.begin() ) - 1;
+
+	return max( row_end, row_start + 1 );
+}
+
+
+
+size_t TextWrap::wrap( float max_width, size_t first_changed )
+{
+	if( max_width != row_max_width )
+	{
+		row_max_width = max_width;
+		first_changed = 0;
+	}
+
+	// The row before the edit may have ended because of the first changed
+	// code point being too wide, so it has to be wrapped again too
+	auto row = get_row_of( first_changed );
+	if( row > 0 && row_starts[row] == first_changed )
+	{
+		row--;
+	}
+
+	row_starts.resize( row + 1 );
+
+	const auto text_size = advances.size() - 1;
+	auto row_end = find_row_end( row_starts.back() );
+	while( row_end < text_size )
+	{
+		row_starts.push_back( row_end );
+		row_end = find_row_end( row_end );
+	}
+
+	return row;
+}
+
+
+
+size_t TextWrap::get_row_count() const
+{
+	return row_starts.size();
+}
+
+
+
+pair<size_t, size_t> TextWrap::get_row( size_t row ) const
+{
+	const auto text_size = advances.size() - 1;
+	if( row >= row_starts.size() )
+	{
+		return { text_size, text_size };
+	}
+
+	const auto row_end = row + 1 < row_starts.size() ? row_starts[row + 1] : text_size;
+	return { row_starts[row], row_end };
+}
+
+
+
+size_t TextWrap::get_row_of( size_t index ) const
+{
+	const auto next_row = upper_bound( row_starts.begin(), row_starts.end(), index );
+	return static_cast<size_t>( next_row - row_starts.begin() ) - 1;
+}
+
+
+
+float TextWrap::get_advance( size_t index ) const
+{
+	return advances[min( index, advances.size() - 1 )];
+}
+
+
+
+float TextWrap::get_width( size_t first, size_t last ) const
+{
+	return get_advance( last ) - get_advance( first );
+}
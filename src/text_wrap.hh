@@ -0,0 +1,56 @@
+#pragma once
+
+#include "common_types.hh"
+
+#include <vector>
+#include <utility>
+#include <functional>
+
+namespace gui
+{
+	// Wraps a single line of text to rows that fit the given width
+	// - The line is measured once to a prefix sum of the glyph advances,
+	//   so the row breaks can be found with a binary search
+	// - After an edit only the glyphs and the rows starting from
+	//   the edit are measured and wrapped again
+	struct TextWrap
+	{
+		// Width of the code point at the index, including the kerning
+		// with the code point before it
+		using GetWidth = std::function<float( size_t index )>;
+
+		// Measures the code points from first_changed to the end of the text,
+		// the code points before it are expected to be unchanged
+		// - get_width is called once per code point, in order
+		void measure(
+			size_t text_size,
+			const GetWidth &get_width,
+			size_t first_changed = 0
+		);
+
+		// Wraps the rows again from the row that has first_changed and
+		// returns the index of the first row that may have changed
+		size_t wrap( float row_max_width, size_t first_changed = 0 );
+
+		size_t get_row_count() const;
+
+		// Code point range [first, last) of the row
+		std::pair<size_t, size_t> get_row( size_t row ) const;
+
+		// Row that holds the code point, the end of the text belongs to the last row
+		size_t get_row_of( size_t index ) const;
+
+		// Width of the text before the code point
+		float get_advance( size_t index ) const;
+
+		float get_width( size_t first, size_t last ) const;
+
+	  protected:
+		// advances[i] is the width of the code points before i
+		std::vector<float> advances{ 0.f };
+		std::vector<size_t> row_starts{ 0 };
+		float row_max_width = 0.f;
+
+		size_t find_row_end( size_t row_start ) const;
+	};
+}
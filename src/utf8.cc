@@ -0,0 +1,606 @@
+#include "utf8.hh"
+
+#include <algorithm>
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UTF8_X86_SIMD
+#endif
+
+#ifdef UTF8_X86_SIMD
+#include <emmintrin.h>
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define UTF8_TARGET_AVX2
+#else
+#define UTF8_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+using namespace std;
+
+namespace
+{
+	using DecodeFunction = uint32_t* (*)( const unsigned char *bytes, size_t size, uint32_t *out );
+	using EncodeFunction = char* (*)( const uint32_t *code_points, size_t count, char *out );
+	using CountFunction  = size_t (*)( const unsigned char *bytes, size_t size );
+
+	struct Implementation
+	{
+		const char     *name;
+		DecodeFunction decode;
+		EncodeFunction encode;
+		CountFunction  count_code_points;
+	};
+
+
+
+	inline bool is_continuation( unsigned char byte )
+	{
+		return (byte & 0xc0) == 0x80;
+	}
+
+
+
+	// Continuation bytes that don't follow a multi-byte lead byte
+	// become a U+FFFD each, moves i past them
+	uint32_t* decode_strays( const unsigned char *bytes, size_t &i, size_t size, uint32_t *out )
+	{
+		while( i < size && is_continuation( bytes[i] ) )
+		{
+			*out++ = utf8::replacement_character;
+			i++;
+		}
+
+		return out;
+	}
+
+
+
+	// Decodes the sequence whose lead byte is at bytes[i] and moves i past it
+	uint32_t* decode_sequence( const unsigned char *bytes, size_t &i, size_t size, uint32_t *out )
+	{
+		const auto lead = bytes[i++];
+
+		// Stray continuation bytes after ASCII are replaced one by one,
+		// so that line breaks and such stay intact in broken text
+		if( lead < 0x80 )
+		{
+			*out++ = lead;
+			return decode_strays( bytes, i, size, out );
+		}
+
+		// The sequence runs until the next byte that isn't a continuation byte
+		auto sequence_end = i;
+		while( sequence_end < size && is_continuation( bytes[sequence_end] ) )
+		{
+			sequence_end++;
+		}
+
+		size_t   continuation_count = 0;
+		uint32_t code_point         = 0;
+		uint32_t min_code_point     = 0;
+
+		if( lead >= 0xc2 && lead <= 0xdf )
+		{
+			continuation_count = 1;
+			code_point = lead & 0x1f;
+			min_code_point = 0x80;
+		}
+		else if( (lead & 0xf0) == 0xe0 )
+		{
+			continuation_count = 2;
+			code_point = lead & 0x0f;
+			min_code_point = 0x800;
+		}
+		else if( lead >= 0xf0 && lead <= 0xf4 )
+		{
+			continuation_count = 3;
+			code_point = lead & 0x07;
+			min_code_point = 0x10000;
+		}
+
+		if( !continuation_count || sequence_end - i != continuation_count )
+		{
+			*out++ = utf8::replacement_character;
+			i = sequence_end;
+			return out;
+		}
+
+		for( ; i < sequence_end; i++ )
+		{
+			code_point = (code_point << 6) | (bytes[i] & 0x3f);
+		}
+
+		const auto is_valid = code_point >= min_code_point &&
+		                      code_point <= 0x10ffff &&
+		                      (code_point < 0xd800 || code_point > 0xdfff);
+
+		*out++ = is_valid ? code_point : utf8::replacement_character;
+		return out;
+	}
+
+
+
+	uint32_t* decode_scalar_from( const unsigned char *bytes, size_t i, size_t size, uint32_t *out )
+	{
+		while( i < size )
+		{
+			out = decode_sequence( bytes, i, size, out );
+		}
+
+		return out;
+	}
+
+
+
+	uint32_t* decode_scalar( const unsigned char *bytes, size_t size, uint32_t *out )
+	{
+		size_t i = 0;
+		out = decode_strays( bytes, i, size, out );
+		return decode_scalar_from( bytes, i, size, out );
+	}
+
+
+
+	// is_stray tells whether continuation bytes at the start are stray,
+	// which they are at the start of the text or after ASCII
+	size_t count_scalar_from( const unsigned char *bytes, size_t size, bool is_stray )
+	{
+		size_t count = 0;
+		for( size_t i = 0; i < size; i++ )
+		{
+			if( !is_continuation( bytes[i] ) )
+			{
+				count++;
+				is_stray = bytes[i] < 0x80;
+			}
+			else
+			{
+				count += is_stray;
+			}
+		}
+
+		return count;
+	}
+
+
+
+	size_t count_scalar( const unsigned char *bytes, size_t size )
+	{
+		return count_scalar_from( bytes, size, true );
+	}
+
+
+
+	char* encode_code_point( uint32_t code_point, char *out )
+	{
+		if( code_point > 0x10ffff || (code_point >= 0xd800 && code_point <= 0xdfff) )
+		{
+			code_point = utf8::replacement_character;
+		}
+
+		if( code_point < 0x80 )
+		{
+			*out++ = static_cast<char>( code_point );
+		}
+		else if( code_point < 0x800 )
+		{
+			*out++ = static_cast<char>( 0xc0 | (code_point >> 6) );
+			*out++ = static_cast<char>( 0x80 | (code_point & 0x3f) );
+		}
+		else if( code_point < 0x10000 )
+		{
+			*out++ = static_cast<char>( 0xe0 | (code_point >> 12) );
+			*out++ = static_cast<char>( 0x80 | ((code_point >> 6) & 0x3f) );
+			*out++ = static_cast<char>( 0x80 | (code_point & 0x3f) );
+		}
+		else
+		{
+			*out++ = static_cast<char>( 0xf0 | (code_point >> 18) );
+			*out++ = static_cast<char>( 0x80 | ((code_point >> 12) & 0x3f) );
+			*out++ = static_cast<char>( 0x80 | ((code_point >> 6) & 0x3f) );
+			*out++ = static_cast<char>( 0x80 | (code_point & 0x3f) );
+		}
+
+		return out;
+	}
+
+
+
+	char* encode_scalar( const uint32_t *code_points, size_t count, char *out )
+	{
+		for( size_t i = 0; i < count; i++ )
+		{
+			out = encode_code_point( code_points[i], out );
+		}
+
+		return out;
+	}
+
+
+
+#ifdef UTF8_X86_SIMD
+	inline unsigned first_set_bit( unsigned mask )
+	{
+	#ifdef _MSC_VER
+		unsigned long index = 0;
+		_BitScanForward( &index, mask );
+		return index;
+	#else
+		return static_cast<unsigned>( __builtin_ctz( mask ) );
+	#endif
+	}
+
+
+
+	bool cpu_has_avx2()
+	{
+	#ifdef _MSC_VER
+		int info[4];
+		__cpuid( info, 0 );
+		if( info[0] < 7 )
+		{
+			return false;
+		}
+
+		// The OS has to save the YMM registers too
+		__cpuid( info, 1 );
+		const auto has_osxsave = (info[2] & (1 << 27)) != 0;
+		const auto has_avx     = (info[2] & (1 << 28)) != 0;
+		if( !has_osxsave || !has_avx || (_xgetbv( 0 ) & 6) != 6 )
+		{
+			return false;
+		}
+
+		__cpuidex( info, 7, 0 );
+		return (info[1] & (1 << 5)) != 0;
+	#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports( "avx2" ) != 0;
+	#endif
+	}
+
+
+
+	uint32_t* decode_sse2( const unsigned char *bytes, size_t size, uint32_t *out )
+	{
+		size_t i = 0;
+		out = decode_strays( bytes, i, size, out );
+		const auto zero = _mm_setzero_si128();
+
+		while( i + 16 <= size )
+		{
+			const auto block = _mm_loadu_si128( reinterpret_cast<const __m128i*>( bytes + i ) );
+			const auto non_ascii = static_cast<unsigned>( _mm_movemask_epi8( block ) );
+
+			// ASCII is just zero-extended, unless stray continuation bytes follow it
+			if( !non_ascii && (i + 16 == size || !is_continuation( bytes[i + 16] )) )
+			{
+				const auto low  = _mm_unpacklo_epi8( block, zero );
+				const auto high = _mm_unpackhi_epi8( block, zero );
+				_mm_storeu_si128( reinterpret_cast<__m128i*>( out ),      _mm_unpacklo_epi16( low, zero ) );
+				_mm_storeu_si128( reinterpret_cast<__m128i*>( out + 4 ),  _mm_unpackhi_epi16( low, zero ) );
+				_mm_storeu_si128( reinterpret_cast<__m128i*>( out + 8 ),  _mm_unpacklo_epi16( high, zero ) );
+				_mm_storeu_si128( reinterpret_cast<__m128i*>( out + 12 ), _mm_unpackhi_epi16( high, zero ) );
+				out += 16;
+				i += 16;
+				continue;
+			}
+
+			// Copy the ASCII before the first multi-byte sequence, the last
+			// ASCII byte is decoded as a sequence in case continuation bytes follow it
+			const auto ascii_count = non_ascii ? first_set_bit( non_ascii ) : 16;
+			const auto ascii_end = i + (ascii_count ? ascii_count - 1 : 0);
+			while( i < ascii_end )
+			{
+				*out++ = bytes[i++];
+			}
+			out = decode_sequence( bytes, i, size, out );
+		}
+
+		return decode_scalar_from( bytes, i, size, out );
+	}
+
+
+
+	UTF8_TARGET_AVX2
+	uint32_t* decode_avx2( const unsigned char *bytes, size_t size, uint32_t *out )
+	{
+		size_t i = 0;
+		out = decode_strays( bytes, i, size, out );
+
+		while( i + 32 <= size )
+		{
+			const auto block = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( bytes + i ) );
+			const auto non_ascii = static_cast<unsigned>( _mm256_movemask_epi8( block ) );
+
+			if( !non_ascii && (i + 32 == size || !is_continuation( bytes[i + 32] )) )
+			{
+				for( size_t part = 0; part < 32; part += 8 )
+				{
+					const auto eight_bytes = _mm_loadl_epi64( reinterpret_cast<const __m128i*>( bytes + i + part ) );
+					_mm256_storeu_si256(
+						reinterpret_cast<__m256i*>( out + part ),
+						_mm256_cvtepu8_epi32( eight_bytes )
+					);
+				}
+				out += 32;
+				i += 32;
+				continue;
+			}
+
+			const auto ascii_count = non_ascii ? first_set_bit( non_ascii ) : 32;
+			const auto ascii_end = i + (ascii_count ? ascii_count - 1 : 0);
+			while( i < ascii_end )
+			{
+				*out++ = bytes[i++];
+			}
+			out = decode_sequence( bytes, i, size, out );
+		}
+
+		return decode_scalar_from( bytes, i, size, out );
+	}
+
+
+
+	// Continuation bytes in [first, last) that follow ASCII or the start, with the
+	// rest of their runs, which may go on past last
+	size_t count_stray_runs( const unsigned char *bytes, size_t first, size_t last, size_t size )
+	{
+		size_t count = 0;
+		for( auto i = first; i < last; i++ )
+		{
+			if( is_continuation( bytes[i] ) && (i == 0 || bytes[i - 1] < 0x80) )
+			{
+				for( ; i < size && is_continuation( bytes[i] ); i++ )
+				{
+					count++;
+				}
+			}
+		}
+
+		return count;
+	}
+
+
+
+	size_t count_sse2( const unsigned char *bytes, size_t size )
+	{
+		// Bytes above 0xbf as signed bytes aren't continuation bytes
+		const auto zero = _mm_setzero_si128();
+		const auto continuation_max = _mm_set1_epi8( -65 );
+		const auto ascii_min = _mm_set1_epi8( -1 );
+
+		// Stray continuation bytes are rare, a group of blocks is only
+		// searched for them if one follows ASCII. The start counts as ASCII
+		size_t count = 0;
+		size_t i = 0;
+		auto previous_block = zero;
+		while( i + 16 <= size )
+		{
+			// The byte counters overflow after 255 blocks
+			const auto group_begin = i;
+			const auto blocks = min<size_t>( (size - i) / 16, 255 );
+			auto counters = zero;
+			auto stray_starts = zero;
+			for( size_t block = 0; block < blocks; block++, i += 16 )
+			{
+				const auto bytes_16 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( bytes + i ) );
+				const auto is_lead = _mm_cmpgt_epi8( bytes_16, continuation_max );
+				counters = _mm_sub_epi8( counters, is_lead );
+
+				const auto previous = _mm_or_si128( _mm_slli_si128( bytes_16, 1 ), _mm_srli_si128( previous_block, 15 ) );
+				stray_starts = _mm_or_si128( stray_starts, _mm_andnot_si128( is_lead, _mm_cmpgt_epi8( previous, ascii_min ) ) );
+				previous_block = bytes_16;
+			}
+
+			const auto sums = _mm_sad_epu8( counters, zero );
+			count += static_cast<size_t>( _mm_cvtsi128_si32( sums ) + _mm_extract_epi16( sums, 4 ) );
+
+			if( _mm_movemask_epi8( stray_starts ) )
+			{
+				count += count_stray_runs( bytes, group_begin, i, size );
+			}
+		}
+
+		// Runs that go on past the blocks have been counted already
+		return count + count_scalar_from( bytes + i, size - i, i == 0 || bytes[i - 1] < 0x80 );
+	}
+
+
+
+	UTF8_TARGET_AVX2
+	size_t count_avx2( const unsigned char *bytes, size_t size )
+	{
+		const auto zero = _mm256_setzero_si256();
+		const auto continuation_max = _mm256_set1_epi8( -65 );
+		const auto ascii_min = _mm256_set1_epi8( -1 );
+
+		size_t count = 0;
+		size_t i = 0;
+		auto previous_block = zero;
+		while( i + 32 <= size )
+		{
+			const auto group_begin = i;
+			const auto blocks = min<size_t>( (size - i) / 32, 255 );
+			auto counters = zero;
+			auto stray_starts = zero;
+			for( size_t block = 0; block < blocks; block++, i += 32 )
+			{
+				const auto bytes_32 = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( bytes + i ) );
+				const auto is_lead = _mm256_cmpgt_epi8( bytes_32, continuation_max );
+				counters = _mm256_sub_epi8( counters, is_lead );
+
+				// The bytes shifted by one across the lanes, the last byte of the previous block first
+				const auto previous = _mm256_alignr_epi8( bytes_32, _mm256_permute2x128_si256( previous_block, bytes_32, 0x21 ), 15 );
+				stray_starts = _mm256_or_si256( stray_starts, _mm256_andnot_si256( is_lead, _mm256_cmpgt_epi8( previous, ascii_min ) ) );
+				previous_block = bytes_32;
+			}
+
+			alignas( 32 ) uint64_t sums[4];
+			_mm256_store_si256( reinterpret_cast<__m256i*>( sums ), _mm256_sad_epu8( counters, zero ) );
+			count += static_cast<size_t>( sums[0] + sums[1] + sums[2] + sums[3] );
+
+			if( _mm256_movemask_epi8( stray_starts ) )
+			{
+				count += count_stray_runs( bytes, group_begin, i, size );
+			}
+		}
+
+		return count + count_scalar_from( bytes + i, size - i, i == 0 || bytes[i - 1] < 0x80 );
+	}
+
+
+
+	char* encode_sse2( const uint32_t *code_points, size_t count, char *out )
+	{
+		const auto zero = _mm_setzero_si128();
+		const auto non_ascii_bits = _mm_set1_epi32( ~0x7f );
+
+		size_t i = 0;
+		while( i + 16 <= count )
+		{
+			const auto block = reinterpret_cast<const __m128i*>( code_points + i );
+			const auto a = _mm_loadu_si128( block );
+			const auto b = _mm_loadu_si128( block + 1 );
+			const auto c = _mm_loadu_si128( block + 2 );
+			const auto d = _mm_loadu_si128( block + 3 );
+
+			const auto all_bits = _mm_or_si128( _mm_or_si128( a, b ), _mm_or_si128( c, d ) );
+			const auto is_ascii = _mm_cmpeq_epi32( _mm_and_si128( all_bits, non_ascii_bits ), zero );
+			if( _mm_movemask_epi8( is_ascii ) != 0xffff )
+			{
+				out = encode_scalar( code_points + i, 16, out );
+				i += 16;
+				continue;
+			}
+
+			// Narrow 16 code points to 16 bytes
+			const auto packed = _mm_packus_epi16( _mm_packs_epi32( a, b ), _mm_packs_epi32( c, d ) );
+			_mm_storeu_si128( reinterpret_cast<__m128i*>( out ), packed );
+			out += 16;
+			i += 16;
+		}
+
+		return encode_scalar( code_points + i, count - i, out );
+	}
+#endif
+
+
+
+	Implementation pick_implementation()
+	{
+	#ifdef UTF8_X86_SIMD
+		if( cpu_has_avx2() )
+		{
+			return { "avx2", decode_avx2, encode_sse2, count_avx2 };
+		}
+
+		return { "sse2", decode_sse2, encode_sse2, count_sse2 };
+	#else
+		return { "scalar", decode_scalar, encode_scalar, count_scalar };
+	#endif
+	}
+
+
+
+	const Implementation& get_implementation()
+	{
+		static const Implementation implementation = pick_implementation();
+		return implementation;
+	}
+
+
+
+	void decode_with( DecodeFunction decode, const char *first, const char *last, vector<uint32_t> &code_points )
+	{
+		const auto size = static_cast<size_t>( last - first );
+		if( !size )
+		{
+			return;
+		}
+
+		// There can't be more code points than bytes
+		const auto old_size = code_points.size();
+		code_points.resize( old_size + size );
+
+		const auto begin = code_points.data() + old_size;
+		const auto end = decode( reinterpret_cast<const unsigned char*>( first ), size, begin );
+		code_points.resize( old_size + static_cast<size_t>( end - begin ) );
+	}
+
+
+
+	void encode_with( EncodeFunction encode, const uint32_t *first, const uint32_t *last, string &str )
+	{
+		const auto count = static_cast<size_t>( last - first );
+		if( !count )
+		{
+			return;
+		}
+
+		const auto old_size = str.size();
+		str.resize( old_size + count * 4 );
+
+		const auto begin = &str[old_size];
+		const auto end = encode( first, count, begin );
+		str.resize( old_size + static_cast<size_t>( end - begin ) );
+	}
+}
+
+
+
+void utf8::decode( const char *first, const char *last, vector<uint32_t> &code_points )
+{
+	decode_with( get_implementation().decode, first, last, code_points );
+}
+
+
+
+void utf8::encode( const uint32_t *first, const uint32_t *last, string &str )
+{
+	encode_with( get_implementation().encode, first, last, str );
+}
+
+
+
+size_t utf8::count_code_points( const char *first, const char *last )
+{
+	return get_implementation().count_code_points(
+		reinterpret_cast<const unsigned char*>( first ),
+		static_cast<size_t>( last - first )
+	);
+}
+
+
+
+const char* utf8::get_implementation_name()
+{
+	return get_implementation().name;
+}
+
+
+
+void utf8::scalar::decode( const char *first, const char *last, vector<uint32_t> &code_points )
+{
+	decode_with( decode_scalar, first, last, code_points );
+}
+
+
+
+void utf8::scalar::encode( const uint32_t *first, const uint32_t *last, string &str )
+{
+	encode_with( encode_scalar, first, last, str );
+}
+
+
+
+size_t utf8::scalar::count_code_points( const char *first, const char *last )
+{
+	return count_scalar(
+		reinterpret_cast<const unsigned char*>( first ),
+		static_cast<size_t>( last - first )
+	);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// UTF-8 <-> UTF-32 conversions
+// - SSE2 or AVX2 is picked at runtime, where available, with the scalar
+//   versions as the fallback. All of them give the same results
+// - A sequence is a lead byte and all the continuation bytes after it.
+//   Malformed sequences (overlong, surrogates, out of range, wrong length)
+//   become a single U+FFFD each
+// - Stray continuation bytes, after ASCII or before the first lead byte,
+//   become a U+FFFD each. count_code_points() counts them the same way
+namespace utf8
+{
+	const uint32_t replacement_character = 0xfffd;
+
+	// Appends the decoded code points to code_points
+	void decode( const char *first, const char *last, std::vector<uint32_t> &code_points );
+
+	// Appends the encoded code points to str, invalid ones are encoded as U+FFFD
+	void encode( const uint32_t *first, const uint32_t *last, std::string &str );
+
+	size_t count_code_points( const char *first, const char *last );
+
+	// Name of the implementation picked for this CPU
+	const char* get_implementation_name();
+
+	namespace scalar
+	{
+		void decode( const char *first, const char *last, std::vector<uint32_t> &code_points );
+		void encode( const uint32_t *first, const uint32_t *last, std::string &str );
+		size_t count_code_points( const char *first, const char *last );
+	}
+}
@@ -8,9 +8,16 @@
 #include "globals.hh"
 #include "settings.hh"
 #include "text_helpers.hh"
+#include "vector_img_file.hh"
+#include "vector_img_pick.hh"
+#include "vector_img_svg.hh"
+#include "logging.hh"
 
+#include <cmath>
 #include <memory>
 #include <iostream>
+#include <algorithm>
+#include <glm/gtc/matrix_transform.hpp>
 
 using namespace std;
 using namespace gui;
@@ -57,6 +64,8 @@ VectorGraphicsEditor::VectorGraphicsEditor()
 
 VectorGraphicsEditor::~VectorGraphicsEditor()
 {
+	// Closing the editor is a clean exit, there is nothing to recover
+	disable_autosave();
 }
 
 
@@ -64,6 +73,21 @@ VectorGraphicsEditor::~VectorGraphicsEditor()
 void VectorGraphicsEditor::render() const
 {
 	GuiElement::render();
+
+	// The snapshot only copies the changed items, the thread writes them
+	const auto now = chrono::steady_clock::now();
+	if( autosave && now - last_autosave >= chrono::milliseconds( autosave_interval_ms ) )
+	{
+		autosave->snapshot( canvas_element->image );
+		last_autosave = now;
+
+		auto error = autosave->get_error();
+		if( error != autosave_error && !error.empty() )
+		{
+			LOG( ERRORS, string_u8{ "Autosave failed: " } + error );
+		}
+		autosave_error = move( error );
+	}
 }
 
 
@@ -75,8 +99,117 @@ void VectorGraphicsEditor::handle_event( const GuiEvent &e )
 
 
 
+namespace
+{
+	bool is_svg_path( const string &path )
+	{
+		const string extension = ".svg";
+		if( path.size() < extension.size() )
+		{
+			return false;
+		}
+
+		return equal( extension.begin(), extension.end(), path.end() - extension.size(), []( char a, char b )
+		{
+			return a == tolower( b );
+		} );
+	}
+}
+
+
+
+void VectorGraphicsEditor::open_file( const string &path )
+{
+	auto &image = canvas_element->image;
+	if( is_svg_path( path ) )
+	{
+		vector_img::import_svg( path, image );
+	}
+	else
+	{
+		vector_img::ImgDocument( path ).load( image );
+	}
+
+	canvas_element->history.reset( image );
+}
+
+
+
+bool VectorGraphicsEditor::can_open( const string &path )
+{
+	return is_svg_path( path ) || vector_img::is_document( path );
+}
+
+
+
+void VectorGraphicsEditor::enable_autosave( const string &path, bool recover_image )
+{
+	disable_autosave();
+
+	auto &image = canvas_element->image;
+	try
+	{
+		if( !recover_image )
+		{
+			vector_img::ImgAutosave::move_files( path, path + ".previous" );
+		}
+		else if( vector_img::ImgAutosave::recover( path, image ) )
+		{
+			canvas_element->history.reset( image );
+		}
+	}
+	catch( runtime_error &e )
+	{
+		// The autosave that couldn't be read is kept for the user, nothing is saved over it
+		LOG( ERRORS, string_u8{ "Couldn't recover the autosave: " } + e.what() );
+		return;
+	}
+
+	autosave.reset( new vector_img::ImgAutosave( path ) );
+	autosave_path = path;
+}
+
+
+
+void VectorGraphicsEditor::disable_autosave()
+{
+	if( !autosave )
+	{
+		return;
+	}
+
+	autosave.reset();
+	vector_img::ImgAutosave::remove_files( autosave_path );
+	autosave_path.clear();
+}
+
+
+
+void VectorGraphicsEditor::save_file( const string &path ) const
+{
+	const auto &image = canvas_element->image;
+	if( is_svg_path( path ) )
+	{
+		vector_img::export_svg( image, path );
+	}
+	else
+	{
+		vector_img::save_document( image, path );
+	}
+}
+
+
+
 VectorGraphicsCanvas::VectorGraphicsCanvas()
-: image( vector_img::VectorImg{} )
+: image( vector_img::VectorImg{} ),
+  is_panning( false ),
+  is_box_selecting( false ),
+  pan_start_offset( 0.f, 0.f ),
+  mesh_builds( 0 ),
+  has_pick_request( false ),
+  pick_mesh_builds( 0 ),
+  pick_origin( 0.f, 0.f ),
+  pick_scale( 0.f )
 {
 	// Set up the image
 	image.img_w = 320;
@@ -84,8 +217,10 @@ VectorGraphicsCanvas::VectorGraphicsCanvas()
 	auto new_layer = make_unique<vector_img::ImgLayer>();
 	image.layers.emplace_back( move( new_layer ) );
 
-	camera_offset = { 0, 0 };
+	camera_offset = { 0.f, 0.f };
 	scale = 1.f;
+
+	history.reset( image );
 }
 
 
@@ -98,6 +233,21 @@ void VectorGraphicsCanvas::handle_event( const gui::GuiEvent &e )
 
 	if( e.type == MOUSE_DRAG_END )
 	{
+		// Drags that moved the view or selected a box don't click
+		if( is_panning || is_box_selecting )
+		{
+			if( is_box_selecting )
+			{
+				const auto a = e.mouse_drag_end.pos_start.to_gl_vec();
+				const auto b = e.mouse_drag_end.pos_end.to_gl_vec();
+				request_pick( glm::ivec2( glm::min( a, b ) ), glm::ivec2( glm::abs( b - a ) ) + glm::ivec2( 1, 1 ), true );
+			}
+
+			is_panning       = false;
+			is_box_selecting = false;
+			return;
+		}
+
 		if( in_area( e.mouse_drag_end.pos_start ) &&
 			in_area( e.mouse_drag_end.pos_end ) )
 		{
@@ -129,12 +279,82 @@ void VectorGraphicsCanvas::handle_event( const gui::GuiEvent &e )
 			{
 				window->clear_popups();
 			}
+
+			// Clicking selects the item under the mouse
+			if( is_in_area && e.mouse_button.button == 1 && e.mouse_button.state == RELEASED )
+			{
+				request_pick( { e.mouse_button.pos.x, e.mouse_button.pos.y }, { 1, 1 }, true );
+			}
 		}
 		else if( is_in_area )
 		{
 			create_context_menu( e.mouse_button.pos );
 		}
 	}
+	else if( e.type == MOUSE_MOVE )
+	{
+		if( in_area( e.mouse_move.pos ) )
+		{
+			request_pick( { e.mouse_move.pos.x, e.mouse_move.pos.y }, { 1, 1 }, false );
+		}
+		else
+		{
+			hovered_item = PickedItem();
+		}
+
+		GuiElement::handle_event( e );
+	}
+	else if( e.type == MOUSE_DRAG )
+	{
+		// The left and the middle button pan the view,
+		// with shift the left button selects the items within a box
+		const auto &start = e.mouse_drag.pos_start;
+		if( (!is_panning && !is_box_selecting) || start.x != drag_start_pos.x || start.y != drag_start_pos.y )
+		{
+			is_panning       = false;
+			is_box_selecting = false;
+			if( !in_area( start ) || (e.mouse_drag.button != 1 && e.mouse_drag.button != 2) )
+			{
+				GuiElement::handle_event( e );
+				return;
+			}
+
+			drag_start_pos = start;
+			if( e.mouse_drag.button == 1 && (SDL_GetModState() & KMOD_SHIFT) )
+			{
+				is_box_selecting = true;
+			}
+			else
+			{
+				is_panning       = true;
+				pan_start_offset = camera_offset;
+			}
+		}
+
+		drag_current_pos = e.mouse_drag.pos_current;
+		if( is_panning )
+		{
+			camera_offset = pan_start_offset + (drag_current_pos.to_gl_vec() - start.to_gl_vec());
+		}
+	}
+	else if( e.type == MOUSE_SCROLL && in_area( e.mouse_scroll.pos ) )
+	{
+		const auto zoom_step = 1.25f;
+		const auto steps = static_cast<float>( e.mouse_scroll.value );
+		zoom( pow( zoom_step, e.mouse_scroll.direction == NORTH ? steps : -steps ), e.mouse_scroll.pos );
+	}
+	else if( e.type == KEY && e.key.state == PRESSED && (e.key.button.mod & KMOD_CTRL) )
+	{
+		// Ctrl+Z undoes, Ctrl+Y and Ctrl+Shift+Z redo
+		if( e.key.button.scancode == SDL_SCANCODE_Z && !(e.key.button.mod & KMOD_SHIFT) )
+		{
+			history.undo( image );
+		}
+		else if( e.key.button.scancode == SDL_SCANCODE_Y || e.key.button.scancode == SDL_SCANCODE_Z )
+		{
+			history.redo( image );
+		}
+	}
 	else
 	{
 		GuiElement::handle_event( e );
@@ -178,13 +398,9 @@ void VectorGraphicsCanvas::create_context_menu( GuiVec2 tgt_pos )
 			return;
 		}
 
-		const auto canvas_area = get_canvas_area();
-
-		auto item = make_unique<vector_img::ImgControlPoint>();
-		item->x = button->context.popup->target_pos.x - canvas_area.x;
-		item->y = button->context.popup->target_pos.y - canvas_area.y;
-		image.layers[0]->items.push_back( move( item ) );
-		item.reset();
+		const auto point = (button->context.popup->target_pos.to_gl_vec() - get_image_origin()) / scale;
+		image.layers[0]->add_control_point( point.x, point.y );
+		history.commit( image );
 
 		window->remove_popup( button->context.popup );
 	};
@@ -224,13 +440,9 @@ void VectorGraphicsCanvas::create_context_menu( GuiVec2 tgt_pos )
 			return;
 		}
 
-		const auto canvas_area = get_canvas_area();
-
-		auto item = make_unique<vector_img::ImgControlPoint>();
-		item->x = button->context.popup->target_pos.x - canvas_area.x;
-		item->y = button->context.popup->target_pos.y - canvas_area.y;
-		image.layers[0]->items.push_back( move( item ) );
-		item.reset();
+		const auto point = (button->context.popup->target_pos.to_gl_vec() - get_image_origin()) / scale;
+		image.layers[0]->add_control_point( point.x, point.y );
+		history.commit( image );
 
 		window->remove_popup( button->context.popup );
 	};
@@ -301,143 +513,757 @@ void VectorGraphicsCanvas::render() const
 
 
 
-void render_vector_img_item(
-	const VectorGraphicsCanvas &canvas,
-	const glm::vec4 &canvas_area,
-	const ShaderProgram &shader,
-	const vector_img::ImgItem *item
-)
+void VectorGraphicsCanvas::zoom( float factor, GuiVec2 around )
+{
+	const auto min_scale = 1.f / 64.f;
+	const auto max_scale = 256.f;
+	const auto new_scale = min( max( scale * factor, min_scale ), max_scale );
+
+	// The image point under the cursor stays under it
+	const auto cursor = around.to_gl_vec();
+	const auto origin = get_image_origin();
+	const auto new_origin = cursor - (cursor - origin) * (new_scale / scale);
+	const auto img_size = glm::vec2( image.img_w, image.img_h );
+
+	camera_offset += new_origin - origin + img_size * (new_scale - scale) / 2.f;
+	scale = new_scale;
+}
+
+
+
+glm::vec2 VectorGraphicsCanvas::get_image_origin() const
+{
+	// The image is centered on the element, then moved by the camera
+	const glm::vec2 center = {
+		pos.x + size.w / 2.f + camera_offset.x,
+		pos.y + size.h / 2.f + camera_offset.y
+	};
+
+	return center - glm::vec2( image.img_w, image.img_h ) * scale / 2.f;
+}
+
+
+
+glm::mat4 VectorGraphicsCanvas::get_view_matrix( glm::vec2 target_origin ) const
+{
+	const auto offset = get_image_origin() - target_origin;
+	const auto view = glm::translate( glm::mat4( 1.f ), glm::vec3{ offset.x, offset.y, 0.f } );
+	return glm::scale( view, glm::vec3{ scale, scale, 1.f } );
+}
+
+
+
+glm::vec4 VectorGraphicsCanvas::get_canvas_area() const
 {
-	using namespace vector_img;
+	// The part of the image within the element
+	const auto img_pos  = get_image_origin();
+	const auto img_size = glm::vec2( image.img_w, image.img_h ) * scale;
 
-	glm::vec2 tmp_a;
-	glm::vec2 tmp_b;
+	const auto left   = max( img_pos.x, tools::int_to_float( pos.x ) );
+	const auto top    = max( img_pos.y, tools::int_to_float( pos.y ) );
+	const auto right  = min( img_pos.x + img_size.x, tools::int_to_float( pos.x + size.w ) );
+	const auto bottom = min( img_pos.y + img_size.y, tools::int_to_float( pos.y + size.h ) );
 
-	const ImgControlPoint *control_point = nullptr;
-	const ImgLine *line = nullptr;
+	return { left, top, max( right - left, 0.f ), max( bottom - top, 0.f ) };
+}
+
+
+
+void VectorGraphicsCanvas::render_vector_img() const
+{
+	const auto color = glm::vec4{ 1.f, 1.f, 1.f, 0.5f };
 
-	switch( item->type )
+	const auto canvas_area   = get_canvas_area();
+	const auto img_area_pos  = glm::vec2{ canvas_area.x, canvas_area.y };
+	const auto img_area_size = glm::vec2{ canvas_area.z, canvas_area.w };
+
+	gl::render_quad_2d( get_root()->size.to_gl_vec(), img_area_pos, img_area_size, color );
+
+	// The layers are drawn into textures of the size of the canvas element
+	const auto window_size = get_root()->size.to_gl_vec();
+	const auto texture_size = glm::ivec2{ size.w, size.h };
+	const auto origin = get_image_origin() - pos.to_gl_vec();
+	if( !texture_size.x || !texture_size.y )
 	{
-		case CONTROL_POINT:
-			control_point = dynamic_cast<const ImgControlPoint*>( item );
-			tmp_a = {
-				canvas_area.x + control_point->x - 2,
-				canvas_area.y + control_point->y - 2
-			};
-			tmp_b = { 5, 5 };
-			gl::render_quad_2d( shader, canvas.get_root()->size.to_gl_vec(), tmp_a, tmp_b );
-			break;
+		return;
+	}
 
-		case LINE:
-			line = dynamic_cast<const ImgLine*>( item );
-			tmp_a = glm::vec2{ line->a.x + canvas_area.x, canvas_area.y + line->a.y };
-			tmp_b = glm::vec2{ line->b.x + canvas_area.x, canvas_area.y + line->b.y };
-			gl::render_line_2d( shader, canvas.get_root()->size.to_gl_vec(), tmp_a, tmp_b );
-			break;
+	stroke_caches.resize( image.layers.size() );
+	layer_caches.resize( image.layers.size() );
+	while( fill_caches.size() < image.layers.size() )
+	{
+		fill_caches.emplace_back( new vector_img::ImgFillCache() );
+	}
+	while( lod_caches.size() < image.layers.size() )
+	{
+		lod_caches.emplace_back( new vector_img::ImgLodCache() );
+	}
 
-		case FILL:
-			break;
+	auto &batch = Globals::batch_2d;
+	const auto draw_layer_meshes = [&batch]( const LayerCache &cache, const glm::mat4 &view )
+	{
+		if( cache.mesh_level )
+		{
+			batch.draw_mesh( cache.level_mesh, view );
+		}
+		else
+		{
+			batch.draw_mesh( cache.fills.mesh, view );
+			batch.draw_mesh( cache.lines.mesh, view );
+		}
+		batch.draw_mesh( cache.control_points.mesh, view );
+	};
 
-		default:
-			return;
+	for( size_t layer_i = 0; layer_i < image.layers.size(); layer_i++ )
+	{
+		const auto &layer = image.layers[layer_i];
+		if( !layer )
+		{
+			continue;
+		}
+
+		// A layer is drawn again when its meshes or the view change, moving
+		// the view only draws the meshes that are already on the GPU
+		auto &cache = layer_caches[layer_i];
+		const auto meshes_changed = update_layer_meshes( layer_i );
+		const auto is_current = cache.framebuffer.framebuffer_id
+		                     && cache.framebuffer.texture_size == texture_size
+		                     && !meshes_changed
+		                     && cache.origin == origin
+		                     && cache.scale == scale;
+
+		if( !is_current )
+		{
+			if( cache.framebuffer.texture_size != texture_size )
+			{
+				cache.framebuffer.resize( texture_size );
+			}
+
+			// Without a framebuffer the layer is drawn on the window,
+			// cut to the canvas element
+			if( !cache.framebuffer.framebuffer_id )
+			{
+				const auto view = get_view_matrix( { 0.f, 0.f } );
+				batch.flush();
+				glEnable( GL_SCISSOR_TEST );
+				glScissor( pos.x, static_cast<GLint>( window_size.y ) - pos.y - size.h, size.w, size.h );
+
+				batch.set_viewport_size( window_size );
+				batch.set_blending( gl::STRAIGHT_ALPHA );
+				draw_layer_meshes( cache, view );
+
+				glDisable( GL_SCISSOR_TEST );
+				continue;
+			}
+
+			cache.framebuffer.bind();
+			glClearColor( 0.f, 0.f, 0.f, 0.f );
+			glClear( GL_COLOR_BUFFER_BIT );
+
+			const auto view = get_view_matrix( pos.to_gl_vec() );
+			batch.set_viewport_size( glm::vec2( texture_size ) );
+			batch.set_blending( gl::PREMULTIPLY_ALPHA );
+			draw_layer_meshes( cache, view );
+
+			glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+			glViewport( 0, 0, static_cast<GLsizei>( window_size.x ), static_cast<GLsizei>( window_size.y ) );
+			gui::any_gl_errors();
+
+			cache.origin = origin;
+			cache.scale  = scale;
+		}
+
+		// The framebuffer texture is upside down compared to the window
+		batch.set_viewport_size( window_size );
+		batch.set_blending( gl::PREMULTIPLIED_ALPHA );
+		batch.add_textured_quad(
+			cache.framebuffer.texture_id,
+			pos.to_gl_vec(),
+			size.to_gl_vec(),
+			{ 0.f, 1.f, 1.f, 0.f },
+			glm::vec4{ 1.f }
+		);
 	}
+
+	batch.set_blending( gl::STRAIGHT_ALPHA );
+
+	update_picking();
+	render_picked_items();
 }
 
 
 
-glm::vec4 VectorGraphicsCanvas::get_canvas_area() const
+namespace
 {
-	const glm::vec2 center = {
-		pos.x + size.w / 2.f + camera_offset.x,
-		pos.y + size.h / 2.f + camera_offset.y
+	template<typename Pool>
+	void get_live_indices( const Pool &pool, vector<uint32_t> &indices )
+	{
+		indices.clear();
+		for( size_t i = 0; i < pool.size(); i++ )
+		{
+			if( !pool.is_removed( i ) )
+			{
+				indices.push_back( static_cast<uint32_t>( i ) );
+			}
+		}
+	}
+
+
+
+	glm::vec4 to_gl_color( vector_img::Color color )
+	{
+		return glm::vec4( color.r, color.g, color.b, color.a ) / 255.f;
+	}
+
+
+
+	// Color of the pick id of the item in the pick buffer
+	glm::vec4 get_pick_color( size_t layer_i, uint32_t slot )
+	{
+		return to_gl_color( vector_img::get_pick_color( vector_img::get_pick_id( layer_i, slot ) ) );
+	}
+
+
+
+	void add_vertices(
+		const vector_img::ImgPoint *points,
+		size_t point_count,
+		glm::vec2 offset,
+		const glm::vec4 &c,
+		vector<gl::BatchVertex> &vertices
+	)
+	{
+		for( size_t i = 0; i < point_count; i++ )
+		{
+			vertices.push_back( gl::BatchVertex{ points[i].x + offset.x, points[i].y + offset.y, 0.f, 0.f, c.r, c.g, c.b, c.a } );
+		}
+	}
+
+
+
+	void add_square( float x, float y, float half_size, const glm::vec4 &c, vector<gl::BatchVertex> &vertices )
+	{
+		const gl::BatchVertex tl{ x - half_size, y - half_size, 0.f, 0.f, c.r, c.g, c.b, c.a };
+		const gl::BatchVertex tr{ x + half_size, y - half_size, 0.f, 0.f, c.r, c.g, c.b, c.a };
+		const gl::BatchVertex br{ x + half_size, y + half_size, 0.f, 0.f, c.r, c.g, c.b, c.a };
+		const gl::BatchVertex bl{ x - half_size, y + half_size, 0.f, 0.f, c.r, c.g, c.b, c.a };
+		vertices.insert( vertices.end(), { bl, tl, tr, tr, br, bl } );
+	}
+
+
+
+	// Control points are squares of 5 pixels at any scale
+	float get_control_point_half_size( float scale )
+	{
+		return 2.5f / scale;
+	}
+}
+
+
+
+bool VectorGraphicsCanvas::update_layer_meshes( size_t layer_i ) const
+{
+	const auto &layer = *image.layers[layer_i];
+	auto &cache = layer_caches[layer_i];
+
+	// Zoomed out, the fills and the lines are drawn from a level of detail of the layer
+	auto &lod_cache = *lod_caches[layer_i];
+	lod_cache.update( layer );
+	const auto level = lod_cache.get_level( scale );
+	const auto level_changed = cache.mesh_level != (level ? level->id : 0);
+	if( level_changed && level )
+	{
+		mesh_vertices.clear();
+		for( size_t i = 0; i < level->colors.size(); i++ )
+		{
+			add_vertices( &level->triangles[i * 3], 3, { 0.f, 0.f }, to_gl_color( level->colors[i] ), mesh_vertices );
+		}
+
+		cache.level_mesh.upload( mesh_vertices );
+	}
+	cache.mesh_level = level ? level->id : 0;
+
+	// The items are kept in full detail also when a level of detail is drawn, for picking
+	const auto items_changed = update_items_meshes( layer_i );
+	if( !items_changed && !level_changed )
+	{
+		return false;
+	}
+
+	cache.mesh_build = ++mesh_builds;
+	return true;
+}
+
+
+
+bool VectorGraphicsCanvas::update_items_meshes( size_t layer_i ) const
+{
+	const auto &layer = *image.layers[layer_i];
+	auto &cache = layer_caches[layer_i];
+	auto &fill_cache = *fill_caches[layer_i];
+	auto &stroke_cache = stroke_caches[layer_i];
+
+	const auto items_changed = cache.mesh_layer != &layer
+	                        || cache.mesh_version != layer.get_version()
+	                        || fill_cache.has_finished_jobs();
+	const auto scale_changed = cache.control_points_scale != scale;
+	if( !items_changed && !scale_changed )
+	{
+		return false;
+	}
+
+	get_live_indices( layer.control_points, layer_items.control_points );
+	const auto &control_points = layer.control_points;
+	const auto half_size = get_control_point_half_size( scale );
+	const AddItem add_control_point = [&]( size_t i, vector<gl::BatchVertex> &vertices )
+	{
+		add_square( control_points.x[i], control_points.y[i], half_size, glm::vec4{ 1.f, 1.f, 1.f, 0.5f }, vertices );
 	};
 
-	// "Soft" image size and position
-	const glm::vec2 img_size = {
-		image.img_w * scale,
-		image.img_h * scale
+	if( !items_changed )
+	{
+		build_items_mesh( cache.control_points, control_points, layer_items.control_points, layer_i, add_control_point );
+		cache.control_points_scale = scale;
+		return true;
+	}
+
+	// The caches are given all the items so that they keep the triangles of all of them,
+	// only the changed ones are tessellated
+	get_live_indices( layer.fills, layer_items.fills );
+	get_live_indices( layer.lines, layer_items.lines );
+	fill_cache.update( layer.fills, layer_items.fills );
+	stroke_cache.update( layer.lines, layer_items.lines );
+
+	// The fills and the lines come from the caches of their triangles, in the image coordinates
+	const auto &fills = layer.fills;
+	const AddItem add_fill = [&]( size_t i, vector<gl::BatchVertex> &vertices )
+	{
+		const auto triangles = fill_cache.get_triangles( fills, i );
+		add_vertices( triangles.points, triangles.point_count, { fills.x[i], fills.y[i] }, to_gl_color( fills.color[i] ), vertices );
 	};
 
-	const glm::vec2 img_pos = {
-		center.x - img_size.x / 2.f,
-		center.y - img_size.y / 2.f
+	const auto &lines = layer.lines;
+	const AddItem add_line = [&]( size_t i, vector<gl::BatchVertex> &vertices )
+	{
+		const auto triangles = stroke_cache.get_triangles( lines, i );
+		add_vertices( triangles.points, triangles.point_count, { 0.f, 0.f }, to_gl_color( lines.color[i] ), vertices );
 	};
 
-	// Render the image background / area
-	glm::vec2 img_area_pos  = img_pos;
-	glm::vec2 img_area_size = img_size;
+	// Only the items changed since the meshes were made are written again,
+	// the items whose triangles changed by their neighbours too
+	layer_changes.clear();
+	const auto can_patch = cache.mesh_layer == &layer && layer.get_changes( cache.mesh_version, layer_changes );
+	if( can_patch )
+	{
+		changed_items.clear();
+		for( const auto &change : layer_changes )
+		{
+			// Items gone or brought to the front leave their ranges, handles
+			// that are no longer valid may have been items of any type
+			const auto type = layer.get_type( change.handle );
+			if( type == vector_img::NO_TYPE || change.type == vector_img::ITEM_REORDERED )
+			{
+				remove_from_items_mesh( cache.fills, change.handle.slot );
+				remove_from_items_mesh( cache.lines, change.handle.slot );
+				remove_from_items_mesh( cache.control_points, change.handle.slot );
+			}
+
+			if( type == vector_img::NO_TYPE )
+			{
+				continue;
+			}
+
+			const auto index = static_cast<uint32_t>( layer.get_index( change.handle ) );
+			switch( type )
+			{
+				case vector_img::FILL:
+					changed_items.fills.push_back( index );
+					break;
 
-	if( img_pos.x < pos.x )
+				case vector_img::LINE:
+					changed_items.lines.push_back( index );
+					break;
+
+				default:
+					changed_items.control_points.push_back( index );
+					break;
+			}
+		}
+
+		const auto add_changed_slots = [&layer]( const vector<uint32_t> &slots, vector<uint32_t> &indices )
+		{
+			for( const auto slot : slots )
+			{
+				const auto handle = layer.find_handle( slot );
+				if( !handle.is_null() )
+				{
+					indices.push_back( static_cast<uint32_t>( layer.get_index( handle ) ) );
+				}
+			}
+		};
+
+		add_changed_slots( fill_cache.get_changed_slots(), changed_items.fills );
+		add_changed_slots( stroke_cache.get_changed_slots(), changed_items.lines );
+
+		for( auto indices : { &changed_items.fills, &changed_items.lines, &changed_items.control_points } )
+		{
+			sort( indices->begin(), indices->end() );
+			indices->erase( unique( indices->begin(), indices->end() ), indices->end() );
+		}
+	}
+
+	if( !can_patch || !patch_items_mesh( cache.fills, fills, changed_items.fills, layer_i, add_fill ) )
+	{
+		build_items_mesh( cache.fills, fills, layer_items.fills, layer_i, add_fill );
+	}
+
+	if( !can_patch || !patch_items_mesh( cache.lines, lines, changed_items.lines, layer_i, add_line ) )
 	{
-		img_area_pos.x = tools::int_to_float( pos.x );
+		build_items_mesh( cache.lines, lines, layer_items.lines, layer_i, add_line );
 	}
 
-	if( img_pos.y < pos.y  )
+	if( !can_patch || scale_changed || !patch_items_mesh( cache.control_points, control_points, changed_items.control_points, layer_i, add_control_point ) )
 	{
-		img_area_pos.y = tools::int_to_float( pos.y );
+		build_items_mesh( cache.control_points, control_points, layer_items.control_points, layer_i, add_control_point );
 	}
 
-	const auto overflow_x = img_pos.x + img_size.x - pos.x  - size.w;
-	const auto overflow_y = img_pos.y + img_size.y - pos.y  - size.h;
+	cache.mesh_layer           = &layer;
+	cache.mesh_version         = layer.get_version();
+	cache.control_points_scale = scale;
+	return true;
+}
+
 
-	if( overflow_x > 0 )
+
+void VectorGraphicsCanvas::build_items_mesh(
+	ItemsMesh &items,
+	const vector_img::ImgItemPool &pool,
+	const vector<uint32_t> &indices,
+	size_t layer_i,
+	const AddItem &add_item
+) const
+{
+	items.ranges.assign( items.ranges.size(), ItemsMesh::Range() );
+	mesh_vertices.clear();
+	pick_vertices.clear();
+
+	for( const auto i : indices )
+	{
+		const auto first = mesh_vertices.size();
+		add_item( i, mesh_vertices );
+
+		const auto slot = pool.slots[i];
+		if( slot >= items.ranges.size() )
+		{
+			items.ranges.resize( slot + 1 );
+		}
+
+		auto &range = items.ranges[slot];
+		range.first    = static_cast<uint32_t>( first );
+		range.count    = static_cast<uint32_t>( mesh_vertices.size() - first );
+		range.capacity = range.count;
+		range.used     = true;
+
+		const auto pick_color = get_pick_color( layer_i, slot );
+		for( auto vertex = first; vertex < mesh_vertices.size(); vertex++ )
+		{
+			auto pick_vertex = mesh_vertices[vertex];
+			pick_vertex.r = pick_color.r;
+			pick_vertex.g = pick_color.g;
+			pick_vertex.b = pick_color.b;
+			pick_vertex.a = pick_color.a;
+			pick_vertices.push_back( pick_vertex );
+		}
+	}
+
+	// Room for the items added until the mesh is built again
+	const auto capacity = mesh_vertices.size() + mesh_vertices.size() / 2 + 3 * 1024;
+	items.mesh.upload( mesh_vertices, capacity );
+	items.ids_mesh.upload( pick_vertices, capacity );
+	items.vertex_count = mesh_vertices.size();
+	items.unused_count = 0;
+}
+
+
+
+bool VectorGraphicsCanvas::patch_items_mesh(
+	ItemsMesh &items,
+	const vector_img::ImgItemPool &pool,
+	const vector<uint32_t> &indices,
+	size_t layer_i,
+	const AddItem &add_item
+) const
+{
+	for( const auto i : indices )
 	{
-		img_area_size.x -= overflow_x * 2;
+		const auto slot = pool.slots[i];
+		if( slot >= items.ranges.size() )
+		{
+			items.ranges.resize( slot + 1 );
+		}
+
+		mesh_vertices.clear();
+		add_item( i, mesh_vertices );
+		const auto count = mesh_vertices.size();
+
+		auto &range = items.ranges[slot];
+		if( !range.used )
+		{
+			range.first    = static_cast<uint32_t>( items.vertex_count );
+			range.count    = static_cast<uint32_t>( count );
+			range.capacity = static_cast<uint32_t>( count );
+			range.used     = true;
+			items.vertex_count += count;
+		}
+		else if( count > range.capacity )
+		{
+			return false;
+		}
+
+		// What is left of the range from before is covered by empty triangles
+		items.unused_count = items.unused_count + range.count - count;
+		mesh_vertices.resize( max<size_t>( count, range.count ), gl::BatchVertex() );
+		range.count = static_cast<uint32_t>( count );
+
+		pick_vertices = mesh_vertices;
+		const auto pick_color = get_pick_color( layer_i, slot );
+		for( size_t vertex = 0; vertex < count; vertex++ )
+		{
+			pick_vertices[vertex].r = pick_color.r;
+			pick_vertices[vertex].g = pick_color.g;
+			pick_vertices[vertex].b = pick_color.b;
+			pick_vertices[vertex].a = pick_color.a;
+		}
+
+		if( !items.mesh.update( range.first, mesh_vertices.data(), mesh_vertices.size() )
+		 || !items.ids_mesh.update( range.first, pick_vertices.data(), pick_vertices.size() ) )
+		{
+			return false;
+		}
 	}
 
-	if( overflow_y > 0 )
+	return items.unused_count * 2 <= items.vertex_count;
+}
+
+
+
+void VectorGraphicsCanvas::remove_from_items_mesh( ItemsMesh &items, uint32_t slot ) const
+{
+	if( slot >= items.ranges.size() || !items.ranges[slot].used )
 	{
-		img_area_size.y -= overflow_y * 2;
+		return;
 	}
 
+	auto &range = items.ranges[slot];
+	mesh_vertices.assign( range.count, gl::BatchVertex() );
+	items.mesh.update( range.first, mesh_vertices.data(), mesh_vertices.size() );
+	items.ids_mesh.update( range.first, mesh_vertices.data(), mesh_vertices.size() );
+
+	items.unused_count += range.count;
+	range = ItemsMesh::Range();
+}
+
+
 
-	auto area = glm::vec4();
-	area.x = img_area_pos.x;
-	area.y = img_area_pos.y;
-	area.z = img_area_size.x;
-	area.w = img_area_size.y;
+void VectorGraphicsCanvas::request_pick( glm::ivec2 area_pos, glm::ivec2 area_size, bool select )
+{
+	// Hovering doesn't replace a selection that hasn't been read yet
+	if( has_pick_request && pick_request.select && !select )
+	{
+		return;
+	}
 
-	return area;
+	pick_request.pos    = area_pos;
+	pick_request.size   = area_size;
+	pick_request.select = select;
+	has_pick_request    = true;
 }
 
 
 
-void VectorGraphicsCanvas::render_vector_img() const
+void VectorGraphicsCanvas::update_picking() const
 {
-	auto shader = Globals::shaders.find( "2d" );
+	take_pick_result();
+	if( !has_pick_request || pick_readback.is_pending() )
+	{
+		return;
+	}
 
-	glUseProgram( shader->second.program );
+	render_pick_buffer();
+	if( !pick_framebuffer.framebuffer_id )
+	{
+		has_pick_request = false;
+		return;
+	}
 
-	const auto colorUniform = shader->second.get_uniform( "color" );
-	glUniform4f( colorUniform, 1.f, 1.f, 1.f, 0.5f );
+	// Only the part of the area within the element is read,
+	// the rows of the buffer go from the bottom up
+	const auto element_pos = glm::ivec2{ pos.x, pos.y };
+	const auto element_end = glm::ivec2{ pos.x + size.w, pos.y + size.h };
+	const auto start = glm::max( pick_request.pos, element_pos ) - element_pos;
+	const auto end   = glm::min( pick_request.pos + pick_request.size, element_end ) - element_pos;
 
-	const auto texturedUniform = shader->second.get_uniform( "textured" );
-	glUniform1i( texturedUniform, 0 );
+	read_request = pick_request;
+	has_pick_request = false;
+	if( end.x <= start.x || end.y <= start.y )
+	{
+		pick_pixels.clear();
+		if( read_request.select )
+		{
+			selected_items.clear();
+		}
+		else
+		{
+			hovered_item = PickedItem();
+		}
+		return;
+	}
 
-	const auto canvas_area   = get_canvas_area();
-	const auto img_area_pos  = glm::vec2{ canvas_area.x, canvas_area.y };
-	const auto img_area_size = glm::vec2{ canvas_area.z, canvas_area.w };
+	pick_readback.start( pick_framebuffer.framebuffer_id, { start.x, size.h - end.y }, end - start );
+}
 
-	gl::render_quad_2d(shader->second, get_root()->size.to_gl_vec(), img_area_pos, img_area_size);
 
-	// Render the image
-	for( auto &layer : image.layers )
+
+void VectorGraphicsCanvas::take_pick_result() const
+{
+	if( !pick_readback.take( pick_pixels ) )
 	{
-		if( !layer )
+		return;
+	}
+
+	vector<uint32_t> ids;
+	vector_img::find_pick_ids( pick_pixels, ids );
+
+	// The items may have been removed since the buffer was drawn
+	vector<PickedItem> items;
+	for( const auto id : ids )
+	{
+		const auto picked = vector_img::decode_pick_id( id );
+		PickedItem item;
+		item.layer = picked.layer;
+		if( item.layer >= image.layers.size() || !image.layers[item.layer] )
 		{
 			continue;
 		}
 
-		for( auto &item : layer->items )
+		item.handle = image.layers[item.layer]->find_handle( picked.slot );
+		if( !item.handle.is_null() )
 		{
-			if( !item )
-			{
-				continue;
-			}
+			items.push_back( item );
+		}
+	}
+
+	if( read_request.select )
+	{
+		selected_items.swap( items );
+	}
+	else
+	{
+		hovered_item = items.empty() ? PickedItem() : items.front();
+	}
+}
+
+
 
-			render_vector_img_item( *this, canvas_area, shader->second, item.get() );
+void VectorGraphicsCanvas::render_pick_buffer() const
+{
+	const auto texture_size = glm::ivec2{ size.w, size.h };
+	if( pick_framebuffer.texture_size != texture_size )
+	{
+		pick_framebuffer.resize( texture_size );
+		pick_scale = 0.f;
+	}
+
+	const auto origin = get_image_origin() - pos.to_gl_vec();
+	if( !pick_framebuffer.framebuffer_id
+	 || (pick_mesh_builds == mesh_builds && pick_origin == origin && pick_scale == scale) )
+	{
+		return;
+	}
+
+	// The ids are written as they are, the topmost item wins
+	// - The meshes of the ids are made with the meshes of the items
+	pick_framebuffer.bind();
+	glClearColor( 0.f, 0.f, 0.f, 0.f );
+	glClear( GL_COLOR_BUFFER_BIT );
+
+	auto &batch = Globals::batch_2d;
+	const auto view = get_view_matrix( pos.to_gl_vec() );
+	batch.set_viewport_size( glm::vec2( texture_size ) );
+	batch.set_blending( gl::REPLACE );
+	const auto layer_count = min( image.layers.size(), vector_img::max_pick_layers );
+	for( size_t layer_i = 0; layer_i < layer_count; layer_i++ )
+	{
+		if( image.layers[layer_i] )
+		{
+			const auto &cache = layer_caches[layer_i];
+			batch.draw_mesh( cache.fills.ids_mesh, view );
+			batch.draw_mesh( cache.lines.ids_mesh, view );
+			batch.draw_mesh( cache.control_points.ids_mesh, view );
 		}
 	}
+	batch.set_blending( gl::STRAIGHT_ALPHA );
+
+	const auto window_size = get_root()->size;
+	glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+	glViewport( 0, 0, window_size.w, window_size.h );
+	batch.set_viewport_size( window_size.to_gl_vec() );
+	gui::any_gl_errors();
+
+	pick_mesh_builds = mesh_builds;
+	pick_origin      = origin;
+	pick_scale       = scale;
+}
+
+
+
+void VectorGraphicsCanvas::render_picked_items() const
+{
+	const auto window_size = get_root()->size.to_gl_vec();
+	const auto origin = get_image_origin();
+
+	const auto render_box = [&window_size]( glm::vec2 a, glm::vec2 b, const glm::vec4 &color )
+	{
+		gl::render_line_2d( window_size, a, { b.x, a.y }, color );
+		gl::render_line_2d( window_size, { b.x, a.y }, b, color );
+		gl::render_line_2d( window_size, b, { a.x, b.y }, color );
+		gl::render_line_2d( window_size, { a.x, b.y }, a, color );
+	};
+
+	const auto render_item = [&]( const PickedItem &item, const glm::vec4 &color )
+	{
+		if( item.layer >= image.layers.size() || !image.layers[item.layer] || !image.layers[item.layer]->contains( item.handle ) )
+		{
+			return;
+		}
+
+		const auto bounds = image.layers[item.layer]->get_bounds( item.handle );
+		render_box(
+			origin + glm::vec2{ bounds.min_x, bounds.min_y } * scale - glm::vec2( 1.f ),
+			origin + glm::vec2{ bounds.max_x, bounds.max_y } * scale + glm::vec2( 1.f ),
+			color
+		);
+	};
+
+	// The outlines are cut to the element
+	auto &batch = Globals::batch_2d;
+	batch.flush();
+	glEnable( GL_SCISSOR_TEST );
+	glScissor( pos.x, static_cast<GLint>( window_size.y ) - pos.y - size.h, size.w, size.h );
+
+	for( const auto &item : selected_items )
+	{
+		render_item( item, { 1.f, 0.6f, 0.f, 1.f } );
+	}
+	render_item( hovered_item, { 0.3f, 0.7f, 1.f, 1.f } );
+
+	if( is_box_selecting )
+	{
+		render_box( drag_start_pos.to_gl_vec(), drag_current_pos.to_gl_vec(), { 1.f, 1.f, 1.f, 0.8f } );
+	}
+
+	batch.flush();
+	glDisable( GL_SCISSOR_TEST );
 }
 
 
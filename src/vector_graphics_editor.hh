@@ -3,21 +3,178 @@
 #include "gui.hh"
 #include "window.hh"
 #include "vector_img.hh"
+#include "vector_img_history.hh"
+#include "vector_img_stroke.hh"
+#include "vector_img_fill.hh"
+#include "vector_img_lod.hh"
+#include "vector_img_autosave.hh"
+#include "gl_helpers.hh"
+#include "gl_batch.hh"
 
+#include <chrono>
+#include <functional>
 
 struct VectorGraphicsCanvas : gui::GuiElement
 {
-	gui::GuiVec2 camera_offset;
+	// The view, scale is in pixels per image unit
+	glm::vec2 camera_offset;
 	float scale;
 	vector_img::VectorImg image;
 
+	// Edits of the image have to be committed to the history
+	vector_img::ImgHistory history;
+
+	// An item of a layer of the image
+	struct PickedItem
+	{
+		size_t                    layer = 0;
+		vector_img::ImgItemHandle handle;
+	};
+
 	VectorGraphicsCanvas();
 
 	virtual void handle_event( const gui::GuiEvent &e ) override;
 	virtual void render() const override;
 
+	// Found by picking, a frame or two after the mouse moves or clicks
+	const PickedItem &get_hovered_item() const { return hovered_item; }
+	const std::vector<PickedItem> &get_selected_items() const { return selected_items; }
+
   protected:
+	// Dragging the canvas pans the view from where the drag started,
+	// with shift the left button selects the items within a box
+	bool         is_panning;
+	bool         is_box_selecting;
+	gui::GuiVec2 drag_start_pos;
+	gui::GuiVec2 drag_current_pos;
+	glm::vec2    pan_start_offset;
+
+	// Reused between the frames to avoid allocating
+	mutable vector_img::ImgLayerIndices        layer_items;
+	mutable vector_img::ImgLayerIndices        changed_items;
+	mutable std::vector<vector_img::ImgChange> layer_changes;
+	mutable std::vector<gl::BatchVertex>       mesh_vertices;
+	mutable std::vector<gl::BatchVertex>       pick_vertices;
+
+	// Triangles of the lines of each layer, kept between the frames
+	mutable std::vector<vector_img::ImgStrokeCache> stroke_caches;
+	mutable std::vector<std::unique_ptr<vector_img::ImgFillCache>> fill_caches;
+
+	// Simplified layers drawn zoomed out instead of the triangles of the items
+	mutable std::vector<std::unique_ptr<vector_img::ImgLodCache>> lod_caches;
+
+	// Triangles of the items of one type of a layer in the drawing order,
+	// with their colors and with their pick ids as colors
+	// - Each item has a range of vertices by its slot, the changes of the layer
+	//   are written over the ranges of the changed items. Items removed or
+	//   brought to the front leave their ranges as empty triangles, new items
+	//   and the items brought to the front are appended
+	// - The meshes are built again when an item outgrows its range,
+	//   the buffers are full or half of the vertices are unused
+	struct ItemsMesh
+	{
+		struct Range
+		{
+			uint32_t first    = 0;
+			uint32_t count    = 0;
+			uint32_t capacity = 0;
+			bool     used     = false;
+		};
+
+		gl::Mesh2D mesh;
+		gl::Mesh2D ids_mesh;
+		std::vector<Range> ranges;
+		size_t vertex_count = 0;
+		size_t unused_count = 0;
+	};
+
+	// Appends the triangles of the item i of a pool with its color
+	using AddItem = std::function<void( size_t i, std::vector<gl::BatchVertex> &vertices )>;
+
+	// Each layer as vertex buffers in image coordinates, and as it was last
+	// drawn with the view it was drawn at
+	// - The vertex buffers are patched with the changes of the layer, the
+	//   view is applied by the view matrix when they are drawn. The GPU cuts
+	//   the triangles to the view, the items aren't culled one by one
+	struct LayerCache
+	{
+		// The layer the meshes were made of, at mesh_version
+		const vector_img::ImgLayer *mesh_layer   = nullptr;
+		uint64_t                    mesh_version = 0;
+
+		ItemsMesh fills;
+		ItemsMesh lines;
+
+		// Control points keep their size on the screen, so they follow the scale
+		ItemsMesh control_points;
+		float     control_points_scale = 0.f;
+
+		// Zoomed out, the fills and the lines are drawn from a level of detail,
+		// mesh_level is its id or 0 for the full detail
+		gl::Mesh2D level_mesh;
+		uint64_t   mesh_level = 0;
+
+		// Value of mesh_builds when the meshes last changed
+		uint64_t mesh_build = 0;
+
+		gl::FramebufferObject framebuffer;
+		glm::vec2 origin = { 0.f, 0.f };
+		float     scale  = 0.f;
+	};
+
+	mutable std::vector<LayerCache> layer_caches;
+	mutable uint64_t mesh_builds;
+
+	// Picking draws the items with their ids as colors into a framebuffer and
+	// reads the pixels under the mouse, or in a box, back from it asynchronously
+	// - The id buffer is drawn again only when the meshes or the view change
+	struct PickRequest
+	{
+		glm::ivec2 pos    = { 0, 0 };
+		glm::ivec2 size   = { 1, 1 };
+		bool       select = false;
+	};
+
+	mutable bool                  has_pick_request;
+	mutable PickRequest           pick_request;
+	mutable PickRequest           read_request;
+	mutable gl::FramebufferObject pick_framebuffer;
+	mutable gl::PixelReadback     pick_readback;
+	mutable std::vector<uint8_t>  pick_pixels;
+	mutable uint64_t              pick_mesh_builds;
+	mutable glm::vec2             pick_origin;
+	mutable float                 pick_scale;
+
+	mutable PickedItem              hovered_item;
+	mutable std::vector<PickedItem> selected_items;
+
 	void render_vector_img() const;
+
+	// Returns whether the meshes of the layer changed
+	bool update_layer_meshes( size_t layer_i ) const;
+	bool update_items_meshes( size_t layer_i ) const;
+	void build_items_mesh( ItemsMesh &items, const vector_img::ImgItemPool &pool, const std::vector<uint32_t> &indices, size_t layer_i, const AddItem &add_item ) const;
+
+	// Writes the items over their ranges or appends them, indices in the drawing order
+	// - Returns false when the mesh has to be built again
+	bool patch_items_mesh( ItemsMesh &items, const vector_img::ImgItemPool &pool, const std::vector<uint32_t> &indices, size_t layer_i, const AddItem &add_item ) const;
+	void remove_from_items_mesh( ItemsMesh &items, uint32_t slot ) const;
+
+	// Area in window pixels
+	void request_pick( glm::ivec2 area_pos, glm::ivec2 area_size, bool select );
+	void update_picking() const;
+	void render_pick_buffer() const;
+	void take_pick_result() const;
+	void render_picked_items() const;
+
+	// Zooms by factor keeping the image point under pos in place
+	void zoom( float factor, gui::GuiVec2 pos );
+
+	// Window position of the image origin, and the matrix
+	// from the image coordinates to pixels from target_origin
+	glm::vec2 get_image_origin() const;
+	glm::mat4 get_view_matrix( glm::vec2 target_origin ) const;
+
 	void create_context_menu( gui::GuiVec2 tgt_pos );
 	glm::vec4 get_canvas_area() const;
 };
@@ -48,11 +205,36 @@ struct VectorGraphicsEditor : gui::GuiElement
 	virtual void render() const override;
 	virtual void handle_event( const gui::GuiEvent &e ) override;
 
+	// SVG files are imported and exported, other files are documents
+	// - Throws runtime_error if the file couldn't be read or written
+	void open_file( const std::string &path );
+	void save_file( const std::string &path ) const;
+
+	// Whether open_file() reads the file as an image, by the extension
+	// of SVG files and the start of documents
+	static bool can_open( const std::string &path );
+
+	// Recovers the image autosaved at the path, if there is one,
+	// and saves the changes of the image there from then on
+	// - Without recover_image an earlier autosave is moved to path + ".previous"
+	//   instead, so that it isn't overwritten
+	// - The image is handed to the autosave between the frames, at most once per autosave_interval_ms
+	// - The autosave is removed when the editor closes
+	void enable_autosave( const std::string &path, bool recover_image = true );
+	void disable_autosave();
+
   protected:
 	using gui::GuiElement::add_child;
 
 	VectorGraphicsToolbar    *toolbar_element;
 	VectorGraphicsCanvas     *canvas_element;
 	VectorGraphicsProperties *properties_element;
+
+	static const int autosave_interval_ms = 1000;
+
+	std::unique_ptr<vector_img::ImgAutosave>      autosave;
+	std::string                                   autosave_path;
+	mutable std::chrono::steady_clock::time_point last_autosave;
+	mutable std::string                           autosave_error;
 };
 
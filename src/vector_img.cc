@@ -1,7 +1,174 @@
 #include "vector_img.hh"
 
+#include <cmath>
+#include <atomic>
+#include <algorithm>
+
 using namespace vector_img;
 
+namespace
+{
+	// Removed items are compacted away when they are
+	// a quarter of the pool and there are enough of them
+	const size_t min_compacted_count = 1024;
+
+	// Shared by all the layers and fills, so that a revision is never seen twice
+	std::atomic<uint64_t> last_revision{ 0 };
+
+
+
+	uint64_t make_revision()
+	{
+		return ++last_revision;
+	}
+
+
+
+	float distance_to_segment( float x, float y, float ax, float ay, float bx, float by )
+	{
+		const auto dx = bx - ax;
+		const auto dy = by - ay;
+		const auto length_sq = dx * dx + dy * dy;
+
+		auto t = 0.f;
+		if( length_sq > 0.f )
+		{
+			t = std::min( std::max( ((x - ax) * dx + (y - ay) * dy) / length_sq, 0.f ), 1.f );
+		}
+
+		const auto px = ax + t * dx - x;
+		const auto py = ay + t * dy - y;
+		return std::sqrt( px * px + py * py );
+	}
+
+
+
+	// Items of higher rank are drawn on top
+	int get_draw_rank( ImgItemType type )
+	{
+		switch( type )
+		{
+			case CONTROL_POINT:
+				return 2;
+
+			case LINE:
+				return 1;
+
+			default:
+				return 0;
+		}
+	}
+}
+
+
+
+const uint32_t ImgItemHandle::no_slot;
+const Color ImgLayer::default_color = Color{ 255, 255, 255, 255 };
+const size_t ImgLayer::journal_size;
+
+
+
+const float ImgLineStyle::miter_limit;
+
+
+
+ImgLayer::ImgLayer()
+{
+	// A new layer doesn't share versions with the layers that came before it
+	version = make_revision();
+	journal_start = version;
+}
+
+
+
+float ImgLineStyle::get_reach( float width ) const
+{
+	// Square caps reach past the corners, miters up to the limit
+	const auto half_width = width / 2.f;
+	if( join == MITER_JOIN )
+	{
+		return half_width * miter_limit;
+	}
+
+	return cap == SQUARE_CAP ? half_width * 1.4142136f : half_width;
+}
+
+
+
+ImgBounds ImgPath::get_bounds() const
+{
+	if( points.empty() )
+	{
+		return { 0.f, 0.f, 0.f, 0.f };
+	}
+
+	ImgBounds bounds = { points[0].x, points[0].y, points[0].x, points[0].y };
+	for( const auto &point : points )
+	{
+		bounds.min_x = std::min( bounds.min_x, point.x );
+		bounds.min_y = std::min( bounds.min_y, point.y );
+		bounds.max_x = std::max( bounds.max_x, point.x );
+		bounds.max_y = std::max( bounds.max_y, point.y );
+	}
+
+	return bounds;
+}
+
+
+
+bool ImgPath::contains( float x, float y ) const
+{
+	// Winding number of the contours around the point
+	auto winding = 0;
+	uint32_t start = 0;
+	for( const auto end : contour_ends )
+	{
+		for( auto i = start; i < end; i++ )
+		{
+			const auto &a = points[i];
+			const auto &b = points[i + 1 < end ? i + 1 : start];
+			if( (a.y <= y) == (b.y <= y) )
+			{
+				continue;
+			}
+
+			const auto side = (b.x - a.x) * (y - a.y) - (x - a.x) * (b.y - a.y);
+			if( b.y > a.y && side > 0.f )
+			{
+				winding++;
+			}
+			else if( b.y < a.y && side < 0.f )
+			{
+				winding--;
+			}
+		}
+		start = end;
+	}
+
+	return rule == EVEN_ODD ? (winding & 1) != 0 : winding != 0;
+}
+
+
+
+float ImgPath::distance_to( float x, float y ) const
+{
+	auto distance = INFINITY;
+	uint32_t start = 0;
+	for( const auto end : contour_ends )
+	{
+		for( auto i = start; i < end; i++ )
+		{
+			const auto &a = points[i];
+			const auto &b = points[i + 1 < end ? i + 1 : start];
+			distance = std::min( distance, distance_to_segment( x, y, a.x, a.y, b.x, b.y ) );
+		}
+		start = end;
+	}
+
+	return distance;
+}
+
+
 
 VectorImg::VectorImg()
 : img_w(0),
@@ -11,33 +178,741 @@ VectorImg::VectorImg()
 
 
 
-ImgItem::ImgItem()
-: type( ImgItemType::NO_TYPE ),
-  x( 0.0 ),
-  y( 0.0 ),
-  color( Color{ 255, 255, 255, 255 } )
+template<typename Column>
+void ImgItemPool::compact_column( Column &column ) const
+{
+	size_t kept = 0;
+	for( size_t i = 0; i < column.size(); i++ )
+	{
+		if( !is_removed( i ) )
+		{
+			if( kept != i )
+			{
+				column[kept] = std::move( column[i] );
+			}
+			kept++;
+		}
+	}
+
+	column.resize( kept );
+}
+
+
+
+void ImgItemPool::compact_slots()
+{
+	slots.erase( std::remove( slots.begin(), slots.end(), ImgItemHandle::no_slot ), slots.end() );
+	removed_count = 0;
+}
+
+
+
+void ImgControlPoints::compact()
+{
+	compact_column( x );
+	compact_column( y );
+	compact_column( color );
+	compact_slots();
+}
+
+
+
+void ImgLines::compact()
+{
+	compact_column( ax );
+	compact_column( ay );
+	compact_column( bx );
+	compact_column( by );
+	compact_column( width );
+	compact_column( color );
+	compact_column( style );
+	compact_slots();
+}
+
+
+
+void ImgFills::compact()
+{
+	compact_column( x );
+	compact_column( y );
+	compact_column( color );
+	compact_column( path );
+	compact_column( path_revision );
+	compact_slots();
+}
+
+
+
+void ImgLayerIndices::clear()
+{
+	control_points.clear();
+	lines.clear();
+	fills.clear();
+}
+
+
+
+ImgItemHandle ImgLayer::make_handle( ImgItemType type, size_t index )
+{
+	uint32_t slot_index = 0;
+	if( free_slots.size() )
+	{
+		slot_index = free_slots.back();
+		free_slots.pop_back();
+	}
+	else
+	{
+		slot_index = static_cast<uint32_t>( item_slots.size() );
+		item_slots.emplace_back();
+	}
+
+	auto &slot = item_slots[slot_index];
+	slot.type = type;
+	slot.index = static_cast<uint32_t>( index );
+
+	get_pool( type ).slots.push_back( slot_index );
+	return get_handle( slot_index );
+}
+
+
+
+ImgItemHandle ImgLayer::get_handle( uint32_t slot_index ) const
+{
+	ImgItemHandle handle;
+	handle.slot = slot_index;
+	handle.generation = item_slots[slot_index].generation;
+	return handle;
+}
+
+
+
+ImgItemHandle ImgLayer::find_handle( uint32_t slot_index ) const
+{
+	if( slot_index >= item_slots.size() || item_slots[slot_index].type == NO_TYPE )
+	{
+		return ImgItemHandle();
+	}
+
+	return get_handle( slot_index );
+}
+
+
+
+const ImgLayer::Slot *ImgLayer::find_slot( ImgItemHandle handle ) const
+{
+	if( handle.slot >= item_slots.size() )
+	{
+		return nullptr;
+	}
+
+	const auto &slot = item_slots[handle.slot];
+	if( slot.type == NO_TYPE || slot.generation != handle.generation )
+	{
+		return nullptr;
+	}
+
+	return &slot;
+}
+
+
+
+ImgItemPool &ImgLayer::get_pool( ImgItemType type )
+{
+	switch( type )
+	{
+		case CONTROL_POINT:
+			return control_points;
+
+		case LINE:
+			return lines;
+
+		default:
+			return fills;
+	}
+}
+
+
+
+ImgItemHandle ImgLayer::add_control_point( float x, float y, Color color )
+{
+	control_points.x.push_back( x );
+	control_points.y.push_back( y );
+	control_points.color.push_back( color );
+	const auto handle = make_handle( CONTROL_POINT, control_points.x.size() - 1 );
+	index.insert( handle.slot, get_item_bounds( CONTROL_POINT, control_points.x.size() - 1 ) );
+	changed( ITEM_ADDED, handle );
+	return handle;
+}
+
+
+
+ImgItemHandle ImgLayer::add_line( float ax, float ay, float bx, float by, float width, Color color, ImgLineStyle style )
+{
+	lines.ax.push_back( ax );
+	lines.ay.push_back( ay );
+	lines.bx.push_back( bx );
+	lines.by.push_back( by );
+	lines.width.push_back( width );
+	lines.color.push_back( color );
+	lines.style.push_back( style );
+	const auto handle = make_handle( LINE, lines.ax.size() - 1 );
+	index.insert( handle.slot, get_item_bounds( LINE, lines.ax.size() - 1 ) );
+	changed( ITEM_ADDED, handle );
+	return handle;
+}
+
+
+
+ImgItemHandle ImgLayer::add_fill( float x, float y, Color color )
+{
+	return add_fill( x, y, ImgPath(), color );
+}
+
+
+
+ImgItemHandle ImgLayer::add_fill( float x, float y, ImgPath path, Color color )
+{
+	fills.x.push_back( x );
+	fills.y.push_back( y );
+	fills.color.push_back( color );
+	fills.path.push_back( std::move( path ) );
+	fills.path_revision.push_back( make_revision() );
+	const auto handle = make_handle( FILL, fills.x.size() - 1 );
+	index.insert( handle.slot, get_item_bounds( FILL, fills.x.size() - 1 ) );
+	changed( ITEM_ADDED, handle );
+	return handle;
+}
+
+
+
+bool ImgLayer::remove( ImgItemHandle handle )
+{
+	if( !find_slot( handle ) )
+	{
+		return false;
+	}
+
+	changed( ITEM_REMOVED, handle );
+
+	auto &slot = item_slots[handle.slot];
+	auto &pool = get_pool( slot.type );
+	pool.slots[slot.index] = ImgItemHandle::no_slot;
+	pool.removed_count++;
+	index.remove( handle.slot );
+
+	const auto type = slot.type;
+
+	// Old handles to the slot become invalid
+	slot.type = NO_TYPE;
+	slot.generation++;
+	free_slots.push_back( handle.slot );
+
+	compact_if_sparse( type );
+	return true;
+}
+
+
+
+void ImgLayer::compact_if_sparse( ImgItemType type )
+{
+	auto &pool = get_pool( type );
+	if( pool.removed_count < min_compacted_count || pool.removed_count * 4 < pool.size() )
+	{
+		return;
+	}
+
+	switch( type )
+	{
+		case CONTROL_POINT:
+			control_points.compact();
+			break;
+
+		case LINE:
+			lines.compact();
+			break;
+
+		default:
+			fills.compact();
+			break;
+	}
+
+	// The items moved, point their slots to the new indices
+	for( size_t i = 0; i < pool.size(); i++ )
+	{
+		item_slots[pool.slots[i]].index = static_cast<uint32_t>( i );
+	}
+}
+
+
+
+void ImgLayer::clear()
+{
+	// Bump the generations, so that the old handles stay invalid
+	for( auto &slot : item_slots )
+	{
+		if( slot.type != NO_TYPE )
+		{
+			slot.type = NO_TYPE;
+			slot.generation++;
+		}
+	}
+
+	free_slots.clear();
+	for( size_t i = item_slots.size(); i-- > 0; )
+	{
+		free_slots.push_back( static_cast<uint32_t>( i ) );
+	}
+
+	control_points = ImgControlPoints{};
+	lines = ImgLines{};
+	fills = ImgFills{};
+	index.clear();
+	changed_all();
+}
+
+
+
+bool ImgLayer::move_item( ImgItemHandle handle, float dx, float dy )
+{
+	const auto slot = find_slot( handle );
+	if( !slot )
+	{
+		return false;
+	}
+
+	changed( ITEM_MODIFIED, handle );
+
+	const auto i = slot->index;
+	switch( slot->type )
+	{
+		case CONTROL_POINT:
+			control_points.x[i] += dx;
+			control_points.y[i] += dy;
+			break;
+
+		case LINE:
+			lines.ax[i] += dx;
+			lines.ay[i] += dy;
+			lines.bx[i] += dx;
+			lines.by[i] += dy;
+			break;
+
+		default:
+			fills.x[i] += dx;
+			fills.y[i] += dy;
+			break;
+	}
+
+	// Moving doesn't change the path of a fill
+	index.update( handle.slot, get_item_bounds( slot->type, i ) );
+	return true;
+}
+
+
+
+void ImgLayer::item_changed( ImgItemHandle handle )
 {
+	const auto slot = find_slot( handle );
+	if( slot )
+	{
+		changed( ITEM_MODIFIED, handle );
+		if( slot->type == FILL )
+		{
+			fills.path_revision[slot->index] = make_revision();
+		}
+		index.update( handle.slot, get_item_bounds( slot->type, slot->index ) );
+	}
 }
 
 
 
-ImgControlPoint::ImgControlPoint()
+bool ImgLayer::bring_to_front( ImgItemHandle handle )
 {
-	type = ImgItemType::CONTROL_POINT;
+	const auto slot = find_slot( handle );
+	if( !slot )
+	{
+		return false;
+	}
+
+	// The item is copied to the end of its pool and the old place is left
+	// removed, the spatial index refers to the slot so it doesn't change
+	const auto i = slot->index;
+	switch( slot->type )
+	{
+		case CONTROL_POINT:
+			if( i + 1 == control_points.size() )
+			{
+				return true;
+			}
+			control_points.x.push_back( control_points.x[i] );
+			control_points.y.push_back( control_points.y[i] );
+			control_points.color.push_back( control_points.color[i] );
+			break;
+
+		case LINE:
+			if( i + 1 == lines.size() )
+			{
+				return true;
+			}
+			lines.ax.push_back( lines.ax[i] );
+			lines.ay.push_back( lines.ay[i] );
+			lines.bx.push_back( lines.bx[i] );
+			lines.by.push_back( lines.by[i] );
+			lines.width.push_back( lines.width[i] );
+			lines.color.push_back( lines.color[i] );
+			lines.style.push_back( lines.style[i] );
+			break;
+
+		default:
+		{
+			if( i + 1 == fills.size() )
+			{
+				return true;
+			}
+			auto path = std::move( fills.path[i] );
+			fills.x.push_back( fills.x[i] );
+			fills.y.push_back( fills.y[i] );
+			fills.color.push_back( fills.color[i] );
+			fills.path.push_back( std::move( path ) );
+			fills.path_revision.push_back( fills.path_revision[i] );
+			break;
+		}
+	}
+
+	const auto type = slot->type;
+	auto &pool = get_pool( type );
+	pool.slots[i] = ImgItemHandle::no_slot;
+	pool.slots.push_back( handle.slot );
+	pool.removed_count++;
+	item_slots[handle.slot].index = static_cast<uint32_t>( pool.size() - 1 );
+
+	changed( ITEM_REORDERED, handle );
+	compact_if_sparse( type );
+	return true;
+}
+
+
+
+bool ImgLayer::is_drawn_on_top( ImgItemType type, const ImgBounds &bounds ) const
+{
+	// Fills are drawn under the lines and the control points, lines under the control points
+	const auto point_count = control_points.size() - control_points.removed_count;
+	const auto line_count = lines.size() - lines.removed_count;
+	if( type == CONTROL_POINT || (type == LINE && !point_count) || (!point_count && !line_count) )
+	{
+		return true;
+	}
+
+	std::vector<uint32_t> found;
+	index.find_in( bounds, found );
+
+	for( const auto slot : found )
+	{
+		const auto found_type = item_slots[slot].type;
+		if( found_type == CONTROL_POINT || (type == FILL && found_type == LINE) )
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+
+void ImgLayer::changed( ImgChangeType type, ImgItemHandle handle )
+{
+	version = make_revision();
+
+	if( handle.slot >= slot_versions.size() )
+	{
+		slot_versions.resize( handle.slot + 1, 0 );
+	}
+	slot_versions[handle.slot] = version;
+
+	// The oldest change is forgotten, the journal reaches back to its version
+	journal.push_back( ImgChange{ type, handle, version } );
+	if( journal.size() > journal_size )
+	{
+		journal_start = journal.front().version;
+		journal.pop_front();
+	}
+}
+
+
+
+void ImgLayer::changed_all()
+{
+	version = make_revision();
+	slot_versions.assign( item_slots.size(), version );
+	journal.clear();
+	journal_start = version;
+}
+
+
+
+uint64_t ImgLayer::get_item_version( ImgItemHandle handle ) const
+{
+	if( !find_slot( handle ) || handle.slot >= slot_versions.size() )
+	{
+		return 0;
+	}
+
+	return slot_versions[handle.slot];
+}
+
+
+
+bool ImgLayer::get_changes( uint64_t since_version, std::vector<ImgChange> &changes ) const
+{
+	if( since_version < journal_start || since_version > version )
+	{
+		return false;
+	}
+
+	const auto first = std::upper_bound( journal.begin(), journal.end(), since_version, []( uint64_t v, const ImgChange &change )
+	{
+		return v < change.version;
+	} );
+	changes.insert( changes.end(), first, journal.end() );
+	return true;
 }
 
 
 
-ImgLine::ImgLine()
-: width( 0 )
+bool ImgLayer::contains( ImgItemHandle handle ) const
 {
-	type = ImgItemType::LINE;
+	return find_slot( handle ) != nullptr;
 }
 
 
 
-ImgFill::ImgFill()
+ImgItemType ImgLayer::get_type( ImgItemHandle handle ) const
 {
-	type = ImgItemType::FILL;
+	const auto slot = find_slot( handle );
+	return slot ? slot->type : NO_TYPE;
 }
 
+
+
+size_t ImgLayer::get_index( ImgItemHandle handle ) const
+{
+	const auto slot = find_slot( handle );
+	return slot ? slot->index : static_cast<size_t>( -1 );
+}
+
+
+
+size_t ImgLayer::size() const
+{
+	return control_points.size() - control_points.removed_count
+	     + lines.size() - lines.removed_count
+	     + fills.size() - fills.removed_count;
+}
+
+
+
+void ImgLayer::translate( float dx, float dy )
+{
+	// Removed items move too, they are never seen anyway
+	const auto offset = []( std::vector<float> &column, float delta )
+	{
+		for( auto &value : column )
+		{
+			value += delta;
+		}
+	};
+
+	offset( control_points.x, dx );
+	offset( control_points.y, dy );
+	offset( lines.ax, dx );
+	offset( lines.ay, dy );
+	offset( lines.bx, dx );
+	offset( lines.by, dy );
+	offset( fills.x, dx );
+	offset( fills.y, dy );
+
+	index.translate( dx, dy );
+	changed_all();
+}
+
+
+
+ImgBounds ImgLayer::get_item_bounds( ImgItemType type, size_t i ) const
+{
+	switch( type )
+	{
+		case CONTROL_POINT:
+			return { control_points.x[i], control_points.y[i], control_points.x[i], control_points.y[i] };
+
+		case LINE:
+		{
+			const auto reach = lines.style[i].get_reach( lines.width[i] );
+			return {
+				std::min( lines.ax[i], lines.bx[i] ) - reach,
+				std::min( lines.ay[i], lines.by[i] ) - reach,
+				std::max( lines.ax[i], lines.bx[i] ) + reach,
+				std::max( lines.ay[i], lines.by[i] ) + reach
+			};
+		}
+
+		default:
+		{
+			if( fills.path[i].points.empty() )
+			{
+				return { fills.x[i], fills.y[i], fills.x[i], fills.y[i] };
+			}
+
+			const auto bounds = fills.path[i].get_bounds();
+			return {
+				fills.x[i] + bounds.min_x,
+				fills.y[i] + bounds.min_y,
+				fills.x[i] + bounds.max_x,
+				fills.y[i] + bounds.max_y
+			};
+		}
+	}
+}
+
+
+
+float ImgLayer::get_item_distance( ImgItemType type, size_t i, float x, float y ) const
+{
+	switch( type )
+	{
+		case CONTROL_POINT:
+			return std::hypot( control_points.x[i] - x, control_points.y[i] - y );
+
+		case LINE:
+		{
+			const auto distance = distance_to_segment(
+				x, y,
+				lines.ax[i], lines.ay[i],
+				lines.bx[i], lines.by[i]
+			);
+			return std::max( distance - lines.width[i] / 2.f, 0.f );
+		}
+
+		default:
+		{
+			const auto &path = fills.path[i];
+			if( path.points.empty() )
+			{
+				return std::hypot( fills.x[i] - x, fills.y[i] - y );
+			}
+
+			const auto path_x = x - fills.x[i];
+			const auto path_y = y - fills.y[i];
+			return path.contains( path_x, path_y ) ? 0.f : path.distance_to( path_x, path_y );
+		}
+	}
+}
+
+
+
+ImgBounds ImgLayer::get_bounds( ImgItemHandle handle ) const
+{
+	const auto slot = find_slot( handle );
+	if( !slot )
+	{
+		return { 0.f, 0.f, 0.f, 0.f };
+	}
+
+	return get_item_bounds( slot->type, slot->index );
+}
+
+
+
+ImgItemHandle ImgLayer::find_item_at( float x, float y, float max_distance ) const
+{
+	std::vector<uint32_t> candidates;
+	index.find_in( { x - max_distance, y - max_distance, x + max_distance, y + max_distance }, candidates );
+
+	// The topmost is the last one drawn
+	ImgItemHandle topmost;
+	auto topmost_rank = -1;
+	uint32_t topmost_index = 0;
+
+	for( const auto candidate : candidates )
+	{
+		const auto &slot = item_slots[candidate];
+		const auto rank = get_draw_rank( slot.type );
+		if( rank < topmost_rank || (rank == topmost_rank && slot.index < topmost_index) )
+		{
+			continue;
+		}
+
+		if( get_item_distance( slot.type, slot.index, x, y ) <= max_distance )
+		{
+			topmost = get_handle( candidate );
+			topmost_rank = rank;
+			topmost_index = slot.index;
+		}
+	}
+
+	return topmost;
+}
+
+
+
+ImgItemHandle ImgLayer::find_nearest_item( float x, float y, float max_distance ) const
+{
+	const auto nearest = index.find_nearest( x, y, max_distance, [this, x, y]( uint32_t candidate )
+	{
+		const auto &slot = item_slots[candidate];
+		return get_item_distance( slot.type, slot.index, x, y );
+	} );
+
+	if( nearest == ImgSpatialIndex::no_id )
+	{
+		return ImgItemHandle();
+	}
+
+	return get_handle( nearest );
+}
+
+
+
+void ImgLayer::find_items_in( const ImgBounds &area, std::vector<ImgItemHandle> &handles ) const
+{
+	std::vector<uint32_t> found;
+	index.find_in( area, found );
+
+	for( const auto slot : found )
+	{
+		handles.push_back( get_handle( slot ) );
+	}
+}
+
+
+
+void ImgLayer::find_visible( const ImgBounds &area, ImgLayerIndices &indices ) const
+{
+	indices.clear();
+
+	std::vector<uint32_t> found;
+	index.find_in( area, found );
+
+	for( const auto candidate : found )
+	{
+		const auto &slot = item_slots[candidate];
+		switch( slot.type )
+		{
+			case CONTROL_POINT:
+				indices.control_points.push_back( slot.index );
+				break;
+
+			case LINE:
+				indices.lines.push_back( slot.index );
+				break;
+
+			default:
+				indices.fills.push_back( slot.index );
+				break;
+		}
+	}
+
+	std::sort( indices.control_points.begin(), indices.control_points.end() );
+	std::sort( indices.lines.begin(), indices.lines.end() );
+	std::sort( indices.fills.begin(), indices.fills.end() );
+}
@@ -1,6 +1,10 @@
 #pragma once
+#include "vector_img_index.hh"
+
+#include <deque>
 #include <vector>
 #include <memory>
+#include <cstdint>
 
 namespace vector_img
 {
@@ -15,10 +19,41 @@ enum ImgItemType : uint8_t
 };
 
 
-struct ImgItem;
+enum ImgChangeType : uint8_t
+{
+	ITEM_ADDED,
+	ITEM_REMOVED,
+	ITEM_MODIFIED,
+	ITEM_REORDERED
+};
+
+
+enum ImgFillRule : uint8_t
+{
+	NON_ZERO,
+	EVEN_ODD
+};
+
+
+enum ImgLineCap : uint8_t
+{
+	BUTT_CAP,
+	ROUND_CAP,
+	SQUARE_CAP
+};
+
+
+enum ImgLineJoin : uint8_t
+{
+	MITER_JOIN,
+	ROUND_JOIN,
+	BEVEL_JOIN
+};
+
+
 struct ImgLayer;
+struct ImgHistory;
 
-using ImgItemPtr  = std::unique_ptr<ImgItem>;
 using ImgLayerPtr = std::unique_ptr<ImgLayer>;
 
 
@@ -32,6 +67,76 @@ struct Color
 
 
 
+struct ImgPoint
+{
+	float x;
+	float y;
+};
+
+
+
+// How the ends of a line are drawn
+// - The join is used instead of the start cap where the line continues
+//   the previous line of the layer, with the same width, color and style
+// - Miter joins sharper than the miter limit become bevel joins
+struct ImgLineStyle
+{
+	static constexpr float miter_limit = 4.f;
+
+	ImgLineCap  cap  = BUTT_CAP;
+	ImgLineJoin join = MITER_JOIN;
+
+	// Farthest distance of the drawn line from its center line
+	float get_reach( float width ) const;
+};
+
+
+
+// Outline of a fill, relative to the position of the fill
+// - The contours are closed, contour_ends[i] is where the contour i
+//   ends in points and the next one starts
+// - Contours within others are holes or not depending on the fill rule
+struct ImgPath
+{
+	std::vector<ImgPoint> points;
+	std::vector<uint32_t> contour_ends;
+	ImgFillRule           rule = NON_ZERO;
+
+	ImgBounds get_bounds() const;
+	bool contains( float x, float y ) const;
+
+	// Distance to the closest contour
+	float distance_to( float x, float y ) const;
+};
+
+
+
+// Refers to an item of a layer
+// - Stays valid until the item is removed, no matter
+//   what happens to the other items of the layer
+struct ImgItemHandle
+{
+	static const uint32_t no_slot = UINT32_MAX;
+
+	uint32_t slot       = no_slot;
+	uint32_t generation = 0;
+
+	bool is_null() const { return slot == no_slot; }
+};
+
+
+
+// A change of an item of a layer, version is the version
+// the layer got by the change
+struct ImgChange
+{
+	ImgChangeType type;
+	ImgItemHandle handle;
+	uint64_t      version;
+};
+
+
+
 struct VectorImg
 {
 	size_t img_w;
@@ -43,50 +148,201 @@ struct VectorImg
 
 
 
-struct ImgLayer
+// Columns shared by the item pools
+// - slots[i] is the handle slot of the item i, or ImgItemHandle::no_slot
+//   once the item has been removed. Removed items stay in place until
+//   the pool is compacted, so that the drawing order is kept
+struct ImgItemPool
 {
-	std::vector<ImgItemPtr> items;
+	std::vector<uint32_t> slots;
+	size_t removed_count = 0;
+
+	size_t size() const { return slots.size(); }
+	bool is_removed( size_t i ) const { return slots[i] == ImgItemHandle::no_slot; }
+
+  protected:
+	template<typename Column>
+	void compact_column( Column &column ) const;
+	void compact_slots();
 };
 
 
 
-struct ImgItem
+struct ImgControlPoints : ImgItemPool
 {
-	ImgItemType type;
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<Color> color;
+
+	void compact();
+};
 
-	float x;
-	float y;
 
-	Color color;
 
-	ImgItem();
-	virtual ~ImgItem() {};
+struct ImgLines : ImgItemPool
+{
+	std::vector<float> ax;
+	std::vector<float> ay;
+	std::vector<float> bx;
+	std::vector<float> by;
+	std::vector<float> width;
+	std::vector<Color> color;
+	std::vector<ImgLineStyle> style;
+
+	void compact();
 };
 
 
 
-struct ImgControlPoint : ImgItem
+// Fills without contours are only a point
+// - path_revision is given a new value, never used before, whenever the path
+//   may have changed, so that what is made of the paths can be cached
+struct ImgFills : ImgItemPool
 {
-	ImgControlPoint();
+	std::vector<float>    x;
+	std::vector<float>    y;
+	std::vector<Color>    color;
+	std::vector<ImgPath>  path;
+	std::vector<uint64_t> path_revision;
+
+	void compact();
 };
 
 
 
-struct ImgLine : ImgItem
+// Pool indices of the items of a layer, in the drawing order
+struct ImgLayerIndices
 {
-	ImgControlPoint a;
-	ImgControlPoint b;
-	float width;
+	std::vector<uint32_t> control_points;
+	std::vector<uint32_t> lines;
+	std::vector<uint32_t> fills;
 
-	ImgLine();
+	void clear();
 };
 
 
-struct ImgFill : ImgItem
+
+// Items of a layer, stored by their type in contiguous columns
+// - Fills are drawn first, then the lines and the control points,
+//   each in the order they were added
+// - Items of different types don't keep the order they were added in, a
+//   line added before a fill is still drawn over it. Drawing the pools one
+//   after another is what keeps them contiguous. is_drawn_on_top() tells
+//   when an item would go under the items it overlaps, the item has to go
+//   to a new layer then, like the SVG importer does
+// - The pools can be read directly, handles map to pool indices with get_index()
+// - The bounds of the items are kept in a spatial index, item_changed()
+//   has to be called after changing the columns of an item directly
+// - The changes of the items are kept in a journal, so that whatever is
+//   made of the items can be updated by only the changed ones
+struct ImgLayer
 {
-	ImgFill();
-};
+	static const Color default_color;
+
+	// Count of the latest changes kept in the journal
+	static const size_t journal_size = 4096;
+
+	// Where a handle points to
+	struct Slot
+	{
+		ImgItemType type       = NO_TYPE;
+		uint32_t    index      = 0;
+		uint32_t    generation = 0;
+	};
+
+	ImgControlPoints control_points;
+	ImgLines         lines;
+	ImgFills         fills;
+
+	ImgLayer();
+
+	ImgItemHandle add_control_point( float x, float y, Color color = default_color );
+	ImgItemHandle add_line( float ax, float ay, float bx, float by, float width, Color color = default_color, ImgLineStyle style = ImgLineStyle() );
+	ImgItemHandle add_fill( float x, float y, Color color = default_color );
+	ImgItemHandle add_fill( float x, float y, ImgPath path, Color color = default_color );
+
+	bool remove( ImgItemHandle handle );
+	void clear();
 
+	bool move_item( ImgItemHandle handle, float dx, float dy );
+	void item_changed( ImgItemHandle handle );
 
+	// Moves the item on top of the other items of its type, the handle stays valid
+	bool bring_to_front( ImgItemHandle handle );
+
+	// An item of the type added now within the bounds would be drawn over the
+	// items it overlaps, no item of a type drawn after it is in the bounds
+	bool is_drawn_on_top( ImgItemType type, const ImgBounds &bounds ) const;
+
+	bool contains( ImgItemHandle handle ) const;
+	ImgItemType get_type( ImgItemHandle handle ) const;
+
+	// Index of the item in the pool of its type
+	size_t get_index( ImgItemHandle handle ) const;
+
+	// Handle of the item in the slot, or a null handle if the slot is free
+	// - The pools give the slots of their items in the slots column
+	ImgItemHandle find_handle( uint32_t slot ) const;
+
+	// Count of the items that haven't been removed
+	size_t size() const;
+
+	void translate( float dx, float dy );
+
+	// Changes whenever the items change, to a value that was never used before
+	uint64_t get_version() const { return version; }
+
+	// Version of the layer when the item last changed, 0 if there is no such item
+	uint64_t get_item_version( ImgItemHandle handle ) const;
+
+	// Appends the changes made after the layer had since_version, oldest first
+	// - Returns false when the journal doesn't reach that far back, or when
+	//   all the items may have changed since then by clear(), translate()
+	//   or the history, whatever is made of the items has to be made again
+	bool get_changes( uint64_t since_version, std::vector<ImgChange> &changes ) const;
+
+	ImgBounds get_bounds( ImgItemHandle handle ) const;
+
+	// Topmost item within max_distance of the point, or a null handle
+	ImgItemHandle find_item_at( float x, float y, float max_distance ) const;
+
+	// Closest item within max_distance of the point, or a null handle
+	ImgItemHandle find_nearest_item( float x, float y, float max_distance ) const;
+
+	// Items whose bounds intersect the area, for rubber band selection
+	void find_items_in( const ImgBounds &area, std::vector<ImgItemHandle> &handles ) const;
+
+	// Items to draw for the area, replaces the contents of indices
+	void find_visible( const ImgBounds &area, ImgLayerIndices &indices ) const;
+
+  protected:
+	// Saves and restores the slots and the index with the items
+	friend struct ImgHistory;
+
+	std::vector<Slot>     item_slots;
+	std::vector<uint32_t> free_slots;
+	ImgSpatialIndex       index;
+	uint64_t              version = 0;
+
+	// Versions of the items by their slots, and the journal
+	// that reaches back to journal_start
+	std::vector<uint64_t>  slot_versions;
+	std::deque<ImgChange>  journal;
+	uint64_t               journal_start = 0;
+
+	void changed( ImgChangeType type, ImgItemHandle handle );
+
+	// All the items may have changed
+	void changed_all();
+	ImgItemHandle make_handle( ImgItemType type, size_t index );
+	ImgItemHandle get_handle( uint32_t slot_index ) const;
+	const Slot *find_slot( ImgItemHandle handle ) const;
+	ImgItemPool &get_pool( ImgItemType type );
+	void compact_if_sparse( ImgItemType type );
+
+	ImgBounds get_item_bounds( ImgItemType type, size_t i ) const;
+	float get_item_distance( ImgItemType type, size_t i, float x, float y ) const;
 };
 
+
+};
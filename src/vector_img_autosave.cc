@@ -0,0 +1,914 @@
+#include "vector_img_autosave.hh"
+#include "vector_img_file.hh"
+#include "vector_img_column.hh"
+#include "common_tools.hh"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+using namespace std;
+using namespace vector_img;
+using namespace vector_img::journal_format;
+
+namespace vector_img
+{
+	// Columns of a layer that changed as a whole, read by the thread
+	struct ImgAutosaveLayer
+	{
+		ImgColumn<uint32_t>     point_slots;
+		ImgColumn<float>        point_x;
+		ImgColumn<float>        point_y;
+		ImgColumn<Color>        point_color;
+		ImgColumn<uint32_t>     line_slots;
+		ImgColumn<float>        line_ax;
+		ImgColumn<float>        line_ay;
+		ImgColumn<float>        line_bx;
+		ImgColumn<float>        line_by;
+		ImgColumn<float>        line_width;
+		ImgColumn<Color>        line_color;
+		ImgColumn<ImgLineStyle> line_style;
+		ImgColumn<uint32_t>     fill_slots;
+		ImgColumn<float>        fill_x;
+		ImgColumn<float>        fill_y;
+		ImgColumn<Color>        fill_color;
+		ImgColumn<ImgPath>      fill_path;
+	};
+}
+
+
+
+namespace
+{
+	// Image kept by the thread, and where the items of the edited image are in it
+	struct MirrorLayer
+	{
+		vector<ImgItemHandle> handles;      // by the slots of the edited image
+		vector<uint32_t>      source_slots; // by the slots of the mirror
+	};
+
+	struct Mirror
+	{
+		VectorImg           image;
+		vector<MirrorLayer> layers;
+	};
+
+
+
+	template<typename Value>
+	void write_value( vector<char> &batch, const Value &value )
+	{
+		const auto bytes = reinterpret_cast<const char*>( &value );
+		batch.insert( batch.end(), bytes, bytes + sizeof( Value ) );
+	}
+
+
+
+	struct BatchReader
+	{
+		const char *data;
+		size_t      size;
+		size_t      position;
+
+		template<typename Value>
+		bool read( Value &value )
+		{
+			if( size - position < sizeof( Value ) )
+			{
+				return false;
+			}
+			memcpy( &value, data + position, sizeof( Value ) );
+			position += sizeof( Value );
+			return true;
+		}
+	};
+
+
+
+	// Calls the function with the handles of the items, in the order of the document
+	template<typename Function>
+	void for_each_item( const ImgLayer &layer, Function function )
+	{
+		const ImgItemPool *pools[] = { &layer.control_points, &layer.lines, &layer.fills };
+		for( const auto pool : pools )
+		{
+			for( size_t i = 0; i < pool->size(); i++ )
+			{
+				if( !pool->is_removed( i ) )
+				{
+					function( layer.find_handle( pool->slots[i] ) );
+				}
+			}
+		}
+	}
+
+
+
+	void write_item_start( vector<char> &batch, uint32_t layer_i, uint32_t slot, ImgItemType type )
+	{
+		write_value( batch, SET_ITEM );
+		write_value( batch, layer_i );
+		write_value( batch, slot );
+		write_value( batch, type );
+	}
+
+
+
+	void write_line( vector<char> &batch, float ax, float ay, float bx, float by, float width, Color color, ImgLineStyle style )
+	{
+		file_format::LineRecord record;
+		memset( &record, 0, sizeof( record ) );
+		record.ax = ax;
+		record.ay = ay;
+		record.bx = bx;
+		record.by = by;
+		record.width = width;
+		record.color = color;
+		record.cap = style.cap;
+		record.join = style.join;
+		write_value( batch, record );
+	}
+
+
+
+	void write_fill( vector<char> &batch, float x, float y, Color color, const ImgPath &path )
+	{
+		file_format::FillRecord record;
+		memset( &record, 0, sizeof( record ) );
+		record.x = x;
+		record.y = y;
+		record.color = color;
+		record.contour_count = static_cast<uint32_t>( path.contour_ends.size() );
+		record.rule = path.rule;
+		write_value( batch, record );
+
+		const auto contour_ends = reinterpret_cast<const char*>( path.contour_ends.data() );
+		batch.insert( batch.end(), contour_ends, contour_ends + path.contour_ends.size() * sizeof( uint32_t ) );
+		write_value( batch, static_cast<uint32_t>( path.points.size() ) );
+		const auto points = reinterpret_cast<const char*>( path.points.data() );
+		batch.insert( batch.end(), points, points + path.points.size() * sizeof( ImgPoint ) );
+	}
+
+
+
+	void write_item( vector<char> &batch, const ImgLayer &layer, uint32_t layer_i, ImgItemHandle handle )
+	{
+		const auto type = layer.get_type( handle );
+		const auto i = layer.get_index( handle );
+		write_item_start( batch, layer_i, handle.slot, type );
+
+		switch( type )
+		{
+			case CONTROL_POINT:
+			{
+				const auto &points = layer.control_points;
+				write_value( batch, file_format::PointRecord{ points.x[i], points.y[i], points.color[i] } );
+				break;
+			}
+
+			case LINE:
+			{
+				const auto &lines = layer.lines;
+				write_line( batch, lines.ax[i], lines.ay[i], lines.bx[i], lines.by[i], lines.width[i], lines.color[i], lines.style[i] );
+				break;
+			}
+
+			default:
+			{
+				const auto &fills = layer.fills;
+				write_fill( batch, fills.x[i], fills.y[i], fills.color[i], fills.path[i] );
+				break;
+			}
+		}
+	}
+
+
+
+	// Clears the layer and adds the items of the columns, in the order of the document
+	void write_layer( vector<char> &batch, const ImgAutosaveLayer &layer, uint32_t layer_i )
+	{
+		write_value( batch, CLEAR_LAYER );
+		write_value( batch, layer_i );
+
+		for( size_t i = 0; i < layer.point_slots.size; i++ )
+		{
+			const auto slot = layer.point_slots.get( i );
+			if( slot != ImgItemHandle::no_slot )
+			{
+				write_item_start( batch, layer_i, slot, CONTROL_POINT );
+				write_value( batch, file_format::PointRecord{ layer.point_x.get( i ), layer.point_y.get( i ), layer.point_color.get( i ) } );
+			}
+		}
+
+		for( size_t i = 0; i < layer.line_slots.size; i++ )
+		{
+			const auto slot = layer.line_slots.get( i );
+			if( slot != ImgItemHandle::no_slot )
+			{
+				write_item_start( batch, layer_i, slot, LINE );
+				write_line(
+					batch,
+					layer.line_ax.get( i ),
+					layer.line_ay.get( i ),
+					layer.line_bx.get( i ),
+					layer.line_by.get( i ),
+					layer.line_width.get( i ),
+					layer.line_color.get( i ),
+					layer.line_style.get( i )
+				);
+			}
+		}
+
+		for( size_t i = 0; i < layer.fill_slots.size; i++ )
+		{
+			const auto slot = layer.fill_slots.get( i );
+			if( slot != ImgItemHandle::no_slot )
+			{
+				write_item_start( batch, layer_i, slot, FILL );
+				write_fill( batch, layer.fill_x.get( i ), layer.fill_y.get( i ), layer.fill_color.get( i ), layer.fill_path.get( i ) );
+			}
+		}
+	}
+
+
+
+	void write_slot_maps( const Mirror &mirror, vector<char> &batch )
+	{
+		for( size_t layer_i = 0; layer_i < mirror.layers.size(); layer_i++ )
+		{
+			const auto &layer = *mirror.image.layers[layer_i];
+			const auto &source_slots = mirror.layers[layer_i].source_slots;
+			write_value( batch, MAP_SLOTS );
+			write_value( batch, static_cast<uint32_t>( layer_i ) );
+			write_value( batch, static_cast<uint32_t>( layer.size() ) );
+			for_each_item( layer, [&]( ImgItemHandle handle )
+			{
+				write_value( batch, source_slots[handle.slot] );
+			} );
+		}
+	}
+
+
+
+	ImgItemHandle find_item( const MirrorLayer &layer, uint32_t source_slot )
+	{
+		return source_slot < layer.handles.size() ? layer.handles[source_slot] : ImgItemHandle();
+	}
+
+
+
+	void map_item( MirrorLayer &layer, uint32_t source_slot, ImgItemHandle handle )
+	{
+		if( source_slot >= layer.handles.size() )
+		{
+			layer.handles.resize( source_slot + 1 );
+		}
+		if( handle.slot >= layer.source_slots.size() )
+		{
+			layer.source_slots.resize( handle.slot + 1, ImgItemHandle::no_slot );
+		}
+		layer.handles[source_slot] = handle;
+		layer.source_slots[handle.slot] = source_slot;
+	}
+
+
+
+	bool read_path( BatchReader &reader, uint32_t contour_count, ImgPath &path )
+	{
+		uint32_t point_count;
+		path.contour_ends.resize( contour_count );
+		for( auto &end : path.contour_ends )
+		{
+			if( !reader.read( end ) )
+			{
+				return false;
+			}
+		}
+		if( !reader.read( point_count ) || (reader.size - reader.position) / sizeof( ImgPoint ) < point_count )
+		{
+			return false;
+		}
+
+		path.points.resize( point_count );
+		memcpy( path.points.data(), reader.data + reader.position, point_count * sizeof( ImgPoint ) );
+		reader.position += point_count * sizeof( ImgPoint );
+		return true;
+	}
+
+
+
+	// Changes the item in its place, or adds it on top if it is new
+	bool set_item( BatchReader &reader, ImgLayer &layer, MirrorLayer &mirror_layer, uint32_t source_slot )
+	{
+		ImgItemType type;
+		if( !reader.read( type ) )
+		{
+			return false;
+		}
+
+		auto handle = find_item( mirror_layer, source_slot );
+		if( !handle.is_null() && layer.get_type( handle ) != type )
+		{
+			layer.remove( handle );
+			handle = ImgItemHandle();
+		}
+
+		switch( type )
+		{
+			case CONTROL_POINT:
+			{
+				file_format::PointRecord record;
+				if( !reader.read( record ) )
+				{
+					return false;
+				}
+				if( handle.is_null() )
+				{
+					handle = layer.add_control_point( record.x, record.y, record.color );
+					break;
+				}
+				const auto i = layer.get_index( handle );
+				layer.control_points.x[i] = record.x;
+				layer.control_points.y[i] = record.y;
+				layer.control_points.color[i] = record.color;
+				layer.item_changed( handle );
+				break;
+			}
+
+			case LINE:
+			{
+				file_format::LineRecord record;
+				if( !reader.read( record ) )
+				{
+					return false;
+				}
+				ImgLineStyle style;
+				style.cap = static_cast<ImgLineCap>( record.cap );
+				style.join = static_cast<ImgLineJoin>( record.join );
+				if( handle.is_null() )
+				{
+					handle = layer.add_line( record.ax, record.ay, record.bx, record.by, record.width, record.color, style );
+					break;
+				}
+				const auto i = layer.get_index( handle );
+				layer.lines.ax[i] = record.ax;
+				layer.lines.ay[i] = record.ay;
+				layer.lines.bx[i] = record.bx;
+				layer.lines.by[i] = record.by;
+				layer.lines.width[i] = record.width;
+				layer.lines.color[i] = record.color;
+				layer.lines.style[i] = style;
+				layer.item_changed( handle );
+				break;
+			}
+
+			case FILL:
+			{
+				file_format::FillRecord record;
+				ImgPath path;
+				if( !reader.read( record ) || !read_path( reader, record.contour_count, path ) )
+				{
+					return false;
+				}
+				path.rule = static_cast<ImgFillRule>( record.rule );
+				if( handle.is_null() )
+				{
+					handle = layer.add_fill( record.x, record.y, move( path ), record.color );
+					break;
+				}
+				const auto i = layer.get_index( handle );
+				layer.fills.x[i] = record.x;
+				layer.fills.y[i] = record.y;
+				layer.fills.color[i] = record.color;
+				layer.fills.path[i] = move( path );
+				layer.item_changed( handle );
+				break;
+			}
+
+			default:
+				return false;
+		}
+
+		map_item( mirror_layer, source_slot, handle );
+		return true;
+	}
+
+
+
+	bool apply_operation( Operation operation, BatchReader &reader, Mirror &mirror )
+	{
+		if( operation == SET_IMAGE )
+		{
+			uint32_t img_w, img_h, layer_count;
+			if( !reader.read( img_w ) || !reader.read( img_h ) || !reader.read( layer_count ) )
+			{
+				return false;
+			}
+
+			auto &layers = mirror.image.layers;
+			mirror.image.img_w = img_w;
+			mirror.image.img_h = img_h;
+			layers.resize( min<size_t>( layers.size(), layer_count ) );
+			while( layers.size() < layer_count )
+			{
+				layers.emplace_back( new ImgLayer() );
+			}
+			mirror.layers.resize( layer_count );
+			return true;
+		}
+
+		uint32_t layer_i;
+		if( !reader.read( layer_i ) || layer_i >= mirror.layers.size() )
+		{
+			return false;
+		}
+
+		auto &layer = *mirror.image.layers[layer_i];
+		auto &mirror_layer = mirror.layers[layer_i];
+		if( operation == CLEAR_LAYER )
+		{
+			layer.clear();
+			mirror_layer = MirrorLayer();
+			return true;
+		}
+
+		if( operation == MAP_SLOTS )
+		{
+			uint32_t count;
+			if( !reader.read( count ) || count != layer.size() )
+			{
+				return false;
+			}
+
+			auto is_valid = true;
+			for_each_item( layer, [&]( ImgItemHandle handle )
+			{
+				uint32_t source_slot;
+				is_valid = is_valid && reader.read( source_slot );
+				if( is_valid )
+				{
+					map_item( mirror_layer, source_slot, handle );
+				}
+			} );
+			return is_valid;
+		}
+
+		uint32_t source_slot;
+		if( !reader.read( source_slot ) )
+		{
+			return false;
+		}
+
+		switch( operation )
+		{
+			case SET_ITEM:
+				return set_item( reader, layer, mirror_layer, source_slot );
+
+			case REMOVE_ITEM:
+			{
+				const auto handle = find_item( mirror_layer, source_slot );
+				if( !handle.is_null() )
+				{
+					layer.remove( handle );
+					mirror_layer.handles[source_slot] = ImgItemHandle();
+				}
+				return true;
+			}
+
+			case RAISE_ITEM:
+				layer.bring_to_front( find_item( mirror_layer, source_slot ) );
+				return true;
+
+			default:
+				return false;
+		}
+	}
+
+
+
+	bool apply_batch( const char *data, size_t size, Mirror &mirror )
+	{
+		BatchReader reader{ data, size, 0 };
+		Operation operation;
+		while( reader.read( operation ) )
+		{
+			if( !apply_operation( operation, reader, mirror ) )
+			{
+				return false;
+			}
+		}
+
+		return reader.position == size;
+	}
+
+
+
+	void write_batch( ofstream &stream, const vector<char> &batch, const string &path )
+	{
+		BatchHeader header;
+		header.size = static_cast<uint32_t>( batch.size() );
+		header.checksum = update_crc32( 0, batch.data(), batch.size() );
+		stream.write( reinterpret_cast<const char*>( &header ), sizeof( header ) );
+		stream.write( batch.data(), batch.size() );
+		stream.flush();
+		if( !stream )
+		{
+			throw runtime_error( "Couldn't write the file: '" + path + "'" );
+		}
+
+		// A batch is saved only once it's on the disk
+		tools::sync_file( path );
+	}
+
+
+
+	string get_journal_path( const string &path )
+	{
+		return path + ".journal";
+	}
+
+
+
+	// Writes the mirror as the document and starts a new journal for it,
+	// returns the size of the journal
+	size_t compact( const Mirror &mirror, const string &path, ofstream &journal )
+	{
+		journal.close();
+
+		const auto temporary_path = path + ".tmp";
+		save_document( mirror.image, temporary_path );
+		tools::sync_file( temporary_path );
+		tools::replace_file( temporary_path, path );
+
+		Header header;
+		memset( &header, 0, sizeof( header ) );
+		header.magic = magic;
+		header.version = version;
+		header.document_checksum = ImgDocument( path ).get_checksum();
+
+		// Until the new journal is in place, the old one doesn't match the document
+		const auto journal_path = get_journal_path( path );
+		const auto temporary_journal_path = journal_path + ".tmp";
+		ofstream stream( temporary_journal_path, ios::binary | ios::trunc );
+		if( !stream )
+		{
+			throw runtime_error( "Couldn't open the file for writing: '" + temporary_journal_path + "'" );
+		}
+
+		vector<char> batch;
+		write_slot_maps( mirror, batch );
+		stream.write( reinterpret_cast<const char*>( &header ), sizeof( header ) );
+		write_batch( stream, batch, temporary_journal_path );
+		stream.close();
+		tools::replace_file( temporary_journal_path, journal_path );
+
+		journal.open( journal_path, ios::binary | ios::app );
+		if( !journal )
+		{
+			throw runtime_error( "Couldn't open the file for writing: '" + journal_path + "'" );
+		}
+		return sizeof( header ) + sizeof( BatchHeader ) + batch.size();
+	}
+}
+
+
+
+ImgAutosave::ImgAutosave( const string &path, size_t compact_size )
+: path( path ),
+  compact_size( compact_size ),
+  img_w( 0 ),
+  img_h( 0 ),
+  queued_count( 0 ),
+  saved_count( 0 ),
+  compaction_count( 0 ),
+  stopping( false )
+{
+	worker = thread( [this]() { run_worker(); } );
+}
+
+
+
+ImgAutosave::~ImgAutosave()
+{
+	{
+		lock_guard<mutex> batches_lock( batches_mutex );
+		stopping = true;
+	}
+	batches_changed.notify_all();
+	worker.join();
+}
+
+
+
+void ImgAutosave::snapshot( const VectorImg &image )
+{
+	QueuedSnapshot snapshot;
+	auto &batch = snapshot.batch;
+	if( image.img_w != img_w || image.img_h != img_h || image.layers.size() != layer_states.size() )
+	{
+		img_w = image.img_w;
+		img_h = image.img_h;
+		layer_states.resize( image.layers.size() );
+		write_value( batch, SET_IMAGE );
+		write_value( batch, static_cast<uint32_t>( img_w ) );
+		write_value( batch, static_cast<uint32_t>( img_h ) );
+		write_value( batch, static_cast<uint32_t>( layer_states.size() ) );
+	}
+
+	// Unchanged layers cost a comparison, changed ones the items that changed
+	for( size_t i = 0; i < image.layers.size(); i++ )
+	{
+		const auto layer = image.layers[i].get();
+		const auto layer_i = static_cast<uint32_t>( i );
+		auto &state = layer_states[i];
+		if( !layer )
+		{
+			if( state.layer )
+			{
+				write_value( batch, CLEAR_LAYER );
+				write_value( batch, layer_i );
+				state = LayerState();
+			}
+			continue;
+		}
+
+		if( layer == state.layer && layer->get_version() == state.version )
+		{
+			continue;
+		}
+
+		// Layers that were replaced or changed as a whole are written out by the thread
+		if( layer != state.layer || !add_changes( *layer, layer_i, state.version, batch ) )
+		{
+			add_layer( *layer, layer_i, state, snapshot );
+		}
+		state.layer = layer;
+		state.version = layer->get_version();
+	}
+
+	if( batch.empty() && snapshot.layers.empty() )
+	{
+		return;
+	}
+
+	{
+		lock_guard<mutex> batches_lock( batches_mutex );
+		queued_snapshots.push_back( move( snapshot ) );
+		queued_count++;
+	}
+	batches_changed.notify_all();
+}
+
+
+
+void ImgAutosave::add_layer( const ImgLayer &layer, uint32_t layer_i, LayerState &state, QueuedSnapshot &snapshot )
+{
+	// Costs a comparison with the previous copy and the chunks that changed,
+	// like the steps of the history
+	const ImgAutosaveLayer empty_columns;
+	const auto &from = state.columns ? *state.columns : empty_columns;
+
+	auto columns = make_shared<ImgAutosaveLayer>();
+	auto &to = *columns;
+	save_column( layer.control_points.slots, from.point_slots, to.point_slots );
+	save_column( layer.control_points.x, from.point_x, to.point_x );
+	save_column( layer.control_points.y, from.point_y, to.point_y );
+	save_column( layer.control_points.color, from.point_color, to.point_color );
+	save_column( layer.lines.slots, from.line_slots, to.line_slots );
+	save_column( layer.lines.ax, from.line_ax, to.line_ax );
+	save_column( layer.lines.ay, from.line_ay, to.line_ay );
+	save_column( layer.lines.bx, from.line_bx, to.line_bx );
+	save_column( layer.lines.by, from.line_by, to.line_by );
+	save_column( layer.lines.width, from.line_width, to.line_width );
+	save_column( layer.lines.color, from.line_color, to.line_color );
+	save_column( layer.lines.style, from.line_style, to.line_style );
+	save_column( layer.fills.slots, from.fill_slots, to.fill_slots );
+	save_column( layer.fills.x, from.fill_x, to.fill_x );
+	save_column( layer.fills.y, from.fill_y, to.fill_y );
+	save_column( layer.fills.color, from.fill_color, to.fill_color );
+	save_column( layer.fills.path, from.fill_path, to.fill_path );
+
+	state.columns = columns;
+	snapshot.layers.push_back( WholeLayer{ layer_i, move( columns ) } );
+}
+
+
+
+bool ImgAutosave::add_changes( const ImgLayer &layer, uint32_t layer_i, uint64_t since_version, vector<char> &batch )
+{
+	changes.clear();
+	if( !layer.get_changes( since_version, changes ) )
+	{
+		return false;
+	}
+
+	// An item is written once with its latest values, where it first changed.
+	// Items removed later are left out, their removal is in the changes
+	written_items.clear();
+	for( const auto &change : changes )
+	{
+		const auto handle = change.handle;
+		if( change.type == ITEM_REMOVED )
+		{
+			write_value( batch, REMOVE_ITEM );
+			write_value( batch, layer_i );
+			write_value( batch, handle.slot );
+		}
+		else if( !layer.contains( handle ) )
+		{
+			continue;
+		}
+		else if( change.type == ITEM_REORDERED )
+		{
+			write_value( batch, RAISE_ITEM );
+			write_value( batch, layer_i );
+			write_value( batch, handle.slot );
+		}
+		else if( written_items.insert( static_cast<uint64_t>( handle.slot ) << 32 | handle.generation ).second )
+		{
+			write_item( batch, layer, layer_i, handle );
+		}
+	}
+
+	return true;
+}
+
+
+
+void ImgAutosave::flush()
+{
+	unique_lock<mutex> batches_lock( batches_mutex );
+	const auto count = queued_count;
+	batches_changed.wait( batches_lock, [this, count]() { return saved_count >= count; } );
+}
+
+
+
+string ImgAutosave::get_error() const
+{
+	lock_guard<mutex> batches_lock( batches_mutex );
+	return error;
+}
+
+
+
+size_t ImgAutosave::get_compaction_count() const
+{
+	lock_guard<mutex> batches_lock( batches_mutex );
+	return compaction_count;
+}
+
+
+
+void ImgAutosave::run_worker()
+{
+	Mirror mirror;
+	ofstream journal;
+	size_t journal_size = 0;
+	auto needs_compaction = true;
+
+	unique_lock<mutex> batches_lock( batches_mutex );
+	while( true )
+	{
+		// The queued batches are saved before stopping
+		batches_changed.wait( batches_lock, [this]() { return stopping || !queued_snapshots.empty(); } );
+		if( queued_snapshots.empty() )
+		{
+			return;
+		}
+
+		auto snapshot = move( queued_snapshots.front() );
+		queued_snapshots.pop_front();
+		batches_lock.unlock();
+
+		// The layers that changed as a whole are written here instead of the UI thread
+		auto &batch = snapshot.batch;
+		for( const auto &whole_layer : snapshot.layers )
+		{
+			write_layer( batch, *whole_layer.columns, whole_layer.layer_i );
+		}
+
+		string batch_error;
+		auto compacted = false;
+		try
+		{
+			apply_batch( batch.data(), batch.size(), mirror );
+			if( !needs_compaction )
+			{
+				write_batch( journal, batch, get_journal_path( path ) );
+				journal_size += sizeof( BatchHeader ) + batch.size();
+				needs_compaction = journal_size > compact_size;
+			}
+
+			// The mirror has the batch already, so the new journal starts without it
+			if( needs_compaction )
+			{
+				journal_size = compact( mirror, path, journal );
+				needs_compaction = false;
+				compacted = true;
+			}
+		}
+		catch( const exception &e )
+		{
+			// The journal may have lost the batch, the next one writes everything
+			batch_error = e.what();
+			needs_compaction = true;
+		}
+
+		batches_lock.lock();
+		saved_count++;
+		compaction_count += compacted ? 1 : 0;
+		error = batch_error;
+		batches_changed.notify_all();
+	}
+}
+
+
+
+bool ImgAutosave::recover( const string &path, VectorImg &image )
+{
+	if( !tools::is_file_readable( path ) )
+	{
+		return false;
+	}
+
+	Mirror mirror;
+	uint32_t document_checksum;
+	{
+		const ImgDocument document( path );
+		if( !document.verify() )
+		{
+			throw runtime_error( "The autosaved document is damaged: '" + path + "'" );
+		}
+		document.load( mirror.image );
+		mirror.layers.resize( mirror.image.layers.size() );
+		document_checksum = document.get_checksum();
+	}
+
+	// A journal of an older document is left over from a compaction that didn't
+	// finish, the document has its changes. The journal ends at a broken batch
+	const auto journal_path = get_journal_path( path );
+	if( tools::is_file_readable( journal_path ) )
+	{
+		const tools::MappedFile journal( journal_path );
+		Header header;
+		memset( &header, 0, sizeof( header ) );
+		if( journal.size() >= sizeof( header ) )
+		{
+			memcpy( &header, journal.data(), sizeof( header ) );
+		}
+
+		const auto is_valid = header.magic == magic
+		                   && header.version <= version
+		                   && header.document_checksum == document_checksum;
+
+		auto offset = is_valid ? sizeof( header ) : journal.size();
+		while( journal.size() - offset >= sizeof( BatchHeader ) )
+		{
+			BatchHeader batch;
+			memcpy( &batch, journal.data() + offset, sizeof( batch ) );
+			offset += sizeof( batch );
+
+			const auto data = journal.data() + offset;
+			if( batch.size > journal.size() - offset || update_crc32( 0, data, batch.size ) != batch.checksum ||
+			    !apply_batch( data, batch.size, mirror ) )
+			{
+				break;
+			}
+			offset += batch.size;
+		}
+	}
+
+	image.img_w = mirror.image.img_w;
+	image.img_h = mirror.image.img_h;
+	image.layers = move( mirror.image.layers );
+	return true;
+}
+
+
+
+void ImgAutosave::remove_files( const string &path )
+{
+	const auto journal_path = get_journal_path( path );
+	for( const auto &file_path : { path, path + ".tmp", journal_path, journal_path + ".tmp" } )
+	{
+		remove( file_path.c_str() );
+	}
+}
+
+
+
+void ImgAutosave::move_files( const string &from, const string &to )
+{
+	remove_files( to );
+	const auto journal_path = get_journal_path( from );
+	if( tools::is_file_readable( journal_path ) )
+	{
+		tools::replace_file( journal_path, get_journal_path( to ) );
+	}
+	if( tools::is_file_readable( from ) )
+	{
+		tools::replace_file( from, to );
+	}
+}
@@ -0,0 +1,167 @@
+#pragma once
+#include "vector_img.hh"
+
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <unordered_set>
+#include <condition_variable>
+
+namespace vector_img
+{
+
+
+struct ImgAutosaveLayer;
+
+
+
+// Journal files of the autosave, little endian
+// - The header names the document the journal continues by the
+//   checksum of its layer table, a journal of another document is ignored
+// - The header is followed by batches, one per snapshot. A batch is its
+//   size and CRC-32 followed by the changes, a batch cut short by a crash
+//   fails the check and ends the journal
+// - Items are named by their slots in the layers of the edited image,
+//   MAP_SLOTS gives the slots of the items of the document in their order.
+//   Fills are their record followed by u32 contour ends, a u32 point
+//   count and the points, SET_ITEM of a new slot adds the item on top
+namespace journal_format
+{
+	const uint32_t magic   = 0x4a524456; // "VDRJ"
+	const uint16_t version = 1;
+
+	enum Operation : uint8_t
+	{
+		SET_IMAGE,   // u32 width, u32 height, u32 layer count
+		CLEAR_LAYER, // u32 layer
+		SET_ITEM,    // u32 layer, u32 slot, u8 item type, the record of the item
+		REMOVE_ITEM, // u32 layer, u32 slot
+		RAISE_ITEM,  // u32 layer, u32 slot, brought to the front
+		MAP_SLOTS    // u32 layer, u32 count, u32 slots of the items
+	};
+
+	struct Header
+	{
+		uint32_t magic;
+		uint16_t version;
+		uint16_t reserved;
+		uint32_t document_checksum;
+		uint32_t reserved2;
+	};
+
+	struct BatchHeader
+	{
+		uint32_t size;
+		uint32_t checksum;
+	};
+
+	static_assert( sizeof( Header ) == 16 && sizeof( BatchHeader ) == 8, "Headers have to match the file layout" );
+}
+
+
+
+// Saves the image in the background, so that a crash loses only the latest edits
+// - snapshot() is called by the UI thread between the frames. It copies only
+//   the items that changed since the last snapshot, found by the journals of
+//   the layers, and hands them to the thread
+// - Layers that changed as a whole, when their journals don't reach back
+//   far enough, are copied to immutable column chunks shared with the
+//   previous copy of the layer, and the thread writes them out
+// - The thread appends the changes to a journal file next to the document
+//   and keeps its own copy of the image. When the journal grows past
+//   compact_size the copy is written as the document and the journal starts over
+// - The document and the journal are replaced by renaming new files over them.
+//   Each batch, and the new files before they are renamed, are synced to the
+//   disk, so that a power loss can't leave them empty
+struct ImgAutosave
+{
+	static const size_t default_compact_size = 16 * 1024 * 1024;
+
+	// Starts over with an empty document at the path, path + ".journal" is the journal
+	explicit ImgAutosave( const std::string &path, size_t compact_size = default_compact_size );
+
+	// Saves the snapshots taken so far before returning
+	~ImgAutosave();
+
+	// Delete potentially dangerous constructors and operators
+	ImgAutosave( ImgAutosave& )            = delete;
+	ImgAutosave& operator=( ImgAutosave& ) = delete;
+
+	void snapshot( const VectorImg &image );
+
+	// Blocks until the thread has saved the snapshots taken so far
+	void flush();
+
+	// Message of the last error of the thread, empty while saving works
+	std::string get_error() const;
+
+	// Count of the documents written, the first snapshot is always written as one
+	size_t get_compaction_count() const;
+
+	// Loads the document and replays its journal, returns false if there is no document
+	// - Throws runtime_error if the document is broken
+	static bool recover( const std::string &path, VectorImg &image );
+	static void remove_files( const std::string &path );
+
+	// Renames the document and the journal at from, if there are, to be at to
+	// - Throws runtime_error if they couldn't be renamed
+	static void move_files( const std::string &from, const std::string &to );
+
+  protected:
+	using LayerColumnsPtr = std::shared_ptr<const ImgAutosaveLayer>;
+
+	// What the last snapshot saw of a layer, and the columns
+	// it last copied to share their chunks with the next copy
+	struct LayerState
+	{
+		const ImgLayer *layer   = nullptr;
+		uint64_t        version = 0;
+		LayerColumnsPtr columns;
+	};
+
+	// Layer written out whole by the thread, after the changes of the batch
+	struct WholeLayer
+	{
+		uint32_t        layer_i;
+		LayerColumnsPtr columns;
+	};
+
+	struct QueuedSnapshot
+	{
+		std::vector<char>       batch;
+		std::vector<WholeLayer> layers;
+	};
+
+	std::string path;
+	size_t      compact_size;
+
+	// Used by the UI thread, written_items has the items
+	// already in the batch by their slots and generations
+	std::vector<LayerState>      layer_states;
+	size_t                       img_w;
+	size_t                       img_h;
+	std::vector<ImgChange>       changes;
+	std::unordered_set<uint64_t> written_items;
+
+	// Shared with the thread
+	mutable std::mutex             batches_mutex;
+	std::condition_variable        batches_changed;
+	std::deque<QueuedSnapshot>     queued_snapshots;
+	size_t                         queued_count;
+	size_t                         saved_count;
+	size_t                         compaction_count;
+	std::string                    error;
+	bool                           stopping;
+	std::thread                    worker;
+
+	void add_layer( const ImgLayer &layer, uint32_t layer_i, LayerState &state, QueuedSnapshot &snapshot );
+	bool add_changes( const ImgLayer &layer, uint32_t layer_i, uint64_t since_version, std::vector<char> &batch );
+	void run_worker();
+};
+
+
+};
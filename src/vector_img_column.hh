@@ -0,0 +1,148 @@
+#pragma once
+#include "vector_img.hh"
+
+#include <memory>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+namespace vector_img
+{
+
+
+// Values in a chunk, editing a few items copies this many values of each column
+const size_t column_chunk_size = 4096;
+
+
+
+// Copy of a column of a layer in immutable chunks
+// - save_column() shares the chunks that didn't change with the previous
+//   copy, so a copy costs a comparison and the chunks that changed
+// - The chunks can be read by other threads while the layer is edited
+template<typename T>
+struct ImgColumn
+{
+	std::vector<std::shared_ptr<const std::vector<T>>> chunks;
+	size_t size = 0;
+
+	const T &get( size_t i ) const { return (*chunks[i / column_chunk_size])[i % column_chunk_size]; }
+};
+
+
+
+inline bool is_same_value( float a, float b )
+{
+	// Bitwise, so that NaNs and negative zeros count as changes
+	return memcmp( &a, &b, sizeof( float ) ) == 0;
+}
+
+
+
+inline bool is_same_value( uint32_t a, uint32_t b )
+{
+	return a == b;
+}
+
+
+
+inline bool is_same_value( uint64_t a, uint64_t b )
+{
+	return a == b;
+}
+
+
+
+inline bool is_same_value( Color a, Color b )
+{
+	return memcmp( &a, &b, sizeof( Color ) ) == 0;
+}
+
+
+
+inline bool is_same_value( ImgLineStyle a, ImgLineStyle b )
+{
+	return a.cap == b.cap && a.join == b.join;
+}
+
+
+
+inline bool is_same_value( const ImgLayer::Slot &a, const ImgLayer::Slot &b )
+{
+	return a.type == b.type && a.index == b.index && a.generation == b.generation;
+}
+
+
+
+inline bool is_same_value( const ImgPath &a, const ImgPath &b )
+{
+	return a.rule == b.rule &&
+	       a.contour_ends == b.contour_ends &&
+	       a.points.size() == b.points.size() &&
+	       (a.points.empty() || memcmp( a.points.data(), b.points.data(), a.points.size() * sizeof( ImgPoint ) ) == 0);
+}
+
+
+
+template<typename T>
+bool is_same_values( const T *a, const T *b, size_t count )
+{
+	for( size_t i = 0; i < count; i++ )
+	{
+		if( !is_same_value( a[i], b[i] ) )
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+
+
+inline bool is_same_values( const float *a, const float *b, size_t count )
+{
+	return memcmp( a, b, count * sizeof( float ) ) == 0;
+}
+
+
+
+inline bool is_same_values( const uint32_t *a, const uint32_t *b, size_t count )
+{
+	return memcmp( a, b, count * sizeof( uint32_t ) ) == 0;
+}
+
+
+
+inline bool is_same_values( const Color *a, const Color *b, size_t count )
+{
+	return memcmp( a, b, count * sizeof( Color ) ) == 0;
+}
+
+
+
+// Reuses the chunks of the previous column that have the same values
+template<typename T>
+void save_column( const std::vector<T> &values, const ImgColumn<T> &previous, ImgColumn<T> &column )
+{
+	column.size = values.size();
+	column.chunks.reserve( (values.size() + column_chunk_size - 1) / column_chunk_size );
+
+	for( size_t begin = 0; begin < values.size(); begin += column_chunk_size )
+	{
+		const auto count = std::min( column_chunk_size, values.size() - begin );
+		const auto k = begin / column_chunk_size;
+		if( k < previous.chunks.size() )
+		{
+			const auto &chunk = previous.chunks[k];
+			if( chunk->size() == count && is_same_values( chunk->data(), values.data() + begin, count ) )
+			{
+				column.chunks.push_back( chunk );
+				continue;
+			}
+		}
+
+		column.chunks.push_back( std::make_shared<const std::vector<T>>( values.begin() + begin, values.begin() + begin + count ) );
+	}
+}
+
+
+};
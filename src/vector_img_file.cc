@@ -0,0 +1,892 @@
+#include "vector_img_file.hh"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+using namespace vector_img;
+using namespace vector_img::file_format;
+
+namespace
+{
+	// Sections start at multiples of this in the file
+	const size_t section_alignment = 8;
+
+	// Records are written out in blocks of this size
+	const size_t write_buffer_size = 64 * 1024;
+
+
+
+	template<typename Record>
+	Record read_record( const char *records, size_t i )
+	{
+		// The mapping may not be aligned for the record
+		Record record;
+		memcpy( &record, records + i * sizeof( Record ), sizeof( Record ) );
+		return record;
+	}
+
+
+
+	size_t get_padding( uint64_t offset )
+	{
+		return static_cast<size_t>( (section_alignment - offset % section_alignment) % section_alignment );
+	}
+
+
+
+	// Widths are positive, a positive width never becomes zero and
+	// widths past the range of half floats become the largest one
+	uint16_t to_half_float( float value )
+	{
+		if( !(value > 0.f) )
+		{
+			return 0;
+		}
+
+		int exponent = 0;
+		const auto fraction = frexp( value, &exponent );
+		if( exponent > 16 )
+		{
+			return 0x7bff;
+		}
+
+		// Subnormals are steps of 2^-24
+		if( exponent < -13 )
+		{
+			return static_cast<uint16_t>( max( ldexp( value, 24 ), 1.f ) + 0.5f );
+		}
+
+		// The rounding may carry to the exponent, which gives the right value
+		const auto mantissa = static_cast<uint32_t>( (fraction * 2.f - 1.f) * 1024.f + 0.5f );
+		const auto bits = (static_cast<uint32_t>( exponent + 14 ) << 10) + mantissa;
+		return static_cast<uint16_t>( min( bits, 0x7bffu ) );
+	}
+
+
+
+	float from_half_float( uint16_t value )
+	{
+		const auto exponent = (value >> 10) & 0x1f;
+		const auto mantissa = value & 0x3ff;
+		if( !exponent )
+		{
+			return ldexp( static_cast<float>( mantissa ), -24 );
+		}
+
+		return ldexp( static_cast<float>( 1024 + mantissa ), exponent - 25 );
+	}
+
+
+
+	void add_to_bounds( ImgBounds &bounds, const ImgBounds &item )
+	{
+		bounds.min_x = min( bounds.min_x, item.min_x );
+		bounds.min_y = min( bounds.min_y, item.min_y );
+		bounds.max_x = max( bounds.max_x, item.max_x );
+		bounds.max_y = max( bounds.max_y, item.max_y );
+	}
+
+
+
+	ImgBounds get_point_bounds( const PointRecord &point )
+	{
+		return { point.x, point.y, point.x, point.y };
+	}
+
+
+
+	ImgLineStyle get_line_style( const LineRecord &line )
+	{
+		ImgLineStyle style;
+		style.cap = static_cast<ImgLineCap>( line.cap );
+		style.join = static_cast<ImgLineJoin>( line.join );
+		return style;
+	}
+
+
+
+	ImgBounds get_line_bounds( const LineRecord &line )
+	{
+		const auto reach = get_line_style( line ).get_reach( line.width );
+		return {
+			min( line.ax, line.bx ) - reach,
+			min( line.ay, line.by ) - reach,
+			max( line.ax, line.bx ) + reach,
+			max( line.ay, line.by ) + reach
+		};
+	}
+
+
+
+	// Writes the records of a section and keeps its checksum
+	struct SectionWriter
+	{
+		ofstream &stream;
+		uint32_t  checksum;
+		uint64_t  size;
+
+		SectionWriter( ofstream &stream )
+		: stream( stream ),
+		  checksum( 0 ),
+		  size( 0 )
+		{
+			buffer.reserve( write_buffer_size );
+		}
+
+		template<typename Record>
+		void write( const Record &record )
+		{
+			const auto bytes = reinterpret_cast<const char*>( &record );
+			buffer.insert( buffer.end(), bytes, bytes + sizeof( Record ) );
+			if( buffer.size() >= write_buffer_size )
+			{
+				flush();
+			}
+		}
+
+		void flush()
+		{
+			checksum = update_crc32( checksum, buffer.data(), buffer.size() );
+			stream.write( buffer.data(), buffer.size() );
+			size += buffer.size();
+			buffer.clear();
+		}
+
+	  protected:
+		vector<char> buffer;
+	};
+
+
+
+	// Writes one layer in its final form, the bounds are taken
+	// from the written values so that they match the quantized items
+	struct LayerWriter
+	{
+		const ImgLayer &layer;
+		LayerEntry     &entry;
+		bool            quantize;
+
+		LayerWriter( const ImgLayer &layer, LayerEntry &entry, bool quantize )
+		: layer( layer ),
+		  entry( entry ),
+		  quantize( quantize )
+		{
+		}
+
+		void set_quantization();
+		void write( SectionWriter &writer );
+
+	  protected:
+		bool has_items = false;
+
+		uint16_t to_steps( float value, float origin ) const;
+		float to_coordinate( uint16_t steps, float origin ) const;
+		void add_item( const ImgBounds &bounds );
+	};
+
+
+
+	void LayerWriter::set_quantization()
+	{
+		auto min_x = INFINITY;
+		auto min_y = INFINITY;
+		auto max_x = -INFINITY;
+		auto max_y = -INFINITY;
+
+		const auto add_point = [&]( float x, float y )
+		{
+			min_x = min( min_x, x );
+			min_y = min( min_y, y );
+			max_x = max( max_x, x );
+			max_y = max( max_y, y );
+		};
+
+		const auto &control_points = layer.control_points;
+		for( size_t i = 0; i < control_points.size(); i++ )
+		{
+			if( !control_points.is_removed( i ) )
+			{
+				add_point( control_points.x[i], control_points.y[i] );
+			}
+		}
+
+		const auto &lines = layer.lines;
+		for( size_t i = 0; i < lines.size(); i++ )
+		{
+			if( !lines.is_removed( i ) )
+			{
+				add_point( lines.ax[i], lines.ay[i] );
+				add_point( lines.bx[i], lines.by[i] );
+			}
+		}
+
+		const auto &fills = layer.fills;
+		for( size_t i = 0; i < fills.size(); i++ )
+		{
+			if( !fills.is_removed( i ) )
+			{
+				add_point( fills.x[i], fills.y[i] );
+			}
+		}
+
+		const auto extent = max( max_x - min_x, max_y - min_y );
+		entry.origin_x = isfinite( min_x ) ? min_x : 0.f;
+		entry.origin_y = isfinite( min_y ) ? min_y : 0.f;
+		entry.step = isfinite( extent ) && extent > 0.f ? extent / UINT16_MAX : 1.f;
+	}
+
+
+
+	uint16_t LayerWriter::to_steps( float value, float origin ) const
+	{
+		const auto steps = round( (value - origin) / entry.step );
+		if( !(steps > 0.f) )
+		{
+			return 0;
+		}
+
+		return static_cast<uint16_t>( min( steps, static_cast<float>( UINT16_MAX ) ) );
+	}
+
+
+
+	float LayerWriter::to_coordinate( uint16_t steps, float origin ) const
+	{
+		return origin + steps * entry.step;
+	}
+
+
+
+	void LayerWriter::add_item( const ImgBounds &bounds )
+	{
+		if( has_items )
+		{
+			add_to_bounds( entry.bounds, bounds );
+		}
+		else
+		{
+			entry.bounds = bounds;
+			has_items = true;
+		}
+	}
+
+
+
+	void LayerWriter::write( SectionWriter &writer )
+	{
+		const auto &control_points = layer.control_points;
+		for( size_t i = 0; i < control_points.size(); i++ )
+		{
+			if( control_points.is_removed( i ) )
+			{
+				continue;
+			}
+
+			PointRecord point = { control_points.x[i], control_points.y[i], control_points.color[i] };
+			if( quantize )
+			{
+				const QuantizedPointRecord record = {
+					to_steps( point.x, entry.origin_x ), to_steps( point.y, entry.origin_y ), point.color
+				};
+				writer.write( record );
+				point.x = to_coordinate( record.x, entry.origin_x );
+				point.y = to_coordinate( record.y, entry.origin_y );
+			}
+			else
+			{
+				writer.write( point );
+			}
+
+			add_item( get_point_bounds( point ) );
+			entry.control_point_count++;
+		}
+
+		const auto &lines = layer.lines;
+		for( size_t i = 0; i < lines.size(); i++ )
+		{
+			if( lines.is_removed( i ) )
+			{
+				continue;
+			}
+
+			LineRecord line = {
+				lines.ax[i], lines.ay[i], lines.bx[i], lines.by[i], lines.width[i], lines.color[i],
+				lines.style[i].cap, lines.style[i].join, { 0, 0 }
+			};
+			if( quantize )
+			{
+				const QuantizedLineRecord record = {
+					to_steps( line.ax, entry.origin_x ), to_steps( line.ay, entry.origin_y ),
+					to_steps( line.bx, entry.origin_x ), to_steps( line.by, entry.origin_y ),
+					to_half_float( line.width ), line.cap, line.join, line.color
+				};
+				writer.write( record );
+				line.ax = to_coordinate( record.ax, entry.origin_x );
+				line.ay = to_coordinate( record.ay, entry.origin_y );
+				line.bx = to_coordinate( record.bx, entry.origin_x );
+				line.by = to_coordinate( record.by, entry.origin_y );
+				line.width = from_half_float( record.width );
+			}
+			else
+			{
+				writer.write( line );
+			}
+
+			add_item( get_line_bounds( line ) );
+			entry.line_count++;
+		}
+
+		const auto &fills = layer.fills;
+		for( size_t i = 0; i < fills.size(); i++ )
+		{
+			if( fills.is_removed( i ) )
+			{
+				continue;
+			}
+
+			const auto &path = fills.path[i];
+			FillRecord fill;
+			memset( &fill, 0, sizeof( fill ) );
+			fill.x = fills.x[i];
+			fill.y = fills.y[i];
+			fill.color = fills.color[i];
+			fill.first_contour = entry.contour_count;
+			fill.contour_count = static_cast<uint32_t>( path.contour_ends.size() );
+			fill.rule = path.rule;
+
+			if( quantize )
+			{
+				QuantizedFillRecord record;
+				memset( &record, 0, sizeof( record ) );
+				record.x = to_steps( fill.x, entry.origin_x );
+				record.y = to_steps( fill.y, entry.origin_y );
+				record.color = fill.color;
+				record.first_contour = fill.first_contour;
+				record.contour_count = fill.contour_count;
+				record.rule = fill.rule;
+				writer.write( record );
+
+				fill.x = to_coordinate( record.x, entry.origin_x );
+				fill.y = to_coordinate( record.y, entry.origin_y );
+			}
+			else
+			{
+				writer.write( fill );
+			}
+
+			const auto path_bounds = path.get_bounds();
+			add_item( {
+				fill.x + path_bounds.min_x,
+				fill.y + path_bounds.min_y,
+				fill.x + path_bounds.max_x,
+				fill.y + path_bounds.max_y
+			} );
+			entry.fill_count++;
+			entry.contour_count += fill.contour_count;
+		}
+
+		// Contour ends continue from the points of the previous fills
+		uint32_t first_point = 0;
+		for( size_t i = 0; i < fills.size(); i++ )
+		{
+			if( fills.is_removed( i ) )
+			{
+				continue;
+			}
+
+			for( const auto end : fills.path[i].contour_ends )
+			{
+				writer.write( first_point + end );
+			}
+			first_point += static_cast<uint32_t>( fills.path[i].points.size() );
+		}
+
+		for( size_t i = 0; i < fills.size(); i++ )
+		{
+			if( !fills.is_removed( i ) )
+			{
+				for( const auto &point : fills.path[i].points )
+				{
+					writer.write( point );
+				}
+			}
+		}
+		entry.path_point_count = first_point;
+
+		writer.flush();
+	}
+}
+
+
+
+uint32_t vector_img::update_crc32( uint32_t crc, const char *data, size_t size )
+{
+	static const auto table = []
+	{
+		vector<uint32_t> result( 256 );
+		for( uint32_t i = 0; i < 256; i++ )
+		{
+			auto value = i;
+			for( int bit = 0; bit < 8; bit++ )
+			{
+				value = (value & 1) ? (value >> 1) ^ 0xedb88320 : value >> 1;
+			}
+			result[i] = value;
+		}
+		return result;
+	}();
+
+	crc = ~crc;
+	for( size_t i = 0; i < size; i++ )
+	{
+		crc = table[(crc ^ static_cast<uint8_t>( data[i] )) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+
+
+void vector_img::save_document( const VectorImg &image, const string &path, const ImgSaveOptions &options )
+{
+	ofstream stream( path, ios::binary | ios::trunc );
+	if( !stream )
+	{
+		throw runtime_error( "Couldn't open the file for writing: '" + path + "'" );
+	}
+
+	Header header;
+	memset( &header, 0, sizeof( header ) );
+	header.magic = magic;
+	header.version = version;
+	header.flags = options.pack ? PACKED : options.quantize ? QUANTIZED | HALF_WIDTHS : 0;
+	header.img_w = static_cast<uint32_t>( image.img_w );
+	header.img_h = static_cast<uint32_t>( image.img_h );
+	header.layer_count = static_cast<uint32_t>( image.layers.size() );
+
+	// The header is written again once the table is in place
+	stream.write( reinterpret_cast<const char*>( &header ), sizeof( header ) );
+	uint64_t offset = sizeof( header );
+
+	const ImgLayer empty_layer;
+	const char padding[section_alignment] = {};
+
+	vector<LayerEntry> table( image.layers.size() );
+	vector<char> packed;
+	for( size_t i = 0; i < image.layers.size(); i++ )
+	{
+		auto &entry = table[i];
+		memset( &entry, 0, sizeof( entry ) );
+		entry.offset = offset;
+
+		const auto &layer = image.layers[i] ? *image.layers[i] : empty_layer;
+		uint64_t section_size = 0;
+		if( options.pack )
+		{
+			packed.clear();
+			const auto pack_header = pack_layer( layer, options.pack_step, packed );
+			entry.control_point_count = pack_header.control_point_count;
+			entry.line_count = pack_header.line_count;
+			entry.fill_count = pack_header.fill_count;
+			entry.contour_count = pack_header.contour_count;
+			entry.path_point_count = pack_header.path_point_count;
+			entry.origin_x = pack_header.origin_x;
+			entry.origin_y = pack_header.origin_y;
+			entry.step = pack_header.step;
+			entry.bounds = pack_header.bounds;
+			entry.packed_size = static_cast<uint32_t>( packed.size() );
+			entry.checksum = update_crc32( 0, packed.data(), packed.size() );
+
+			stream.write( packed.data(), packed.size() );
+			section_size = packed.size();
+		}
+		else
+		{
+			LayerWriter layer_writer( layer, entry, options.quantize );
+			if( options.quantize )
+			{
+				layer_writer.set_quantization();
+			}
+
+			SectionWriter writer( stream );
+			layer_writer.write( writer );
+			entry.checksum = writer.checksum;
+			section_size = writer.size;
+		}
+
+		const auto padding_size = get_padding( offset + section_size );
+		stream.write( padding, padding_size );
+		offset += section_size + padding_size;
+
+		if( !stream )
+		{
+			throw runtime_error( "Couldn't write the file: '" + path + "'" );
+		}
+	}
+
+	const auto table_data = reinterpret_cast<const char*>( table.data() );
+	const auto table_size = table.size() * sizeof( LayerEntry );
+	stream.write( table_data, table_size );
+
+	header.table_offset = offset;
+	header.table_checksum = update_crc32( 0, table_data, table_size );
+	stream.seekp( 0 );
+	stream.write( reinterpret_cast<const char*>( &header ), sizeof( header ) );
+
+	stream.flush();
+	if( !stream )
+	{
+		throw runtime_error( "Couldn't write the file: '" + path + "'" );
+	}
+}
+
+
+
+bool vector_img::is_document( const string &path )
+{
+	ifstream stream( path, ios::binary );
+	uint32_t file_magic = 0;
+	stream.read( reinterpret_cast<char*>( &file_magic ), sizeof( file_magic ) );
+	return stream && file_magic == magic;
+}
+
+
+
+ImgDocumentLayer::ImgDocumentLayer( const LayerEntry &entry, const char *section, uint16_t flags )
+: entry( entry ),
+  quantized( (flags & QUANTIZED) != 0 ),
+  packed( (flags & PACKED) != 0 ),
+  half_widths( (flags & HALF_WIDTHS) != 0 )
+{
+	const auto point_size = quantized ? sizeof( QuantizedPointRecord ) : sizeof( PointRecord );
+	const auto line_size = quantized ? sizeof( QuantizedLineRecord ) : sizeof( LineRecord );
+	const auto fill_size = quantized ? sizeof( QuantizedFillRecord ) : sizeof( FillRecord );
+
+	// Packed layers are read from the start of the section as a whole
+	control_points = section;
+	if( packed )
+	{
+		lines = fills = contour_ends = path_points = nullptr;
+		return;
+	}
+
+	lines = control_points + entry.control_point_count * point_size;
+	fills = lines + entry.line_count * line_size;
+	contour_ends = fills + entry.fill_count * fill_size;
+	path_points = contour_ends + entry.contour_count * sizeof( uint32_t );
+}
+
+
+
+size_t ImgDocumentLayer::get_section_size() const
+{
+	if( packed )
+	{
+		return entry.packed_size;
+	}
+
+	const auto point_size = quantized ? sizeof( QuantizedPointRecord ) : sizeof( PointRecord );
+	const auto line_size = quantized ? sizeof( QuantizedLineRecord ) : sizeof( LineRecord );
+	const auto fill_size = quantized ? sizeof( QuantizedFillRecord ) : sizeof( FillRecord );
+
+	return static_cast<size_t>( entry.control_point_count ) * point_size +
+	       static_cast<size_t>( entry.line_count ) * line_size +
+	       static_cast<size_t>( entry.fill_count ) * fill_size +
+	       static_cast<size_t>( entry.contour_count ) * sizeof( uint32_t ) +
+	       static_cast<size_t>( entry.path_point_count ) * sizeof( ImgPoint );
+}
+
+
+
+void ImgDocumentLayer::check_records() const
+{
+	if( packed )
+	{
+		throw runtime_error( "The records of packed layers can't be read one by one" );
+	}
+}
+
+
+
+PointRecord ImgDocumentLayer::get_control_point( size_t i ) const
+{
+	check_records();
+	if( !quantized )
+	{
+		return read_record<PointRecord>( control_points, i );
+	}
+
+	const auto record = read_record<QuantizedPointRecord>( control_points, i );
+	return { to_coordinate( record.x, entry.origin_x ), to_coordinate( record.y, entry.origin_y ), record.color };
+}
+
+
+
+LineRecord ImgDocumentLayer::get_line( size_t i ) const
+{
+	check_records();
+	if( !quantized )
+	{
+		return read_record<LineRecord>( lines, i );
+	}
+
+	const auto record = read_record<QuantizedLineRecord>( lines, i );
+	return {
+		to_coordinate( record.ax, entry.origin_x ),
+		to_coordinate( record.ay, entry.origin_y ),
+		to_coordinate( record.bx, entry.origin_x ),
+		to_coordinate( record.by, entry.origin_y ),
+		half_widths ? from_half_float( record.width ) : to_coordinate( record.width, 0.f ),
+		record.color,
+		record.cap,
+		record.join,
+		{ 0, 0 }
+	};
+}
+
+
+
+FillRecord ImgDocumentLayer::get_fill( size_t i ) const
+{
+	check_records();
+	if( !quantized )
+	{
+		return read_record<FillRecord>( fills, i );
+	}
+
+	const auto record = read_record<QuantizedFillRecord>( fills, i );
+
+	FillRecord fill;
+	memset( &fill, 0, sizeof( fill ) );
+	fill.x = to_coordinate( record.x, entry.origin_x );
+	fill.y = to_coordinate( record.y, entry.origin_y );
+	fill.color = record.color;
+	fill.first_contour = record.first_contour;
+	fill.contour_count = record.contour_count;
+	fill.rule = record.rule;
+	return fill;
+}
+
+
+
+uint32_t ImgDocumentLayer::get_contour_end( size_t i ) const
+{
+	// Damaged files can't point past the points of the layer
+	return min( read_record<uint32_t>( contour_ends, i ), entry.path_point_count );
+}
+
+
+
+ImgPath ImgDocumentLayer::get_fill_path( const FillRecord &fill ) const
+{
+	ImgPath path;
+	path.rule = fill.rule == EVEN_ODD ? EVEN_ODD : NON_ZERO;
+
+	const auto first_contour = min( fill.first_contour, entry.contour_count );
+	const auto last_contour = first_contour + min( fill.contour_count, entry.contour_count - first_contour );
+	if( first_contour == last_contour )
+	{
+		return path;
+	}
+
+	const auto first_point = first_contour ? get_contour_end( first_contour - 1 ) : 0;
+	auto end = first_point;
+	for( auto i = first_contour; i < last_contour; i++ )
+	{
+		end = max( get_contour_end( i ), end );
+		path.contour_ends.push_back( end - first_point );
+	}
+
+	path.points.resize( end - first_point );
+	if( path.points.size() )
+	{
+		memcpy( path.points.data(), path_points + first_point * sizeof( ImgPoint ), path.points.size() * sizeof( ImgPoint ) );
+	}
+
+	return path;
+}
+
+
+
+ImgBounds ImgDocumentLayer::get_fill_bounds( const FillRecord &fill ) const
+{
+	ImgBounds bounds = { fill.x, fill.y, fill.x, fill.y };
+
+	// The points are read in place, without making the path
+	const auto first_contour = min( fill.first_contour, entry.contour_count );
+	const auto last_contour = first_contour + min( fill.contour_count, entry.contour_count - first_contour );
+	if( first_contour == last_contour )
+	{
+		return bounds;
+	}
+
+	const auto first_point = first_contour ? get_contour_end( first_contour - 1 ) : 0;
+	const auto end = get_contour_end( last_contour - 1 );
+	for( auto i = first_point; i < end; i++ )
+	{
+		const auto point = read_record<ImgPoint>( path_points, i );
+		const ImgBounds point_bounds = { fill.x + point.x, fill.y + point.y, fill.x + point.x, fill.y + point.y };
+		if( i == first_point )
+		{
+			bounds = point_bounds;
+		}
+		else
+		{
+			add_to_bounds( bounds, point_bounds );
+		}
+	}
+
+	return bounds;
+}
+
+
+
+void ImgDocumentLayer::find_items_in( const ImgBounds &area, ImgLayerIndices &indices ) const
+{
+	check_records();
+	indices.clear();
+	if( !entry.bounds.intersects( area ) )
+	{
+		return;
+	}
+
+	for( uint32_t i = 0; i < entry.control_point_count; i++ )
+	{
+		if( get_point_bounds( get_control_point( i ) ).intersects( area ) )
+		{
+			indices.control_points.push_back( i );
+		}
+	}
+
+	for( uint32_t i = 0; i < entry.line_count; i++ )
+	{
+		if( get_line_bounds( get_line( i ) ).intersects( area ) )
+		{
+			indices.lines.push_back( i );
+		}
+	}
+
+	for( uint32_t i = 0; i < entry.fill_count; i++ )
+	{
+		if( get_fill_bounds( get_fill( i ) ).intersects( area ) )
+		{
+			indices.fills.push_back( i );
+		}
+	}
+}
+
+
+
+bool ImgDocumentLayer::verify() const
+{
+	return update_crc32( 0, control_points, get_section_size() ) == entry.checksum;
+}
+
+
+
+void ImgDocumentLayer::load( ImgLayer &layer ) const
+{
+	if( packed )
+	{
+		unpack_layer( control_points, get_section_size(), layer );
+		return;
+	}
+
+	for( size_t i = 0; i < get_control_point_count(); i++ )
+	{
+		const auto point = get_control_point( i );
+		layer.add_control_point( point.x, point.y, point.color );
+	}
+
+	for( size_t i = 0; i < get_line_count(); i++ )
+	{
+		const auto line = get_line( i );
+		layer.add_line( line.ax, line.ay, line.bx, line.by, line.width, line.color, get_line_style( line ) );
+	}
+
+	for( size_t i = 0; i < get_fill_count(); i++ )
+	{
+		const auto fill = get_fill( i );
+		layer.add_fill( fill.x, fill.y, get_fill_path( fill ), fill.color );
+	}
+}
+
+
+
+ImgDocument::ImgDocument( const string &path )
+: file( path )
+{
+	const auto invalid = [&path]( const string &reason )
+	{
+		return runtime_error( "Not a valid document: '" + path + "', " + reason );
+	};
+
+	if( file.size() < sizeof( Header ) )
+	{
+		throw invalid( "the file is too short" );
+	}
+
+	memcpy( &header, file.data(), sizeof( Header ) );
+	if( header.magic != magic )
+	{
+		throw invalid( "unknown file type" );
+	}
+	if( header.version > version )
+	{
+		throw invalid( "made with a newer version" );
+	}
+
+	const auto table_size = static_cast<uint64_t>( header.layer_count ) * sizeof( LayerEntry );
+	if( header.table_offset < sizeof( Header ) || header.table_offset > file.size() ||
+	    table_size > file.size() - header.table_offset )
+	{
+		throw invalid( "the layer table is out of the file" );
+	}
+
+	const auto table = file.data() + header.table_offset;
+	if( update_crc32( 0, table, static_cast<size_t>( table_size ) ) != header.table_checksum )
+	{
+		throw invalid( "the layer table is damaged" );
+	}
+
+	layers.reserve( header.layer_count );
+	for( uint32_t i = 0; i < header.layer_count; i++ )
+	{
+		const auto entry = read_record<LayerEntry>( table, i );
+		if( entry.offset < sizeof( Header ) || entry.offset > header.table_offset )
+		{
+			throw invalid( "a layer is out of the file" );
+		}
+
+		layers.emplace_back( entry, file.data() + entry.offset, header.flags );
+		if( layers.back().get_section_size() > header.table_offset - entry.offset )
+		{
+			throw invalid( "a layer is out of the file" );
+		}
+	}
+}
+
+
+
+bool ImgDocument::verify() const
+{
+	return all_of( layers.begin(), layers.end(), []( const ImgDocumentLayer &layer ) { return layer.verify(); } );
+}
+
+
+
+void ImgDocument::load( VectorImg &image ) const
+{
+	image.img_w = header.img_w;
+	image.img_h = header.img_h;
+	image.layers.clear();
+
+	for( const auto &document_layer : layers )
+	{
+		image.layers.emplace_back( new ImgLayer() );
+		document_layer.load( *image.layers.back() );
+	}
+}
@@ -0,0 +1,252 @@
+#pragma once
+#include "vector_img.hh"
+#include "vector_img_pack.hh"
+#include "common_tools.hh"
+
+#include <string>
+#include <cstdint>
+
+namespace vector_img
+{
+
+
+// Binary document files, little endian
+// - The header is followed by a section per layer and the layer table
+// - A section has fixed width records for the control points, lines
+//   and fills of the layer, in this order and in their drawing order.
+//   The contour ends and the points of the fill paths follow them
+// - Quantized files store item coordinates as 16 bit steps from the
+//   origin of the layer, which is enough for most drawings at half the
+//   size. Line widths are half floats, so that thin lines of large
+//   layers keep their width. Path points are relative to their fill and
+//   always floats
+// - Packed files store each section as a packed layer, see pack_layer(),
+//   their records can only be read by loading the document
+// - The layer table and each section have their own CRC-32
+namespace file_format
+{
+	const uint32_t magic   = 0x49524456; // "VDRI"
+	const uint16_t version = 3;
+
+	// Quantized files of version 2 have the line widths in steps
+	enum Flags : uint16_t
+	{
+		QUANTIZED   = 1,
+		PACKED      = 2,
+		HALF_WIDTHS = 4
+	};
+
+	struct Header
+	{
+		uint32_t magic;
+		uint16_t version;
+		uint16_t flags;
+		uint32_t img_w;
+		uint32_t img_h;
+		uint32_t layer_count;
+		uint32_t table_checksum;
+		uint64_t table_offset;
+	};
+
+	struct LayerEntry
+	{
+		uint64_t  offset;
+		uint32_t  control_point_count;
+		uint32_t  line_count;
+		uint32_t  fill_count;
+		uint32_t  contour_count;
+		uint32_t  path_point_count;
+		uint32_t  checksum;
+
+		// Quantized coordinate = (coordinate - origin) / step
+		float     origin_x;
+		float     origin_y;
+		float     step;
+
+		// Bounds of the items, lines with their width
+		ImgBounds bounds;
+
+		// Size of the section of packed files
+		uint32_t  packed_size;
+	};
+
+	struct PointRecord
+	{
+		float x;
+		float y;
+		Color color;
+	};
+
+	struct LineRecord
+	{
+		float   ax;
+		float   ay;
+		float   bx;
+		float   by;
+		float   width;
+		Color   color;
+		uint8_t cap;
+		uint8_t join;
+		uint8_t reserved[2];
+	};
+
+	// The contours of a fill follow the ones of the previous fills,
+	// contour ends count the path points from the start of the layer
+	struct FillRecord
+	{
+		float    x;
+		float    y;
+		Color    color;
+		uint32_t first_contour;
+		uint32_t contour_count;
+		uint8_t  rule;
+		uint8_t  reserved[3];
+	};
+
+	struct QuantizedPointRecord
+	{
+		uint16_t x;
+		uint16_t y;
+		Color    color;
+	};
+
+	struct QuantizedLineRecord
+	{
+		uint16_t ax;
+		uint16_t ay;
+		uint16_t bx;
+		uint16_t by;
+		uint16_t width;
+		uint8_t  cap;
+		uint8_t  join;
+		Color    color;
+	};
+
+	struct QuantizedFillRecord
+	{
+		uint16_t x;
+		uint16_t y;
+		Color    color;
+		uint32_t first_contour;
+		uint32_t contour_count;
+		uint8_t  rule;
+		uint8_t  reserved[3];
+	};
+
+	static_assert( sizeof( Header ) == 32, "Header has to match the file layout" );
+	static_assert( sizeof( LayerEntry ) == 64, "LayerEntry has to match the file layout" );
+	static_assert( sizeof( LineRecord ) == 28 && sizeof( QuantizedLineRecord ) == 16, "Records have to match the file layout" );
+	static_assert( sizeof( PointRecord ) == 12 && sizeof( QuantizedPointRecord ) == 8, "Records have to match the file layout" );
+	static_assert( sizeof( FillRecord ) == 24 && sizeof( QuantizedFillRecord ) == 20, "Records have to match the file layout" );
+}
+
+
+
+// CRC-32 of the data continued from crc, 0 to start a new one
+uint32_t update_crc32( uint32_t crc, const char *data, size_t size );
+
+
+
+struct ImgSaveOptions
+{
+	bool quantize = false;
+
+	// Coordinates of packed files are rounded to multiples of pack_step
+	bool  pack      = false;
+	float pack_step = default_pack_step;
+};
+
+
+
+// Writes the image section by section, only a small buffer
+// or a packed layer is kept in memory
+// - Throws runtime_error if the file couldn't be written
+void save_document( const VectorImg &image, const std::string &path, const ImgSaveOptions &options = ImgSaveOptions() );
+
+// Whether the file starts like a document, the rest isn't checked
+bool is_document( const std::string &path );
+
+
+
+// Layer of a mapped document, records are decoded when they are read
+struct ImgDocumentLayer
+{
+	ImgDocumentLayer( const file_format::LayerEntry &entry, const char *section, uint16_t flags );
+
+	size_t get_control_point_count() const { return entry.control_point_count; }
+	size_t get_line_count() const { return entry.line_count; }
+	size_t get_fill_count() const { return entry.fill_count; }
+	size_t get_path_point_count() const { return entry.path_point_count; }
+	const ImgBounds& get_bounds() const { return entry.bounds; }
+	bool is_packed() const { return packed; }
+
+	// Adds the items on top of the items of the layer
+	void load( ImgLayer &layer ) const;
+
+	// Records of the items, throw runtime_error if the layer is packed
+	file_format::PointRecord get_control_point( size_t i ) const;
+	file_format::LineRecord get_line( size_t i ) const;
+	file_format::FillRecord get_fill( size_t i ) const;
+	ImgPath get_fill_path( const file_format::FillRecord &fill ) const;
+
+	// Items whose bounds intersect the area, by scanning the records
+	// - Throws runtime_error if the layer is packed
+	void find_items_in( const ImgBounds &area, ImgLayerIndices &indices ) const;
+
+	// Size of the section in the file
+	size_t get_section_size() const;
+	bool verify() const;
+
+  protected:
+	file_format::LayerEntry entry;
+	const char *control_points;
+	const char *lines;
+	const char *fills;
+	const char *contour_ends;
+	const char *path_points;
+	bool quantized;
+	bool packed;
+	bool half_widths;
+
+	void check_records() const;
+	uint32_t get_contour_end( size_t i ) const;
+	ImgBounds get_fill_bounds( const file_format::FillRecord &fill ) const;
+
+	float to_coordinate( uint16_t value, float origin ) const { return origin + value * entry.step; }
+};
+
+
+
+// Read-only view of a document file mapped to memory
+// - Opening only checks the header and the layer table,
+//   the sections are read from the mapping when needed
+// - Throws runtime_error if the file isn't a valid document
+struct ImgDocument
+{
+	explicit ImgDocument( const std::string &path );
+
+	size_t get_width() const { return header.img_w; }
+	size_t get_height() const { return header.img_h; }
+	bool is_quantized() const { return (header.flags & file_format::QUANTIZED) != 0; }
+	bool is_packed() const { return (header.flags & file_format::PACKED) != 0; }
+
+	// Checksum of the layer table, which has the checksums of the sections
+	uint32_t get_checksum() const { return header.table_checksum; }
+
+	size_t get_layer_count() const { return layers.size(); }
+	const ImgDocumentLayer& get_layer( size_t i ) const { return layers[i]; }
+
+	// Checks the checksums of all the sections
+	bool verify() const;
+
+	// Copies the items to the image for editing, replaces its layers
+	void load( VectorImg &image ) const;
+
+  protected:
+	tools::MappedFile             file;
+	file_format::Header           header;
+	std::vector<ImgDocumentLayer> layers;
+};
+
+
+};
@@ -0,0 +1,540 @@
+#include "vector_img_fill.hh"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+using namespace std;
+using namespace vector_img;
+
+namespace
+{
+	// Fills that haven't been updated in this many updates are dropped
+	const uint32_t unused_update_count = 600;
+	const unsigned max_worker_count    = 4;
+
+
+
+	struct Edge
+	{
+		float top_x;
+		float top_y;
+		float bottom_y;
+		float slope;   // dx / dy
+		int   winding; // +1 going down, -1 going up
+
+		float get_x( float y ) const { return top_x + (y - top_y) * slope; }
+	};
+
+
+
+	struct ActiveEdge
+	{
+		uint32_t edge;
+		float    top_x;
+	};
+
+
+
+	struct Span
+	{
+		uint32_t left;
+		uint32_t right;
+		float    top_y;
+		float    top_left;
+		float    top_right;
+	};
+
+	const uint32_t no_span = UINT32_MAX;
+
+
+
+	void add_trapezoid( float top_y, float bottom_y, float top_left, float top_right, float bottom_left, float bottom_right, vector<ImgPoint> &triangles )
+	{
+		// Trapezoids that end in a point need only one triangle
+		if( top_right > top_left )
+		{
+			triangles.push_back( { top_left, top_y } );
+			triangles.push_back( { top_right, top_y } );
+			triangles.push_back( { bottom_right, bottom_y } );
+		}
+		if( bottom_right > bottom_left )
+		{
+			triangles.push_back( { bottom_right, bottom_y } );
+			triangles.push_back( { bottom_left, bottom_y } );
+			triangles.push_back( { top_left, top_y } );
+		}
+	}
+}
+
+
+
+void vector_img::tessellate_path( const ImgPath &path, vector<ImgPoint> &triangles )
+{
+	const auto &points = path.points;
+	if( points.size() < 3 )
+	{
+		return;
+	}
+
+	// Horizontal edges don't bound any trapezoid
+	vector<Edge> edges;
+	edges.reserve( points.size() );
+	const auto bounds = path.get_bounds();
+
+	uint32_t begin = 0;
+	for( const auto contour_end : path.contour_ends )
+	{
+		const auto end = min( contour_end, static_cast<uint32_t>( points.size() ) );
+		for( auto i = begin; i < end; i++ )
+		{
+			const auto &a = points[i];
+			const auto &b = points[i + 1 < end ? i + 1 : begin];
+			if( a.y == b.y || !std::isfinite( a.x + a.y + b.x + b.y ) )
+			{
+				continue;
+			}
+
+			const auto &top    = a.y < b.y ? a : b;
+			const auto &bottom = a.y < b.y ? b : a;
+
+			Edge edge;
+			edge.top_x    = top.x;
+			edge.top_y    = top.y;
+			edge.bottom_y = bottom.y;
+			edge.slope    = (bottom.x - top.x) / (bottom.y - top.y);
+			edge.winding  = a.y < b.y ? 1 : -1;
+			edges.push_back( edge );
+		}
+		begin = end;
+	}
+
+	sort( edges.begin(), edges.end(), []( const Edge &a, const Edge &b )
+	{
+		return a.top_y < b.top_y;
+	} );
+
+	// Crossings closer than this to the top of the trapezoids are
+	// taken as rounding errors, so that the sweep always moves on
+	const auto min_height = max( bounds.max_y - bounds.min_y, bounds.max_x - bounds.min_x ) * 1e-6f;
+
+	// Spans between the same two edges grow into one trapezoid until
+	// another edge comes between them or one of them ends
+	vector<Span> spans;
+	vector<Span> next_spans;
+	vector<uint32_t> span_of_left( edges.size(), no_span );
+
+	const auto end_spans = [&]( float bottom_y )
+	{
+		for( const auto &span : spans )
+		{
+			span_of_left[span.left] = no_span;
+			if( span.right != no_span )
+			{
+				add_trapezoid(
+					span.top_y, bottom_y,
+					span.top_left, span.top_right,
+					edges[span.left].get_x( bottom_y ), edges[span.right].get_x( bottom_y ),
+					triangles
+				);
+			}
+		}
+		spans.clear();
+	};
+
+	vector<ActiveEdge> active;
+	size_t next_edge = 0;
+	auto y = edges.empty() ? 0.f : edges[0].top_y;
+
+	while( next_edge < edges.size() || !active.empty() )
+	{
+		// The edges that end at y leave the sweep, the ones that start there join it
+		active.erase(
+			remove_if( active.begin(), active.end(), [&]( const ActiveEdge &a ) { return edges[a.edge].bottom_y <= y; } ),
+			active.end()
+		);
+
+		if( active.empty() )
+		{
+			end_spans( y );
+			if( next_edge < edges.size() )
+			{
+				y = max( y, edges[next_edge].top_y );
+			}
+		}
+
+		while( next_edge < edges.size() && edges[next_edge].top_y <= y )
+		{
+			active.push_back( { static_cast<uint32_t>( next_edge ), 0.f } );
+			next_edge++;
+		}
+
+		if( active.empty() )
+		{
+			continue;
+		}
+
+		// The trapezoids end where the next edge starts or an edge ends
+		auto next_y = next_edge < edges.size() ? edges[next_edge].top_y : edges[active[0].edge].bottom_y;
+		for( auto &a : active )
+		{
+			next_y = min( next_y, edges[a.edge].bottom_y );
+			a.top_x = edges[a.edge].get_x( y );
+		}
+
+		// Insertion sort, the order changes little between the trapezoids
+		for( size_t i = 1; i < active.size(); i++ )
+		{
+			const auto a = active[i];
+			auto j = i;
+			for( ; j > 0; j-- )
+			{
+				const auto &b = active[j - 1];
+				if( b.top_x < a.top_x || (b.top_x == a.top_x && edges[b.edge].slope <= edges[a.edge].slope) )
+				{
+					break;
+				}
+				active[j] = b;
+			}
+			active[j] = a;
+		}
+
+		// Neighbours that cross at y, give or take rounding errors, trade places
+		const auto min_step = max( min_height, fabs( y ) * 1e-6f );
+		const auto get_crossing = [&]( size_t i )
+		{
+			const auto &left  = edges[active[i].edge];
+			const auto &right = edges[active[i + 1].edge];
+			if( left.slope <= right.slope || left.get_x( next_y ) <= right.get_x( next_y ) )
+			{
+				return numeric_limits<float>::infinity();
+			}
+			return y + (active[i + 1].top_x - active[i].top_x) / (left.slope - right.slope);
+		};
+
+		for( auto swapped = true; swapped; )
+		{
+			swapped = false;
+			for( size_t i = 0; i + 1 < active.size(); i++ )
+			{
+				if( get_crossing( i ) < y + min_step )
+				{
+					swap( active[i], active[i + 1] );
+					swapped = true;
+				}
+			}
+		}
+
+		// ...or where two edges cross, the first crossing is between neighbours
+		for( size_t i = 0; i + 1 < active.size(); i++ )
+		{
+			next_y = min( next_y, get_crossing( i ) );
+		}
+
+		// The spans between the edges are inside by the winding left of them
+		next_spans.clear();
+		auto winding = 0;
+		for( size_t i = 0; i + 1 < active.size(); i++ )
+		{
+			winding += edges[active[i].edge].winding;
+			const auto inside = path.rule == EVEN_ODD ? (winding & 1) != 0 : winding != 0;
+			if( !inside )
+			{
+				continue;
+			}
+
+			const auto left  = active[i].edge;
+			const auto right = active[i + 1].edge;
+			const auto span = span_of_left[left];
+			if( span != no_span && spans[span].right == right )
+			{
+				next_spans.push_back( spans[span] );
+				spans[span].right = no_span;
+			}
+			else
+			{
+				next_spans.push_back( { left, right, y, active[i].top_x, active[i + 1].top_x } );
+			}
+		}
+
+		end_spans( y );
+		spans.swap( next_spans );
+		for( uint32_t i = 0; i < spans.size(); i++ )
+		{
+			span_of_left[spans[i].left] = i;
+		}
+
+		y = next_y;
+	}
+
+	end_spans( y );
+}
+
+
+
+const size_t ImgFillCache::default_threaded_point_count;
+
+
+
+ImgFillCache::ImgFillCache( size_t threaded_point_count )
+: threaded_point_count( threaded_point_count ),
+  tessellated_count( 0 ),
+  update_count( 0 ),
+  running_count( 0 ),
+  stopping( false )
+{
+}
+
+
+
+ImgFillCache::~ImgFillCache()
+{
+	{
+		lock_guard<mutex> jobs_lock( jobs_mutex );
+		stopping = true;
+		queued_jobs.clear();
+	}
+	jobs_changed.notify_all();
+
+	for( auto &worker : workers )
+	{
+		worker.join();
+	}
+}
+
+
+
+void ImgFillCache::start_workers()
+{
+	const auto hardware_count = thread::hardware_concurrency();
+	const auto worker_count = min( max( hardware_count, 2u ) - 1, max_worker_count );
+	for( unsigned i = 0; i < worker_count; i++ )
+	{
+		workers.emplace_back( [this]() { run_worker(); } );
+	}
+}
+
+
+
+void ImgFillCache::run_worker()
+{
+	unique_lock<mutex> jobs_lock( jobs_mutex );
+	while( true )
+	{
+		jobs_changed.wait( jobs_lock, [this]() { return stopping || !queued_jobs.empty(); } );
+		if( stopping )
+		{
+			return;
+		}
+
+		auto job = move( queued_jobs.front() );
+		queued_jobs.pop_front();
+		running_count++;
+
+		jobs_lock.unlock();
+		tessellate_path( *job.path, job.triangles );
+		job.path.reset();
+		jobs_lock.lock();
+
+		running_count--;
+		finished_jobs.push_back( move( job ) );
+		jobs_changed.notify_all();
+	}
+}
+
+
+
+void ImgFillCache::take_finished_jobs()
+{
+	vector<Job> finished;
+	{
+		lock_guard<mutex> jobs_lock( jobs_mutex );
+		finished.swap( finished_jobs );
+	}
+
+	// Results for paths that have changed again are thrown away
+	for( auto &job : finished )
+	{
+		if( job.slot < entries.size() && entries[job.slot].queued_revision == job.revision )
+		{
+			auto &entry = entries[job.slot];
+			entry.triangles.swap( job.triangles );
+			entry.revision = job.revision;
+			entry.queued_revision = 0;
+			changed_slots.push_back( job.slot );
+		}
+	}
+}
+
+
+
+void ImgFillCache::update( const ImgFills &fills, const vector<uint32_t> &indices )
+{
+	update_count++;
+	tessellated_count = 0;
+	changed_slots.clear();
+	take_finished_jobs();
+
+	vector<Job> jobs;
+	for( const auto i : indices )
+	{
+		if( fills.is_removed( i ) )
+		{
+			continue;
+		}
+
+		const auto slot = fills.slots[i];
+		if( slot >= entries.size() )
+		{
+			entries.resize( slot + 1 );
+		}
+
+		auto &entry = entries[slot];
+		entry.last_update = update_count;
+
+		const auto revision = fills.path_revision[i];
+		if( entry.revision == revision || entry.queued_revision == revision )
+		{
+			continue;
+		}
+
+		tessellated_count++;
+		const auto &path = fills.path[i];
+		if( path.points.size() < threaded_point_count )
+		{
+			entry.triangles.clear();
+			tessellate_path( path, entry.triangles );
+			entry.revision = revision;
+			entry.queued_revision = 0;
+			changed_slots.push_back( slot );
+			continue;
+		}
+
+		entry.queued_revision = revision;
+
+		Job job;
+		job.slot     = slot;
+		job.revision = revision;
+		job.path     = make_shared<const ImgPath>( path );
+		jobs.push_back( move( job ) );
+	}
+
+	if( !jobs.empty() )
+	{
+		if( workers.empty() )
+		{
+			start_workers();
+		}
+
+		{
+			lock_guard<mutex> jobs_lock( jobs_mutex );
+
+			// Queued jobs of the same fills are replaced
+			for( auto &job : jobs )
+			{
+				const auto queued = find_if( queued_jobs.begin(), queued_jobs.end(), [&]( const Job &other )
+				{
+					return other.slot == job.slot;
+				} );
+
+				if( queued != queued_jobs.end() )
+				{
+					*queued = move( job );
+				}
+				else
+				{
+					queued_jobs.push_back( move( job ) );
+				}
+			}
+		}
+		jobs_changed.notify_all();
+	}
+
+	if( update_count % unused_update_count == 0 )
+	{
+		drop_unused_entries();
+	}
+}
+
+
+
+void ImgFillCache::drop_unused_entries()
+{
+	for( auto &entry : entries )
+	{
+		if( entry.last_update + unused_update_count < update_count )
+		{
+			entry = Entry();
+		}
+	}
+
+	while( !entries.empty() && !entries.back().revision && !entries.back().queued_revision )
+	{
+		entries.pop_back();
+	}
+}
+
+
+
+ImgFillCache::Triangles ImgFillCache::get_triangles( const ImgFills &fills, size_t i ) const
+{
+	const auto slot = fills.slots[i];
+	if( slot >= entries.size() || entries[slot].triangles.empty() )
+	{
+		return { nullptr, 0 };
+	}
+
+	const auto &triangles = entries[slot].triangles;
+	return { triangles.data(), triangles.size() };
+}
+
+
+
+bool ImgFillCache::is_busy() const
+{
+	lock_guard<mutex> jobs_lock( jobs_mutex );
+	return !queued_jobs.empty() || running_count > 0 || !finished_jobs.empty();
+}
+
+
+
+bool ImgFillCache::has_finished_jobs() const
+{
+	lock_guard<mutex> jobs_lock( jobs_mutex );
+	return !finished_jobs.empty();
+}
+
+
+
+void ImgFillCache::wait()
+{
+	unique_lock<mutex> jobs_lock( jobs_mutex );
+	jobs_changed.wait( jobs_lock, [this]() { return queued_jobs.empty() && running_count == 0; } );
+}
+
+
+
+void ImgFillCache::clear()
+{
+	{
+		lock_guard<mutex> jobs_lock( jobs_mutex );
+		queued_jobs.clear();
+	}
+
+	// Jobs that are still running finish for nothing
+	entries.clear();
+	changed_slots.clear();
+	tessellated_count = 0;
+}
+
+
+
+size_t ImgFillCache::get_memory_size() const
+{
+	auto size = entries.capacity() * sizeof( Entry );
+	for( const auto &entry : entries )
+	{
+		size += entry.triangles.capacity() * sizeof( ImgPoint );
+	}
+	return size;
+}
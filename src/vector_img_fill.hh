@@ -0,0 +1,115 @@
+#pragma once
+#include "vector_img.hh"
+
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <condition_variable>
+
+namespace vector_img
+{
+
+
+// Appends the triangles covering the inside of the path, three corners per triangle
+// - A sweep over y cuts the path into trapezoids between the edges, at the
+//   ends of the edges and where they cross, so holes and self intersecting
+//   contours are filled by the fill rule of the path
+// - The triangles are relative to the position of the fill, like the path
+void tessellate_path( const ImgPath &path, std::vector<ImgPoint> &triangles );
+
+
+
+// Triangles of the fills of a layer, kept between the frames
+// - A fill is tessellated again only when its path revision changes,
+//   moving the fill keeps the triangles
+// - Paths with many points are tessellated by worker threads, the old
+//   triangles of a fill are drawn until the new ones are ready
+// - Fills that haven't been updated for a while are dropped
+struct ImgFillCache
+{
+	static const size_t default_threaded_point_count = 2048;
+
+	struct Triangles
+	{
+		const ImgPoint *points;
+		size_t          point_count;
+	};
+
+	explicit ImgFillCache( size_t threaded_point_count = default_threaded_point_count );
+	~ImgFillCache();
+
+	// Delete potentially dangerous constructors and operators
+	ImgFillCache( ImgFillCache& )            = delete;
+	ImgFillCache& operator=( ImgFillCache& ) = delete;
+
+	// Takes the finished work of the threads and tessellates
+	// or queues the fills that changed since they were last updated
+	void update( const ImgFills &fills, const std::vector<uint32_t> &indices );
+
+	// Triangles of the fill i of the pool, valid until the next update
+	Triangles get_triangles( const ImgFills &fills, size_t i ) const;
+
+	// Whether the threads have fills left to tessellate,
+	// or tessellated fills that the next update takes
+	bool is_busy() const;
+
+	// Whether the threads have tessellated fills that the next update takes
+	bool has_finished_jobs() const;
+
+	// Blocks until the threads are done, the results are taken by the next update
+	void wait();
+
+	void clear();
+
+	// Count of the fills tessellated or queued by the last update
+	size_t get_tessellated_count() const { return tessellated_count; }
+
+	// Slots of the fills whose triangles changed by the last update,
+	// tessellated by it or taken from the threads
+	const std::vector<uint32_t> &get_changed_slots() const { return changed_slots; }
+	size_t get_memory_size() const;
+
+  protected:
+	struct Entry
+	{
+		// Revision of the path the triangles were made of, 0 for none
+		uint64_t revision         = 0;
+		uint64_t queued_revision  = 0;
+		uint32_t last_update      = 0;
+		std::vector<ImgPoint> triangles;
+	};
+
+	struct Job
+	{
+		uint32_t slot;
+		uint64_t revision;
+		std::shared_ptr<const ImgPath> path;
+		std::vector<ImgPoint> triangles;
+	};
+
+	std::vector<Entry>    entries;
+	std::vector<uint32_t> changed_slots;
+	size_t   threaded_point_count;
+	size_t   tessellated_count;
+	uint32_t update_count;
+
+	// Shared with the threads
+	mutable std::mutex      jobs_mutex;
+	std::condition_variable jobs_changed;
+	std::deque<Job>         queued_jobs;
+	std::vector<Job>        finished_jobs;
+	size_t                  running_count;
+	bool                    stopping;
+	std::vector<std::thread> workers;
+
+	void start_workers();
+	void run_worker();
+	void take_finished_jobs();
+	void drop_unused_entries();
+};
+
+
+};
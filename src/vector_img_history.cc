@@ -0,0 +1,656 @@
+#include "vector_img_history.hh"
+#include "vector_img_column.hh"
+
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+using namespace vector_img;
+
+namespace
+{
+	// Steps that change more than 1/bulk_divisor of the items of a layer keep
+	// the index on both sides, smaller changes update it item by item
+	const size_t bulk_divisor    = 32;
+	const size_t min_bulk_change = 1024;
+
+
+
+	template<typename T>
+	size_t get_memory_size( const vector<T> &values )
+	{
+		return values.capacity() * sizeof( T );
+	}
+
+
+
+	size_t get_memory_size( const vector<ImgPath> &paths )
+	{
+		auto memory_size = paths.capacity() * sizeof( ImgPath );
+		for( const auto &path : paths )
+		{
+			memory_size += path.points.capacity() * sizeof( ImgPoint ) + path.contour_ends.capacity() * sizeof( uint32_t );
+		}
+		return memory_size;
+	}
+
+
+
+	// Copies the chunks that differ, the values have to match from
+	template<typename T>
+	void restore_column( vector<T> &values, const ImgColumn<T> &from, const ImgColumn<T> &to )
+	{
+		values.resize( to.size );
+		for( size_t k = 0; k < to.chunks.size(); k++ )
+		{
+			if( k < from.chunks.size() && from.chunks[k] == to.chunks[k] )
+			{
+				continue;
+			}
+
+			const auto &chunk = *to.chunks[k];
+			copy( chunk.begin(), chunk.end(), values.begin() + k * column_chunk_size );
+		}
+	}
+
+
+
+	// Sets changed[i] for the values that differ between the columns
+	template<typename T>
+	void mark_changed( const ImgColumn<T> &a, const ImgColumn<T> &b, vector<uint8_t> &changed )
+	{
+		const auto chunk_count = max( a.chunks.size(), b.chunks.size() );
+		for( size_t k = 0; k < chunk_count; k++ )
+		{
+			const auto chunk_a = k < a.chunks.size() ? a.chunks[k].get() : nullptr;
+			const auto chunk_b = k < b.chunks.size() ? b.chunks[k].get() : nullptr;
+			if( chunk_a == chunk_b )
+			{
+				continue;
+			}
+
+			const auto size_a = chunk_a ? chunk_a->size() : 0;
+			const auto size_b = chunk_b ? chunk_b->size() : 0;
+			const auto begin = k * column_chunk_size;
+			for( size_t i = 0; i < max( size_a, size_b ); i++ )
+			{
+				if( i >= size_a || i >= size_b || !is_same_value( (*chunk_a)[i], (*chunk_b)[i] ) )
+				{
+					changed[begin + i] = 1;
+				}
+			}
+		}
+	}
+
+
+
+	template<typename T>
+	bool is_shared( const ImgColumn<T> &a, const ImgColumn<T> &b )
+	{
+		return a.size == b.size && a.chunks == b.chunks;
+	}
+
+
+
+	template<typename T>
+	size_t get_unshared_size( const ImgColumn<T> &column, const ImgColumn<T> &previous )
+	{
+		size_t memory_size = 0;
+		for( size_t k = 0; k < column.chunks.size(); k++ )
+		{
+			if( k >= previous.chunks.size() || previous.chunks[k] != column.chunks[k] )
+			{
+				memory_size += get_memory_size( *column.chunks[k] );
+			}
+		}
+		return memory_size;
+	}
+}
+
+
+
+namespace vector_img
+{
+	// Columns of a layer at one step
+	struct ImgLayerSnapshot
+	{
+		ImgColumn<uint32_t>       point_slots;
+		ImgColumn<float>          point_x;
+		ImgColumn<float>          point_y;
+		ImgColumn<Color>          point_color;
+		ImgColumn<uint32_t>       line_slots;
+		ImgColumn<float>          line_ax;
+		ImgColumn<float>          line_ay;
+		ImgColumn<float>          line_bx;
+		ImgColumn<float>          line_by;
+		ImgColumn<float>          line_width;
+		ImgColumn<Color>          line_color;
+		ImgColumn<ImgLineStyle>   line_style;
+		ImgColumn<uint32_t>       fill_slots;
+		ImgColumn<float>          fill_x;
+		ImgColumn<float>          fill_y;
+		ImgColumn<Color>          fill_color;
+		ImgColumn<ImgPath>        fill_path;
+		ImgColumn<uint64_t>       fill_path_revision;
+		ImgColumn<ImgLayer::Slot> item_slots;
+		ImgColumn<uint32_t>       free_slots;
+
+		size_t removed_points = 0;
+		size_t removed_lines  = 0;
+		size_t removed_fills  = 0;
+
+		// Index matching the columns, kept for the current step and around large changes
+		unique_ptr<ImgSpatialIndex> index;
+		bool                        keeps_index = false;
+	};
+}
+
+
+
+namespace
+{
+	// Calls function( column_a, column_b ) for the same column of both snapshots
+	template<typename Snapshot, typename Function>
+	void for_each_column( Snapshot &a, Snapshot &b, Function function )
+	{
+		function( a.point_slots, b.point_slots );
+		function( a.point_x, b.point_x );
+		function( a.point_y, b.point_y );
+		function( a.point_color, b.point_color );
+		function( a.line_slots, b.line_slots );
+		function( a.line_ax, b.line_ax );
+		function( a.line_ay, b.line_ay );
+		function( a.line_bx, b.line_bx );
+		function( a.line_by, b.line_by );
+		function( a.line_width, b.line_width );
+		function( a.line_color, b.line_color );
+		function( a.line_style, b.line_style );
+		function( a.fill_slots, b.fill_slots );
+		function( a.fill_x, b.fill_x );
+		function( a.fill_y, b.fill_y );
+		function( a.fill_color, b.fill_color );
+		function( a.fill_path, b.fill_path );
+		function( a.fill_path_revision, b.fill_path_revision );
+		function( a.item_slots, b.item_slots );
+		function( a.free_slots, b.free_slots );
+	}
+
+
+
+	bool is_shared( const ImgLayerSnapshot &a, const ImgLayerSnapshot &b )
+	{
+		auto shared = a.removed_points == b.removed_points &&
+		              a.removed_lines == b.removed_lines &&
+		              a.removed_fills == b.removed_fills;
+
+		for_each_column( a, b, [&shared]( const auto &column_a, const auto &column_b )
+		{
+			shared = shared && is_shared( column_a, column_b );
+		} );
+
+		return shared;
+	}
+
+
+
+	// Slots of the items that differ between the snapshots
+	void find_changed_slots( const ImgLayerSnapshot &a, const ImgLayerSnapshot &b, vector<uint32_t> &slots )
+	{
+		// Slots of the added, removed and moved items
+		vector<uint8_t> changed_slots( max( a.item_slots.size, b.item_slots.size ), 0 );
+		mark_changed( a.item_slots, b.item_slots, changed_slots );
+
+		// Items of a pool that changed in any column, by the slots on both sides
+		vector<uint8_t> changed;
+		const auto add_pool_slots = [&]( const ImgColumn<uint32_t> &slots_a, const ImgColumn<uint32_t> &slots_b )
+		{
+			for( size_t i = 0; i < changed.size(); i++ )
+			{
+				if( !changed[i] )
+				{
+					continue;
+				}
+
+				if( i < slots_a.size && slots_a.get( i ) != ImgItemHandle::no_slot )
+				{
+					changed_slots[slots_a.get( i )] = 1;
+				}
+				if( i < slots_b.size && slots_b.get( i ) != ImgItemHandle::no_slot )
+				{
+					changed_slots[slots_b.get( i )] = 1;
+				}
+			}
+		};
+
+		changed.assign( max( a.point_slots.size, b.point_slots.size ), 0 );
+		mark_changed( a.point_slots, b.point_slots, changed );
+		mark_changed( a.point_x, b.point_x, changed );
+		mark_changed( a.point_y, b.point_y, changed );
+		add_pool_slots( a.point_slots, b.point_slots );
+
+		changed.assign( max( a.line_slots.size, b.line_slots.size ), 0 );
+		mark_changed( a.line_slots, b.line_slots, changed );
+		mark_changed( a.line_ax, b.line_ax, changed );
+		mark_changed( a.line_ay, b.line_ay, changed );
+		mark_changed( a.line_bx, b.line_bx, changed );
+		mark_changed( a.line_by, b.line_by, changed );
+		mark_changed( a.line_width, b.line_width, changed );
+		mark_changed( a.line_style, b.line_style, changed );
+		add_pool_slots( a.line_slots, b.line_slots );
+
+		changed.assign( max( a.fill_slots.size, b.fill_slots.size ), 0 );
+		mark_changed( a.fill_slots, b.fill_slots, changed );
+		mark_changed( a.fill_x, b.fill_x, changed );
+		mark_changed( a.fill_y, b.fill_y, changed );
+		mark_changed( a.fill_path, b.fill_path, changed );
+		mark_changed( a.fill_path_revision, b.fill_path_revision, changed );
+		add_pool_slots( a.fill_slots, b.fill_slots );
+
+		for( size_t i = 0; i < changed_slots.size(); i++ )
+		{
+			if( changed_slots[i] )
+			{
+				slots.push_back( static_cast<uint32_t>( i ) );
+			}
+		}
+	}
+}
+
+
+
+const size_t ImgHistory::default_memory_limit;
+
+
+
+ImgHistory::ImgHistory( size_t memory_limit )
+: current( 0 ),
+  memory_limit( memory_limit )
+{
+	reset( VectorImg() );
+}
+
+
+
+ImgHistory::~ImgHistory()
+{
+}
+
+
+
+void ImgHistory::reset( const VectorImg &image )
+{
+	steps.clear();
+	steps.push_back( save( image, nullptr ) );
+	current = 0;
+}
+
+
+
+ImgHistory::Step ImgHistory::save( const VectorImg &image, const Step *previous ) const
+{
+	Step step;
+	step.img_w = image.img_w;
+	step.img_h = image.img_h;
+
+	const ImgLayer empty_layer;
+	for( size_t i = 0; i < image.layers.size(); i++ )
+	{
+		const auto &layer = image.layers[i] ? *image.layers[i] : empty_layer;
+		const auto has_previous = previous && i < previous->layers.size();
+		step.layers.push_back( save_layer( layer, has_previous ? previous->layers[i] : nullptr ) );
+	}
+
+	step.memory_size = get_step_memory_size( step, previous );
+	return step;
+}
+
+
+
+ImgHistory::LayerSnapshotPtr ImgHistory::save_layer( const ImgLayer &layer, const LayerSnapshotPtr &previous ) const
+{
+	const ImgLayerSnapshot empty_snapshot;
+	const auto &from = previous ? *previous : empty_snapshot;
+
+	auto snapshot = make_shared<ImgLayerSnapshot>();
+	auto &to = *snapshot;
+
+	save_column( layer.control_points.slots, from.point_slots, to.point_slots );
+	save_column( layer.control_points.x, from.point_x, to.point_x );
+	save_column( layer.control_points.y, from.point_y, to.point_y );
+	save_column( layer.control_points.color, from.point_color, to.point_color );
+	save_column( layer.lines.slots, from.line_slots, to.line_slots );
+	save_column( layer.lines.ax, from.line_ax, to.line_ax );
+	save_column( layer.lines.ay, from.line_ay, to.line_ay );
+	save_column( layer.lines.bx, from.line_bx, to.line_bx );
+	save_column( layer.lines.by, from.line_by, to.line_by );
+	save_column( layer.lines.width, from.line_width, to.line_width );
+	save_column( layer.lines.color, from.line_color, to.line_color );
+	save_column( layer.lines.style, from.line_style, to.line_style );
+	save_column( layer.fills.slots, from.fill_slots, to.fill_slots );
+	save_column( layer.fills.x, from.fill_x, to.fill_x );
+	save_column( layer.fills.y, from.fill_y, to.fill_y );
+	save_column( layer.fills.color, from.fill_color, to.fill_color );
+	save_column( layer.fills.path, from.fill_path, to.fill_path );
+	save_column( layer.fills.path_revision, from.fill_path_revision, to.fill_path_revision );
+	save_column( layer.item_slots, from.item_slots, to.item_slots );
+	save_column( layer.free_slots, from.free_slots, to.free_slots );
+
+	to.removed_points = layer.control_points.removed_count;
+	to.removed_lines = layer.lines.removed_count;
+	to.removed_fills = layer.fills.removed_count;
+
+	if( !previous )
+	{
+		to.index.reset( new ImgSpatialIndex( layer.index ) );
+		return snapshot;
+	}
+
+	// Unchanged layers share the whole snapshot
+	if( is_shared( from, to ) )
+	{
+		return previous;
+	}
+
+	vector<uint32_t> slots;
+	find_changed_slots( from, to, slots );
+	keep_index( layer, *previous, to, slots );
+	return snapshot;
+}
+
+
+
+void ImgHistory::keep_index( const ImgLayer &layer, ImgLayerSnapshot &from, ImgLayerSnapshot &to, const vector<uint32_t> &slots ) const
+{
+	if( to.index )
+	{
+		return;
+	}
+
+	if( slots.size() >= min_bulk_change && slots.size() * bulk_divisor >= layer.item_slots.size() )
+	{
+		from.keeps_index = true;
+		to.keeps_index = true;
+	}
+
+	// The index of a small change is passed on to the next step
+	if( from.index && !from.keeps_index )
+	{
+		to.index = move( from.index );
+		update_index( *to.index, layer, slots );
+	}
+	else
+	{
+		to.index.reset( new ImgSpatialIndex( layer.index ) );
+	}
+}
+
+
+
+void ImgHistory::update_index( ImgSpatialIndex &index, const ImgLayer &layer, const vector<uint32_t> &slots ) const
+{
+	for( const auto slot : slots )
+	{
+		if( slot < layer.item_slots.size() && layer.item_slots[slot].type != NO_TYPE )
+		{
+			const auto &item = layer.item_slots[slot];
+			index.update( slot, layer.get_item_bounds( item.type, item.index ) );
+		}
+		else if( index.contains( slot ) )
+		{
+			index.remove( slot );
+		}
+	}
+}
+
+
+
+bool ImgHistory::commit( const VectorImg &image, bool merge )
+{
+	// Committing after undoing drops the undone steps
+	steps.resize( current + 1 );
+
+	const auto merged = merge && current > 0 && steps[current].mergeable;
+	auto step = save( image, &steps[current] );
+
+	auto changed = step.img_w != steps[current].img_w ||
+	               step.img_h != steps[current].img_h ||
+	               step.layers.size() != steps[current].layers.size();
+	for( size_t i = 0; i < step.layers.size() && !changed; i++ )
+	{
+		changed = step.layers[i] != steps[current].layers[i];
+	}
+
+	if( !changed )
+	{
+		return false;
+	}
+
+	step.mergeable = true;
+	if( merged )
+	{
+		// The chunks of the replaced step are freed, unless the previous step shares them
+		step.memory_size = get_step_memory_size( step, &steps[current - 1] );
+		steps[current] = move( step );
+	}
+	else
+	{
+		steps.push_back( move( step ) );
+		current++;
+	}
+
+	drop_old_steps();
+	return true;
+}
+
+
+
+bool ImgHistory::can_undo() const
+{
+	return current > 0;
+}
+
+
+
+bool ImgHistory::can_redo() const
+{
+	return current + 1 < steps.size();
+}
+
+
+
+bool ImgHistory::undo( VectorImg &image )
+{
+	if( !can_undo() )
+	{
+		return false;
+	}
+
+	restore( image, current - 1 );
+	return true;
+}
+
+
+
+bool ImgHistory::redo( VectorImg &image )
+{
+	if( !can_redo() )
+	{
+		return false;
+	}
+
+	restore( image, current + 1 );
+	return true;
+}
+
+
+
+void ImgHistory::restore( VectorImg &image, size_t step )
+{
+	auto &from = steps[current];
+	auto &to = steps[step];
+
+	image.img_w = to.img_w;
+	image.img_h = to.img_h;
+	image.layers.resize( to.layers.size() );
+
+	for( size_t i = 0; i < to.layers.size(); i++ )
+	{
+		const auto has_from = i < from.layers.size() && image.layers[i];
+		if( has_from && from.layers[i] == to.layers[i] )
+		{
+			continue;
+		}
+
+		if( !image.layers[i] )
+		{
+			image.layers[i].reset( new ImgLayer() );
+		}
+
+		ImgLayerSnapshot empty_snapshot;
+		restore_layer( *image.layers[i], has_from ? *from.layers[i] : empty_snapshot, *to.layers[i] );
+	}
+
+	// A new drag after undoing starts a new step
+	to.mergeable = false;
+	current = step;
+}
+
+
+
+void ImgHistory::restore_layer( ImgLayer &layer, ImgLayerSnapshot &from, ImgLayerSnapshot &to ) const
+{
+	restore_column( layer.control_points.slots, from.point_slots, to.point_slots );
+	restore_column( layer.control_points.x, from.point_x, to.point_x );
+	restore_column( layer.control_points.y, from.point_y, to.point_y );
+	restore_column( layer.control_points.color, from.point_color, to.point_color );
+	restore_column( layer.lines.slots, from.line_slots, to.line_slots );
+	restore_column( layer.lines.ax, from.line_ax, to.line_ax );
+	restore_column( layer.lines.ay, from.line_ay, to.line_ay );
+	restore_column( layer.lines.bx, from.line_bx, to.line_bx );
+	restore_column( layer.lines.by, from.line_by, to.line_by );
+	restore_column( layer.lines.width, from.line_width, to.line_width );
+	restore_column( layer.lines.color, from.line_color, to.line_color );
+	restore_column( layer.lines.style, from.line_style, to.line_style );
+	restore_column( layer.fills.slots, from.fill_slots, to.fill_slots );
+	restore_column( layer.fills.x, from.fill_x, to.fill_x );
+	restore_column( layer.fills.y, from.fill_y, to.fill_y );
+	restore_column( layer.fills.color, from.fill_color, to.fill_color );
+	restore_column( layer.fills.path, from.fill_path, to.fill_path );
+	restore_column( layer.fills.path_revision, from.fill_path_revision, to.fill_path_revision );
+	restore_column( layer.item_slots, from.item_slots, to.item_slots );
+	restore_column( layer.free_slots, from.free_slots, to.free_slots );
+
+	layer.control_points.removed_count = to.removed_points;
+	layer.lines.removed_count = to.removed_lines;
+	layer.fills.removed_count = to.removed_fills;
+	layer.changed_all();
+
+	if( to.index )
+	{
+		layer.index = *to.index;
+		if( !from.keeps_index )
+		{
+			from.index.reset();
+		}
+		return;
+	}
+
+	vector<uint32_t> slots;
+	find_changed_slots( from, to, slots );
+	update_index( layer.index, layer, slots );
+	keep_index( layer, from, to, slots );
+}
+
+
+
+size_t ImgHistory::get_step_memory_size( const Step &step, const Step *previous ) const
+{
+	const ImgLayerSnapshot empty_snapshot;
+
+	size_t memory_size = 0;
+	for( size_t i = 0; i < step.layers.size(); i++ )
+	{
+		const auto has_previous = previous && i < previous->layers.size();
+		if( has_previous && previous->layers[i] == step.layers[i] )
+		{
+			continue;
+		}
+
+		const ImgLayerSnapshot &snapshot = *step.layers[i];
+		for_each_column( snapshot, has_previous ? *previous->layers[i] : empty_snapshot,
+			[&memory_size]( const auto &column, const auto &previous_column )
+			{
+				memory_size += get_unshared_size( column, previous_column );
+			}
+		);
+	}
+
+	return memory_size;
+}
+
+
+
+size_t ImgHistory::get_index_memory_size( const Step &step, const Step *previous ) const
+{
+	// The kept indices, once for each snapshot
+	size_t memory_size = 0;
+	for( size_t i = 0; i < step.layers.size(); i++ )
+	{
+		const auto &snapshot = step.layers[i];
+		const auto is_new = !previous || i >= previous->layers.size() || previous->layers[i] != snapshot;
+		if( is_new && snapshot->index )
+		{
+			memory_size += snapshot->index->get_memory_size();
+		}
+	}
+
+	return memory_size;
+}
+
+
+
+size_t ImgHistory::get_memory_size() const
+{
+	size_t memory_size = 0;
+	for( size_t i = 0; i < steps.size(); i++ )
+	{
+		memory_size += steps[i].memory_size + get_index_memory_size( steps[i], i ? &steps[i - 1] : nullptr );
+	}
+
+	return memory_size;
+}
+
+
+
+void ImgHistory::set_memory_limit( size_t limit )
+{
+	memory_limit = limit;
+	drop_old_steps();
+}
+
+
+
+void ImgHistory::drop_old_steps()
+{
+	auto memory_size = get_memory_size();
+	if( memory_size <= memory_limit )
+	{
+		return;
+	}
+
+	// The current step is always kept
+	size_t dropped = 0;
+	while( memory_size > memory_limit && dropped < current )
+	{
+		memory_size -= steps[dropped].memory_size + get_index_memory_size( steps[dropped], nullptr );
+		dropped++;
+
+		// The new first step owns what it shared with the dropped step, indices included
+		memory_size -= steps[dropped].memory_size + get_index_memory_size( steps[dropped], &steps[dropped - 1] );
+		steps[dropped].memory_size = get_step_memory_size( steps[dropped], nullptr );
+		memory_size += steps[dropped].memory_size + get_index_memory_size( steps[dropped], nullptr );
+	}
+
+	steps.erase( steps.begin(), steps.begin() + dropped );
+	current -= dropped;
+}
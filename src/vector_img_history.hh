@@ -0,0 +1,82 @@
+#pragma once
+#include "vector_img.hh"
+
+#include <memory>
+#include <vector>
+
+namespace vector_img
+{
+
+
+struct ImgLayerSnapshot;
+
+
+
+// Undo and redo steps of an image
+// - A step keeps the columns of the layers in immutable chunks and shares
+//   the chunks that didn't change with the previous step, so it takes
+//   memory only for the chunks that were changed
+// - commit() has to be called after each edit, the image is compared
+//   chunk by chunk with the last step
+// - Undoing copies back only the changed chunks and updates the index for
+//   the changed items. The spatial index of the layer is kept around steps
+//   that change a large share of its items, instead of updating it item by item
+// - The oldest steps are dropped when the steps take more memory than the limit
+struct ImgHistory
+{
+	static const size_t default_memory_limit = 256 * 1024 * 1024;
+
+	explicit ImgHistory( size_t memory_limit = default_memory_limit );
+	~ImgHistory();
+
+	// Forgets the steps, the image becomes the only step
+	void reset( const VectorImg &image );
+
+	// Adds the changes since the last step as a new step, returns false if nothing changed
+	// - With merge, the changes go to the last step unless it has been undone,
+	//   like the moves of a drag after the first one
+	bool commit( const VectorImg &image, bool merge = false );
+
+	bool can_undo() const;
+	bool can_redo() const;
+	bool undo( VectorImg &image );
+	bool redo( VectorImg &image );
+
+	void set_memory_limit( size_t limit );
+	size_t get_memory_size() const;
+	size_t get_step_count() const { return steps.size(); }
+
+  protected:
+	using LayerSnapshotPtr = std::shared_ptr<ImgLayerSnapshot>;
+
+	struct Step
+	{
+		std::vector<LayerSnapshotPtr> layers;
+		size_t img_w       = 0;
+		size_t img_h       = 0;
+		bool   mergeable   = false;
+
+		// Chunks that aren't shared with the previous step
+		size_t memory_size = 0;
+	};
+
+	std::vector<Step> steps;
+	size_t            current;
+	size_t            memory_limit;
+
+	Step save( const VectorImg &image, const Step *previous ) const;
+	LayerSnapshotPtr save_layer( const ImgLayer &layer, const LayerSnapshotPtr &previous ) const;
+	void restore( VectorImg &image, size_t step );
+	void restore_layer( ImgLayer &layer, ImgLayerSnapshot &from, ImgLayerSnapshot &to ) const;
+
+	// Keeps the index of the current step for undoing large changes
+	void keep_index( const ImgLayer &layer, ImgLayerSnapshot &from, ImgLayerSnapshot &to, const std::vector<uint32_t> &slots ) const;
+	void update_index( ImgSpatialIndex &index, const ImgLayer &layer, const std::vector<uint32_t> &slots ) const;
+
+	size_t get_step_memory_size( const Step &step, const Step *previous ) const;
+	size_t get_index_memory_size( const Step &step, const Step *previous ) const;
+	void drop_old_steps();
+};
+
+
+};
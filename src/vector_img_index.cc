@@ -0,0 +1,442 @@
+#include "vector_img_index.hh"
+
+#include <cmath>
+#include <queue>
+#include <algorithm>
+
+using namespace std;
+using namespace vector_img;
+
+namespace
+{
+	// Smallest side of the root, so that a few first items
+	// close to each other don't make the root grow right away
+	const float min_root_size = 256.f;
+}
+
+
+
+const uint32_t ImgSpatialIndex::no_id;
+const uint32_t ImgSpatialIndex::no_node;
+
+
+
+bool ImgBounds::contains( const ImgBounds &other ) const
+{
+	return other.min_x >= min_x && other.max_x <= max_x &&
+	       other.min_y >= min_y && other.max_y <= max_y;
+}
+
+
+
+bool ImgBounds::intersects( const ImgBounds &other ) const
+{
+	return other.min_x <= max_x && other.max_x >= min_x &&
+	       other.min_y <= max_y && other.max_y >= min_y;
+}
+
+
+
+float ImgBounds::distance_to( float x, float y ) const
+{
+	const auto dx = max( max( min_x - x, x - max_x ), 0.f );
+	const auto dy = max( max( min_y - y, y - max_y ), 0.f );
+	return sqrt( dx * dx + dy * dy );
+}
+
+
+
+ImgSpatialIndex::ImgSpatialIndex()
+: item_count( 0 )
+{
+}
+
+
+
+bool ImgSpatialIndex::contains( uint32_t id ) const
+{
+	return id < locations.size() && locations[id].node != no_node;
+}
+
+
+
+size_t ImgSpatialIndex::size() const
+{
+	return item_count;
+}
+
+
+
+size_t ImgSpatialIndex::get_memory_size() const
+{
+	auto memory_size = nodes.capacity() * sizeof( Node ) + locations.capacity() * sizeof( Location );
+	for( const auto &node : nodes )
+	{
+		memory_size += node.entries.capacity() * sizeof( Entry );
+	}
+	return memory_size;
+}
+
+
+
+uint32_t ImgSpatialIndex::find_child( uint32_t node, const ImgBounds &bounds ) const
+{
+	const auto first_child = nodes[node].first_child;
+	if( first_child == no_node )
+	{
+		return no_node;
+	}
+
+	for( auto child = first_child; child < first_child + 4; child++ )
+	{
+		if( nodes[child].bounds.contains( bounds ) )
+		{
+			return child;
+		}
+	}
+
+	return no_node;
+}
+
+
+
+void ImgSpatialIndex::add_entry( uint32_t node, const Entry &entry )
+{
+	if( entry.id >= locations.size() )
+	{
+		locations.resize( entry.id + 1, Location{ no_node, 0 } );
+	}
+
+	auto &entries = nodes[node].entries;
+	locations[entry.id] = Location{ node, static_cast<uint32_t>( entries.size() ) };
+	entries.push_back( entry );
+}
+
+
+
+void ImgSpatialIndex::split( uint32_t node )
+{
+	const auto bounds = nodes[node].bounds;
+	const auto depth = nodes[node].depth + 1;
+	const auto mid_x = (bounds.min_x + bounds.max_x) / 2.f;
+	const auto mid_y = (bounds.min_y + bounds.max_y) / 2.f;
+
+	const ImgBounds child_bounds[4] = {
+		{ bounds.min_x, bounds.min_y, mid_x,        mid_y        },
+		{ mid_x,        bounds.min_y, bounds.max_x, mid_y        },
+		{ bounds.min_x, mid_y,        mid_x,        bounds.max_y },
+		{ mid_x,        mid_y,        bounds.max_x, bounds.max_y }
+	};
+
+	const auto first_child = static_cast<uint32_t>( nodes.size() );
+	for( const auto &child : child_bounds )
+	{
+		nodes.push_back( Node{ child, no_node, depth, {} } );
+	}
+	nodes[node].first_child = first_child;
+
+	// Move down the entries that fit to a child
+	auto entries = move( nodes[node].entries );
+	nodes[node].entries.clear();
+
+	for( const auto &entry : entries )
+	{
+		const auto child = find_child( node, entry.bounds );
+		add_entry( child != no_node ? child : node, entry );
+	}
+}
+
+
+
+void ImgSpatialIndex::place( const Entry &entry )
+{
+	uint32_t node = 0;
+	for( ;; )
+	{
+		if( nodes[node].first_child == no_node )
+		{
+			if( nodes[node].entries.size() < max_node_items || nodes[node].depth >= max_depth )
+			{
+				break;
+			}
+
+			split( node );
+		}
+
+		const auto child = find_child( node, entry.bounds );
+		if( child == no_node )
+		{
+			break;
+		}
+
+		node = child;
+	}
+
+	add_entry( node, entry );
+}
+
+
+
+void ImgSpatialIndex::grow_to_fit( const ImgBounds &bounds )
+{
+	if( nodes.empty() )
+	{
+		const auto side = max( max( bounds.max_x - bounds.min_x, bounds.max_y - bounds.min_y ), min_root_size );
+		const auto center_x = (bounds.min_x + bounds.max_x) / 2.f;
+		const auto center_y = (bounds.min_y + bounds.max_y) / 2.f;
+
+		const ImgBounds root_bounds{
+			center_x - side / 2.f, center_y - side / 2.f,
+			center_x + side / 2.f, center_y + side / 2.f
+		};
+		nodes.push_back( Node{ root_bounds, no_node, 0, {} } );
+		return;
+	}
+
+	auto root_bounds = nodes[0].bounds;
+	if( root_bounds.contains( bounds ) )
+	{
+		return;
+	}
+
+	// Double the root towards the bounds until they fit
+	while( !root_bounds.contains( bounds ) )
+	{
+		const auto side = root_bounds.max_x - root_bounds.min_x;
+		if( bounds.min_x < root_bounds.min_x )
+		{
+			root_bounds.min_x -= side;
+		}
+		else
+		{
+			root_bounds.max_x += side;
+		}
+
+		if( bounds.min_y < root_bounds.min_y )
+		{
+			root_bounds.min_y -= side;
+		}
+		else
+		{
+			root_bounds.max_y += side;
+		}
+	}
+
+	// The node bounds change all over, so the tree is rebuilt
+	vector<Entry> entries;
+	entries.reserve( item_count );
+	for( auto &node : nodes )
+	{
+		entries.insert( entries.end(), node.entries.begin(), node.entries.end() );
+	}
+
+	nodes.clear();
+	nodes.push_back( Node{ root_bounds, no_node, 0, {} } );
+
+	for( const auto &entry : entries )
+	{
+		place( entry );
+	}
+}
+
+
+
+void ImgSpatialIndex::insert( uint32_t id, const ImgBounds &bounds )
+{
+	// The root could never grow to fit these
+	if( !isfinite( bounds.min_x ) || !isfinite( bounds.min_y ) ||
+	    !isfinite( bounds.max_x ) || !isfinite( bounds.max_y ) )
+	{
+		return;
+	}
+
+	if( contains( id ) )
+	{
+		update( id, bounds );
+		return;
+	}
+
+	grow_to_fit( bounds );
+	place( Entry{ id, bounds } );
+	item_count++;
+}
+
+
+
+void ImgSpatialIndex::update( uint32_t id, const ImgBounds &bounds )
+{
+	if( !contains( id ) )
+	{
+		insert( id, bounds );
+		return;
+	}
+
+	// Small moves usually keep the item in the same node
+	const auto location = locations[id];
+	const auto &node = nodes[location.node];
+	if( node.bounds.contains( bounds ) && find_child( location.node, bounds ) == no_node )
+	{
+		nodes[location.node].entries[location.entry].bounds = bounds;
+		return;
+	}
+
+	remove( id );
+	insert( id, bounds );
+}
+
+
+
+void ImgSpatialIndex::remove( uint32_t id )
+{
+	if( !contains( id ) )
+	{
+		return;
+	}
+
+	const auto location = locations[id];
+	auto &entries = nodes[location.node].entries;
+
+	// Swap with the last entry of the node
+	const auto last = entries.back();
+	entries[location.entry] = last;
+	locations[last.id].entry = location.entry;
+	entries.pop_back();
+
+	locations[id].node = no_node;
+	item_count--;
+}
+
+
+
+void ImgSpatialIndex::translate( float dx, float dy )
+{
+	const auto offset = [dx, dy]( ImgBounds &bounds )
+	{
+		bounds.min_x += dx;
+		bounds.max_x += dx;
+		bounds.min_y += dy;
+		bounds.max_y += dy;
+	};
+
+	for( auto &node : nodes )
+	{
+		offset( node.bounds );
+		for( auto &entry : node.entries )
+		{
+			offset( entry.bounds );
+		}
+	}
+}
+
+
+
+void ImgSpatialIndex::clear()
+{
+	nodes.clear();
+	locations.clear();
+	item_count = 0;
+}
+
+
+
+void ImgSpatialIndex::find_in( const ImgBounds &area, vector<uint32_t> &ids ) const
+{
+	if( nodes.empty() )
+	{
+		return;
+	}
+
+	vector<uint32_t> stack{ 0 };
+	while( stack.size() )
+	{
+		const auto &node = nodes[stack.back()];
+		stack.pop_back();
+
+		// The entries are within the bounds of their node
+		if( !node.bounds.intersects( area ) )
+		{
+			continue;
+		}
+
+		for( const auto &entry : node.entries )
+		{
+			if( entry.bounds.intersects( area ) )
+			{
+				ids.push_back( entry.id );
+			}
+		}
+
+		if( node.first_child != no_node )
+		{
+			for( uint32_t i = 0; i < 4; i++ )
+			{
+				stack.push_back( node.first_child + i );
+			}
+		}
+	}
+}
+
+
+
+uint32_t ImgSpatialIndex::find_nearest(
+	float x,
+	float y,
+	float max_distance,
+	const function<float( uint32_t id )> &distance
+) const
+{
+	if( nodes.empty() )
+	{
+		return no_id;
+	}
+
+	// Best first search, closest nodes first
+	using QueuedNode = pair<float, uint32_t>;
+	priority_queue<QueuedNode, vector<QueuedNode>, greater<QueuedNode>> queue;
+	queue.push( { nodes[0].bounds.distance_to( x, y ), 0 } );
+
+	auto nearest = no_id;
+	auto nearest_distance = max_distance;
+
+	while( queue.size() )
+	{
+		const auto queued = queue.top();
+		queue.pop();
+
+		if( queued.first > nearest_distance )
+		{
+			break;
+		}
+
+		const auto &node = nodes[queued.second];
+		for( const auto &entry : node.entries )
+		{
+			if( entry.bounds.distance_to( x, y ) > nearest_distance )
+			{
+				continue;
+			}
+
+			const auto entry_distance = distance( entry.id );
+			if( entry_distance < nearest_distance ||
+			    (nearest == no_id && entry_distance <= nearest_distance) )
+			{
+				nearest = entry.id;
+				nearest_distance = entry_distance;
+			}
+		}
+
+		if( node.first_child != no_node )
+		{
+			for( auto child = node.first_child; child < node.first_child + 4; child++ )
+			{
+				const auto child_distance = nodes[child].bounds.distance_to( x, y );
+				if( child_distance <= nearest_distance )
+				{
+					queue.push( { child_distance, child } );
+				}
+			}
+		}
+	}
+
+	return nearest;
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace vector_img
+{
+
+
+struct ImgBounds
+{
+	float min_x;
+	float min_y;
+	float max_x;
+	float max_y;
+
+	bool contains( const ImgBounds &other ) const;
+	bool intersects( const ImgBounds &other ) const;
+
+	// Zero for points within the bounds
+	float distance_to( float x, float y ) const;
+};
+
+
+
+// Quadtree over the bounds of the items of a layer
+// - Items are kept in the smallest node that contains their bounds,
+//   a leaf is split when it gets more than max_node_items
+// - The root grows to fit items added outside of it
+// - Items are identified by ids that should stay small, like handle slots
+struct ImgSpatialIndex
+{
+	static const uint32_t no_id          = UINT32_MAX;
+	static const size_t   max_node_items = 16;
+	static const size_t   max_depth      = 16;
+
+	ImgSpatialIndex();
+
+	void insert( uint32_t id, const ImgBounds &bounds );
+	void update( uint32_t id, const ImgBounds &bounds );
+	void remove( uint32_t id );
+	void translate( float dx, float dy );
+	void clear();
+
+	bool contains( uint32_t id ) const;
+	size_t size() const;
+
+	// Bytes allocated for the nodes and the entries
+	size_t get_memory_size() const;
+
+	// Ids of the items whose bounds intersect the area, in no particular order
+	void find_in( const ImgBounds &area, std::vector<uint32_t> &ids ) const;
+
+	// Item with the smallest distance to the point, up to max_distance
+	// - distance( id ) gives the exact distance to the item, it must not
+	//   be less than the distance to the bounds of the item
+	uint32_t find_nearest(
+		float x,
+		float y,
+		float max_distance,
+		const std::function<float( uint32_t id )> &distance
+	) const;
+
+  protected:
+	static const uint32_t no_node = UINT32_MAX;
+
+	struct Entry
+	{
+		uint32_t  id;
+		ImgBounds bounds;
+	};
+
+	// The four children of a node are next to each other
+	struct Node
+	{
+		ImgBounds          bounds;
+		uint32_t           first_child;
+		uint32_t           depth;
+		std::vector<Entry> entries;
+	};
+
+	struct Location
+	{
+		uint32_t node;
+		uint32_t entry;
+	};
+
+	std::vector<Node>     nodes;
+	std::vector<Location> locations;
+	size_t                item_count;
+
+	void grow_to_fit( const ImgBounds &bounds );
+	void place( const Entry &entry );
+	void split( uint32_t node );
+	void add_entry( uint32_t node, const Entry &entry );
+	uint32_t find_child( uint32_t node, const ImgBounds &bounds ) const;
+};
+
+
+};
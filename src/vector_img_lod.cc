@@ -0,0 +1,662 @@
+#include "vector_img_lod.hh"
+#include "vector_img_stroke.hh"
+#include "vector_img_fill.hh"
+
+#include <cmath>
+#include <atomic>
+#include <limits>
+#include <algorithm>
+#include <unordered_map>
+
+using namespace std;
+using namespace vector_img;
+
+namespace
+{
+	// Pixels spanned by the items at the scale of the first and the last level
+	const float max_level_extent = 4096.f;
+	const float min_level_extent = 64.f;
+
+	// Greatest distance of the simplified items from the previous level, in pixels
+	const float level_tolerance = 0.25f;
+
+	atomic<uint64_t> last_level_id( 0 );
+
+
+
+	// Joined lines, as the range of their ends in the points
+	struct Chain
+	{
+		uint32_t     first;
+		uint32_t     end;
+		float        width;
+		Color        color;
+		ImgLineStyle style;
+	};
+
+
+
+	struct Shape
+	{
+		float   x;
+		float   y;
+		Color   color;
+		ImgPath path;
+	};
+
+
+
+	// Items merged into a pixel square, the colors are weighted by the covered area
+	struct CellSum
+	{
+		float r          = 0.f;
+		float g          = 0.f;
+		float b          = 0.f;
+		float alpha_area = 0.f;
+	};
+
+	typedef unordered_map<uint64_t, CellSum> Cells;
+
+
+
+	float get_squared_distance( ImgPoint p, ImgPoint a, ImgPoint b )
+	{
+		const auto dx = b.x - a.x;
+		const auto dy = b.y - a.y;
+		const auto squared_length = dx * dx + dy * dy;
+		const auto t = squared_length > 0.f ? min( max( ((p.x - a.x) * dx + (p.y - a.y) * dy) / squared_length, 0.f ), 1.f ) : 0.f;
+		const auto x = a.x + t * dx - p.x;
+		const auto y = a.y + t * dy - p.y;
+		return x * x + y * y;
+	}
+
+
+
+	ImgBounds get_bounds( const ImgPoint *points, size_t count )
+	{
+		ImgBounds bounds = { points[0].x, points[0].y, points[0].x, points[0].y };
+		for( size_t i = 1; i < count; i++ )
+		{
+			bounds.min_x = min( bounds.min_x, points[i].x );
+			bounds.min_y = min( bounds.min_y, points[i].y );
+			bounds.max_x = max( bounds.max_x, points[i].x );
+			bounds.max_y = max( bounds.max_y, points[i].y );
+		}
+		return bounds;
+	}
+
+
+
+	float get_extent( const ImgBounds &bounds )
+	{
+		return max( bounds.max_x - bounds.min_x, bounds.max_y - bounds.min_y );
+	}
+
+
+
+	float get_length( const ImgPoint *points, size_t count )
+	{
+		auto length = 0.f;
+		for( size_t i = 1; i < count; i++ )
+		{
+			length += hypot( points[i].x - points[i - 1].x, points[i].y - points[i - 1].y );
+		}
+		return length;
+	}
+
+
+
+	float get_area( const ImgPath &path )
+	{
+		auto area = 0.f;
+		uint32_t start = 0;
+		for( const auto end : path.contour_ends )
+		{
+			for( auto i = start; i < end && end <= path.points.size(); i++ )
+			{
+				const auto &a = path.points[i];
+				const auto &b = path.points[i + 1 < end ? i + 1 : start];
+				area += a.x * b.y - b.x * a.y;
+			}
+			start = end;
+		}
+		return fabs( area ) / 2.f;
+	}
+
+
+
+	void get_chains( const ImgLines &lines, vector<Chain> &chains, vector<ImgPoint> &points )
+	{
+		for( size_t i = 0; i < lines.size(); i++ )
+		{
+			if( lines.is_removed( i ) )
+			{
+				continue;
+			}
+
+			if( chains.empty() || !continues_previous_line( lines, i ) )
+			{
+				chains.push_back( { static_cast<uint32_t>( points.size() ), 0, lines.width[i], lines.color[i], lines.style[i] } );
+				points.push_back( { lines.ax[i], lines.ay[i] } );
+			}
+			points.push_back( { lines.bx[i], lines.by[i] } );
+			chains.back().end = static_cast<uint32_t>( points.size() );
+		}
+	}
+
+
+
+	void get_shapes( const ImgFills &fills, vector<Shape> &shapes )
+	{
+		for( size_t i = 0; i < fills.size(); i++ )
+		{
+			if( !fills.is_removed( i ) && !fills.path[i].points.empty() )
+			{
+				shapes.push_back( { fills.x[i], fills.y[i], fills.color[i], fills.path[i] } );
+			}
+		}
+	}
+
+
+
+	// Simplifies the closed contours of the path, contours that become lines are dropped
+	void simplify_path( ImgPath &path, float tolerance, vector<ImgPoint> &contour )
+	{
+		ImgPath simplified;
+		simplified.rule = path.rule;
+
+		uint32_t start = 0;
+		for( const auto end : path.contour_ends )
+		{
+			if( end > start + 2 && end <= path.points.size() )
+			{
+				contour.assign( path.points.begin() + start, path.points.begin() + end );
+				contour.push_back( path.points[start] );
+
+				const auto first = simplified.points.size();
+				simplify_polyline( contour.data(), contour.size(), tolerance, simplified.points );
+				simplified.points.pop_back();
+				if( simplified.points.size() - first < 3 )
+				{
+					simplified.points.resize( first );
+				}
+				else
+				{
+					simplified.contour_ends.push_back( static_cast<uint32_t>( simplified.points.size() ) );
+				}
+			}
+			start = end;
+		}
+
+		path = move( simplified );
+	}
+
+
+
+	int32_t get_cell( float position )
+	{
+		const auto cell = floor( position );
+		return static_cast<int32_t>( min( max( cell, -2147483648.f ), 2147483520.f ) );
+	}
+
+
+
+	uint64_t get_cell_key( int32_t cell_x, int32_t cell_y )
+	{
+		return static_cast<uint64_t>( static_cast<uint32_t>( cell_x ) ) << 32 | static_cast<uint32_t>( cell_y );
+	}
+
+
+
+	void add_to_cells( float x, float y, float cell_size, Color color, float area, Cells &cells )
+	{
+		const auto weight = color.a / 255.f * area;
+		auto &sum = cells[get_cell_key( get_cell( x / cell_size ), get_cell( y / cell_size ) )];
+		sum.r += color.r * weight;
+		sum.g += color.g * weight;
+		sum.b += color.b * weight;
+		sum.alpha_area += weight;
+	}
+
+
+
+	// The cells of the next level are twice as large
+	void merge_cells( Cells &cells )
+	{
+		Cells merged;
+		merged.reserve( cells.size() / 2 );
+		for( const auto &cell : cells )
+		{
+			const auto cell_x = static_cast<int32_t>( cell.first >> 32 );
+			const auto cell_y = static_cast<int32_t>( static_cast<uint32_t>( cell.first ) );
+			const auto key = get_cell_key(
+				static_cast<int32_t>( floor( cell_x / 2.0 ) ),
+				static_cast<int32_t>( floor( cell_y / 2.0 ) )
+			);
+
+			auto &sum = merged[key];
+			sum.r += cell.second.r;
+			sum.g += cell.second.g;
+			sum.b += cell.second.b;
+			sum.alpha_area += cell.second.alpha_area;
+		}
+		cells.swap( merged );
+	}
+
+
+
+	void add_triangles( const vector<ImgPoint> &triangles, ImgPoint offset, Color color, ImgLodLevel &level )
+	{
+		for( const auto &point : triangles )
+		{
+			level.triangles.push_back( { point.x + offset.x, point.y + offset.y } );
+		}
+		level.colors.insert( level.colors.end(), triangles.size() / 3, color );
+	}
+
+
+
+	uint8_t to_byte( float value )
+	{
+		return static_cast<uint8_t>( min( value + 0.5f, 255.f ) );
+	}
+
+
+
+	void add_cells( const Cells &cells, float cell_size, ImgLodLevel &level )
+	{
+		// Cells covered less than what a color byte can show are dropped
+		const auto cell_area = cell_size * cell_size;
+		for( const auto &cell : cells )
+		{
+			const auto &sum = cell.second;
+			const auto alpha = min( sum.alpha_area / cell_area, 1.f );
+			if( alpha * 255.f < 0.5f )
+			{
+				continue;
+			}
+
+			const Color color = {
+				to_byte( sum.r / sum.alpha_area ),
+				to_byte( sum.g / sum.alpha_area ),
+				to_byte( sum.b / sum.alpha_area ),
+				to_byte( alpha * 255.f )
+			};
+
+			const auto x = static_cast<int32_t>( cell.first >> 32 ) * cell_size;
+			const auto y = static_cast<int32_t>( static_cast<uint32_t>( cell.first ) ) * cell_size;
+			level.triangles.insert( level.triangles.end(), {
+				{ x, y }, { x + cell_size, y }, { x + cell_size, y + cell_size },
+				{ x + cell_size, y + cell_size }, { x, y + cell_size }, { x, y }
+			} );
+			level.colors.insert( level.colors.end(), 2, color );
+		}
+	}
+
+
+
+	void add_chain( const Chain &chain, const vector<ImgPoint> &points, float scale, vector<ImgPoint> &triangles, ImgLodLevel &level )
+	{
+		// Lines thinner than a pixel would flicker, they get fainter instead
+		auto width = chain.width;
+		auto color = chain.color;
+		if( width * scale < 1.f )
+		{
+			color.a = to_byte( color.a * width * scale );
+			width = 1.f / scale;
+		}
+		if( !color.a )
+		{
+			return;
+		}
+
+		triangles.clear();
+		for( auto i = chain.first; i + 1 < chain.end; i++ )
+		{
+			const auto previous = i > chain.first ? &points[i - 1] : nullptr;
+			tessellate_line( points[i], points[i + 1], previous, i + 2 < chain.end, width, chain.style, triangles );
+		}
+		add_triangles( triangles, { 0.f, 0.f }, color, level );
+	}
+}
+
+
+
+void vector_img::simplify_polyline( const ImgPoint *points, size_t count, float tolerance, vector<ImgPoint> &simplified )
+{
+	if( count < 3 )
+	{
+		simplified.insert( simplified.end(), points, points + count );
+		return;
+	}
+
+	// The point farthest from the segment between two kept points is kept
+	// if it's out of tolerance, and both sides of it are simplified again
+	vector<bool> keep( count, false );
+	keep[0] = true;
+	keep[count - 1] = true;
+
+	const auto squared_tolerance = tolerance * tolerance;
+	vector<pair<size_t, size_t>> ranges = { { 0, count - 1 } };
+	while( !ranges.empty() )
+	{
+		const auto range = ranges.back();
+		ranges.pop_back();
+
+		auto farthest = range.first;
+		auto farthest_distance = 0.f;
+		for( auto i = range.first + 1; i < range.second; i++ )
+		{
+			const auto distance = get_squared_distance( points[i], points[range.first], points[range.second] );
+			if( distance > farthest_distance )
+			{
+				farthest = i;
+				farthest_distance = distance;
+			}
+		}
+
+		if( farthest_distance > squared_tolerance )
+		{
+			keep[farthest] = true;
+			ranges.push_back( { range.first, farthest } );
+			ranges.push_back( { farthest, range.second } );
+		}
+	}
+
+	for( size_t i = 0; i < count; i++ )
+	{
+		if( keep[i] )
+		{
+			simplified.push_back( points[i] );
+		}
+	}
+}
+
+
+
+void vector_img::build_lod_levels( const ImgLines &lines, const ImgFills &fills, vector<ImgLodLevel> &levels )
+{
+	levels.clear();
+
+	vector<Chain> chains;
+	vector<ImgPoint> points;
+	vector<Shape> shapes;
+	get_chains( lines, chains, points );
+	get_shapes( fills, shapes );
+	if( points.empty() && shapes.empty() )
+	{
+		return;
+	}
+
+	auto bounds = points.empty() ? ImgBounds{ shapes[0].x, shapes[0].y, shapes[0].x, shapes[0].y } : get_bounds( points.data(), points.size() );
+	for( const auto &shape : shapes )
+	{
+		const auto path_bounds = shape.path.get_bounds();
+		bounds.min_x = min( bounds.min_x, shape.x + path_bounds.min_x );
+		bounds.min_y = min( bounds.min_y, shape.y + path_bounds.min_y );
+		bounds.max_x = max( bounds.max_x, shape.x + path_bounds.max_x );
+		bounds.max_y = max( bounds.max_y, shape.y + path_bounds.max_y );
+	}
+
+	const auto extent = get_extent( bounds );
+	if( !(extent > 0.f) || !isfinite( extent ) )
+	{
+		return;
+	}
+
+	// Each level simplifies the items of the previous one, the items merged
+	// into cells stay in them and the cells are merged in turn
+	Cells fill_cells;
+	Cells line_cells;
+	vector<Chain> next_chains;
+	vector<ImgPoint> next_points;
+	vector<ImgPoint> triangles;
+	for( auto scale = exp2( floor( log2( max_level_extent / extent ) ) ); extent * scale >= min_level_extent; scale /= 2.f )
+	{
+		const auto cell_size = 1.f / scale;
+		const auto tolerance = level_tolerance * cell_size;
+		if( !levels.empty() )
+		{
+			merge_cells( fill_cells );
+			merge_cells( line_cells );
+		}
+
+		levels.emplace_back();
+		auto &level = levels.back();
+		level.id    = ++last_level_id;
+		level.scale = scale;
+
+		size_t kept_count = 0;
+		for( auto &shape : shapes )
+		{
+			const auto path_bounds = shape.path.get_bounds();
+			const auto area = get_area( shape.path );
+			if( get_extent( path_bounds ) > cell_size )
+			{
+				simplify_path( shape.path, tolerance, triangles );
+			}
+
+			if( get_extent( path_bounds ) <= cell_size || shape.path.contour_ends.empty() )
+			{
+				const auto x = shape.x + (path_bounds.min_x + path_bounds.max_x) / 2.f;
+				const auto y = shape.y + (path_bounds.min_y + path_bounds.max_y) / 2.f;
+				add_to_cells( x, y, cell_size, shape.color, area, fill_cells );
+				continue;
+			}
+
+			if( &shapes[kept_count] != &shape )
+			{
+				shapes[kept_count] = move( shape );
+			}
+			kept_count++;
+		}
+		shapes.erase( shapes.begin() + kept_count, shapes.end() );
+
+		add_cells( fill_cells, cell_size, level );
+		for( const auto &shape : shapes )
+		{
+			triangles.clear();
+			tessellate_path( shape.path, triangles );
+			add_triangles( triangles, { shape.x, shape.y }, shape.color, level );
+		}
+
+		next_chains.clear();
+		next_points.clear();
+		for( auto chain : chains )
+		{
+			const auto chain_points = points.data() + chain.first;
+			const auto count = chain.end - chain.first;
+			const auto chain_bounds = get_bounds( chain_points, count );
+			const auto reach = chain.style.get_reach( chain.width );
+			if( get_extent( chain_bounds ) + 2.f * reach <= cell_size )
+			{
+				const auto x = (chain_bounds.min_x + chain_bounds.max_x) / 2.f;
+				const auto y = (chain_bounds.min_y + chain_bounds.max_y) / 2.f;
+				add_to_cells( x, y, cell_size, chain.color, get_length( chain_points, count ) * chain.width, line_cells );
+				continue;
+			}
+
+			chain.first = static_cast<uint32_t>( next_points.size() );
+			simplify_polyline( chain_points, count, tolerance, next_points );
+			chain.end = static_cast<uint32_t>( next_points.size() );
+			next_chains.push_back( chain );
+		}
+		chains.swap( next_chains );
+		points.swap( next_points );
+
+		add_cells( line_cells, cell_size, level );
+		for( const auto &chain : chains )
+		{
+			add_chain( chain, points, scale, triangles, level );
+		}
+	}
+}
+
+
+
+const size_t ImgLodCache::default_min_item_count;
+
+
+
+ImgLodCache::ImgLodCache( size_t min_item_count )
+: min_item_count( min_item_count ),
+  queued_version( 0 ),
+  running( false ),
+  stopping( false )
+{
+}
+
+
+
+ImgLodCache::~ImgLodCache()
+{
+	{
+		lock_guard<mutex> jobs_lock( jobs_mutex );
+		stopping = true;
+		queued_job.reset();
+	}
+	jobs_changed.notify_all();
+
+	if( worker.joinable() )
+	{
+		worker.join();
+	}
+}
+
+
+
+void ImgLodCache::run_worker()
+{
+	unique_lock<mutex> jobs_lock( jobs_mutex );
+	while( true )
+	{
+		jobs_changed.wait( jobs_lock, [this]() { return stopping || queued_job; } );
+		if( stopping )
+		{
+			return;
+		}
+
+		auto job = move( queued_job );
+		running = true;
+
+		jobs_lock.unlock();
+		build_lod_levels( job->lines, job->fills, job->levels );
+		job->lines = ImgLines();
+		job->fills = ImgFills();
+		jobs_lock.lock();
+
+		running = false;
+		finished_job = move( job );
+		jobs_changed.notify_all();
+	}
+}
+
+
+
+void ImgLodCache::update( const ImgLayer &layer )
+{
+	{
+		lock_guard<mutex> jobs_lock( jobs_mutex );
+		if( finished_job )
+		{
+			if( finished_job->version == queued_version )
+			{
+				levels.swap( finished_job->levels );
+			}
+			finished_job.reset();
+		}
+
+		if( running || queued_job )
+		{
+			return;
+		}
+	}
+
+	const auto version = layer.get_version();
+	if( version == queued_version )
+	{
+		return;
+	}
+
+	queued_version = version;
+	const auto item_count = layer.lines.size() - layer.lines.removed_count + layer.fills.size() - layer.fills.removed_count;
+	if( item_count < min_item_count )
+	{
+		levels.clear();
+		return;
+	}
+
+	// The pools are copied for the thread, which is free until it's queued
+	auto job = make_unique<Job>();
+	job->version = version;
+	job->lines   = layer.lines;
+	job->fills   = layer.fills;
+
+	if( !worker.joinable() )
+	{
+		worker = thread( [this]() { run_worker(); } );
+	}
+
+	{
+		lock_guard<mutex> jobs_lock( jobs_mutex );
+		queued_job = move( job );
+	}
+	jobs_changed.notify_all();
+}
+
+
+
+const ImgLodLevel *ImgLodCache::get_level( float scale ) const
+{
+	// The levels go from the finest to the coarsest
+	for( auto level = levels.rbegin(); level != levels.rend(); ++level )
+	{
+		if( level->scale >= scale )
+		{
+			return &*level;
+		}
+	}
+	return nullptr;
+}
+
+
+
+bool ImgLodCache::is_busy() const
+{
+	lock_guard<mutex> jobs_lock( jobs_mutex );
+	return running || queued_job || finished_job;
+}
+
+
+
+void ImgLodCache::wait()
+{
+	unique_lock<mutex> jobs_lock( jobs_mutex );
+	jobs_changed.wait( jobs_lock, [this]() { return !running && !queued_job; } );
+}
+
+
+
+void ImgLodCache::clear()
+{
+	{
+		lock_guard<mutex> jobs_lock( jobs_mutex );
+		queued_job.reset();
+	}
+
+	// Levels still being built are thrown away when they finish
+	levels.clear();
+	queued_version = 0;
+}
+
+
+
+size_t ImgLodCache::get_memory_size() const
+{
+	auto size = levels.capacity() * sizeof( ImgLodLevel );
+	for( const auto &level : levels )
+	{
+		size += level.triangles.capacity() * sizeof( ImgPoint ) + level.colors.capacity() * sizeof( Color );
+	}
+	return size;
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include "vector_img.hh"
+
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <condition_variable>
+
+namespace vector_img
+{
+
+
+// Appends the points of the polyline that are needed to keep it within
+// tolerance of the original, by Douglas-Peucker; the ends are always kept
+void simplify_polyline( const ImgPoint *points, size_t count, float tolerance, std::vector<ImgPoint> &simplified );
+
+
+
+// The lines and the fills of a layer simplified to be drawn zoomed out
+// - scale is the largest scale the level is drawn at, in pixels per unit
+// - The triangles are in image coordinates, three corners per triangle
+//   and a color for each triangle
+struct ImgLodLevel
+{
+	uint64_t id;
+	float    scale;
+	std::vector<ImgPoint> triangles;
+	std::vector<Color>    colors;
+};
+
+// Replaces levels with the levels of the lines and the fills, the finest first
+// - The first level is for the scale where the items span 4096 pixels at most,
+//   each next one for half the scale of the previous, down to 64 pixels
+// - Polylines of joined lines and the contours of the fills are simplified
+//   within a quarter of a pixel, lines thinner than a pixel are drawn a pixel
+//   wide and fainter
+// - Items smaller than a pixel are merged into the pixel squares they are in,
+//   with their average color and the alpha of the area they cover. The squares
+//   are drawn under the other items of their type
+void build_lod_levels( const ImgLines &lines, const ImgFills &fills, std::vector<ImgLodLevel> &levels );
+
+
+
+// Levels of detail of a layer, built by a worker thread
+// - Layers with few items are always drawn in full detail
+// - The levels are built again when the layer changes, the levels of the
+//   previous version are drawn until the new ones are ready
+struct ImgLodCache
+{
+	static const size_t default_min_item_count = 10000;
+
+	explicit ImgLodCache( size_t min_item_count = default_min_item_count );
+	~ImgLodCache();
+
+	// Delete potentially dangerous constructors and operators
+	ImgLodCache( ImgLodCache& )            = delete;
+	ImgLodCache& operator=( ImgLodCache& ) = delete;
+
+	// Takes the levels finished by the thread, and queues the layer
+	// once the thread is free if it changed since it was last queued
+	void update( const ImgLayer &layer );
+
+	// Coarsest level that can be drawn at the scale, nullptr for the full detail
+	const ImgLodLevel *get_level( float scale ) const;
+
+	// Whether the thread is building levels, or has levels that the next update takes
+	bool is_busy() const;
+
+	// Blocks until the thread is done, the levels are taken by the next update
+	void wait();
+
+	void clear();
+
+	size_t get_level_count() const { return levels.size(); }
+	size_t get_memory_size() const;
+
+  protected:
+	struct Job
+	{
+		uint64_t version;
+		ImgLines lines;
+		ImgFills fills;
+		std::vector<ImgLodLevel> levels;
+	};
+
+	std::vector<ImgLodLevel> levels;
+	size_t   min_item_count;
+
+	// Version of the layer last queued or found too small, 0 for none
+	// - Levels finished for other versions are thrown away
+	uint64_t queued_version;
+
+	// Shared with the thread
+	mutable std::mutex      jobs_mutex;
+	std::condition_variable jobs_changed;
+	std::unique_ptr<Job>    queued_job;
+	std::unique_ptr<Job>    finished_job;
+	bool                    running;
+	bool                    stopping;
+	std::thread             worker;
+
+	void run_worker();
+};
+
+
+};
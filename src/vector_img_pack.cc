@@ -0,0 +1,777 @@
+#include "vector_img_pack.hh"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PACK_SSE2
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define PACK_SSSE3_FUNCTION
+#else
+#define PACK_SSSE3_FUNCTION __attribute__(( target( "ssse3" ) ))
+#endif
+#endif
+
+using namespace std;
+using namespace vector_img;
+
+namespace
+{
+	// Coordinates are kept within this many steps from the origin
+	const float max_steps = 1073741824.f;
+
+
+
+	// Small differences of either sign become small values
+	uint32_t zigzag( uint32_t difference )
+	{
+		return (difference << 1) ^ (0u - (difference >> 31));
+	}
+
+
+
+	uint32_t unzigzag( uint32_t value )
+	{
+		return (value >> 1) ^ (0u - (value & 1));
+	}
+
+
+
+	uint32_t get_byte_count( uint32_t value )
+	{
+		return value < 0x100 ? 1 : value < 0x10000 ? 2 : value < 0x1000000 ? 3 : 4;
+	}
+
+
+
+	// Byte counts of the four values of each control byte, and the shuffles
+	// that move their bytes to the low bytes of four 32 bit lanes
+	struct ControlTables
+	{
+		uint8_t group_sizes[256];
+		uint8_t shuffles[256][16];
+
+		ControlTables()
+		{
+			for( unsigned control = 0; control < 256; control++ )
+			{
+				uint8_t offset = 0;
+				for( unsigned value = 0; value < 4; value++ )
+				{
+					const auto byte_count = ((control >> (value * 2)) & 3) + 1;
+					for( unsigned byte = 0; byte < 4; byte++ )
+					{
+						shuffles[control][value * 4 + byte] = byte < byte_count ? static_cast<uint8_t>( offset + byte ) : 0x80;
+					}
+					offset += static_cast<uint8_t>( byte_count );
+				}
+				group_sizes[control] = offset;
+			}
+		}
+	};
+
+
+
+#ifdef PACK_SSE2
+	bool has_ssse3()
+	{
+		static const auto result = []
+		{
+		#ifdef _MSC_VER
+			int info[4];
+			__cpuid( info, 1 );
+			return (info[2] & (1 << 9)) != 0;
+		#else
+			return __builtin_cpu_supports( "ssse3" ) != 0;
+		#endif
+		}();
+		return result;
+	}
+
+
+
+	// Unpacks the whole groups of four values while 16 bytes can be read,
+	// returns the count of values unpacked
+	PACK_SSSE3_FUNCTION size_t unpack_groups(
+		const uint8_t *controls,
+		size_t group_count,
+		const uint8_t *&position,
+		const uint8_t *end,
+		uint32_t *values,
+		uint32_t &previous
+	)
+	{
+		static const ControlTables tables;
+		const auto zero = _mm_setzero_si128();
+		const auto one = _mm_set1_epi32( 1 );
+		auto carry = _mm_set1_epi32( static_cast<int>( previous ) );
+
+		size_t group = 0;
+		for( ; group < group_count && end - position >= 16; group++ )
+		{
+			const auto control = controls[group];
+			const auto bytes = _mm_loadu_si128( reinterpret_cast<const __m128i*>( position ) );
+			const auto shuffle = _mm_loadu_si128( reinterpret_cast<const __m128i*>( tables.shuffles[control] ) );
+			auto differences = _mm_shuffle_epi8( bytes, shuffle );
+			differences = _mm_xor_si128( _mm_srli_epi32( differences, 1 ), _mm_sub_epi32( zero, _mm_and_si128( differences, one ) ) );
+
+			// Prefix sum of the differences, continued from the previous group
+			differences = _mm_add_epi32( differences, _mm_slli_si128( differences, 4 ) );
+			differences = _mm_add_epi32( differences, _mm_slli_si128( differences, 8 ) );
+			const auto sums = _mm_add_epi32( differences, carry );
+			_mm_storeu_si128( reinterpret_cast<__m128i*>( values + group * 4 ), sums );
+
+			carry = _mm_shuffle_epi32( sums, _MM_SHUFFLE( 3, 3, 3, 3 ) );
+			position += tables.group_sizes[control];
+		}
+
+		previous = static_cast<uint32_t>( _mm_cvtsi128_si32( carry ) );
+		return group * 4;
+	}
+#endif
+
+
+
+	uint32_t to_steps( float value, float origin, float step )
+	{
+		const auto steps = round( (value - origin) / step );
+		if( !(steps == steps) )
+		{
+			return 0;
+		}
+
+		return static_cast<uint32_t>( static_cast<int32_t>( min( max( steps, -max_steps ), max_steps ) ) );
+	}
+
+
+
+	// Packing and unpacking give the same coordinates by the same steps
+	void to_coordinates( const uint32_t *steps, size_t count, float origin, float step, float *coordinates )
+	{
+		size_t i = 0;
+
+	#ifdef PACK_SSE2
+		const auto origins = _mm_set1_ps( origin );
+		const auto step_sizes = _mm_set1_ps( step );
+		for( ; i + 4 <= count; i += 4 )
+		{
+			const auto values = _mm_cvtepi32_ps( _mm_loadu_si128( reinterpret_cast<const __m128i*>( steps + i ) ) );
+			_mm_storeu_ps( coordinates + i, _mm_add_ps( origins, _mm_mul_ps( values, step_sizes ) ) );
+		}
+	#endif
+
+		for( ; i < count; i++ )
+		{
+			coordinates[i] = origin + static_cast<float>( static_cast<int32_t>( steps[i] ) ) * step;
+		}
+	}
+
+
+
+	uint32_t to_value( Color color )
+	{
+		uint32_t value;
+		memcpy( &value, &color, sizeof( value ) );
+		return value;
+	}
+
+
+
+	Color to_color( uint32_t value )
+	{
+		Color color;
+		memcpy( &color, &value, sizeof( color ) );
+		return color;
+	}
+
+
+
+	template<typename Pool>
+	void get_live_indices( const Pool &pool, vector<uint32_t> &indices )
+	{
+		indices.clear();
+		for( size_t i = 0; i < pool.size(); i++ )
+		{
+			if( !pool.is_removed( i ) )
+			{
+				indices.push_back( static_cast<uint32_t>( i ) );
+			}
+		}
+	}
+
+
+
+	template<typename Value>
+	void gather( const vector<Value> &column, const vector<uint32_t> &indices, vector<Value> &values )
+	{
+		values.resize( indices.size() );
+		for( size_t i = 0; i < indices.size(); i++ )
+		{
+			values[i] = column[indices[i]];
+		}
+	}
+
+
+
+	void to_steps( const vector<float> &coordinates, float origin, float step, vector<uint32_t> &steps )
+	{
+		steps.resize( coordinates.size() );
+		for( size_t i = 0; i < coordinates.size(); i++ )
+		{
+			steps[i] = to_steps( coordinates[i], origin, step );
+		}
+	}
+
+
+
+	void to_coordinates( const vector<uint32_t> &steps, float origin, float step, vector<float> &coordinates )
+	{
+		coordinates.resize( steps.size() );
+		to_coordinates( steps.data(), steps.size(), origin, step, coordinates.data() );
+	}
+
+
+
+	runtime_error broken_layer()
+	{
+		return runtime_error( "The packed layer is broken" );
+	}
+
+
+
+	// Appends the columns of a layer to the packed data
+	struct ColumnWriter
+	{
+		vector<char>     &data;
+		vector<uint32_t>  lengths;
+		vector<uint32_t>  runs;
+
+		void write( const vector<uint32_t> &values )
+		{
+			pack_column( values.data(), values.size(), data );
+		}
+
+		// Repeated values as a column of the run count, one of the run lengths and one of the values
+		void write_runs( const vector<uint32_t> &values )
+		{
+			lengths.clear();
+			runs.clear();
+			for( size_t i = 0; i < values.size(); i++ )
+			{
+				if( i && values[i] == values[i - 1] )
+				{
+					lengths.back()++;
+					continue;
+				}
+				lengths.push_back( 1 );
+				runs.push_back( values[i] );
+			}
+
+			const auto run_count = static_cast<uint32_t>( runs.size() );
+			pack_column( &run_count, 1, data );
+			write( lengths );
+			write( runs );
+		}
+	};
+
+
+
+	// Reads the columns of a packed layer, throws runtime_error if they are broken
+	// - Every value takes at least a byte, so counts can be checked before allocating
+	struct ColumnReader
+	{
+		const char       *data;
+		size_t            size;
+		size_t            position;
+		vector<uint32_t>  lengths;
+		vector<uint32_t>  runs;
+
+		void read( size_t count, vector<uint32_t> &values )
+		{
+			if( count > size - position )
+			{
+				throw broken_layer();
+			}
+
+			values.resize( count );
+			const auto column_size = unpack_column( data + position, size - position, count, values.data() );
+			if( count && !column_size )
+			{
+				throw broken_layer();
+			}
+			position += column_size;
+		}
+
+		void read_runs( size_t count, vector<uint32_t> &values )
+		{
+			read( 1, lengths );
+			const auto run_count = lengths[0];
+			read( run_count, lengths );
+			read( run_count, runs );
+
+			values.clear();
+			for( size_t i = 0; i < run_count; i++ )
+			{
+				if( lengths[i] > count - values.size() )
+				{
+					throw broken_layer();
+				}
+				values.insert( values.end(), lengths[i], runs[i] );
+			}
+
+			if( values.size() != count )
+			{
+				throw broken_layer();
+			}
+		}
+
+		void read_coordinates( size_t count, float origin, float step, vector<uint32_t> &steps, vector<float> &coordinates )
+		{
+			read( count, steps );
+			to_coordinates( steps, origin, step, coordinates );
+		}
+	};
+
+
+
+	struct BoundsBuilder
+	{
+		ImgBounds bounds   = { 0.f, 0.f, 0.f, 0.f };
+		bool      is_empty = true;
+
+		void add( const ImgBounds &item )
+		{
+			if( is_empty )
+			{
+				bounds = item;
+				is_empty = false;
+				return;
+			}
+
+			bounds.min_x = min( bounds.min_x, item.min_x );
+			bounds.min_y = min( bounds.min_y, item.min_y );
+			bounds.max_x = max( bounds.max_x, item.max_x );
+			bounds.max_y = max( bounds.max_y, item.max_y );
+		}
+	};
+
+
+
+}
+
+
+
+void vector_img::pack_column( const uint32_t *values, size_t count, vector<char> &data )
+{
+	const auto controls = data.size();
+	data.resize( controls + (count + 3) / 4, 0 );
+
+	uint32_t previous = 0;
+	for( size_t i = 0; i < count; i++ )
+	{
+		const auto value = zigzag( values[i] - previous );
+		const auto byte_count = get_byte_count( value );
+		data[controls + i / 4] |= static_cast<char>( (byte_count - 1) << (i % 4 * 2) );
+		for( uint32_t byte = 0; byte < byte_count; byte++ )
+		{
+			data.push_back( static_cast<char>( value >> (byte * 8) ) );
+		}
+		previous = values[i];
+	}
+}
+
+
+
+size_t vector_img::unpack_column( const char *data, size_t size, size_t count, uint32_t *values )
+{
+	const auto control_size = (count + 3) / 4;
+	if( size < control_size )
+	{
+		return 0;
+	}
+
+	const auto controls = reinterpret_cast<const uint8_t*>( data );
+	const auto end = controls + size;
+	auto position = controls + control_size;
+	uint32_t previous = 0;
+	size_t i = 0;
+
+#ifdef PACK_SSE2
+	if( has_ssse3() )
+	{
+		i = unpack_groups( controls, count / 4, position, end, values, previous );
+	}
+#endif
+
+	// The rest a value at a time, near the end of the data
+	for( ; i < count; i++ )
+	{
+		const auto byte_count = static_cast<size_t>( ((controls[i / 4] >> (i % 4 * 2)) & 3) + 1 );
+		if( static_cast<size_t>( end - position ) < byte_count )
+		{
+			return 0;
+		}
+
+		uint32_t value = 0;
+		for( size_t byte = 0; byte < byte_count; byte++ )
+		{
+			value |= static_cast<uint32_t>( position[byte] ) << (byte * 8);
+		}
+		position += byte_count;
+
+		previous += unzigzag( value );
+		values[i] = previous;
+	}
+
+	return static_cast<size_t>( position - controls );
+}
+
+
+
+
+
+
+ImgPackHeader vector_img::pack_layer( const ImgLayer &layer, float step, vector<char> &data )
+{
+	ImgPackHeader header;
+	memset( &header, 0, sizeof( header ) );
+	header.step = step > 0.f && isfinite( step ) ? step : default_pack_step;
+	step = header.step;
+
+	ImgLayerIndices items;
+	get_live_indices( layer.control_points, items.control_points );
+	get_live_indices( layer.lines, items.lines );
+	get_live_indices( layer.fills, items.fills );
+	header.control_point_count = static_cast<uint32_t>( items.control_points.size() );
+	header.line_count = static_cast<uint32_t>( items.lines.size() );
+	header.fill_count = static_cast<uint32_t>( items.fills.size() );
+
+	const auto &control_points = layer.control_points;
+	const auto &lines = layer.lines;
+	const auto &fills = layer.fills;
+
+	// The origin is the top left of the items, paths are relative to their fills
+	auto min_x = INFINITY;
+	auto min_y = INFINITY;
+	for( const auto i : items.control_points )
+	{
+		min_x = min( min_x, control_points.x[i] );
+		min_y = min( min_y, control_points.y[i] );
+	}
+	for( const auto i : items.lines )
+	{
+		min_x = min( { min_x, lines.ax[i], lines.bx[i] } );
+		min_y = min( { min_y, lines.ay[i], lines.by[i] } );
+	}
+	for( const auto i : items.fills )
+	{
+		min_x = min( min_x, fills.x[i] );
+		min_y = min( min_y, fills.y[i] );
+	}
+	header.origin_x = isfinite( min_x ) ? min_x : 0.f;
+	header.origin_y = isfinite( min_y ) ? min_y : 0.f;
+
+	const auto header_offset = data.size();
+	data.resize( header_offset + sizeof( header ) );
+
+	// The bounds are of the coordinates as they are unpacked
+	ColumnWriter writer{ data, {}, {} };
+	BoundsBuilder bounds;
+	vector<float> column;
+	vector<float> xs;
+	vector<float> ys;
+	vector<uint32_t> x_steps;
+	vector<uint32_t> y_steps;
+	vector<uint32_t> values;
+	vector<Color> colors;
+
+	// Control points
+	gather( control_points.x, items.control_points, column );
+	to_steps( column, header.origin_x, step, x_steps );
+	gather( control_points.y, items.control_points, column );
+	to_steps( column, header.origin_y, step, y_steps );
+	writer.write( x_steps );
+	writer.write( y_steps );
+
+	gather( control_points.color, items.control_points, colors );
+	values.resize( colors.size() );
+	transform( colors.begin(), colors.end(), values.begin(), to_value );
+	writer.write_runs( values );
+
+	to_coordinates( x_steps, header.origin_x, step, xs );
+	to_coordinates( y_steps, header.origin_y, step, ys );
+	for( size_t i = 0; i < xs.size(); i++ )
+	{
+		bounds.add( { xs[i], ys[i], xs[i], ys[i] } );
+	}
+
+	// Lines, a line starting where the previous one ended only has its end
+	vector<uint32_t> ax, ay, bx, by;
+	gather( lines.ax, items.lines, column );
+	to_steps( column, header.origin_x, step, ax );
+	gather( lines.ay, items.lines, column );
+	to_steps( column, header.origin_y, step, ay );
+	gather( lines.bx, items.lines, column );
+	to_steps( column, header.origin_x, step, bx );
+	gather( lines.by, items.lines, column );
+	to_steps( column, header.origin_y, step, by );
+
+	values.resize( items.lines.size() );
+	x_steps.clear();
+	y_steps.clear();
+	for( size_t i = 0; i < items.lines.size(); i++ )
+	{
+		values[i] = i && ax[i] == bx[i - 1] && ay[i] == by[i - 1];
+		if( !values[i] )
+		{
+			x_steps.push_back( ax[i] );
+			y_steps.push_back( ay[i] );
+		}
+		x_steps.push_back( bx[i] );
+		y_steps.push_back( by[i] );
+	}
+	writer.write_runs( values );
+	writer.write( x_steps );
+	writer.write( y_steps );
+
+	vector<uint32_t> width_steps;
+	gather( lines.width, items.lines, column );
+	to_steps( column, 0.f, step, width_steps );
+	writer.write_runs( width_steps );
+
+	gather( lines.color, items.lines, colors );
+	values.resize( colors.size() );
+	transform( colors.begin(), colors.end(), values.begin(), to_value );
+	writer.write_runs( values );
+
+	vector<ImgLineStyle> styles;
+	gather( lines.style, items.lines, styles );
+	values.resize( styles.size() );
+	transform( styles.begin(), styles.end(), values.begin(), []( ImgLineStyle style ) { return style.cap | style.join << 8; } );
+	writer.write_runs( values );
+
+	vector<float> widths;
+	to_coordinates( width_steps, 0.f, step, widths );
+	for( size_t i = 0; i < items.lines.size(); i++ )
+	{
+		const auto a_x = header.origin_x + static_cast<int32_t>( ax[i] ) * step;
+		const auto a_y = header.origin_y + static_cast<int32_t>( ay[i] ) * step;
+		const auto b_x = header.origin_x + static_cast<int32_t>( bx[i] ) * step;
+		const auto b_y = header.origin_y + static_cast<int32_t>( by[i] ) * step;
+		const auto reach = styles[i].get_reach( widths[i] );
+		bounds.add( { min( a_x, b_x ) - reach, min( a_y, b_y ) - reach, max( a_x, b_x ) + reach, max( a_y, b_y ) + reach } );
+	}
+
+	// Fills, the contours as their point counts
+	gather( fills.x, items.fills, column );
+	to_steps( column, header.origin_x, step, x_steps );
+	gather( fills.y, items.fills, column );
+	to_steps( column, header.origin_y, step, y_steps );
+	writer.write( x_steps );
+	writer.write( y_steps );
+	to_coordinates( x_steps, header.origin_x, step, xs );
+	to_coordinates( y_steps, header.origin_y, step, ys );
+
+	gather( fills.color, items.fills, colors );
+	values.resize( colors.size() );
+	transform( colors.begin(), colors.end(), values.begin(), to_value );
+	writer.write_runs( values );
+
+	values.clear();
+	for( const auto i : items.fills )
+	{
+		values.push_back( fills.path[i].rule );
+	}
+	writer.write_runs( values );
+
+	values.clear();
+	for( const auto i : items.fills )
+	{
+		values.push_back( static_cast<uint32_t>( fills.path[i].contour_ends.size() ) );
+	}
+	writer.write_runs( values );
+
+	vector<uint32_t> path_sizes;
+	values.clear();
+	for( const auto i : items.fills )
+	{
+		const auto &path = fills.path[i];
+		uint32_t start = 0;
+		for( const auto end : path.contour_ends )
+		{
+			const auto contour_end = min( max( end, start ), static_cast<uint32_t>( path.points.size() ) );
+			values.push_back( contour_end - start );
+			start = contour_end;
+		}
+		path_sizes.push_back( start );
+		header.path_point_count += start;
+	}
+	header.contour_count = static_cast<uint32_t>( values.size() );
+	writer.write( values );
+
+	vector<float> path_xs;
+	vector<float> path_ys;
+	for( size_t fill = 0; fill < items.fills.size(); fill++ )
+	{
+		const auto &points = fills.path[items.fills[fill]].points;
+		for( uint32_t point = 0; point < path_sizes[fill]; point++ )
+		{
+			path_xs.push_back( points[point].x );
+			path_ys.push_back( points[point].y );
+		}
+	}
+	to_steps( path_xs, 0.f, step, x_steps );
+	to_steps( path_ys, 0.f, step, y_steps );
+	writer.write( x_steps );
+	writer.write( y_steps );
+	to_coordinates( x_steps, 0.f, step, path_xs );
+	to_coordinates( y_steps, 0.f, step, path_ys );
+
+	size_t first_point = 0;
+	for( size_t fill = 0; fill < items.fills.size(); fill++ )
+	{
+		ImgBounds fill_bounds = { xs[fill], ys[fill], xs[fill], ys[fill] };
+		for( size_t point = first_point; point < first_point + path_sizes[fill]; point++ )
+		{
+			const auto x = xs[fill] + path_xs[point];
+			const auto y = ys[fill] + path_ys[point];
+			if( point == first_point )
+			{
+				fill_bounds = { x, y, x, y };
+			}
+			fill_bounds = { min( fill_bounds.min_x, x ), min( fill_bounds.min_y, y ), max( fill_bounds.max_x, x ), max( fill_bounds.max_y, y ) };
+		}
+		bounds.add( fill_bounds );
+		first_point += path_sizes[fill];
+	}
+
+	header.bounds = bounds.bounds;
+	memcpy( data.data() + header_offset, &header, sizeof( header ) );
+	return header;
+}
+
+
+
+void vector_img::unpack_layer( const char *data, size_t size, ImgLayer &layer )
+{
+	ImgPackHeader header;
+	if( size < sizeof( header ) )
+	{
+		throw broken_layer();
+	}
+	memcpy( &header, data, sizeof( header ) );
+
+	// All the columns are read before any item is added, broken data leaves the layer as it was
+	const auto step = header.step;
+	ColumnReader reader{ data, size, sizeof( header ), {}, {} };
+	vector<uint32_t> steps;
+	vector<float> point_xs;
+	vector<float> point_ys;
+	vector<uint32_t> point_colors;
+	reader.read_coordinates( header.control_point_count, header.origin_x, step, steps, point_xs );
+	reader.read_coordinates( header.control_point_count, header.origin_y, step, steps, point_ys );
+	reader.read_runs( header.control_point_count, point_colors );
+
+	vector<uint32_t> joined;
+	reader.read_runs( header.line_count, joined );
+	const auto joined_count = static_cast<size_t>( count_if( joined.begin(), joined.end(), []( uint32_t value ) { return value != 0; } ) );
+	const auto end_count = static_cast<size_t>( header.line_count ) * 2 - joined_count;
+	if( header.line_count && joined[0] )
+	{
+		throw broken_layer();
+	}
+
+	vector<float> end_xs;
+	vector<float> end_ys;
+	vector<float> widths;
+	vector<uint32_t> line_colors;
+	vector<uint32_t> styles;
+	reader.read_coordinates( end_count, header.origin_x, step, steps, end_xs );
+	reader.read_coordinates( end_count, header.origin_y, step, steps, end_ys );
+	reader.read_runs( header.line_count, steps );
+	to_coordinates( steps, 0.f, step, widths );
+	reader.read_runs( header.line_count, line_colors );
+	reader.read_runs( header.line_count, styles );
+
+	vector<float> fill_xs;
+	vector<float> fill_ys;
+	vector<uint32_t> fill_colors;
+	vector<uint32_t> rules;
+	vector<uint32_t> contour_counts;
+	vector<uint32_t> contour_sizes;
+	vector<float> path_xs;
+	vector<float> path_ys;
+	reader.read_coordinates( header.fill_count, header.origin_x, step, steps, fill_xs );
+	reader.read_coordinates( header.fill_count, header.origin_y, step, steps, fill_ys );
+	reader.read_runs( header.fill_count, fill_colors );
+	reader.read_runs( header.fill_count, rules );
+	reader.read_runs( header.fill_count, contour_counts );
+	reader.read( header.contour_count, contour_sizes );
+	reader.read_coordinates( header.path_point_count, 0.f, step, steps, path_xs );
+	reader.read_coordinates( header.path_point_count, 0.f, step, steps, path_ys );
+
+	size_t total_contours = 0;
+	size_t total_points = 0;
+	for( size_t i = 0; i < header.fill_count; i++ )
+	{
+		if( contour_counts[i] > contour_sizes.size() - total_contours )
+		{
+			throw broken_layer();
+		}
+		for( uint32_t j = 0; j < contour_counts[i]; j++ )
+		{
+			total_points += contour_sizes[total_contours++];
+		}
+	}
+	if( total_points > path_xs.size() )
+	{
+		throw broken_layer();
+	}
+
+	// Control points
+	for( size_t i = 0; i < header.control_point_count; i++ )
+	{
+		layer.add_control_point( point_xs[i], point_ys[i], to_color( point_colors[i] ) );
+	}
+
+	// Lines
+	size_t end_i = 0;
+	for( size_t i = 0; i < header.line_count; i++ )
+	{
+		const auto a = joined[i] ? end_i - 1 : end_i++;
+		const auto b = end_i++;
+
+		ImgLineStyle style;
+		style.cap = static_cast<ImgLineCap>( min<uint32_t>( styles[i] & 0xff, SQUARE_CAP ) );
+		style.join = static_cast<ImgLineJoin>( min<uint32_t>( styles[i] >> 8 & 0xff, BEVEL_JOIN ) );
+		layer.add_line( end_xs[a], end_ys[a], end_xs[b], end_ys[b], widths[i], to_color( line_colors[i] ), style );
+	}
+
+	// Fills
+	size_t contour = 0;
+	size_t point = 0;
+	for( size_t i = 0; i < header.fill_count; i++ )
+	{
+		ImgPath path;
+		path.rule = rules[i] == EVEN_ODD ? EVEN_ODD : NON_ZERO;
+		size_t end = 0;
+		for( uint32_t j = 0; j < contour_counts[i]; j++ )
+		{
+			end += contour_sizes[contour++];
+			path.contour_ends.push_back( static_cast<uint32_t>( end ) );
+		}
+
+		path.points.resize( end );
+		for( size_t j = 0; j < end; j++, point++ )
+		{
+			path.points[j] = { path_xs[point], path_ys[point] };
+		}
+
+		layer.add_fill( fill_xs[i], fill_ys[i], move( path ), to_color( fill_colors[i] ) );
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include "vector_img.hh"
+
+#include <vector>
+#include <cstdint>
+
+namespace vector_img
+{
+
+
+// Packed columns of values
+// - A value is stored as its difference to the previous value, in 1 to 4
+//   bytes by its size. The byte counts of four values at a time are
+//   in a control byte in front of the bytes of all the values, so that
+//   the bytes of four values can be moved in place by a single shuffle
+// - Differences wrap around, any 32 bit values can be packed
+
+// Appends the packed values to data
+void pack_column( const uint32_t *values, size_t count, std::vector<char> &data );
+
+// Reads count packed values, returns the size of the column or 0 if the data is too short
+size_t unpack_column( const char *data, size_t size, size_t count, uint32_t *values );
+
+
+
+// Counts and bounds of a packed layer, the packed data starts with it
+struct ImgPackHeader
+{
+	uint32_t  control_point_count;
+	uint32_t  line_count;
+	uint32_t  fill_count;
+	uint32_t  contour_count;
+	uint32_t  path_point_count;
+
+	// Coordinate = origin + steps * step
+	float     origin_x;
+	float     origin_y;
+	float     step;
+
+	// Bounds of the items as they are unpacked, lines with their width
+	ImgBounds bounds;
+};
+
+
+
+// Packed layers keep the items in their drawing order with their coordinates
+// rounded to a grid, for documents and for layers kept out of editing
+// - Each column of the items is packed on its own, the points of the fill
+//   paths along their contours
+// - A line starting where the previous one ends is flagged as joined and
+//   only its end is kept, polylines cost a single point per line
+// - Colors, widths, styles and other values repeating over many items are
+//   kept as runs of the same value
+// - Removed items are left out
+static const float default_pack_step = 1.f / 64.f;
+
+// Appends the packed layer to data, returns its header
+ImgPackHeader pack_layer( const ImgLayer &layer, float step, std::vector<char> &data );
+
+// Adds the packed items on top of the items of the layer
+// - Throws runtime_error if the data is broken, the layer is left as it was
+void unpack_layer( const char *data, size_t size, ImgLayer &layer );
+
+
+};
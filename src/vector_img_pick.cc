@@ -0,0 +1,69 @@
+#include "vector_img_pick.hh"
+
+#include <algorithm>
+
+using namespace std;
+using namespace vector_img;
+
+
+
+uint32_t vector_img::get_pick_id( size_t layer_i, uint32_t slot )
+{
+	if( layer_i >= max_pick_layers || slot > max_pick_slot )
+	{
+		return 0;
+	}
+
+	return (static_cast<uint32_t>( layer_i ) << 24) | (slot + 1);
+}
+
+
+
+Color vector_img::get_pick_color( uint32_t id )
+{
+	return Color{
+		static_cast<uint8_t>( id & 0xff ),
+		static_cast<uint8_t>( (id >> 8) & 0xff ),
+		static_cast<uint8_t>( (id >> 16) & 0xff ),
+		static_cast<uint8_t>( id >> 24 )
+	};
+}
+
+
+
+uint32_t vector_img::read_pick_id( const uint8_t *pixel )
+{
+	return pixel[0] | (pixel[1] << 8) | (pixel[2] << 16) | (static_cast<uint32_t>( pixel[3] ) << 24);
+}
+
+
+
+ImgPickedSlot vector_img::decode_pick_id( uint32_t id )
+{
+	ImgPickedSlot picked;
+	if( id & 0xffffff )
+	{
+		picked.layer = id >> 24;
+		picked.slot  = (id & 0xffffff) - 1;
+	}
+
+	return picked;
+}
+
+
+
+void vector_img::find_pick_ids( const vector<uint8_t> &pixels, vector<uint32_t> &ids )
+{
+	ids.clear();
+	for( size_t i = 0; i + 3 < pixels.size(); i += 4 )
+	{
+		const auto id = read_pick_id( &pixels[i] );
+		if( id && (ids.empty() || ids.back() != id) )
+		{
+			ids.push_back( id );
+		}
+	}
+
+	sort( ids.begin(), ids.end() );
+	ids.erase( unique( ids.begin(), ids.end() ), ids.end() );
+}
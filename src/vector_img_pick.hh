@@ -0,0 +1,44 @@
+#pragma once
+#include "vector_img.hh"
+
+#include <vector>
+#include <cstdint>
+
+namespace vector_img
+{
+
+
+// Ids of the items in a pick buffer, 0 where there is no item
+// - The layer is in the alpha byte, the slot + 1 in the color bytes, so
+//   only the first max_pick_layers layers and the slots up to
+//   max_pick_slot can be picked
+const size_t   max_pick_layers = 256;
+const uint32_t max_pick_slot   = 0xfffffe;
+
+
+
+// The layer and the slot an id was made of
+struct ImgPickedSlot
+{
+	size_t   layer = 0;
+	uint32_t slot  = ImgItemHandle::no_slot;
+};
+
+
+
+// Id of the item, or 0 when the item can't be picked
+uint32_t get_pick_id( size_t layer_i, uint32_t slot );
+
+// Color to draw the id with, the bytes are the pixel of the id
+Color get_pick_color( uint32_t id );
+
+// Id of an RGBA pixel of the buffer
+uint32_t read_pick_id( const uint8_t *pixel );
+
+ImgPickedSlot decode_pick_id( uint32_t id );
+
+// Ids of the RGBA pixels, sorted and without duplicates or 0
+void find_pick_ids( const std::vector<uint8_t> &pixels, std::vector<uint32_t> &ids );
+
+
+};
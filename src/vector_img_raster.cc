@@ -0,0 +1,634 @@
+#include "vector_img_raster.hh"
+#include "vector_img_stroke.hh"
+#include "sdl2.hh"
+
+#include <cmath>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RASTER_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+using namespace vector_img;
+
+namespace
+{
+	struct Point
+	{
+		float x;
+		float y;
+	};
+
+
+
+	// Renders the items touching one tile of the output
+	// - Edges accumulate signed area and cover into the accumulation
+	//   buffer, a prefix sum over a row then gives the coverage of each pixel
+	// - Pixels are premultiplied RGBA floats until the tile is done
+	struct TileRasterizer
+	{
+		int x0     = 0;
+		int y0     = 0;
+		int width  = 0;
+		int height = 0;
+
+		// Room for the writes one and two pixels past the right edge
+		size_t stride = 0;
+		vector<float> accumulation;
+		vector<float> pixels;
+
+		ImgLayerIndices  visible;
+		vector<Point>    path_points;
+		vector<ImgPoint> line_triangles;
+		vector<uint32_t> triangle_ends;
+
+		void reset( int tile_x, int tile_y, int tile_width, int tile_height, const float background[4] );
+		void fill_polygon( const Point *points, size_t count, const float color[4] );
+
+		// Contours end before the indices in contour_ends, the fill rule decides what is inside
+		void fill_path( const Point *points, const uint32_t *contour_ends, size_t contour_count, ImgFillRule rule, const float color[4] );
+		void write_to( ImgRaster &raster ) const;
+
+	  protected:
+		void add_edge( Point a, Point b );
+		void accumulate_edge( Point a, Point b );
+		void fill_row( int row, int x_begin, int x_end, ImgFillRule rule, const float color[4] );
+	};
+
+
+
+	void TileRasterizer::reset( int tile_x, int tile_y, int tile_width, int tile_height, const float background[4] )
+	{
+		x0 = tile_x;
+		y0 = tile_y;
+		width = tile_width;
+		height = tile_height;
+		stride = static_cast<size_t>( width ) + 4;
+
+		accumulation.assign( stride * height, 0.f );
+		pixels.resize( static_cast<size_t>( width ) * height * 4 );
+		for( size_t i = 0; i < pixels.size(); i += 4 )
+		{
+			copy( background, background + 4, &pixels[i] );
+		}
+	}
+
+
+
+	void TileRasterizer::accumulate_edge( Point a, Point b )
+	{
+		// The edge is within the tile, x in [0, width] and y in [0, height]
+		if( a.y == b.y )
+		{
+			return;
+		}
+
+		auto direction = 1.f;
+		if( a.y > b.y )
+		{
+			swap( a, b );
+			direction = -1.f;
+		}
+
+		const auto dxdy = (b.x - a.x) / (b.y - a.y);
+		const auto max_x = static_cast<float>( width );
+		auto x = a.x;
+
+		const auto row_end = min( static_cast<int>( ceil( b.y ) ), height );
+		for( auto row = static_cast<int>( a.y ); row < row_end; row++ )
+		{
+			auto line = &accumulation[row * stride];
+
+			const auto dy = min( row + 1.f, b.y ) - max( static_cast<float>( row ), a.y );
+			// Stepping may drift a bit past the borders of the tile
+			const auto x_next = min( max( x + dxdy * dy, 0.f ), max_x );
+			const auto d = dy * direction;
+
+			const auto left = min( x, x_next );
+			const auto right = max( x, x_next );
+			const auto left_floor = floor( left );
+			const auto left_i = static_cast<int>( left_floor );
+			const auto right_ceil = ceil( right );
+			const auto right_i = static_cast<int>( right_ceil );
+
+			if( right_i <= left_i + 1 )
+			{
+				// Within a single pixel, split by the middle of the edge
+				const auto middle = 0.5f * (x + x_next) - left_floor;
+				line[left_i] += d - d * middle;
+				line[left_i + 1] += d * middle;
+			}
+			else
+			{
+				const auto s = 1.f / (right - left);
+				const auto left_fraction = left - left_floor;
+				const auto a0 = 0.5f * s * (1.f - left_fraction) * (1.f - left_fraction);
+				const auto right_fraction = right - right_ceil + 1.f;
+				const auto am = 0.5f * s * right_fraction * right_fraction;
+
+				line[left_i] += d * a0;
+				if( right_i == left_i + 2 )
+				{
+					line[left_i + 1] += d * (1.f - a0 - am);
+				}
+				else
+				{
+					const auto a1 = s * (1.5f - left_fraction);
+					line[left_i + 1] += d * (a1 - a0);
+					for( auto xi = left_i + 2; xi < right_i - 1; xi++ )
+					{
+						line[xi] += d * s;
+					}
+
+					const auto a2 = a1 + (right_i - left_i - 3) * s;
+					line[right_i - 1] += d * (1.f - a2 - am);
+				}
+
+				line[right_i] += d * am;
+			}
+
+			x = x_next;
+		}
+	}
+
+
+
+	void TileRasterizer::add_edge( Point a, Point b )
+	{
+		const auto tile_w = static_cast<float>( width );
+		const auto tile_h = static_cast<float>( height );
+
+		// Clip to the rows of the tile
+		if( (a.y <= 0.f && b.y <= 0.f) || (a.y >= tile_h && b.y >= tile_h) || a.y == b.y )
+		{
+			return;
+		}
+
+		const auto clip_y = [&]( Point &p, const Point &other, float y )
+		{
+			p.x += (other.x - p.x) * (y - p.y) / (other.y - p.y);
+			p.y = y;
+		};
+
+		if( a.y < 0.f ) clip_y( a, b, 0.f );
+		if( b.y < 0.f ) clip_y( b, a, 0.f );
+		if( a.y > tile_h ) clip_y( a, b, tile_h );
+		if( b.y > tile_h ) clip_y( b, a, tile_h );
+
+		// Parts left and right of the tile still cover the pixels on their right,
+		// so they are pressed to vertical edges on the tile borders
+		Point points[4] = { a };
+		size_t count = 1;
+
+		float crossings[2];
+		size_t crossing_count = 0;
+		for( const auto edge_x : { 0.f, tile_w } )
+		{
+			if( (a.x < edge_x) != (b.x < edge_x) && a.x != b.x )
+			{
+				crossings[crossing_count++] = (edge_x - a.x) / (b.x - a.x);
+			}
+		}
+
+		if( crossing_count == 2 && crossings[0] > crossings[1] )
+		{
+			swap( crossings[0], crossings[1] );
+		}
+
+		for( size_t i = 0; i < crossing_count; i++ )
+		{
+			const auto t = crossings[i];
+			points[count++] = Point{ a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t };
+		}
+		points[count++] = b;
+
+		for( size_t i = 0; i + 1 < count; i++ )
+		{
+			auto p = points[i];
+			auto q = points[i + 1];
+			p.x = min( max( p.x, 0.f ), tile_w );
+			q.x = min( max( q.x, 0.f ), tile_w );
+			accumulate_edge( p, q );
+		}
+	}
+
+
+
+	void TileRasterizer::fill_row( int row, int x_begin, int x_end, ImgFillRule rule, const float color[4] )
+	{
+		// The accumulated sum is the winding number where the pixel is fully covered,
+		// with even-odd the coverage falls again from one winding to two
+		const auto even_odd = rule == EVEN_ODD;
+
+		auto line = &accumulation[row * stride];
+		auto pixel = &pixels[(static_cast<size_t>( row ) * width + x_begin) * 4];
+		auto x = x_begin;
+		auto sum = 0.f;
+
+	#ifdef RASTER_SSE2
+		const auto zero = _mm_setzero_ps();
+		const auto one = _mm_set1_ps( 1.f );
+		const auto two = _mm_set1_ps( 2.f );
+		const auto half = _mm_set1_ps( 0.5f );
+		const auto abs_mask = _mm_castsi128_ps( _mm_set1_epi32( 0x7fffffff ) );
+		const auto src = _mm_loadu_ps( color );
+		const auto src_alpha = _mm_set1_ps( color[3] );
+
+		const auto blend = [&]( float *target, __m128 coverage )
+		{
+			const auto destination = _mm_loadu_ps( target );
+			const auto keep = _mm_sub_ps( one, _mm_mul_ps( src_alpha, coverage ) );
+			_mm_storeu_ps( target, _mm_add_ps( _mm_mul_ps( src, coverage ), _mm_mul_ps( destination, keep ) ) );
+		};
+
+		// Prefix sum of four values at a time
+		auto carry = zero;
+		for( ; x + 4 <= x_end; x += 4, pixel += 16 )
+		{
+			auto values = _mm_loadu_ps( line + x );
+			values = _mm_add_ps( values, _mm_castsi128_ps( _mm_slli_si128( _mm_castps_si128( values ), 4 ) ) );
+			values = _mm_add_ps( values, _mm_castsi128_ps( _mm_slli_si128( _mm_castps_si128( values ), 8 ) ) );
+			values = _mm_add_ps( values, carry );
+			carry = _mm_shuffle_ps( values, values, _MM_SHUFFLE( 3, 3, 3, 3 ) );
+
+			auto coverage = _mm_and_ps( values, abs_mask );
+			if( even_odd )
+			{
+				const auto windings = _mm_cvtepi32_ps( _mm_cvttps_epi32( _mm_mul_ps( coverage, half ) ) );
+				coverage = _mm_sub_ps( coverage, _mm_mul_ps( windings, two ) );
+				coverage = _mm_min_ps( coverage, _mm_sub_ps( two, coverage ) );
+			}
+			coverage = _mm_min_ps( coverage, one );
+			if( !_mm_movemask_ps( _mm_cmpgt_ps( coverage, zero ) ) )
+			{
+				continue;
+			}
+
+			blend( pixel,      _mm_shuffle_ps( coverage, coverage, _MM_SHUFFLE( 0, 0, 0, 0 ) ) );
+			blend( pixel + 4,  _mm_shuffle_ps( coverage, coverage, _MM_SHUFFLE( 1, 1, 1, 1 ) ) );
+			blend( pixel + 8,  _mm_shuffle_ps( coverage, coverage, _MM_SHUFFLE( 2, 2, 2, 2 ) ) );
+			blend( pixel + 12, _mm_shuffle_ps( coverage, coverage, _MM_SHUFFLE( 3, 3, 3, 3 ) ) );
+		}
+
+		sum = _mm_cvtss_f32( carry );
+	#endif
+
+		for( ; x < x_end; x++, pixel += 4 )
+		{
+			sum += line[x];
+			auto coverage = abs( sum );
+			if( even_odd )
+			{
+				coverage -= 2.f * floor( coverage * 0.5f );
+				coverage = min( coverage, 2.f - coverage );
+			}
+			coverage = min( coverage, 1.f );
+			if( coverage <= 0.f )
+			{
+				continue;
+			}
+
+			const auto keep = 1.f - color[3] * coverage;
+			for( int channel = 0; channel < 4; channel++ )
+			{
+				pixel[channel] = color[channel] * coverage + pixel[channel] * keep;
+			}
+		}
+	}
+
+
+
+	void TileRasterizer::fill_polygon( const Point *points, size_t count, const float color[4] )
+	{
+		const auto contour_end = static_cast<uint32_t>( count );
+		fill_path( points, &contour_end, 1, NON_ZERO, color );
+	}
+
+
+
+	void TileRasterizer::fill_path( const Point *points, const uint32_t *contour_ends, size_t contour_count, ImgFillRule rule, const float color[4] )
+	{
+		const size_t count = contour_count ? contour_ends[contour_count - 1] : 0;
+		if( !count )
+		{
+			return;
+		}
+
+		auto min_x = points[0].x;
+		auto max_x = points[0].x;
+		auto min_y = points[0].y;
+		auto max_y = points[0].y;
+		for( size_t i = 1; i < count; i++ )
+		{
+			min_x = min( min_x, points[i].x );
+			max_x = max( max_x, points[i].x );
+			min_y = min( min_y, points[i].y );
+			max_y = max( max_y, points[i].y );
+		}
+
+		if( max_x <= 0.f || max_y <= 0.f || min_x >= width || min_y >= height )
+		{
+			return;
+		}
+
+		// Each contour is closed back to its first point
+		size_t contour_begin = 0;
+		for( size_t contour = 0; contour < contour_count; contour++ )
+		{
+			const size_t contour_end = min<size_t>( contour_ends[contour], count );
+			for( auto i = contour_begin; i < contour_end; i++ )
+			{
+				add_edge( points[i], points[i + 1 < contour_end ? i + 1 : contour_begin] );
+			}
+			contour_begin = max( contour_begin, contour_end );
+		}
+
+		const auto x_begin = static_cast<int>( max( floor( min_x ), 0.f ) );
+		const auto x_end = static_cast<int>( min( ceil( max_x ) + 1.f, static_cast<float>( width ) ) );
+		const auto zero_end = min( static_cast<size_t>( ceil( max( max_x, 0.f ) ) ) + 2, stride );
+		const auto row_begin = static_cast<int>( max( floor( min_y ), 0.f ) );
+		const auto row_end = static_cast<int>( min( ceil( max_y ), static_cast<float>( height ) ) );
+
+		for( auto row = row_begin; row < row_end; row++ )
+		{
+			fill_row( row, x_begin, x_end, rule, color );
+
+			// Leave the accumulation buffer clean for the next item
+			auto line = &accumulation[row * stride];
+			fill( line + x_begin, line + zero_end, 0.f );
+		}
+	}
+
+
+
+	void TileRasterizer::write_to( ImgRaster &raster ) const
+	{
+		const auto to_byte = []( float value )
+		{
+			return static_cast<uint8_t>( min( max( value, 0.f ), 1.f ) * 255.f + 0.5f );
+		};
+
+		for( int row = 0; row < height; row++ )
+		{
+			auto source = &pixels[static_cast<size_t>( row ) * width * 4];
+			auto target = &raster.pixels[((y0 + row) * raster.width + x0) * 4];
+
+			for( int x = 0; x < width; x++, source += 4, target += 4 )
+			{
+				// Rounding leaves slight coverage around the edges, the color
+				// of those would come out of dividing almost nothing
+				const auto alpha = to_byte( source[3] );
+				const auto unmultiply = alpha ? 1.f / source[3] : 0.f;
+				target[0] = to_byte( source[0] * unmultiply );
+				target[1] = to_byte( source[1] * unmultiply );
+				target[2] = to_byte( source[2] * unmultiply );
+				target[3] = alpha;
+			}
+		}
+	}
+
+
+
+	void to_premultiplied( Color color, float result[4] )
+	{
+		const auto alpha = color.a / 255.f;
+		result[0] = color.r / 255.f * alpha;
+		result[1] = color.g / 255.f * alpha;
+		result[2] = color.b / 255.f * alpha;
+		result[3] = alpha;
+	}
+
+
+
+	// Appends the triangles of the line i in the coordinates of the tile,
+	// with the caps and joins the canvas draws
+	void add_line_triangles( const ImgLines &lines, size_t i, float scale, TileRasterizer &tile )
+	{
+		const auto to_tile = [&]( float x, float y )
+		{
+			return ImgPoint{ x * scale - tile.x0, y * scale - tile.y0 };
+		};
+
+		const auto has_previous  = continues_previous_line( lines, i );
+		const auto joined_at_end = i + 1 < lines.size() && continues_previous_line( lines, i + 1 );
+		const auto previous      = has_previous ? to_tile( lines.ax[i - 1], lines.ay[i - 1] ) : ImgPoint{ 0.f, 0.f };
+
+		// Lines without a width are drawn one pixel wide
+		tessellate_line(
+			to_tile( lines.ax[i], lines.ay[i] ),
+			to_tile( lines.bx[i], lines.by[i] ),
+			has_previous ? &previous : nullptr,
+			joined_at_end,
+			max( lines.width[i] * scale, 1.f ),
+			lines.style[i],
+			tile.line_triangles
+		);
+	}
+
+
+
+	// Fills the line triangles of the tile as one path
+	// - The triangles are all turned the same way, so that by the non-zero
+	//   rule their overlaps are covered once and their shared edges cancel
+	void fill_line_triangles( TileRasterizer &tile, const float color[4] )
+	{
+		const auto &triangles = tile.line_triangles;
+		tile.path_points.resize( triangles.size() );
+		tile.triangle_ends.clear();
+		for( size_t i = 0; i + 2 < triangles.size(); i += 3 )
+		{
+			const auto &a = triangles[i];
+			const auto &b = triangles[i + 1];
+			const auto &c = triangles[i + 2];
+			const auto turn = (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y);
+
+			tile.path_points[i]     = { a.x, a.y };
+			tile.path_points[i + 1] = turn < 0.f ? Point{ c.x, c.y } : Point{ b.x, b.y };
+			tile.path_points[i + 2] = turn < 0.f ? Point{ b.x, b.y } : Point{ c.x, c.y };
+			tile.triangle_ends.push_back( static_cast<uint32_t>( i + 3 ) );
+		}
+
+		tile.fill_path( tile.path_points.data(), tile.triangle_ends.data(), tile.triangle_ends.size(), NON_ZERO, color );
+	}
+
+
+
+	void render_layer( const ImgLayer &layer, const RasterOptions &options, TileRasterizer &tile )
+	{
+		const auto scale = options.scale;
+
+		// Items reaching into the tile, hairlines and control points are sized in pixels
+		const auto margin = (max( options.control_point_size, 1.f ) + 1.f) / scale;
+		const ImgBounds tile_area = {
+			tile.x0 / scale - margin,
+			tile.y0 / scale - margin,
+			(tile.x0 + tile.width) / scale + margin,
+			(tile.y0 + tile.height) / scale + margin
+		};
+		layer.find_visible( tile_area, tile.visible );
+
+		float color[4];
+
+		// Fills are below the lines, their paths are relative to their positions
+		const auto &fills = layer.fills;
+		for( const auto i : tile.visible.fills )
+		{
+			const auto &path = fills.path[i];
+			if( path.contour_ends.empty() || path.contour_ends.back() > path.points.size() )
+			{
+				continue;
+			}
+
+			const auto x = fills.x[i] * scale - tile.x0;
+			const auto y = fills.y[i] * scale - tile.y0;
+			tile.path_points.resize( path.points.size() );
+			for( size_t point = 0; point < path.points.size(); point++ )
+			{
+				tile.path_points[point] = { x + path.points[point].x * scale, y + path.points[point].y * scale };
+			}
+
+			to_premultiplied( fills.color[i], color );
+			tile.fill_path( tile.path_points.data(), path.contour_ends.data(), path.contour_ends.size(), path.rule, color );
+		}
+
+		// Lines that continue each other are filled together, so that
+		// the overlaps of their joins aren't blended twice
+		const auto &lines = layer.lines;
+		const auto &visible_lines = tile.visible.lines;
+		for( size_t run_begin = 0; run_begin < visible_lines.size(); )
+		{
+			tile.line_triangles.clear();
+			auto run_end = run_begin;
+			do
+			{
+				add_line_triangles( lines, visible_lines[run_end], scale, tile );
+				run_end++;
+			}
+			while( run_end < visible_lines.size()
+			    && visible_lines[run_end] == visible_lines[run_end - 1] + 1
+			    && continues_previous_line( lines, visible_lines[run_end] ) );
+
+			to_premultiplied( lines.color[visible_lines[run_begin]], color );
+			fill_line_triangles( tile, color );
+			run_begin = run_end;
+		}
+
+		if( options.control_point_size <= 0.f )
+		{
+			return;
+		}
+
+		const auto half_size = options.control_point_size / 2.f;
+		const auto &control_points = layer.control_points;
+		for( const auto i : tile.visible.control_points )
+		{
+			const auto x = control_points.x[i] * scale - tile.x0;
+			const auto y = control_points.y[i] * scale - tile.y0;
+
+			const Point square[4] = {
+				{ x - half_size, y - half_size },
+				{ x + half_size, y - half_size },
+				{ x + half_size, y + half_size },
+				{ x - half_size, y + half_size }
+			};
+
+			to_premultiplied( control_points.color[i], color );
+			tile.fill_polygon( square, 4, color );
+		}
+	}
+}
+
+
+
+ImgRaster vector_img::rasterize( const VectorImg &image, const RasterOptions &options )
+{
+	ImgRaster raster;
+	if( options.scale <= 0.f || !options.tile_size )
+	{
+		return raster;
+	}
+
+	raster.width = static_cast<size_t>( ceil( image.img_w * options.scale ) );
+	raster.height = static_cast<size_t>( ceil( image.img_h * options.scale ) );
+	raster.pixels.resize( raster.width * raster.height * 4 );
+
+	const auto tile_size = static_cast<size_t>( options.tile_size );
+	const auto tiles_x = (raster.width + tile_size - 1) / tile_size;
+	const auto tiles_y = (raster.height + tile_size - 1) / tile_size;
+	const auto tile_count = tiles_x * tiles_y;
+
+	float background[4];
+	to_premultiplied( options.background, background );
+
+	// Each thread takes the next tile until all are done, the tiles don't overlap
+	atomic<size_t> next_tile( 0 );
+	const auto render_tiles = [&]()
+	{
+		TileRasterizer tile;
+		for( auto i = next_tile++; i < tile_count; i = next_tile++ )
+		{
+			const auto x = (i % tiles_x) * tile_size;
+			const auto y = (i / tiles_x) * tile_size;
+			tile.reset(
+				static_cast<int>( x ),
+				static_cast<int>( y ),
+				static_cast<int>( min( tile_size, raster.width - x ) ),
+				static_cast<int>( min( tile_size, raster.height - y ) ),
+				background
+			);
+
+			for( const auto &layer : image.layers )
+			{
+				if( layer )
+				{
+					render_layer( *layer, options, tile );
+				}
+			}
+
+			tile.write_to( raster );
+		}
+	};
+
+	auto thread_count = options.thread_count ? options.thread_count : thread::hardware_concurrency();
+	thread_count = static_cast<unsigned>( min<size_t>( max( thread_count, 1u ), tile_count ) );
+
+	vector<thread> workers;
+	for( unsigned i = 1; i < thread_count; i++ )
+	{
+		workers.emplace_back( render_tiles );
+	}
+
+	render_tiles();
+
+	for( auto &worker : workers )
+	{
+		worker.join();
+	}
+
+	return raster;
+}
+
+
+
+void vector_img::save_png( const ImgRaster &raster, const string &path )
+{
+	// The surface only wraps the pixels, byte order RGBA on any endianness
+	sdl2::SurfacePtr surface( SDL_CreateRGBSurfaceWithFormatFrom(
+		const_cast<uint8_t*>( raster.pixels.data() ),
+		static_cast<int>( raster.width ),
+		static_cast<int>( raster.height ),
+		32,
+		static_cast<int>( raster.width * 4 ),
+		SDL_PIXELFORMAT_RGBA32
+	) );
+
+	if( !surface || IMG_SavePNG( surface.get(), path.c_str() ) )
+	{
+		throw runtime_error( "Failed to save the image to " + path + ": " + SDL_GetError() );
+	}
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include "vector_img.hh"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace vector_img
+{
+
+
+struct RasterOptions
+{
+	// Output pixels per image unit
+	float scale = 1.f;
+
+	// Tiles are rendered in parallel, thread_count 0 uses all the cores
+	unsigned tile_size    = 64;
+	unsigned thread_count = 0;
+
+	// Control points are drawn as squares like on the canvas, 0 leaves them out
+	float control_point_size = 5.f;
+
+	Color background = { 0, 0, 0, 0 };
+};
+
+
+
+// RGBA pixels with straight alpha, rows from top to bottom
+struct ImgRaster
+{
+	size_t width  = 0;
+	size_t height = 0;
+	std::vector<uint8_t> pixels;
+};
+
+
+
+// Renders the image on the CPU, no window or GL context needed
+// - Coverage is computed analytically for each pixel, the items are
+//   composited in the drawing order of their layers
+// - Fills are filled from the edges of their paths by their fill rules
+// - Lines are filled from the triangles of tessellate_line, with the caps
+//   and joins of the canvas
+ImgRaster rasterize( const VectorImg &image, const RasterOptions &options = RasterOptions() );
+
+// Throws runtime_error if the file couldn't be written
+void save_png( const ImgRaster &raster, const std::string &path );
+
+
+};
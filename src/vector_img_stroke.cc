@@ -0,0 +1,397 @@
+#include "vector_img_stroke.hh"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+using namespace vector_img;
+
+namespace
+{
+	// Greatest distance of the segments of round caps and joins from the arc
+	const float arc_tolerance = 0.25f;
+	const int   max_arc_segments = 256;
+
+	// The shared array is compacted when half of it is unused and it's this large
+	const size_t min_compacted_points = 4096;
+
+	const float pi = 3.14159265f;
+
+
+
+	ImgPoint add( ImgPoint a, ImgPoint b )      { return { a.x + b.x, a.y + b.y }; }
+	ImgPoint subtract( ImgPoint a, ImgPoint b ) { return { a.x - b.x, a.y - b.y }; }
+	ImgPoint multiply( ImgPoint a, float s )    { return { a.x * s, a.y * s }; }
+	float dot( ImgPoint a, ImgPoint b )         { return a.x * b.x + a.y * b.y; }
+	float cross( ImgPoint a, ImgPoint b )       { return a.x * b.y - a.y * b.x; }
+
+
+
+	void add_triangle( ImgPoint a, ImgPoint b, ImgPoint c, vector<ImgPoint> &triangles )
+	{
+		triangles.push_back( a );
+		triangles.push_back( b );
+		triangles.push_back( c );
+	}
+
+
+
+	// Fan around the center from center + from, turning by angle
+	void add_fan( ImgPoint center, ImgPoint from, float angle, vector<ImgPoint> &triangles )
+	{
+		const auto radius = sqrt( dot( from, from ) );
+		auto step = pi / 2.f;
+		if( radius > arc_tolerance )
+		{
+			step = 2.f * acos( 1.f - arc_tolerance / radius );
+		}
+
+		const auto segments = min( max( static_cast<int>( ceil( fabs( angle ) / step ) ), 1 ), max_arc_segments );
+		const auto segment_angle = angle / segments;
+		const auto c = cos( segment_angle );
+		const auto s = sin( segment_angle );
+
+		auto offset = from;
+		for( int i = 0; i < segments; i++ )
+		{
+			const ImgPoint next = { offset.x * c - offset.y * s, offset.x * s + offset.y * c };
+			add_triangle( center, add( center, offset ), add( center, next ), triangles );
+			offset = next;
+		}
+	}
+
+
+
+	// Join at a between the line coming along incoming and the line leaving along outgoing,
+	// both normalized. Only the outer side of the corner is filled, the inner side is
+	// covered by the overlapping bodies of the lines
+	void add_join( ImgPoint a, ImgPoint incoming, ImgPoint outgoing, float half_width, ImgLineJoin join, vector<ImgPoint> &triangles )
+	{
+		const auto turn = cross( incoming, outgoing );
+		const auto along = dot( incoming, outgoing );
+		if( fabs( turn ) < 1e-6f && along > 0.f )
+		{
+			return;
+		}
+
+		// The outer side is on the right of a left turn
+		const auto side = turn > 0.f ? -half_width : half_width;
+		const ImgPoint from = { -incoming.y * side, incoming.x * side };
+		const ImgPoint to   = { -outgoing.y * side, outgoing.x * side };
+
+		if( join == ROUND_JOIN )
+		{
+			add_fan( a, from, atan2( cross( from, to ), dot( from, to ) ), triangles );
+			return;
+		}
+
+		if( join == MITER_JOIN )
+		{
+			// The tip is 1 / cos(half of the angle between the offsets) half widths away
+			const auto cos_half = sqrt( max( (1.f + along) / 2.f, 0.f ) );
+			if( cos_half * ImgLineStyle::miter_limit > 1.f )
+			{
+				auto middle = add( from, to );
+				middle = multiply( middle, half_width / (cos_half * sqrt( dot( middle, middle ) )) );
+				const auto tip = add( a, middle );
+				add_triangle( a, add( a, from ), tip, triangles );
+				add_triangle( a, tip, add( a, to ), triangles );
+				return;
+			}
+		}
+
+		add_triangle( a, add( a, from ), add( a, to ), triangles );
+	}
+
+
+
+	bool is_same_color( Color a, Color b )
+	{
+		return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+	}
+
+
+
+	bool is_same_style( ImgLineStyle a, ImgLineStyle b )
+	{
+		return a.cap == b.cap && a.join == b.join;
+	}
+}
+
+
+
+void vector_img::tessellate_line(
+	ImgPoint a,
+	ImgPoint b,
+	const ImgPoint *previous,
+	bool joined_at_end,
+	float width,
+	ImgLineStyle style,
+	vector<ImgPoint> &triangles
+)
+{
+	const auto half_width = width / 2.f;
+	if( !(half_width > 0.f) )
+	{
+		return;
+	}
+
+	const auto diff = subtract( b, a );
+	const auto length = sqrt( dot( diff, diff ) );
+	if( length <= 0.f )
+	{
+		// Only the caps of a lone point are drawn
+		if( previous || joined_at_end )
+		{
+			return;
+		}
+
+		if( style.cap == ROUND_CAP )
+		{
+			add_fan( a, { half_width, 0.f }, 2.f * pi, triangles );
+		}
+		else if( style.cap == SQUARE_CAP )
+		{
+			const ImgPoint top_left     = { a.x - half_width, a.y - half_width };
+			const ImgPoint bottom_right = { a.x + half_width, a.y + half_width };
+			add_triangle( top_left, { bottom_right.x, top_left.y }, bottom_right, triangles );
+			add_triangle( bottom_right, { top_left.x, bottom_right.y }, top_left, triangles );
+		}
+		return;
+	}
+
+	const auto direction = multiply( diff, 1.f / length );
+	const ImgPoint normal = { -direction.y * half_width, direction.x * half_width };
+
+	const auto has_start_cap = !previous;
+	const auto has_end_cap   = !joined_at_end;
+
+	// Square caps extend the body by half of the width
+	auto start = a;
+	auto end   = b;
+	if( style.cap == SQUARE_CAP )
+	{
+		const auto extension = multiply( direction, half_width );
+		if( has_start_cap )
+		{
+			start = subtract( start, extension );
+		}
+		if( has_end_cap )
+		{
+			end = add( end, extension );
+		}
+	}
+
+	const auto start_left  = add( start, normal );
+	const auto start_right = subtract( start, normal );
+	const auto end_left    = add( end, normal );
+	const auto end_right   = subtract( end, normal );
+	add_triangle( start_right, start_left, end_left, triangles );
+	add_triangle( end_left, end_right, start_right, triangles );
+
+	if( style.cap == ROUND_CAP )
+	{
+		if( has_start_cap )
+		{
+			add_fan( a, normal, pi, triangles );
+		}
+		if( has_end_cap )
+		{
+			add_fan( b, multiply( normal, -1.f ), pi, triangles );
+		}
+	}
+
+	if( previous )
+	{
+		const auto incoming = subtract( a, *previous );
+		const auto incoming_length = sqrt( dot( incoming, incoming ) );
+		if( incoming_length > 0.f )
+		{
+			add_join( a, multiply( incoming, 1.f / incoming_length ), direction, half_width, style.join, triangles );
+		}
+	}
+}
+
+
+
+bool vector_img::continues_previous_line( const ImgLines &lines, size_t i )
+{
+	if( i == 0 || lines.is_removed( i ) || lines.is_removed( i - 1 ) )
+	{
+		return false;
+	}
+
+	// Lines of no length have no direction to join
+	const auto previous = i - 1;
+	return lines.bx[previous] == lines.ax[i]
+	    && lines.by[previous] == lines.ay[i]
+	    && (lines.ax[previous] != lines.bx[previous] || lines.ay[previous] != lines.by[previous])
+	    && (lines.ax[i] != lines.bx[i] || lines.ay[i] != lines.by[i])
+	    && lines.width[previous] == lines.width[i]
+	    && is_same_color( lines.color[previous], lines.color[i] )
+	    && is_same_style( lines.style[previous], lines.style[i] );
+}
+
+
+
+bool ImgStrokeCache::is_current( const Entry &entry, const ImgLines &lines, size_t i, bool has_previous, bool joined_at_end ) const
+{
+	if( !entry.valid
+	 || entry.ax != lines.ax[i] || entry.ay != lines.ay[i]
+	 || entry.bx != lines.bx[i] || entry.by != lines.by[i]
+	 || entry.width != lines.width[i]
+	 || !is_same_style( entry.style, lines.style[i] )
+	 || entry.has_previous != has_previous
+	 || entry.joined_at_end != joined_at_end )
+	{
+		return false;
+	}
+
+	return !has_previous
+	    || (entry.previous.x == lines.ax[i - 1] && entry.previous.y == lines.ay[i - 1]);
+}
+
+
+
+void ImgStrokeCache::tessellate( Entry &entry, const ImgLines &lines, size_t i, bool has_previous, bool joined_at_end )
+{
+	entry.ax            = lines.ax[i];
+	entry.ay            = lines.ay[i];
+	entry.bx            = lines.bx[i];
+	entry.by            = lines.by[i];
+	entry.width         = lines.width[i];
+	entry.style         = lines.style[i];
+	entry.has_previous  = has_previous;
+	entry.joined_at_end = joined_at_end;
+	entry.valid         = true;
+	if( has_previous )
+	{
+		entry.previous = { lines.ax[i - 1], lines.ay[i - 1] };
+	}
+
+	scratch.clear();
+	tessellate_line(
+		{ entry.ax, entry.ay },
+		{ entry.bx, entry.by },
+		has_previous ? &entry.previous : nullptr,
+		joined_at_end,
+		entry.width,
+		entry.style,
+		scratch
+	);
+
+	// Lines that need more room than they had move to the end
+	if( scratch.size() > entry.capacity )
+	{
+		unused_points += entry.capacity;
+		entry.first    = static_cast<uint32_t>( points.size() );
+		entry.capacity = static_cast<uint32_t>( scratch.size() );
+		points.resize( points.size() + scratch.size() );
+	}
+
+	copy( scratch.begin(), scratch.end(), points.begin() + entry.first );
+	entry.count = static_cast<uint32_t>( scratch.size() );
+	changed_slots.push_back( lines.slots[i] );
+}
+
+
+
+void ImgStrokeCache::update( const ImgLines &lines, const vector<uint32_t> &indices )
+{
+	update_count++;
+	changed_slots.clear();
+
+	for( const auto i : indices )
+	{
+		if( lines.is_removed( i ) )
+		{
+			continue;
+		}
+
+		const auto slot = lines.slots[i];
+		if( slot >= entries.size() )
+		{
+			entries.resize( slot + 1 );
+		}
+
+		auto &entry = entries[slot];
+		entry.last_update = update_count;
+
+		const auto has_previous  = continues_previous_line( lines, i );
+		const auto joined_at_end = i + 1 < lines.size() && continues_previous_line( lines, i + 1 );
+		if( !is_current( entry, lines, i, has_previous, joined_at_end ) )
+		{
+			tessellate( entry, lines, i, has_previous, joined_at_end );
+		}
+	}
+
+	if( unused_points > min_compacted_points && unused_points * 2 > points.size() )
+	{
+		compact();
+	}
+}
+
+
+
+void ImgStrokeCache::compact()
+{
+	// Only the lines of the last update are kept, the others
+	// are tessellated again when they are needed
+	vector<ImgPoint> kept;
+	kept.reserve( points.size() - unused_points );
+
+	for( auto &entry : entries )
+	{
+		if( !entry.valid )
+		{
+			continue;
+		}
+
+		if( entry.last_update != update_count )
+		{
+			entry = Entry();
+			continue;
+		}
+
+		const auto first = points.begin() + entry.first;
+		entry.first    = static_cast<uint32_t>( kept.size() );
+		entry.capacity = entry.count;
+		kept.insert( kept.end(), first, first + entry.count );
+	}
+
+	points.swap( kept );
+	unused_points = 0;
+}
+
+
+
+ImgStrokeCache::Triangles ImgStrokeCache::get_triangles( const ImgLines &lines, size_t i ) const
+{
+	const auto slot = lines.slots[i];
+	if( slot >= entries.size() || !entries[slot].valid || !entries[slot].count )
+	{
+		return { nullptr, 0 };
+	}
+
+	const auto &entry = entries[slot];
+	return { points.data() + entry.first, entry.count };
+}
+
+
+
+void ImgStrokeCache::clear()
+{
+	entries.clear();
+	points.clear();
+	unused_points = 0;
+	changed_slots.clear();
+}
+
+
+
+size_t ImgStrokeCache::get_memory_size() const
+{
+	return entries.capacity() * sizeof( Entry )
+	     + points.capacity() * sizeof( ImgPoint )
+	     + scratch.capacity() * sizeof( ImgPoint );
+}
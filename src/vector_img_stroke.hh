@@ -0,0 +1,96 @@
+#pragma once
+#include "vector_img.hh"
+
+#include <vector>
+#include <cstdint>
+
+namespace vector_img
+{
+
+
+// Appends the triangles of a line drawn with its width, caps and joins,
+// three corners per triangle
+// - previous is the start of the line that this line continues, the join is
+//   drawn at the start of this line instead of the start cap
+// - joined_at_end leaves out the end cap, the next line draws the join
+// - Round caps and joins are split into segments that stay within
+//   a quarter of a unit from the arc
+void tessellate_line(
+	ImgPoint a,
+	ImgPoint b,
+	const ImgPoint *previous,
+	bool joined_at_end,
+	float width,
+	ImgLineStyle style,
+	std::vector<ImgPoint> &triangles
+);
+
+// Whether the line i of the pool continues the line before it, see ImgLineStyle
+bool continues_previous_line( const ImgLines &lines, size_t i );
+
+
+
+// Triangles of the lines of a layer, kept between the frames
+// - A line is tessellated again only when its geometry, its style
+//   or its joins with the neighbouring lines change
+// - The lines are keyed by their handle slots, so compacting the pool
+//   or undoing doesn't throw the triangles away
+// - The triangles of all the lines share one array, lines whose triangles
+//   haven't been needed for a while are dropped when it gets sparse
+struct ImgStrokeCache
+{
+	struct Triangles
+	{
+		const ImgPoint *points;
+		size_t          point_count;
+	};
+
+	// Tessellates the lines that changed since they were last updated
+	void update( const ImgLines &lines, const std::vector<uint32_t> &indices );
+
+	// Triangles of the line i of the pool, valid until the next update
+	Triangles get_triangles( const ImgLines &lines, size_t i ) const;
+
+	void clear();
+
+	// Count and slots of the lines tessellated by the last update
+	size_t get_tessellated_count() const { return changed_slots.size(); }
+	const std::vector<uint32_t> &get_changed_slots() const { return changed_slots; }
+	size_t get_memory_size() const;
+
+  protected:
+	struct Entry
+	{
+		float        ax           = 0.f;
+		float        ay           = 0.f;
+		float        bx           = 0.f;
+		float        by           = 0.f;
+		float        width        = 0.f;
+		ImgLineStyle style;
+		ImgPoint     previous;
+		bool         has_previous  = false;
+		bool         joined_at_end = false;
+		bool         valid         = false;
+
+		// Range of the triangles in points, capacity is kept
+		// so that a line can be tessellated again in place
+		uint32_t first       = 0;
+		uint32_t count       = 0;
+		uint32_t capacity    = 0;
+		uint32_t last_update = 0;
+	};
+
+	std::vector<Entry>    entries;
+	std::vector<ImgPoint> points;
+	std::vector<ImgPoint> scratch;
+	std::vector<uint32_t> changed_slots;
+	size_t   unused_points = 0;
+	uint32_t update_count  = 0;
+
+	bool is_current( const Entry &entry, const ImgLines &lines, size_t i, bool has_previous, bool joined_at_end ) const;
+	void tessellate( Entry &entry, const ImgLines &lines, size_t i, bool has_previous, bool joined_at_end );
+	void compact();
+};
+
+
+};
@@ -0,0 +1,1906 @@
+#include "vector_img_svg.hh"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+using namespace vector_img;
+
+namespace
+{
+	// Files are read and written in blocks of this size
+	const size_t block_size = 64 * 1024;
+
+	// Largest distance of the flattened curves from the real ones, in image units
+	const float curve_tolerance = 0.25f;
+
+	const size_t max_curve_segments = 256;
+
+	// Control points are written as circles of the size they are drawn
+	const float control_point_radius = 2.5f;
+
+	const float pi = 3.14159265358979f;
+
+
+
+	struct Transform
+	{
+		float a = 1.f;
+		float b = 0.f;
+		float c = 0.f;
+		float d = 1.f;
+		float e = 0.f;
+		float f = 0.f;
+
+		ImgPoint apply( ImgPoint point ) const
+		{
+			return { a * point.x + c * point.y + e, b * point.x + d * point.y + f };
+		}
+
+		// Average scaling, for the stroke widths
+		float get_scale() const
+		{
+			return sqrt( abs( a * d - b * c ) );
+		}
+
+		Transform operator*( const Transform &other ) const
+		{
+			Transform result;
+			result.a = a * other.a + c * other.b;
+			result.b = b * other.a + d * other.b;
+			result.c = a * other.c + c * other.d;
+			result.d = b * other.c + d * other.d;
+			result.e = a * other.e + c * other.f + e;
+			result.f = b * other.e + d * other.f + f;
+			return result;
+		}
+	};
+
+
+
+	struct Paint
+	{
+		bool  visible = false;
+		Color color   = { 0, 0, 0, 255 };
+	};
+
+
+
+	// Inherited from the parent elements
+	struct Style
+	{
+		Paint       fill;
+		Paint       stroke;
+		float       stroke_width   = 1.f;
+		ImgLineStyle line_style;
+		float       opacity        = 1.f;
+		float       fill_opacity   = 1.f;
+		float       stroke_opacity = 1.f;
+		ImgFillRule fill_rule      = NON_ZERO;
+		Transform   transform;
+		bool        hidden         = false;
+	};
+
+
+
+	// Points to the text of the tag being handled
+	struct Text
+	{
+		const char *begin;
+		const char *end;
+
+		bool operator==( const char *other ) const
+		{
+			const auto length = strlen( other );
+			return static_cast<size_t>( end - begin ) == length && equal( begin, end, other );
+		}
+
+		bool starts_with( const char *prefix ) const
+		{
+			const auto length = strlen( prefix );
+			return static_cast<size_t>( end - begin ) >= length && equal( prefix, prefix + length, begin );
+		}
+	};
+
+
+
+	struct Attribute
+	{
+		Text name;
+		Text value;
+	};
+
+
+
+	bool is_space( char c )
+	{
+		return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+	}
+
+
+
+	bool is_digit( char c )
+	{
+		return c >= '0' && c <= '9';
+	}
+
+
+
+	Text trim( Text text )
+	{
+		while( text.begin < text.end && is_space( *text.begin ) )
+		{
+			text.begin++;
+		}
+		while( text.end > text.begin && is_space( text.end[-1] ) )
+		{
+			text.end--;
+		}
+		return text;
+	}
+
+
+
+	void skip_separators( const char *&p, const char *end )
+	{
+		while( p < end && (is_space( *p ) || *p == ',') )
+		{
+			p++;
+		}
+	}
+
+
+
+	// Reads a number like in path data, where "1-2.5.5" is three numbers
+	bool parse_number( const char *&p, const char *end, float &value )
+	{
+		static const double powers[] = {
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+			1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20
+		};
+
+		skip_separators( p, end );
+
+		auto q = p;
+		auto negative = false;
+		if( q < end && (*q == '-' || *q == '+') )
+		{
+			negative = *q == '-';
+			q++;
+		}
+
+		double mantissa = 0.0;
+		auto digits = 0;
+		auto exponent = 0;
+		for( ; q < end && is_digit( *q ); q++, digits++ )
+		{
+			mantissa = mantissa * 10.0 + (*q - '0');
+		}
+
+		if( q < end && *q == '.' )
+		{
+			for( q++; q < end && is_digit( *q ); q++, digits++ )
+			{
+				mantissa = mantissa * 10.0 + (*q - '0');
+				exponent--;
+			}
+		}
+
+		if( !digits )
+		{
+			return false;
+		}
+
+		// An "e" without digits belongs to what follows, like in "1em"
+		if( q + 1 < end && (*q == 'e' || *q == 'E') )
+		{
+			auto r = q + 1;
+			auto negative_exponent = false;
+			if( *r == '-' || *r == '+' )
+			{
+				negative_exponent = *r == '-';
+				r++;
+			}
+
+			if( r < end && is_digit( *r ) )
+			{
+				auto value = 0;
+				for( ; r < end && is_digit( *r ); r++ )
+				{
+					value = min( value * 10 + (*r - '0'), 1000 );
+				}
+				exponent += negative_exponent ? -value : value;
+				q = r;
+			}
+		}
+
+		if( exponent < 0 && exponent >= -20 )
+		{
+			mantissa /= powers[-exponent];
+		}
+		else if( exponent > 0 && exponent <= 20 )
+		{
+			mantissa *= powers[exponent];
+		}
+		else if( exponent )
+		{
+			mantissa *= pow( 10.0, exponent );
+		}
+
+		value = static_cast<float>( negative ? -mantissa : mantissa );
+		p = q;
+		return true;
+	}
+
+
+
+	// Arc flags can be written without separators, like "a1 1 0 0010 10"
+	bool parse_flag( const char *&p, const char *end, bool &flag )
+	{
+		skip_separators( p, end );
+		if( p == end || (*p != '0' && *p != '1') )
+		{
+			return false;
+		}
+
+		flag = *p++ == '1';
+		return true;
+	}
+
+
+
+	bool parse_number( Text text, float &value )
+	{
+		return parse_number( text.begin, text.end, value );
+	}
+
+
+
+	// Numbers of lists like "points" or "viewBox"
+	size_t parse_numbers( Text text, float *values, size_t count )
+	{
+		size_t parsed = 0;
+		while( parsed < count && parse_number( text.begin, text.end, values[parsed] ) )
+		{
+			parsed++;
+		}
+		return parsed;
+	}
+
+
+
+	int parse_hex_digit( char c )
+	{
+		if( is_digit( c ) ) return c - '0';
+		if( c >= 'a' && c <= 'f' ) return c - 'a' + 10;
+		if( c >= 'A' && c <= 'F' ) return c - 'A' + 10;
+		return -1;
+	}
+
+
+
+	bool parse_color( Text text, Color &color )
+	{
+		struct NamedColor
+		{
+			const char *name;
+			Color       color;
+		};
+
+		static const NamedColor named_colors[] = {
+			{ "black",   {   0,   0,   0, 255 } },
+			{ "white",   { 255, 255, 255, 255 } },
+			{ "red",     { 255,   0,   0, 255 } },
+			{ "green",   {   0, 128,   0, 255 } },
+			{ "lime",    {   0, 255,   0, 255 } },
+			{ "blue",    {   0,   0, 255, 255 } },
+			{ "yellow",  { 255, 255,   0, 255 } },
+			{ "cyan",    {   0, 255, 255, 255 } },
+			{ "aqua",    {   0, 255, 255, 255 } },
+			{ "magenta", { 255,   0, 255, 255 } },
+			{ "fuchsia", { 255,   0, 255, 255 } },
+			{ "gray",    { 128, 128, 128, 255 } },
+			{ "grey",    { 128, 128, 128, 255 } },
+			{ "silver",  { 192, 192, 192, 255 } },
+			{ "maroon",  { 128,   0,   0, 255 } },
+			{ "olive",   { 128, 128,   0, 255 } },
+			{ "navy",    {   0,   0, 128, 255 } },
+			{ "purple",  { 128,   0, 128, 255 } },
+			{ "teal",    {   0, 128, 128, 255 } },
+			{ "orange",  { 255, 165,   0, 255 } }
+		};
+
+		text = trim( text );
+		const auto length = text.end - text.begin;
+
+		if( length && *text.begin == '#' )
+		{
+			int digits[8];
+			const auto count = length - 1;
+			if( count != 3 && count != 4 && count != 6 && count != 8 )
+			{
+				return false;
+			}
+
+			for( int i = 0; i < count; i++ )
+			{
+				digits[i] = parse_hex_digit( text.begin[i + 1] );
+				if( digits[i] < 0 )
+				{
+					return false;
+				}
+			}
+
+			// Short forms repeat each digit
+			uint8_t channels[4] = { 0, 0, 0, 255 };
+			const auto channel_count = count % 3 == 0 ? 3 : 4;
+			for( int i = 0; i < channel_count; i++ )
+			{
+				channels[i] = static_cast<uint8_t>( count <= 4 ? digits[i] * 17 : digits[i * 2] * 16 + digits[i * 2 + 1] );
+			}
+
+			color = { channels[0], channels[1], channels[2], channels[3] };
+			return true;
+		}
+
+		if( text.starts_with( "rgb" ) )
+		{
+			auto p = find( text.begin, text.end, '(' );
+			uint8_t channels[4] = { 0, 0, 0, 255 };
+			for( int i = 0; i < 4 && p < text.end; i++ )
+			{
+				p++;
+				float value = 0.f;
+				if( !parse_number( p, text.end, value ) )
+				{
+					break;
+				}
+
+				// Percentages and the alpha of rgba() are fractions of 255
+				const auto percent = p < text.end && *p == '%';
+				if( percent || i == 3 )
+				{
+					value = value * (percent ? 2.55f : 255.f);
+				}
+				channels[i] = static_cast<uint8_t>( min( max( value, 0.f ), 255.f ) + 0.5f );
+
+				while( p < text.end && *p != ',' && *p != ')' && !is_space( *p ) )
+				{
+					p++;
+				}
+			}
+
+			color = { channels[0], channels[1], channels[2], channels[3] };
+			return true;
+		}
+
+		for( const auto &named : named_colors )
+		{
+			if( text == named.name )
+			{
+				color = named.color;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+
+
+	void parse_paint( Text text, Paint &paint )
+	{
+		text = trim( text );
+		if( text == "none" || text == "transparent" )
+		{
+			paint.visible = false;
+		}
+		else if( text.starts_with( "url(" ) )
+		{
+			// Gradients and patterns aren't supported, use the fallback color if there is one
+			const auto fallback = find( text.begin, text.end, ')' );
+			Color color = { 0, 0, 0, 255 };
+			if( fallback != text.end && parse_color( { fallback + 1, text.end }, color ) )
+			{
+				paint.color = color;
+			}
+			paint.visible = true;
+		}
+		else if( text == "currentColor" )
+		{
+			paint = Paint();
+			paint.visible = true;
+		}
+		else if( parse_color( text, paint.color ) )
+		{
+			paint.visible = true;
+		}
+	}
+
+
+
+	// Transforms are applied from left to right, like "translate(10) rotate(45)"
+	Transform parse_transform( Text text )
+	{
+		Transform result;
+
+		auto p = text.begin;
+		while( p < text.end )
+		{
+			while( p < text.end && (is_space( *p ) || *p == ',') )
+			{
+				p++;
+			}
+
+			const auto name_begin = p;
+			while( p < text.end && *p != '(' )
+			{
+				p++;
+			}
+			const auto name = trim( { name_begin, p } );
+
+			const auto close = find( p, text.end, ')' );
+			if( close == text.end )
+			{
+				break;
+			}
+
+			float values[6] = {};
+			const auto count = parse_numbers( { p + 1, close }, values, 6 );
+			p = close + 1;
+
+			Transform transform;
+			if( name == "matrix" && count == 6 )
+			{
+				transform.a = values[0];
+				transform.b = values[1];
+				transform.c = values[2];
+				transform.d = values[3];
+				transform.e = values[4];
+				transform.f = values[5];
+			}
+			else if( name == "translate" && count >= 1 )
+			{
+				transform.e = values[0];
+				transform.f = count >= 2 ? values[1] : 0.f;
+			}
+			else if( name == "scale" && count >= 1 )
+			{
+				transform.a = values[0];
+				transform.d = count >= 2 ? values[1] : values[0];
+			}
+			else if( name == "rotate" && count >= 1 )
+			{
+				const auto angle = values[0] * pi / 180.f;
+				Transform rotation;
+				rotation.a = cos( angle );
+				rotation.b = sin( angle );
+				rotation.c = -rotation.b;
+				rotation.d = rotation.a;
+
+				// Around the given center
+				Transform to_center, from_center;
+				if( count >= 3 )
+				{
+					to_center.e = values[1];
+					to_center.f = values[2];
+					from_center.e = -values[1];
+					from_center.f = -values[2];
+				}
+				transform = to_center * rotation * from_center;
+			}
+			else if( name == "skewX" && count >= 1 )
+			{
+				transform.c = tan( values[0] * pi / 180.f );
+			}
+			else if( name == "skewY" && count >= 1 )
+			{
+				transform.b = tan( values[0] * pi / 180.f );
+			}
+
+			result = result * transform;
+		}
+
+		return result;
+	}
+
+
+
+	// Flattened outline of an element, in image coordinates
+	struct Outline
+	{
+		vector<ImgPoint> points;
+		vector<uint32_t> contour_ends;
+		vector<uint8_t>  contour_closed;
+
+		void clear()
+		{
+			points.clear();
+			contour_ends.clear();
+			contour_closed.clear();
+		}
+
+		bool has_open_contour() const
+		{
+			return points.size() > (contour_ends.size() ? contour_ends.back() : 0);
+		}
+
+		void end_contour( bool closed )
+		{
+			if( has_open_contour() )
+			{
+				contour_ends.push_back( static_cast<uint32_t>( points.size() ) );
+				contour_closed.push_back( closed );
+			}
+		}
+	};
+
+
+
+	// Builds the outline of path data, the coordinates are kept in user
+	// space and transformed as the points are added
+	struct PathParser
+	{
+		Outline         &outline;
+		const Transform &transform;
+		float            tolerance;
+
+		PathParser( Outline &outline, const Transform &transform )
+		: outline( outline ),
+		  transform( transform )
+		{
+			const auto scale = transform.get_scale();
+			tolerance = curve_tolerance / (scale > 0.f ? scale : 1.f);
+		}
+
+		void parse( Text data );
+
+		void move_to( ImgPoint point );
+		void line_to( ImgPoint point );
+		void cubic_to( ImgPoint control_1, ImgPoint control_2, ImgPoint point );
+		void quadratic_to( ImgPoint control, ImgPoint point );
+		void arc_to( float rx, float ry, float rotation, bool large_arc, bool sweep, ImgPoint point );
+		void close();
+
+	  protected:
+		ImgPoint current = { 0.f, 0.f };
+		ImgPoint start   = { 0.f, 0.f };
+
+		void add_point( ImgPoint point );
+	};
+
+
+
+	void PathParser::add_point( ImgPoint point )
+	{
+		// After a close the next segment starts from the start of the contour
+		if( !outline.has_open_contour() )
+		{
+			outline.points.push_back( transform.apply( current ) );
+		}
+
+		outline.points.push_back( transform.apply( point ) );
+		current = point;
+	}
+
+
+
+	void PathParser::move_to( ImgPoint point )
+	{
+		outline.end_contour( false );
+		outline.points.push_back( transform.apply( point ) );
+		current = start = point;
+	}
+
+
+
+	void PathParser::line_to( ImgPoint point )
+	{
+		add_point( point );
+	}
+
+
+
+	void PathParser::cubic_to( ImgPoint control_1, ImgPoint control_2, ImgPoint point )
+	{
+		// Enough segments to keep within the tolerance
+		const auto dx = max( abs( current.x - 2.f * control_1.x + control_2.x ), abs( control_1.x - 2.f * control_2.x + point.x ) );
+		const auto dy = max( abs( current.y - 2.f * control_1.y + control_2.y ), abs( control_1.y - 2.f * control_2.y + point.y ) );
+		const auto segments = static_cast<size_t>( min(
+			ceil( sqrt( 0.75f * sqrt( dx * dx + dy * dy ) / tolerance ) ),
+			static_cast<float>( max_curve_segments )
+		) );
+
+		const auto from = current;
+		for( size_t i = 1; i < segments; i++ )
+		{
+			const auto t = static_cast<float>( i ) / segments;
+			const auto u = 1.f - t;
+			const auto w0 = u * u * u;
+			const auto w1 = 3.f * u * u * t;
+			const auto w2 = 3.f * u * t * t;
+			const auto w3 = t * t * t;
+			add_point( {
+				w0 * from.x + w1 * control_1.x + w2 * control_2.x + w3 * point.x,
+				w0 * from.y + w1 * control_1.y + w2 * control_2.y + w3 * point.y
+			} );
+		}
+
+		add_point( point );
+	}
+
+
+
+	void PathParser::quadratic_to( ImgPoint control, ImgPoint point )
+	{
+		const auto dx = current.x - 2.f * control.x + point.x;
+		const auto dy = current.y - 2.f * control.y + point.y;
+		const auto segments = static_cast<size_t>( min(
+			ceil( sqrt( 0.25f * sqrt( dx * dx + dy * dy ) / tolerance ) ),
+			static_cast<float>( max_curve_segments )
+		) );
+
+		const auto from = current;
+		for( size_t i = 1; i < segments; i++ )
+		{
+			const auto t = static_cast<float>( i ) / segments;
+			const auto u = 1.f - t;
+			add_point( {
+				u * u * from.x + 2.f * u * t * control.x + t * t * point.x,
+				u * u * from.y + 2.f * u * t * control.y + t * t * point.y
+			} );
+		}
+
+		add_point( point );
+	}
+
+
+
+	void PathParser::arc_to( float rx, float ry, float rotation, bool large_arc, bool sweep, ImgPoint point )
+	{
+		rx = abs( rx );
+		ry = abs( ry );
+		if( rx == 0.f || ry == 0.f || (point.x == current.x && point.y == current.y) )
+		{
+			line_to( point );
+			return;
+		}
+
+		// From the end points to the center of the ellipse, as in the SVG specification
+		const auto angle = rotation * pi / 180.f;
+		const auto cos_angle = cos( angle );
+		const auto sin_angle = sin( angle );
+
+		const auto half_dx = (current.x - point.x) / 2.f;
+		const auto half_dy = (current.y - point.y) / 2.f;
+		const auto x1 = cos_angle * half_dx + sin_angle * half_dy;
+		const auto y1 = -sin_angle * half_dx + cos_angle * half_dy;
+
+		// Radii too small to reach the end point are scaled up
+		const auto lambda = (x1 * x1) / (rx * rx) + (y1 * y1) / (ry * ry);
+		if( lambda > 1.f )
+		{
+			rx *= sqrt( lambda );
+			ry *= sqrt( lambda );
+		}
+
+		const auto numerator = rx * rx * ry * ry - rx * rx * y1 * y1 - ry * ry * x1 * x1;
+		const auto denominator = rx * rx * y1 * y1 + ry * ry * x1 * x1;
+		const auto coefficient = sqrt( max( numerator / denominator, 0.f ) ) * (large_arc == sweep ? -1.f : 1.f);
+		const auto center_x1 = coefficient * rx * y1 / ry;
+		const auto center_y1 = -coefficient * ry * x1 / rx;
+
+		const auto center_x = cos_angle * center_x1 - sin_angle * center_y1 + (current.x + point.x) / 2.f;
+		const auto center_y = sin_angle * center_x1 + cos_angle * center_y1 + (current.y + point.y) / 2.f;
+
+		const auto start_angle = atan2( (y1 - center_y1) / ry, (x1 - center_x1) / rx );
+		auto delta_angle = atan2( (-y1 - center_y1) / ry, (-x1 - center_x1) / rx ) - start_angle;
+		if( sweep && delta_angle < 0.f )
+		{
+			delta_angle += 2.f * pi;
+		}
+		else if( !sweep && delta_angle > 0.f )
+		{
+			delta_angle -= 2.f * pi;
+		}
+
+		// Segment angle that keeps the chords within the tolerance
+		const auto radius = max( rx, ry );
+		const auto segment_angle = tolerance < radius ? 2.f * acos( 1.f - tolerance / radius ) : pi / 2.f;
+		const auto segments = static_cast<size_t>( min(
+			max( ceil( abs( delta_angle ) / segment_angle ), 1.f ),
+			static_cast<float>( max_curve_segments )
+		) );
+
+		for( size_t i = 1; i < segments; i++ )
+		{
+			const auto t = start_angle + delta_angle * i / segments;
+			const auto x = rx * cos( t );
+			const auto y = ry * sin( t );
+			add_point( {
+				center_x + cos_angle * x - sin_angle * y,
+				center_y + sin_angle * x + cos_angle * y
+			} );
+		}
+
+		add_point( point );
+	}
+
+
+
+	void PathParser::close()
+	{
+		outline.end_contour( true );
+		current = start;
+	}
+
+
+
+	void PathParser::parse( Text data )
+	{
+		auto p = data.begin;
+		const auto end = data.end;
+
+		char command = 0;
+		char previous = 0;
+		ImgPoint last_control = { 0.f, 0.f };
+
+		for( ;; )
+		{
+			skip_separators( p, end );
+			if( p == end )
+			{
+				break;
+			}
+
+			if( !is_digit( *p ) && *p != '-' && *p != '+' && *p != '.' )
+			{
+				command = *p++;
+				if( command == 'Z' || command == 'z' )
+				{
+					close();
+					previous = command;
+					continue;
+				}
+			}
+			else if( !command || command == 'Z' || command == 'z' )
+			{
+				// Numbers without a command, the path is broken from here on
+				break;
+			}
+
+			const auto relative = command >= 'a';
+			const auto offset = relative ? current : ImgPoint{ 0.f, 0.f };
+			const auto read_point = [&]( ImgPoint &point )
+			{
+				if( !parse_number( p, end, point.x ) || !parse_number( p, end, point.y ) )
+				{
+					return false;
+				}
+				point.x += offset.x;
+				point.y += offset.y;
+				return true;
+			};
+
+			ImgPoint point, control_1, control_2;
+			float value = 0.f;
+			auto ok = true;
+
+			switch( command )
+			{
+				case 'M':
+				case 'm':
+					ok = read_point( point );
+					if( ok )
+					{
+						move_to( point );
+
+						// Following pairs are line segments
+						command = relative ? 'l' : 'L';
+					}
+					break;
+
+				case 'L':
+				case 'l':
+					ok = read_point( point );
+					if( ok ) line_to( point );
+					break;
+
+				case 'H':
+				case 'h':
+					ok = parse_number( p, end, value );
+					if( ok ) line_to( { value + offset.x, current.y } );
+					break;
+
+				case 'V':
+				case 'v':
+					ok = parse_number( p, end, value );
+					if( ok ) line_to( { current.x, value + offset.y } );
+					break;
+
+				case 'C':
+				case 'c':
+					ok = read_point( control_1 ) && read_point( control_2 ) && read_point( point );
+					if( ok )
+					{
+						cubic_to( control_1, control_2, point );
+						last_control = control_2;
+					}
+					break;
+
+				case 'S':
+				case 's':
+					ok = read_point( control_2 ) && read_point( point );
+					if( ok )
+					{
+						// The first control point mirrors the last one of the previous curve
+						const auto smooth = strchr( "CcSs", previous ) != nullptr && previous;
+						control_1 = smooth ? ImgPoint{ 2.f * current.x - last_control.x, 2.f * current.y - last_control.y } : current;
+						cubic_to( control_1, control_2, point );
+						last_control = control_2;
+					}
+					break;
+
+				case 'Q':
+				case 'q':
+					ok = read_point( control_1 ) && read_point( point );
+					if( ok )
+					{
+						quadratic_to( control_1, point );
+						last_control = control_1;
+					}
+					break;
+
+				case 'T':
+				case 't':
+					ok = read_point( point );
+					if( ok )
+					{
+						const auto smooth = strchr( "QqTt", previous ) != nullptr && previous;
+						control_1 = smooth ? ImgPoint{ 2.f * current.x - last_control.x, 2.f * current.y - last_control.y } : current;
+						quadratic_to( control_1, point );
+						last_control = control_1;
+					}
+					break;
+
+				case 'A':
+				case 'a':
+				{
+					float rx = 0.f, ry = 0.f, rotation = 0.f;
+					bool large_arc = false, sweep = false;
+					ok = parse_number( p, end, rx ) && parse_number( p, end, ry ) && parse_number( p, end, rotation ) &&
+					     parse_flag( p, end, large_arc ) && parse_flag( p, end, sweep ) && read_point( point );
+					if( ok ) arc_to( rx, ry, rotation, large_arc, sweep, point );
+					break;
+				}
+
+				default:
+					ok = false;
+					break;
+			}
+
+			if( !ok )
+			{
+				break;
+			}
+
+			previous = command;
+		}
+
+		outline.end_contour( false );
+	}
+
+
+
+	// Handles the elements as the tags are found in the file
+	struct SvgImporter
+	{
+		explicit SvgImporter( VectorImg &image );
+
+		void feed( const char *p, const char *end );
+		void finish();
+
+	  protected:
+		enum State
+		{
+			TEXT,
+			TAG,
+			COMMENT,
+			CDATA,
+			INSTRUCTION
+		};
+
+		VectorImg &image;
+
+		// Tokenizer state, only the current tag is kept
+		State  state         = TEXT;
+		string tag;
+		char   quote         = 0;
+		int    bracket_depth = 0;
+		int    end_run       = 0;
+
+		vector<Attribute> attributes;
+
+		// One style for each open element, the first one is the default
+		vector<Style> styles;
+		size_t        layer_depth = 0;
+		ImgLayer     *layer       = nullptr;
+		bool          has_size    = false;
+		bool          has_root    = false;
+
+		Outline outline;
+		float   max_x = 0.f;
+		float   max_y = 0.f;
+
+		void feed_tag( const char *&p, const char *end );
+		void feed_until( const char *&p, const char *end, char last, char repeated, int count );
+		void handle_tag();
+		void parse_attributes( const char *p, const char *end );
+		const Text *find_attribute( const char *name ) const;
+		float get_number( const char *name, float fallback = 0.f ) const;
+
+		void start_element( Text name, bool self_closing );
+		void end_element();
+		void apply_property( Text name, Text value, Style &style );
+		void set_root_size( Style &style );
+
+		ImgLayer &get_layer( ImgItemType type, const ImgBounds &bounds );
+		void add_outline( const Style &style, bool fillable );
+		void add_control_point( const Style &style, ImgPoint center );
+	};
+
+
+
+	SvgImporter::SvgImporter( VectorImg &image )
+	: image( image )
+	{
+		image.layers.clear();
+		image.img_w = 0;
+		image.img_h = 0;
+
+		// SVG fills with black by default
+		Style style;
+		style.fill.visible = true;
+		styles.push_back( style );
+	}
+
+
+
+	void SvgImporter::feed( const char *p, const char *end )
+	{
+		while( p < end )
+		{
+			switch( state )
+			{
+				case TEXT:
+				{
+					// The text content isn't needed
+					const auto found = static_cast<const char*>( memchr( p, '<', end - p ) );
+					if( !found )
+					{
+						return;
+					}
+
+					p = found + 1;
+					state = TAG;
+					tag.clear();
+					quote = 0;
+					bracket_depth = 0;
+					break;
+				}
+
+				case TAG:
+					feed_tag( p, end );
+					break;
+
+				case COMMENT:
+					feed_until( p, end, '>', '-', 2 );
+					break;
+
+				case CDATA:
+					feed_until( p, end, '>', ']', 2 );
+					break;
+
+				case INSTRUCTION:
+					feed_until( p, end, '>', '?', 1 );
+					break;
+			}
+		}
+	}
+
+
+
+	void SvgImporter::feed_until( const char *&p, const char *end, char last, char repeated, int count )
+	{
+		for( ; p < end; p++ )
+		{
+			if( *p == last && end_run >= count )
+			{
+				p++;
+				state = TEXT;
+				return;
+			}
+
+			end_run = *p == repeated ? end_run + 1 : 0;
+		}
+	}
+
+
+
+	void SvgImporter::feed_tag( const char *&p, const char *end )
+	{
+		while( p < end )
+		{
+			// Element tags and attribute values are copied in runs
+			const auto is_markup = !tag.empty() && (tag[0] == '!' || tag[0] == '?');
+			if( quote )
+			{
+				const auto found = static_cast<const char*>( memchr( p, quote, end - p ) );
+				const auto run_end = found ? found : end;
+				tag.append( p, run_end );
+				p = run_end;
+			}
+			else if( !tag.empty() && !is_markup )
+			{
+				auto run_end = p;
+				while( run_end < end && *run_end != '"' && *run_end != '\'' && *run_end != '>' )
+				{
+					run_end++;
+				}
+				tag.append( p, run_end );
+				p = run_end;
+			}
+
+			if( p == end )
+			{
+				return;
+			}
+
+			const auto c = *p++;
+			if( quote )
+			{
+				if( c == quote )
+				{
+					quote = 0;
+				}
+			}
+			else if( c == '"' || c == '\'' )
+			{
+				quote = c;
+			}
+			else if( c == '>' && bracket_depth <= 0 )
+			{
+				state = TEXT;
+				handle_tag();
+				return;
+			}
+			else if( is_markup && tag.size() >= 2 && tag[0] == '!' && tag[1] != '[' )
+			{
+				// Declarations can have an internal subset in brackets
+				bracket_depth += c == '[' ? 1 : c == ']' ? -1 : 0;
+			}
+
+			tag.push_back( c );
+
+			// Comments, character data and processing instructions aren't kept
+			if( (tag.size() == 1 || is_markup) && (tag == "!--" || tag == "![CDATA[" || tag == "?") )
+			{
+				state = tag[0] == '?' ? INSTRUCTION : tag[1] == '-' ? COMMENT : CDATA;
+				end_run = 0;
+				return;
+			}
+		}
+	}
+
+
+
+	void SvgImporter::handle_tag()
+	{
+		if( tag.empty() || tag[0] == '!' )
+		{
+			return;
+		}
+
+		if( tag[0] == '/' )
+		{
+			end_element();
+			return;
+		}
+
+		const auto begin = tag.data();
+		auto end = tag.data() + tag.size();
+		const auto self_closing = end[-1] == '/';
+		if( self_closing )
+		{
+			end--;
+		}
+
+		auto p = begin;
+		while( p < end && !is_space( *p ) )
+		{
+			p++;
+		}
+
+		// Namespace prefixes like "svg:line" are left out
+		Text name = { begin, p };
+		const auto colon = find( name.begin, name.end, ':' );
+		if( colon != name.end )
+		{
+			name.begin = colon + 1;
+		}
+
+		parse_attributes( p, end );
+		start_element( name, self_closing );
+	}
+
+
+
+	void SvgImporter::parse_attributes( const char *p, const char *end )
+	{
+		attributes.clear();
+		for( ;; )
+		{
+			while( p < end && is_space( *p ) )
+			{
+				p++;
+			}
+			if( p == end )
+			{
+				return;
+			}
+
+			Attribute attribute;
+			attribute.name.begin = p;
+			while( p < end && *p != '=' && !is_space( *p ) )
+			{
+				p++;
+			}
+			attribute.name.end = p;
+
+			while( p < end && is_space( *p ) )
+			{
+				p++;
+			}
+			if( p == end || *p != '=' )
+			{
+				continue;
+			}
+
+			for( p++; p < end && is_space( *p ); p++ )
+			{
+			}
+			if( p == end )
+			{
+				return;
+			}
+
+			if( *p == '"' || *p == '\'' )
+			{
+				const auto value_quote = *p++;
+				attribute.value.begin = p;
+				p = find( p, end, value_quote );
+				attribute.value.end = p;
+				if( p < end )
+				{
+					p++;
+				}
+			}
+			else
+			{
+				attribute.value.begin = p;
+				while( p < end && !is_space( *p ) )
+				{
+					p++;
+				}
+				attribute.value.end = p;
+			}
+
+			attributes.push_back( attribute );
+		}
+	}
+
+
+
+	const Text *SvgImporter::find_attribute( const char *name ) const
+	{
+		for( const auto &attribute : attributes )
+		{
+			if( attribute.name == name )
+			{
+				return &attribute.value;
+			}
+		}
+
+		return nullptr;
+	}
+
+
+
+	float SvgImporter::get_number( const char *name, float fallback ) const
+	{
+		const auto value = find_attribute( name );
+		auto number = fallback;
+		if( value )
+		{
+			parse_number( *value, number );
+		}
+		return number;
+	}
+
+
+
+	void SvgImporter::apply_property( Text name, Text value, Style &style )
+	{
+		float number = 0.f;
+		value = trim( value );
+
+		if( name == "fill" )
+		{
+			parse_paint( value, style.fill );
+		}
+		else if( name == "stroke" )
+		{
+			parse_paint( value, style.stroke );
+		}
+		else if( name == "stroke-width" && parse_number( value, number ) )
+		{
+			style.stroke_width = number;
+		}
+		else if( name == "opacity" && parse_number( value, number ) )
+		{
+			style.opacity *= min( max( number, 0.f ), 1.f );
+		}
+		else if( name == "fill-opacity" && parse_number( value, number ) )
+		{
+			style.fill_opacity = min( max( number, 0.f ), 1.f );
+		}
+		else if( name == "stroke-opacity" && parse_number( value, number ) )
+		{
+			style.stroke_opacity = min( max( number, 0.f ), 1.f );
+		}
+		else if( name == "fill-rule" )
+		{
+			style.fill_rule = value == "evenodd" ? EVEN_ODD : NON_ZERO;
+		}
+		else if( name == "stroke-linecap" )
+		{
+			style.line_style.cap = value == "round" ? ROUND_CAP : value == "square" ? SQUARE_CAP : BUTT_CAP;
+		}
+		else if( name == "stroke-linejoin" )
+		{
+			style.line_style.join = value == "round" ? ROUND_JOIN : value == "bevel" ? BEVEL_JOIN : MITER_JOIN;
+		}
+		else if( (name == "display" && value == "none") || (name == "visibility" && value == "hidden") )
+		{
+			style.hidden = true;
+		}
+	}
+
+
+
+	void SvgImporter::set_root_size( Style &style )
+	{
+		const auto width_attribute = find_attribute( "width" );
+		const auto height_attribute = find_attribute( "height" );
+		const auto is_absolute = []( const Text *value )
+		{
+			return value && find( value->begin, value->end, '%' ) == value->end;
+		};
+
+		float width = 0.f, height = 0.f;
+		const auto has_width = is_absolute( width_attribute ) && parse_number( *width_attribute, width );
+		const auto has_height = is_absolute( height_attribute ) && parse_number( *height_attribute, height );
+
+		float view_box[4] = {};
+		const auto view_box_attribute = find_attribute( "viewBox" );
+		const auto has_view_box = view_box_attribute && parse_numbers( *view_box_attribute, view_box, 4 ) == 4 &&
+		                          view_box[2] > 0.f && view_box[3] > 0.f;
+
+		if( has_view_box )
+		{
+			if( !has_width ) width = has_height ? height * view_box[2] / view_box[3] : view_box[2];
+			if( !has_height ) height = width * view_box[3] / view_box[2];
+
+			// The view box is fit and centered like with the default preserveAspectRatio
+			const auto scale = min( width / view_box[2], height / view_box[3] );
+			Transform transform;
+			transform.a = scale;
+			transform.d = scale;
+			transform.e = (width - view_box[2] * scale) / 2.f - view_box[0] * scale;
+			transform.f = (height - view_box[3] * scale) / 2.f - view_box[1] * scale;
+			style.transform = style.transform * transform;
+		}
+
+		if( has_view_box || (has_width && has_height) )
+		{
+			image.img_w = static_cast<size_t>( ceil( max( width, 0.f ) ) );
+			image.img_h = static_cast<size_t>( ceil( max( height, 0.f ) ) );
+			has_size = true;
+		}
+	}
+
+
+
+	void SvgImporter::start_element( Text name, bool self_closing )
+	{
+		auto style = styles.back();
+
+		// Presentation attributes first, the style attribute overrides them
+		for( const auto &attribute : attributes )
+		{
+			apply_property( attribute.name, attribute.value, style );
+		}
+
+		const auto style_attribute = find_attribute( "style" );
+		if( style_attribute )
+		{
+			auto p = style_attribute->begin;
+			while( p < style_attribute->end )
+			{
+				const auto declaration_end = find( p, style_attribute->end, ';' );
+				const auto colon = find( p, declaration_end, ':' );
+				if( colon != declaration_end )
+				{
+					apply_property( trim( { p, colon } ), { colon + 1, declaration_end }, style );
+				}
+				p = declaration_end + (declaration_end < style_attribute->end ? 1 : 0);
+			}
+		}
+
+		const auto transform = find_attribute( "transform" );
+		if( transform )
+		{
+			style.transform = style.transform * parse_transform( *transform );
+		}
+
+		if( name == "svg" && !has_root )
+		{
+			has_root = true;
+			set_root_size( style );
+		}
+		else if( name == "g" && styles.size() == 2 && !style.hidden )
+		{
+			// Top level groups are the layers
+			image.layers.emplace_back( new ImgLayer() );
+			layer = image.layers.back().get();
+			layer_depth = styles.size() + 1;
+		}
+		else if( name == "defs" || name == "symbol" || name == "clipPath" || name == "mask" ||
+		         name == "marker" || name == "pattern" || name == "linearGradient" ||
+		         name == "radialGradient" || name == "filter" || name == "style" )
+		{
+			// Only drawn when referenced, which isn't supported
+			style.hidden = true;
+		}
+		else if( !style.hidden )
+		{
+			outline.clear();
+			PathParser parser( outline, style.transform );
+
+			if( name == "line" )
+			{
+				parser.move_to( { get_number( "x1" ), get_number( "y1" ) } );
+				parser.line_to( { get_number( "x2" ), get_number( "y2" ) } );
+				outline.end_contour( false );
+				add_outline( style, false );
+			}
+			else if( name == "rect" )
+			{
+				const auto x = get_number( "x" );
+				const auto y = get_number( "y" );
+				const auto width = get_number( "width" );
+				const auto height = get_number( "height" );
+				if( width > 0.f && height > 0.f )
+				{
+					parser.move_to( { x, y } );
+					parser.line_to( { x + width, y } );
+					parser.line_to( { x + width, y + height } );
+					parser.line_to( { x, y + height } );
+					parser.close();
+					add_outline( style, true );
+				}
+			}
+			else if( name == "polyline" || name == "polygon" )
+			{
+				const auto points = find_attribute( "points" );
+				if( points )
+				{
+					auto p = points->begin;
+					ImgPoint point;
+					for( auto first = true; parse_number( p, points->end, point.x ) && parse_number( p, points->end, point.y ); first = false )
+					{
+						if( first )
+						{
+							parser.move_to( point );
+						}
+						else
+						{
+							parser.line_to( point );
+						}
+					}
+
+					if( name == "polygon" )
+					{
+						parser.close();
+					}
+					outline.end_contour( false );
+					add_outline( style, true );
+				}
+			}
+			else if( name == "path" )
+			{
+				const auto data = find_attribute( "d" );
+				if( data )
+				{
+					parser.parse( *data );
+					add_outline( style, true );
+				}
+			}
+			else if( name == "circle" || name == "ellipse" )
+			{
+				add_control_point( style, { get_number( "cx" ), get_number( "cy" ) } );
+			}
+		}
+
+		if( !self_closing )
+		{
+			styles.push_back( style );
+		}
+	}
+
+
+
+	void SvgImporter::end_element()
+	{
+		// The default style is never closed
+		if( styles.size() > 1 )
+		{
+			styles.pop_back();
+		}
+
+		if( styles.size() < layer_depth )
+		{
+			layer = nullptr;
+			layer_depth = 0;
+		}
+	}
+
+
+
+	// Items drawn under the items of another type they overlap
+	// would lose the painting order, they start a new layer
+	ImgLayer &SvgImporter::get_layer( ImgItemType type, const ImgBounds &bounds )
+	{
+		if( !layer || !layer->is_drawn_on_top( type, bounds ) )
+		{
+			image.layers.emplace_back( new ImgLayer() );
+			layer = image.layers.back().get();
+		}
+
+		return *layer;
+	}
+
+
+
+	Color apply_opacity( Color color, float opacity )
+	{
+		color.a = static_cast<uint8_t>( color.a * opacity + 0.5f );
+		return color;
+	}
+
+
+
+	void SvgImporter::add_outline( const Style &style, bool fillable )
+	{
+		const auto &points = outline.points;
+		if( points.empty() )
+		{
+			return;
+		}
+
+		ImgBounds bounds = { points[0].x, points[0].y, points[0].x, points[0].y };
+		for( const auto &point : points )
+		{
+			bounds.min_x = min( bounds.min_x, point.x );
+			bounds.min_y = min( bounds.min_y, point.y );
+			bounds.max_x = max( bounds.max_x, point.x );
+			bounds.max_y = max( bounds.max_y, point.y );
+		}
+		max_x = max( max_x, bounds.max_x );
+		max_y = max( max_y, bounds.max_y );
+
+		if( fillable && style.fill.visible )
+		{
+			ImgPath path;
+			path.rule = style.fill_rule;
+
+			// Contours need an area, the position of the fill is the corner of its bounds
+			auto origin = points[0];
+			uint32_t start = 0;
+			for( const auto end : outline.contour_ends )
+			{
+				if( end - start >= 3 )
+				{
+					for( auto i = start; i < end; i++ )
+					{
+						origin.x = min( origin.x, points[i].x );
+						origin.y = min( origin.y, points[i].y );
+					}
+				}
+				start = end;
+			}
+
+			start = 0;
+			for( const auto end : outline.contour_ends )
+			{
+				if( end - start >= 3 )
+				{
+					for( auto i = start; i < end; i++ )
+					{
+						path.points.push_back( { points[i].x - origin.x, points[i].y - origin.y } );
+					}
+					path.contour_ends.push_back( static_cast<uint32_t>( path.points.size() ) );
+				}
+				start = end;
+			}
+
+			const auto color = apply_opacity( style.fill.color, style.opacity * style.fill_opacity );
+			get_layer( FILL, bounds ).add_fill( origin.x, origin.y, move( path ), color );
+		}
+
+		if( style.stroke.visible )
+		{
+			const auto width = style.stroke_width * style.transform.get_scale();
+			const auto color = apply_opacity( style.stroke.color, style.opacity * style.stroke_opacity );
+			const auto reach = style.line_style.get_reach( width );
+			auto &target = get_layer( LINE, { bounds.min_x - reach, bounds.min_y - reach, bounds.max_x + reach, bounds.max_y + reach } );
+
+			uint32_t start = 0;
+			for( size_t contour = 0; contour < outline.contour_ends.size(); contour++ )
+			{
+				const auto end = outline.contour_ends[contour];
+				for( auto i = start; i + 1 < end; i++ )
+				{
+					target.add_line( points[i].x, points[i].y, points[i + 1].x, points[i + 1].y, width, color, style.line_style );
+				}
+
+				const auto &first = points[start];
+				const auto &last = points[end - 1];
+				if( outline.contour_closed[contour] && end - start > 2 && (first.x != last.x || first.y != last.y) )
+				{
+					target.add_line( last.x, last.y, first.x, first.y, width, color, style.line_style );
+				}
+				start = end;
+			}
+		}
+	}
+
+
+
+	void SvgImporter::add_control_point( const Style &style, ImgPoint center )
+	{
+		const auto &paint = style.fill.visible ? style.fill : style.stroke;
+		if( !paint.visible )
+		{
+			return;
+		}
+
+		const auto opacity = style.opacity * (style.fill.visible ? style.fill_opacity : style.stroke_opacity);
+		const auto point = style.transform.apply( center );
+		max_x = max( max_x, point.x );
+		max_y = max( max_y, point.y );
+
+		get_layer( CONTROL_POINT, { point.x, point.y, point.x, point.y } ).add_control_point( point.x, point.y, apply_opacity( paint.color, opacity ) );
+	}
+
+
+
+	void SvgImporter::finish()
+	{
+		// Without a size the image is made to fit the items
+		if( !has_size )
+		{
+			image.img_w = static_cast<size_t>( ceil( max_x ) );
+			image.img_h = static_cast<size_t>( ceil( max_y ) );
+		}
+	}
+
+
+
+	// Buffers the text and formats the numbers without the stream
+	struct SvgWriter
+	{
+		explicit SvgWriter( const string &path );
+
+		void write( const char *text );
+		void write_number( float value );
+		void write_color( const char *attribute, const char *opacity_attribute, Color color );
+		void write_point( float x, float y );
+		void flush();
+
+	  protected:
+		ofstream stream;
+		string   buffer;
+		string   path;
+	};
+
+
+
+	SvgWriter::SvgWriter( const string &path )
+	: stream( path, ios::binary | ios::trunc ),
+	  path( path )
+	{
+		if( !stream )
+		{
+			throw runtime_error( "Couldn't open the file for writing: '" + path + "'" );
+		}
+		buffer.reserve( block_size + 256 );
+	}
+
+
+
+	void SvgWriter::flush()
+	{
+		stream.write( buffer.data(), buffer.size() );
+		buffer.clear();
+
+		if( !stream )
+		{
+			throw runtime_error( "Couldn't write the file: '" + path + "'" );
+		}
+	}
+
+
+
+	void SvgWriter::write( const char *text )
+	{
+		buffer += text;
+		if( buffer.size() >= block_size )
+		{
+			flush();
+		}
+	}
+
+
+
+	void SvgWriter::write_number( float value )
+	{
+		if( !isfinite( value ) )
+		{
+			value = 0.f;
+		}
+
+		// Three decimals are plenty for image coordinates
+		const auto scaled = llround( static_cast<double>( value ) * 1000.0 );
+		if( llabs( scaled ) >= 1000000000000000LL )
+		{
+			char text[32];
+			snprintf( text, sizeof( text ), "%g", value );
+			write( text );
+			return;
+		}
+
+		char digits[32];
+		auto end = digits + sizeof( digits ) - 1;
+		*end = 0;
+		auto p = end;
+
+		auto magnitude = scaled < 0 ? -scaled : scaled;
+		auto fraction = magnitude % 1000;
+		auto integer = magnitude / 1000;
+
+		if( fraction )
+		{
+			auto decimals = 3;
+			for( ; fraction % 10 == 0; decimals-- )
+			{
+				fraction /= 10;
+			}
+			for( ; decimals > 0; decimals-- )
+			{
+				*--p = static_cast<char>( '0' + fraction % 10 );
+				fraction /= 10;
+			}
+			*--p = '.';
+		}
+
+		do
+		{
+			*--p = static_cast<char>( '0' + integer % 10 );
+			integer /= 10;
+		}
+		while( integer );
+
+		if( scaled < 0 )
+		{
+			*--p = '-';
+		}
+
+		write( p );
+	}
+
+
+
+	void SvgWriter::write_point( float x, float y )
+	{
+		write_number( x );
+		write( " " );
+		write_number( y );
+	}
+
+
+
+	void SvgWriter::write_color( const char *attribute, const char *opacity_attribute, Color color )
+	{
+		char text[16];
+		snprintf( text, sizeof( text ), "#%02x%02x%02x", color.r, color.g, color.b );
+
+		write( " " );
+		write( attribute );
+		write( "=\"" );
+		write( text );
+		write( "\"" );
+
+		if( color.a != 255 )
+		{
+			write( " " );
+			write( opacity_attribute );
+			write( "=\"" );
+			write_number( color.a / 255.f );
+			write( "\"" );
+		}
+	}
+}
+
+
+
+void vector_img::import_svg( const string &path, VectorImg &image )
+{
+	ifstream stream( path, ios::binary );
+	if( !stream )
+	{
+		throw runtime_error( "Couldn't open the file: '" + path + "'" );
+	}
+
+	SvgImporter importer( image );
+	vector<char> block( block_size );
+	while( stream )
+	{
+		stream.read( block.data(), block.size() );
+		const auto size = static_cast<size_t>( stream.gcount() );
+		importer.feed( block.data(), block.data() + size );
+	}
+
+	if( stream.bad() )
+	{
+		throw runtime_error( "Couldn't read the file: '" + path + "'" );
+	}
+
+	importer.finish();
+}
+
+
+
+void vector_img::export_svg( const VectorImg &image, const string &path )
+{
+	SvgWriter writer( path );
+
+	writer.write( "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n" );
+	writer.write( "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" );
+	writer.write_number( static_cast<float>( image.img_w ) );
+	writer.write( "\" height=\"" );
+	writer.write_number( static_cast<float>( image.img_h ) );
+	writer.write( "\" viewBox=\"0 0 " );
+	writer.write_point( static_cast<float>( image.img_w ), static_cast<float>( image.img_h ) );
+	writer.write( "\">\n" );
+
+	// Items in their drawing order, fills first
+	for( const auto &layer : image.layers )
+	{
+		writer.write( "<g>\n" );
+		if( !layer )
+		{
+			writer.write( "</g>\n" );
+			continue;
+		}
+
+		const auto &fills = layer->fills;
+		for( size_t i = 0; i < fills.size(); i++ )
+		{
+			if( fills.is_removed( i ) )
+			{
+				continue;
+			}
+
+			// Fills without contours are written as a single point
+			const auto &path = fills.path[i];
+			writer.write( "<path d=\"" );
+			if( path.contour_ends.empty() )
+			{
+				writer.write( "M" );
+				writer.write_point( fills.x[i], fills.y[i] );
+				writer.write( "Z" );
+			}
+
+			uint32_t start = 0;
+			for( const auto end : path.contour_ends )
+			{
+				for( auto j = start; j < end; j++ )
+				{
+					writer.write( j == start ? "M" : " " );
+					writer.write_point( fills.x[i] + path.points[j].x, fills.y[i] + path.points[j].y );
+				}
+				writer.write( "Z" );
+				start = end;
+			}
+
+			writer.write( "\"" );
+			writer.write_color( "fill", "fill-opacity", fills.color[i] );
+			if( path.rule == EVEN_ODD )
+			{
+				writer.write( " fill-rule=\"evenodd\"" );
+			}
+			writer.write( "/>\n" );
+		}
+
+		const auto &lines = layer->lines;
+		for( size_t i = 0; i < lines.size(); i++ )
+		{
+			if( lines.is_removed( i ) )
+			{
+				continue;
+			}
+
+			writer.write( "<line x1=\"" );
+			writer.write_number( lines.ax[i] );
+			writer.write( "\" y1=\"" );
+			writer.write_number( lines.ay[i] );
+			writer.write( "\" x2=\"" );
+			writer.write_number( lines.bx[i] );
+			writer.write( "\" y2=\"" );
+			writer.write_number( lines.by[i] );
+			writer.write( "\" stroke-width=\"" );
+			writer.write_number( lines.width[i] );
+			writer.write( "\"" );
+			writer.write_color( "stroke", "stroke-opacity", lines.color[i] );
+			const auto style = lines.style[i];
+			if( style.cap != BUTT_CAP )
+			{
+				writer.write( style.cap == ROUND_CAP ? " stroke-linecap=\"round\"" : " stroke-linecap=\"square\"" );
+			}
+			if( style.join != MITER_JOIN )
+			{
+				writer.write( style.join == ROUND_JOIN ? " stroke-linejoin=\"round\"" : " stroke-linejoin=\"bevel\"" );
+			}
+			writer.write( "/>\n" );
+		}
+
+		const auto &control_points = layer->control_points;
+		for( size_t i = 0; i < control_points.size(); i++ )
+		{
+			if( control_points.is_removed( i ) )
+			{
+				continue;
+			}
+
+			writer.write( "<circle cx=\"" );
+			writer.write_number( control_points.x[i] );
+			writer.write( "\" cy=\"" );
+			writer.write_number( control_points.y[i] );
+			writer.write( "\" r=\"" );
+			writer.write_number( control_point_radius );
+			writer.write( "\"" );
+			writer.write_color( "fill", "fill-opacity", control_points.color[i] );
+			writer.write( "/>\n" );
+		}
+
+		writer.write( "</g>\n" );
+	}
+
+	writer.write( "</svg>\n" );
+	writer.flush();
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include "vector_img.hh"
+
+#include <string>
+
+namespace vector_img
+{
+
+
+// Reads the file in blocks, only the tag being parsed is kept in memory
+// - Each top level <g> becomes a layer, items between the groups
+//   go to layers of their own to keep the drawing order
+// - <line>, <polyline> and stroked outlines become lines, <circle> and
+//   <ellipse> control points, filled <path>, <polygon> and <rect> fills
+// - Transforms, presentation attributes, style attributes and opacities
+//   are applied, curves and arcs are flattened to line segments
+// - Replaces the contents of the image, throws runtime_error if the
+//   file couldn't be read
+void import_svg( const std::string &path, VectorImg &image );
+
+// Writes the items as they are read from the layers, through a small buffer
+// - Throws runtime_error if the file couldn't be written
+void export_svg( const VectorImg &image, const std::string &path );
+
+
+};
@@ -306,6 +306,8 @@ void Window::render() const
 	glClearColor( 0.2f, 0.2f, 0.2f, 1.0f );
 	glClear( GL_COLOR_BUFFER_BIT );
 
+	Globals::batch_2d.begin_frame( size.to_gl_vec() );
+
 	GuiElement::render();
 
 	for( const auto &popup : popup_elements )
@@ -313,6 +315,8 @@ void Window::render() const
 		popup->render();
 	}
 
+	Globals::batch_2d.flush();
+
 	glFlush();
 	SDL_GL_SwapWindow( window.get() );
 }
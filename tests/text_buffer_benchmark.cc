@@ -0,0 +1,290 @@
+#include "../src/text_buffer.hh"
+#include "../src/utf8.hh"
+
+#include <catch.hpp>
+#include <chrono>
+#include <random>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+using namespace gui;
+
+namespace
+{
+	const std::string mapped_path = "text_buffer_test.txt";
+
+
+
+	string_unicode to_unicode( const std::string &text )
+	{
+		return string_unicode( text.begin(), text.end() );
+	}
+
+
+
+	// Offsets where the lines of the text start, the way TextBuffer counts them
+	std::vector<size_t> get_line_starts( const string_unicode &text )
+	{
+		std::vector<size_t> starts = { 0 };
+		for( size_t i = 0; i < text.size(); i++ )
+		{
+			if( text[i] == TextBuffer::line_break )
+			{
+				starts.push_back( i + 1 );
+			}
+		}
+		return starts;
+	}
+
+
+
+	void require_same_text( const TextBuffer &buffer, const string_unicode &expected )
+	{
+		REQUIRE( buffer.size() == expected.size() );
+		REQUIRE( buffer.get_text() == expected );
+
+		const auto starts = get_line_starts( expected );
+		REQUIRE( buffer.get_line_count() == starts.size() );
+		for( size_t line = 0; line < starts.size(); line++ )
+		{
+			const auto end = line + 1 < starts.size() ? starts[line + 1] - 1 : expected.size();
+			REQUIRE( buffer.get_line_start( line ) == starts[line] );
+			REQUIRE( buffer.get_line_length( line ) == end - starts[line] );
+			REQUIRE( buffer.get_line( line ) == string_unicode( expected.begin() + starts[line], expected.begin() + end ) );
+		}
+	}
+
+
+
+	// Random text with a line break every few code points, some of them outside of ASCII
+	string_unicode make_random_text( std::mt19937 &random, size_t size )
+	{
+		const uint32_t characters[] = { 'a', 'b', ' ', 0xe4, 0x5b50, 0x1f600, TextBuffer::line_break };
+		std::uniform_int_distribution<size_t> pick( 0, 6 );
+
+		string_unicode text;
+		for( size_t i = 0; i < size; i++ )
+		{
+			text.push_back( characters[pick( random )] );
+		}
+		return text;
+	}
+}
+
+
+
+TEST_CASE( "Text buffers insert, erase and find lines" )
+{
+	TextBuffer buffer;
+	REQUIRE( buffer.size() == 0 );
+	REQUIRE( buffer.get_line_count() == 1 );
+	REQUIRE( buffer.get_line( 0 ).empty() );
+
+	buffer.insert( 0, to_unicode( "first\nthird" ) );
+	buffer.insert( 6, to_unicode( "second\n" ) );
+	require_same_text( buffer, to_unicode( "first\nsecond\nthird" ) );
+	REQUIRE( buffer.at( 6 ) == 's' );
+	REQUIRE( buffer.get_offset( 1, 3 ) == 9 );
+
+	// Columns past the end of the line stop at the line break
+	REQUIRE( buffer.get_offset( 0, 100 ) == 5 );
+	REQUIRE( buffer.get_line_start( 10 ) == buffer.size() );
+	REQUIRE_THROWS_AS( buffer.at( buffer.size() ), std::out_of_range );
+
+	// Offsets past the end append, counts past the end erase to the end
+	buffer.insert( 1000, to_unicode( "\n" ) );
+	buffer.erase( 0, 6 );
+	require_same_text( buffer, to_unicode( "second\nthird\n" ) );
+	buffer.erase( 7, 1000 );
+	require_same_text( buffer, to_unicode( "second\n" ) );
+	buffer.erase( 100, 1 );
+	buffer.insert( 0, string_unicode() );
+	require_same_text( buffer, to_unicode( "second\n" ) );
+
+	buffer.clear();
+	require_same_text( buffer, string_unicode() );
+
+	// Texts larger than a leaf are split over many leaves and joined back
+	std::mt19937 random( 1 );
+	const auto text = make_random_text( random, 20000 );
+	TextBuffer large( text );
+	require_same_text( large, text );
+	REQUIRE( large.get_text( 4000, 3000 ) == string_unicode( text.begin() + 4000, text.begin() + 7000 ) );
+	REQUIRE( large.get_text( 19990, 100 ) == string_unicode( text.end() - 10, text.end() ) );
+	REQUIRE( large.get_text( 20000, 10 ).empty() );
+}
+
+
+
+TEST_CASE( "Copies of text buffers are snapshots" )
+{
+	std::mt19937 random( 2 );
+	const auto text = make_random_text( random, 5000 );
+	TextBuffer buffer( text );
+	const auto snapshot = buffer;
+
+	buffer.erase( 100, 2000 );
+	buffer.insert( 50, to_unicode( "edited\n" ) );
+	REQUIRE( buffer.size() == 5000 - 2000 + 7 );
+
+	// The snapshot still has the text from before the edits
+	require_same_text( snapshot, text );
+
+	auto copy = snapshot;
+	copy.clear();
+	require_same_text( snapshot, text );
+}
+
+
+
+TEST_CASE( "Text buffers read and edit mapped text" )
+{
+	const std::string utf8_text =
+		"Lorem ipsum \xc3\xa4\xc3\xb6\n\xe5\xad\x90\xe7\x8c\xab dolor\n\xf0\x9f\x98\x80 sit amet\n"
+		"consectetur \xe2\x82\xac adipiscing\n";
+	{
+		std::ofstream stream( mapped_path, std::ios::binary | std::ios::trunc );
+		stream << utf8_text;
+	}
+
+	string_unicode expected;
+	utf8::decode( utf8_text.data(), utf8_text.data() + utf8_text.size(), expected );
+
+	{
+		std::shared_ptr<const tools::MappedFile> file( new tools::MappedFile( mapped_path ) );
+		REQUIRE( file->size() == utf8_text.size() );
+
+		// Two ranges, split after the second line, counted like the loader counts them
+		const auto split = utf8_text.find( "\xf0\x9f\x98\x80" );
+		const auto add_range = [&]( TextBuffer &buffer, size_t begin, size_t end )
+		{
+			buffer.append_mapped(
+				file,
+				begin,
+				end,
+				utf8::count_code_points( file->data() + begin, file->data() + end ),
+				std::count( file->data() + begin, file->data() + end, '\n' )
+			);
+		};
+
+		TextBuffer buffer;
+		add_range( buffer, 0, split );
+		add_range( buffer, split, utf8_text.size() );
+		require_same_text( buffer, expected );
+		REQUIRE( buffer.at( 12 ) == 0xe4 );
+		REQUIRE( buffer.get_line( 2 ).front() == 0x1f600 );
+
+		// Edits within the mapped ranges keep the rest of them mapped
+		buffer.insert( 14, to_unicode( "X\n" ) );
+		expected.insert( expected.begin() + 14, { 'X', '\n' } );
+		buffer.erase( 20, 5 );
+		expected.erase( expected.begin() + 20, expected.begin() + 25 );
+		require_same_text( buffer, expected );
+	}
+
+	std::remove( mapped_path.c_str() );
+}
+
+
+
+TEST_CASE( "Random edits of text buffers match the edits of a plain vector" )
+{
+	std::mt19937 random( 3 );
+	TextBuffer buffer;
+	string_unicode expected;
+	std::vector<std::pair<TextBuffer, string_unicode>> snapshots;
+
+	for( int edit = 0; edit < 2000; edit++ )
+	{
+		std::uniform_int_distribution<size_t> offset( 0, expected.size() + 5 );
+		const auto at = offset( random );
+
+		// Mostly small edits, now and then one larger than a leaf
+		std::uniform_int_distribution<size_t> count( 0, edit % 50 == 0 ? 2000 : 40 );
+		if( random() % 3 == 0 )
+		{
+			const auto length = count( random );
+			buffer.erase( at, length );
+			if( at < expected.size() )
+			{
+				expected.erase( expected.begin() + at, expected.begin() + std::min( at + length, expected.size() ) );
+			}
+		}
+		else
+		{
+			const auto text = make_random_text( random, count( random ) );
+			buffer.insert( at, text );
+			expected.insert( expected.begin() + std::min( at, expected.size() ), text.begin(), text.end() );
+		}
+
+		REQUIRE( buffer.size() == expected.size() );
+		if( edit % 100 == 0 )
+		{
+			require_same_text( buffer, expected );
+			snapshots.emplace_back( buffer, expected );
+		}
+
+		if( !expected.empty() )
+		{
+			std::uniform_int_distribution<size_t> index( 0, expected.size() - 1 );
+			const auto i = index( random );
+			REQUIRE( buffer.at( i ) == expected[i] );
+		}
+	}
+
+	require_same_text( buffer, expected );
+	for( const auto &snapshot : snapshots )
+	{
+		require_same_text( snapshot.first, snapshot.second );
+	}
+}
+
+
+
+TEST_CASE( "Text buffer speed", "[.][benchmark]" )
+{
+	using seconds = std::chrono::duration<double>;
+
+	std::mt19937 random( 1 );
+	const auto text = make_random_text( random, 10 * 1024 * 1024 );
+
+	auto start = std::chrono::steady_clock::now();
+	TextBuffer buffer( text );
+	const seconds build_time = std::chrono::steady_clock::now() - start;
+
+	const int edit_count = 100000;
+	start = std::chrono::steady_clock::now();
+	for( int i = 0; i < edit_count; i++ )
+	{
+		std::uniform_int_distribution<size_t> offset( 0, buffer.size() );
+		if( i % 2 )
+		{
+			buffer.erase( offset( random ), 3 );
+		}
+		else
+		{
+			buffer.insert( offset( random ), to_unicode( "abc" ) );
+		}
+	}
+	const seconds edit_time = std::chrono::steady_clock::now() - start;
+
+	const int query_count = 100000;
+	size_t found = 0;
+	start = std::chrono::steady_clock::now();
+	for( int i = 0; i < query_count; i++ )
+	{
+		std::uniform_int_distribution<size_t> line( 0, buffer.get_line_count() - 1 );
+		found += buffer.get_line_start( line( random ) );
+	}
+	const seconds line_time = std::chrono::steady_clock::now() - start;
+
+	REQUIRE( buffer.size() == text.size() );
+	REQUIRE( found > 0 );
+
+	std::wcout << "Text buffer of " << text.size() << " code points\n"
+	           << "  build:      " << build_time.count() * 1000.0 << " ms\n"
+	           << "  edit:       " << edit_time.count() * 1e6 / edit_count << " us\n"
+	           << "  line start: " << line_time.count() * 1e6 / query_count << " us\n";
+}
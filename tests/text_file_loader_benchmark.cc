@@ -0,0 +1,197 @@
+#include "../src/text_file_loader.hh"
+#include "../src/text_buffer.hh"
+#include "../src/utf8.hh"
+
+#include <catch.hpp>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+using namespace gui;
+
+namespace
+{
+	const std::string loader_path = "text_file_loader_test.txt";
+
+
+
+	void write_file( const std::string &text )
+	{
+		std::ofstream stream( loader_path, std::ios::binary | std::ios::trunc );
+		stream << text;
+	}
+
+
+
+	// Text where a multibyte sequence crosses every chunk boundary, the boundaries
+	// land on different bytes of the sequences and the chunks end after them
+	std::string make_boundary_text( size_t boundary_count )
+	{
+		const std::string sequences[] = { "\xf0\x9f\x98\x80", "\xe5\xad\x90", "\xc3\xa4" };
+
+		std::string text = "\xef\xbb\xbf";
+		for( size_t i = 0; i < boundary_count; i++ )
+		{
+			const auto &sequence = sequences[i % 3];
+			const auto boundary = text.size() + TextFileLoader::chunk_size;
+			const auto sequence_begin = boundary - 1 - i % (sequence.size() - 1);
+			while( text.size() < sequence_begin )
+			{
+				text += text.size() % 64 ? 'a' : '\n';
+			}
+			text += sequence;
+		}
+		text += "\nend";
+		return text;
+	}
+
+
+
+	// Takes the chunks until the loader is done
+	std::vector<TextFileChunk> take_all_chunks( TextFileLoader &loader )
+	{
+		std::vector<TextFileChunk> chunks;
+		while( !loader.is_done() )
+		{
+			const auto taken = loader.take_chunks();
+			chunks.insert( chunks.end(), taken.begin(), taken.end() );
+			std::this_thread::yield();
+		}
+		return chunks;
+	}
+}
+
+
+
+TEST_CASE( "Text file chunks don't split UTF-8 sequences" )
+{
+	const auto text = make_boundary_text( 6 );
+	write_file( text );
+
+	string_unicode expected;
+	utf8::decode( text.data() + 3, text.data() + text.size(), expected );
+	{
+		TextFileLoader loader( loader_path );
+		const auto file = loader.get_file();
+		REQUIRE( file->size() == text.size() );
+
+		// The first chunk is there before the worker gets to the rest
+		const auto first = loader.take_chunks();
+		REQUIRE( !first.empty() );
+		REQUIRE( first.front().byte_begin == 3 );
+
+		auto chunks = take_all_chunks( loader );
+		chunks.insert( chunks.begin(), first.begin(), first.end() );
+		REQUIRE( loader.get_progress() == 1.f );
+		REQUIRE( loader.take_chunks().empty() );
+		REQUIRE( chunks.size() == 7 );
+
+		// The chunks follow each other without gaps and each one starts a sequence
+		TextBuffer buffer;
+		size_t byte_end = 3;
+		for( const auto &chunk : chunks )
+		{
+			REQUIRE( chunk.byte_begin == byte_end );
+			REQUIRE( chunk.byte_end > chunk.byte_begin );
+			REQUIRE( chunk.byte_end - chunk.byte_begin < TextFileLoader::chunk_size + 4 );
+			if( &chunk != &chunks.back() )
+			{
+				REQUIRE( chunk.byte_end - chunk.byte_begin > TextFileLoader::chunk_size );
+			}
+			REQUIRE( (text[chunk.byte_begin] & 0xc0) != 0x80 );
+			REQUIRE( chunk.code_points == utf8::count_code_points( &text[chunk.byte_begin], text.data() + chunk.byte_end ) );
+			REQUIRE( chunk.line_breaks == size_t( std::count( &text[chunk.byte_begin], text.data() + chunk.byte_end, '\n' ) ) );
+
+			buffer.append_mapped( file, chunk.byte_begin, chunk.byte_end, chunk.code_points, chunk.line_breaks );
+			byte_end = chunk.byte_end;
+		}
+		REQUIRE( byte_end == text.size() );
+
+		// None of the boundary sequences decoded to a replacement character
+		REQUIRE( std::count( expected.begin(), expected.end(), 0xfffd ) == 0 );
+		REQUIRE( buffer.get_text() == expected );
+	}
+
+	std::remove( loader_path.c_str() );
+}
+
+
+
+TEST_CASE( "Small and empty text files are indexed right away" )
+{
+	write_file( "one\ntwo \xc3\xa4\n" );
+	{
+		TextFileLoader loader( loader_path );
+		REQUIRE( loader.get_progress() == 1.f );
+		REQUIRE( !loader.is_done() );
+
+		const auto chunks = loader.take_chunks();
+		REQUIRE( chunks.size() == 1 );
+		REQUIRE( chunks.front().byte_begin == 0 );
+		REQUIRE( chunks.front().byte_end == 11 );
+		REQUIRE( chunks.front().code_points == 10 );
+		REQUIRE( chunks.front().line_breaks == 2 );
+		REQUIRE( loader.is_done() );
+	}
+
+	// Files of only a byte order mark have no chunks
+	for( const std::string text : { "", "\xef\xbb\xbf" } )
+	{
+		write_file( text );
+		TextFileLoader loader( loader_path );
+		REQUIRE( loader.get_progress() == 1.f );
+		REQUIRE( loader.is_done() );
+		REQUIRE( loader.take_chunks().empty() );
+	}
+
+	std::remove( loader_path.c_str() );
+	REQUIRE_THROWS_AS( TextFileLoader{ loader_path }, std::runtime_error );
+}
+
+
+
+TEST_CASE( "Loaders stop indexing when destroyed" )
+{
+	write_file( make_boundary_text( 200 ) );
+	for( int i = 0; i < 20; i++ )
+	{
+		TextFileLoader loader( loader_path );
+		REQUIRE( loader.get_progress() > 0.f );
+	}
+
+	std::remove( loader_path.c_str() );
+}
+
+
+
+TEST_CASE( "Text file indexing speed", "[.][benchmark]" )
+{
+	using seconds = std::chrono::duration<double>;
+
+	const auto text = make_boundary_text( 4 * 1024 );
+	write_file( text );
+
+	size_t code_points = 0;
+	size_t line_breaks = 0;
+	const auto start = std::chrono::steady_clock::now();
+	{
+		TextFileLoader loader( loader_path );
+		for( const auto &chunk : take_all_chunks( loader ) )
+		{
+			code_points += chunk.code_points;
+			line_breaks += chunk.line_breaks;
+		}
+	}
+	const seconds index_time = std::chrono::steady_clock::now() - start;
+
+	std::remove( loader_path.c_str() );
+
+	REQUIRE( line_breaks == size_t( std::count( text.begin(), text.end(), '\n' ) ) );
+
+	std::wcout << "Indexed " << text.size() / (1024 * 1024) << " MiB, " << code_points << " code points\n"
+	           << "  index: " << index_time.count() * 1000.0 << " ms\n"
+	           << "  MiB/s: " << text.size() / (1024.0 * 1024.0) / index_time.count() << "\n";
+}
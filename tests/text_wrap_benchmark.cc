@@ -0,0 +1,218 @@
+#include "../src/text_wrap.hh"
+
+#include <catch.hpp>
+#include <chrono>
+#include <random>
+#include <iostream>
+
+using namespace gui;
+
+namespace
+{
+	// Widths of the code points, kept in a plain vector
+	TextWrap::GetWidth get_width_of( const std::vector<float> &widths )
+	{
+		return [&widths]( size_t i ) { return widths[i]; };
+	}
+
+
+
+	std::vector<std::pair<size_t, size_t>> get_rows( const TextWrap &wrap )
+	{
+		std::vector<std::pair<size_t, size_t>> rows;
+		for( size_t row = 0; row < wrap.get_row_count(); row++ )
+		{
+			rows.push_back( wrap.get_row( row ) );
+		}
+		return rows;
+	}
+
+
+
+	// Rows of the text measured and wrapped from the start
+	std::vector<std::pair<size_t, size_t>> get_full_rows( const std::vector<float> &widths, float max_width )
+	{
+		TextWrap wrap;
+		wrap.measure( widths.size(), get_width_of( widths ) );
+		wrap.wrap( max_width );
+		return get_rows( wrap );
+	}
+
+
+
+	std::vector<float> make_random_widths( std::mt19937 &random, size_t count )
+	{
+		std::uniform_int_distribution<int> width( 1, 12 );
+		std::vector<float> widths;
+		for( size_t i = 0; i < count; i++ )
+		{
+			widths.push_back( static_cast<float>( width( random ) ) );
+		}
+		return widths;
+	}
+}
+
+
+
+TEST_CASE( "Text is wrapped to rows that fit the width" )
+{
+	const std::vector<float> widths = { 10, 10, 10, 10, 10, 25, 10, 40, 10 };
+
+	TextWrap wrap;
+	size_t calls = 0;
+	size_t next_index = 0;
+	wrap.measure(
+		widths.size(),
+		[&]( size_t i )
+		{
+			// Measured once per code point, in order
+			REQUIRE( i == next_index++ );
+			calls++;
+			return widths[i];
+		}
+	);
+	REQUIRE( calls == widths.size() );
+
+	REQUIRE( wrap.get_advance( 0 ) == 0.f );
+	REQUIRE( wrap.get_advance( 6 ) == 75.f );
+	REQUIRE( wrap.get_advance( 100 ) == 135.f );
+	REQUIRE( wrap.get_width( 2, 5 ) == 30.f );
+
+	REQUIRE( wrap.wrap( 35.f ) == 0 );
+
+	// The code point wider than the row still gets a row of its own
+	const std::vector<std::pair<size_t, size_t>> rows = { { 0, 3 }, { 3, 5 }, { 5, 7 }, { 7, 8 }, { 8, 9 } };
+	REQUIRE( get_rows( wrap ) == rows );
+	REQUIRE( wrap.get_row( 100 ) == std::make_pair<size_t, size_t>( 9, 9 ) );
+
+	REQUIRE( wrap.get_row_of( 0 ) == 0 );
+	REQUIRE( wrap.get_row_of( 3 ) == 1 );
+	REQUIRE( wrap.get_row_of( 6 ) == 2 );
+	REQUIRE( wrap.get_row_of( 9 ) == 4 );
+
+	// Wider rows fit more, a row is exactly full at the limit
+	wrap.wrap( 50.f );
+	REQUIRE( get_rows( wrap ) == get_full_rows( widths, 50.f ) );
+	REQUIRE( wrap.get_row( 0 ) == std::make_pair<size_t, size_t>( 0, 5 ) );
+
+	// An empty text has one empty row
+	TextWrap empty;
+	empty.measure( 0, get_width_of( widths ) );
+	empty.wrap( 10.f );
+	REQUIRE( empty.get_row_count() == 1 );
+	REQUIRE( empty.get_row( 0 ) == std::make_pair<size_t, size_t>( 0, 0 ) );
+	REQUIRE( empty.get_row_of( 0 ) == 0 );
+}
+
+
+
+TEST_CASE( "Wrapped text measures and wraps only the edited part again" )
+{
+	std::vector<float> widths( 100, 10.f );
+
+	TextWrap wrap;
+	wrap.measure( widths.size(), get_width_of( widths ) );
+	wrap.wrap( 95.f );
+	REQUIRE( wrap.get_row_count() == 12 );
+
+	// Widening a code point of row 5 pushes the rest of the text forward
+	widths[52] = 30.f;
+	size_t calls = 0;
+	wrap.measure( widths.size(), [&]( size_t i ) { calls++; return widths[i]; }, 52 );
+	REQUIRE( calls == 48 );
+
+	const auto first_changed_row = wrap.wrap( 95.f, 52 );
+	REQUIRE( first_changed_row == 5 );
+	REQUIRE( get_rows( wrap ) == get_full_rows( widths, 95.f ) );
+	REQUIRE( wrap.get_row( 5 ) == std::make_pair<size_t, size_t>( 45, 52 ) );
+
+	// The row before the edit is wrapped again when the edit starts a row,
+	// a narrower first code point may fit at its end
+	widths.erase( widths.begin() + 52 );
+	wrap.measure( widths.size(), get_width_of( widths ), 52 );
+	REQUIRE( wrap.wrap( 95.f, 52 ) == 5 );
+	REQUIRE( get_rows( wrap ) == get_full_rows( widths, 95.f ) );
+
+	// Another width wraps all of the rows
+	REQUIRE( wrap.wrap( 200.f, 90 ) == 0 );
+	REQUIRE( get_rows( wrap ) == get_full_rows( widths, 200.f ) );
+}
+
+
+
+TEST_CASE( "Random edits of wrapped text match wrapping the text again" )
+{
+	std::mt19937 random( 1 );
+	auto widths = make_random_widths( random, 500 );
+
+	TextWrap wrap;
+	wrap.measure( widths.size(), get_width_of( widths ) );
+	wrap.wrap( 80.f );
+
+	for( int edit = 0; edit < 500; edit++ )
+	{
+		std::uniform_int_distribution<size_t> offset( 0, widths.size() );
+		std::uniform_int_distribution<size_t> count( 0, 30 );
+		const auto at = offset( random );
+		if( random() % 2 && at < widths.size() )
+		{
+			const auto last = std::min( at + count( random ), widths.size() );
+			widths.erase( widths.begin() + at, widths.begin() + last );
+		}
+		else
+		{
+			const auto added = make_random_widths( random, count( random ) );
+			widths.insert( widths.begin() + at, added.begin(), added.end() );
+		}
+
+		const auto before = get_rows( wrap );
+		const auto max_width = edit % 50 == 0 ? 40.f + edit % 7 * 10.f : 80.f - edit / 50 % 2 * 20.f;
+		wrap.measure( widths.size(), get_width_of( widths ), at );
+		const auto first_changed_row = wrap.wrap( max_width, at );
+
+		const auto expected = get_full_rows( widths, max_width );
+		REQUIRE( get_rows( wrap ) == expected );
+		REQUIRE( wrap.get_advance( widths.size() ) == wrap.get_width( 0, widths.size() ) );
+
+		// The rows before the first changed one are the same as before the edit
+		REQUIRE( first_changed_row <= before.size() );
+		for( size_t row = 0; row < first_changed_row; row++ )
+		{
+			REQUIRE( before[row] == expected[row] );
+		}
+	}
+}
+
+
+
+TEST_CASE( "Text wrapping speed", "[.][benchmark]" )
+{
+	using seconds = std::chrono::duration<double>;
+
+	std::mt19937 random( 1 );
+	auto widths = make_random_widths( random, 1024 * 1024 );
+
+	TextWrap wrap;
+	auto start = std::chrono::steady_clock::now();
+	wrap.measure( widths.size(), get_width_of( widths ) );
+	wrap.wrap( 800.f );
+	const seconds full_time = std::chrono::steady_clock::now() - start;
+
+	// Typing near the end of the line
+	const int edit_count = 10000;
+	start = std::chrono::steady_clock::now();
+	for( int i = 0; i < edit_count; i++ )
+	{
+		const auto at = widths.size() - 1000;
+		widths.insert( widths.begin() + at, 7.f );
+		wrap.measure( widths.size(), get_width_of( widths ), at );
+		wrap.wrap( 800.f, at );
+	}
+	const seconds edit_time = std::chrono::steady_clock::now() - start;
+
+	REQUIRE( wrap.get_row( wrap.get_row_count() - 1 ).second == widths.size() );
+
+	std::wcout << "Wrapped " << widths.size() << " code points to " << wrap.get_row_count() << " rows\n"
+	           << "  full: " << full_time.count() * 1000.0 << " ms\n"
+	           << "  edit: " << edit_time.count() * 1e6 / edit_count << " us\n";
+}
@@ -0,0 +1,164 @@
+#include "../src/utf8.hh"
+
+#include <catch.hpp>
+#include <chrono>
+#include <iostream>
+
+namespace
+{
+	// Mostly ASCII with some two, three and four byte sequences mixed in
+	std::string make_test_text( size_t size )
+	{
+		const std::string words[] = {
+			"Lorem ipsum dolor sit amet ", "\xc3\xa4\xc3\xb6 ", "\xe5\xad\x90\xe7\x8c\xab ",
+			"consectetur adipiscing elit ", "\xf0\x9f\x98\x80 ", "\n"
+		};
+
+		std::string text;
+		for( size_t i = 0; text.size() < size; i++ )
+		{
+			text += words[(i * 7) % 6];
+		}
+
+		return text;
+	}
+
+
+
+	template<typename Function>
+	double measure_mb_per_s( size_t bytes, Function function )
+	{
+		const int rounds = 20;
+
+		const auto start = std::chrono::steady_clock::now();
+		for( int i = 0; i < rounds; i++ )
+		{
+			function();
+		}
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		return bytes * rounds / elapsed.count() / (1024 * 1024);
+	}
+}
+
+
+
+TEST_CASE( "UTF-8 conversions match the scalar versions" )
+{
+	const std::string invalid[] = {
+		"\xc0\xaf", "\xed\xa0\x80", "\xf4\x90\x80\x80", "\xe2\x82", "\xc3\xa4\xa4", "\x80\x80" "abc", "\xff",
+		"A\x80" "B", "A\x80\x80\xc3\xa4", std::string( 40, 'a' ) + "\x80" + std::string( 40, 'b' ) + "\xbf\xbf"
+	};
+
+	for( const auto &text : invalid )
+	{
+		std::vector<uint32_t> decoded, scalar_decoded;
+		utf8::decode( text.data(), text.data() + text.size(), decoded );
+		utf8::scalar::decode( text.data(), text.data() + text.size(), scalar_decoded );
+
+		REQUIRE( decoded == scalar_decoded );
+		REQUIRE( decoded.size() == utf8::count_code_points( text.data(), text.data() + text.size() ) );
+		REQUIRE( decoded.size() == utf8::scalar::count_code_points( text.data(), text.data() + text.size() ) );
+	}
+
+	// Stray continuation bytes are replaced one by one, the text around them stays
+	std::vector<uint32_t> decoded;
+	const std::string stray = "A\x80" "B\n\xbf\xbf";
+	utf8::decode( stray.data(), stray.data() + stray.size(), decoded );
+	REQUIRE( decoded == std::vector<uint32_t>{ 'A', utf8::replacement_character, 'B', '\n', utf8::replacement_character, utf8::replacement_character } );
+
+	decoded.clear();
+	const std::string leading = "\x80\x80" "abc";
+	utf8::decode( leading.data(), leading.data() + leading.size(), decoded );
+	REQUIRE( decoded == std::vector<uint32_t>{ utf8::replacement_character, utf8::replacement_character, 'a', 'b', 'c' } );
+
+	// Long enough for the vector loops, with the sequences at every alignment
+	auto text = make_test_text( 4096 );
+	for( size_t offset = 0; offset < 33; offset++ )
+	{
+		const auto first = text.data() + offset;
+		const auto last = text.data() + text.size();
+
+		std::vector<uint32_t> decoded, scalar_decoded;
+		utf8::decode( first, last, decoded );
+		utf8::scalar::decode( first, last, scalar_decoded );
+		REQUIRE( decoded == scalar_decoded );
+		REQUIRE( utf8::count_code_points( first, last ) == utf8::scalar::count_code_points( first, last ) );
+
+		REQUIRE( decoded.size() == utf8::count_code_points( first, last ) );
+
+		// Continuation bytes at the start are replaced by the decoder
+		size_t stray_count = 0;
+		while( (first[stray_count] & 0xc0) == 0x80 )
+		{
+			REQUIRE( decoded[stray_count] == utf8::replacement_character );
+			stray_count++;
+		}
+
+		std::string encoded;
+		utf8::encode( decoded.data() + stray_count, decoded.data() + decoded.size(), encoded );
+		REQUIRE( encoded == std::string( first + stray_count, last ) );
+	}
+
+	// Runs of stray continuation bytes at every alignment, some crossing the blocks
+	std::string strays;
+	for( size_t i = 0; strays.size() < 4096; i++ )
+	{
+		strays += std::string( i % 40, 'a' ) + std::string( 1 + i % 35, '\x80' ) + "\xc3\xa4";
+	}
+
+	for( size_t offset = 0; offset < 33; offset++ )
+	{
+		const auto first = strays.data() + offset;
+		const auto last = strays.data() + strays.size();
+
+		std::vector<uint32_t> decoded, scalar_decoded;
+		utf8::decode( first, last, decoded );
+		utf8::scalar::decode( first, last, scalar_decoded );
+		REQUIRE( decoded == scalar_decoded );
+		REQUIRE( decoded.size() == utf8::count_code_points( first, last ) );
+		REQUIRE( decoded.size() == utf8::scalar::count_code_points( first, last ) );
+	}
+}
+
+
+
+TEST_CASE( "UTF-8 conversion speed", "[.][benchmark]" )
+{
+	const auto text = make_test_text( 16 * 1024 * 1024 );
+	const auto first = text.data();
+	const auto last = text.data() + text.size();
+
+	std::vector<uint32_t> code_points;
+	std::string encoded;
+
+	const auto decode_speed = measure_mb_per_s( text.size(), [&]{
+		code_points.clear();
+		utf8::decode( first, last, code_points );
+	} );
+	const auto scalar_decode_speed = measure_mb_per_s( text.size(), [&]{
+		code_points.clear();
+		utf8::scalar::decode( first, last, code_points );
+	} );
+	const auto encode_speed = measure_mb_per_s( text.size(), [&]{
+		encoded.clear();
+		utf8::encode( code_points.data(), code_points.data() + code_points.size(), encoded );
+	} );
+	const auto scalar_encode_speed = measure_mb_per_s( text.size(), [&]{
+		encoded.clear();
+		utf8::scalar::encode( code_points.data(), code_points.data() + code_points.size(), encoded );
+	} );
+
+	size_t count = 0;
+	const auto count_speed = measure_mb_per_s( text.size(), [&]{
+		count = utf8::count_code_points( first, last );
+	} );
+
+	REQUIRE( encoded == text );
+	REQUIRE( count == code_points.size() );
+
+	std::wcout << "UTF-8 (" << utf8::get_implementation_name() << ") MB/s\n"
+	           << "  decode: " << decode_speed << " (scalar " << scalar_decode_speed << ")\n"
+	           << "  encode: " << encode_speed << " (scalar " << scalar_encode_speed << ")\n"
+	           << "  count:  " << count_speed << "\n";
+}
@@ -0,0 +1,355 @@
+#include "../src/vector_img_autosave.hh"
+#include "../src/vector_img_history.hh"
+#include "vector_img_test_helpers.hh"
+
+#include <catch.hpp>
+#include <chrono>
+#include <random>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+using namespace vector_img;
+using namespace vector_img_tests;
+
+namespace
+{
+	const std::string autosave_path = "autosave_test.vdr";
+
+
+
+	// Coordinates of the items in their drawing order
+	std::vector<float> get_coordinates( const ImgLayer &layer )
+	{
+		std::vector<float> coordinates;
+		const auto &points = layer.control_points;
+		for( size_t i = 0; i < points.size(); i++ )
+		{
+			if( !points.is_removed( i ) )
+			{
+				coordinates.insert( coordinates.end(), { points.x[i], points.y[i] } );
+			}
+		}
+
+		const auto &lines = layer.lines;
+		for( size_t i = 0; i < lines.size(); i++ )
+		{
+			if( !lines.is_removed( i ) )
+			{
+				coordinates.insert( coordinates.end(), { lines.ax[i], lines.ay[i], lines.bx[i], lines.by[i], lines.width[i] } );
+			}
+		}
+
+		const auto &fills = layer.fills;
+		for( size_t i = 0; i < fills.size(); i++ )
+		{
+			if( !fills.is_removed( i ) )
+			{
+				coordinates.insert( coordinates.end(), { fills.x[i], fills.y[i] } );
+				for( const auto &point : fills.path[i].points )
+				{
+					coordinates.insert( coordinates.end(), { point.x, point.y } );
+				}
+			}
+		}
+
+		return coordinates;
+	}
+
+
+
+	bool is_same_image( const VectorImg &a, const VectorImg &b )
+	{
+		if( a.img_w != b.img_w || a.img_h != b.img_h || a.layers.size() != b.layers.size() )
+		{
+			return false;
+		}
+
+		for( size_t i = 0; i < a.layers.size(); i++ )
+		{
+			if( get_coordinates( *a.layers[i] ) != get_coordinates( *b.layers[i] ) )
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+
+
+	VectorImg recover()
+	{
+		VectorImg image;
+		REQUIRE( ImgAutosave::recover( autosave_path, image ) );
+		return image;
+	}
+}
+
+
+
+TEST_CASE( "Autosave recovers the image from the document and the journal" )
+{
+	ImgAutosave::remove_files( autosave_path );
+	VectorImg empty;
+	REQUIRE_FALSE( ImgAutosave::recover( autosave_path, empty ) );
+
+	VectorImg image;
+	image.img_w = 640;
+	image.img_h = 480;
+	image.layers.emplace_back( new ImgLayer() );
+	auto &layer = *image.layers[0];
+	const auto point = layer.add_control_point( 1.f, 2.f );
+	const auto line = layer.add_line( 0.f, 0.f, 10.f, 10.f, 2.f );
+	const auto fill = layer.add_fill( 5.f, 5.f, make_square( 4.f ) );
+	layer.add_line( 20.f, 20.f, 30.f, 30.f, 1.f );
+
+	{
+		ImgAutosave autosave( autosave_path, 1024 * 1024 );
+		autosave.snapshot( image );
+		autosave.flush();
+		REQUIRE( autosave.get_error().empty() );
+		REQUIRE( autosave.get_compaction_count() == 1 );
+		REQUIRE( is_same_image( recover(), image ) );
+
+		// Moved, removed, new and reordered items go to the journal
+		layer.move_item( point, 3.f, 0.f );
+		layer.remove( line );
+		layer.add_line( 40.f, 40.f, 50.f, 50.f, 3.f );
+		layer.fills.path[layer.get_index( fill )].points[2].x = 8.f;
+		layer.item_changed( fill );
+		autosave.snapshot( image );
+
+		const auto raised = layer.add_control_point( 7.f, 7.f );
+		layer.add_control_point( 8.f, 8.f );
+		layer.bring_to_front( raised );
+		image.layers.emplace_back( new ImgLayer() );
+		image.layers[1]->add_fill( 0.f, 0.f, make_square( 1.f ) );
+		autosave.snapshot( image );
+
+		// Nothing changed, nothing is queued
+		autosave.snapshot( image );
+		autosave.flush();
+		REQUIRE( autosave.get_error().empty() );
+		REQUIRE( autosave.get_compaction_count() == 1 );
+		REQUIRE( is_same_image( recover(), image ) );
+
+		// Changes of a whole layer write the layer again
+		layer.translate( 1.f, 1.f );
+		autosave.snapshot( image );
+	}
+
+	REQUIRE( is_same_image( recover(), image ) );
+
+	// Moved aside, the autosave can still be recovered
+	const auto previous_path = autosave_path + ".previous";
+	ImgAutosave::move_files( autosave_path, previous_path );
+	VectorImg moved;
+	REQUIRE_FALSE( ImgAutosave::recover( autosave_path, moved ) );
+	REQUIRE( ImgAutosave::recover( previous_path, moved ) );
+	REQUIRE( is_same_image( moved, image ) );
+
+	ImgAutosave::remove_files( previous_path );
+	ImgAutosave::remove_files( autosave_path );
+}
+
+
+
+TEST_CASE( "Autosave compacts the journal and drops a broken end" )
+{
+	ImgAutosave::remove_files( autosave_path );
+
+	VectorImg image;
+	image.layers.emplace_back( new ImgLayer() );
+	auto &layer = *image.layers[0];
+	const auto first = layer.add_line( 0.f, 0.f, 10.f, 10.f, 2.f );
+	layer.add_control_point( 1.f, 1.f );
+
+	ImgAutosave autosave( autosave_path, 512 );
+	autosave.snapshot( image );
+
+	// The large fill doesn't fit in the journal, the items are
+	// found by their slots again in the new document
+	ImgPath path;
+	for( int i = 0; i < 100; i++ )
+	{
+		path.points.push_back( { static_cast<float>( i ), static_cast<float>( i % 2 ) } );
+	}
+	path.contour_ends.push_back( 100 );
+	layer.add_fill( 0.f, 0.f, path );
+	autosave.snapshot( image );
+	autosave.flush();
+	REQUIRE( autosave.get_compaction_count() == 2 );
+
+	layer.move_item( first, 5.f, 5.f );
+	autosave.snapshot( image );
+	autosave.flush();
+	REQUIRE( autosave.get_compaction_count() == 2 );
+	REQUIRE( is_same_image( recover(), image ) );
+
+	const auto before_last = get_coordinates( layer );
+	layer.add_control_point( 2.f, 2.f );
+	autosave.snapshot( image );
+	autosave.flush();
+	REQUIRE( autosave.get_compaction_count() == 2 );
+	REQUIRE( is_same_image( recover(), image ) );
+
+	// A crash while appending leaves a batch cut short
+	const auto journal_path = autosave_path + ".journal";
+	std::vector<char> journal;
+	{
+		std::ifstream stream( journal_path, std::ios::binary );
+		journal.assign( std::istreambuf_iterator<char>( stream ), std::istreambuf_iterator<char>() );
+	}
+	{
+		std::ofstream stream( journal_path, std::ios::binary | std::ios::trunc );
+		stream.write( journal.data(), journal.size() - 3 );
+	}
+	REQUIRE( get_coordinates( *recover().layers[0] ) == before_last );
+
+	ImgAutosave::remove_files( autosave_path );
+}
+
+
+
+TEST_CASE( "Autosave writes the layers that changed as a whole on its thread" )
+{
+	ImgAutosave::remove_files( autosave_path );
+
+	// Enough items for many chunks, with removed ones in between
+	VectorImg image;
+	image.img_w = 100;
+	image.img_h = 100;
+	image.layers.emplace_back( new ImgLayer() );
+	auto &layer = *image.layers[0];
+	std::vector<ImgItemHandle> handles;
+	for( int i = 0; i < 10000; i++ )
+	{
+		const auto x = static_cast<float>( i % 100 );
+		const auto y = static_cast<float>( i / 100 );
+		handles.push_back( layer.add_line( x, y, x + 1.f, y, 1.f, ImgLayer::default_color, ImgLineStyle{ ROUND_CAP, BEVEL_JOIN } ) );
+		if( i % 1000 == 0 )
+		{
+			handles.push_back( layer.add_fill( x, y, make_square( 2.f ) ) );
+			handles.push_back( layer.add_control_point( x, y ) );
+		}
+	}
+	for( size_t i = 0; i < handles.size(); i += 7 )
+	{
+		layer.remove( handles[i] );
+	}
+
+	ImgHistory history;
+	history.reset( image );
+	{
+		ImgAutosave autosave( autosave_path );
+		autosave.snapshot( image );
+
+		layer.translate( 2.f, 3.f );
+		history.commit( image );
+		autosave.snapshot( image );
+		autosave.flush();
+		REQUIRE( autosave.get_error().empty() );
+		REQUIRE( is_same_image( recover(), image ) );
+
+		// Changes after the layer was written whole find the items by their slots
+		layer.move_item( handles[1], 5.f, 5.f );
+		layer.remove( handles[2] );
+		layer.add_control_point( 50.f, 50.f );
+		autosave.snapshot( image );
+
+		// Undoing changes the layer as a whole, so does replacing it
+		history.undo( image );
+		autosave.snapshot( image );
+		autosave.flush();
+		REQUIRE( is_same_image( recover(), image ) );
+
+		VectorImg copy;
+		copy.img_w = image.img_w;
+		copy.img_h = image.img_h;
+		copy.layers.emplace_back( new ImgLayer() );
+		copy.layers[0]->add_fill( 1.f, 1.f, make_square( 3.f ) );
+		copy.layers.emplace_back( std::move( image.layers[0] ) );
+		image = std::move( copy );
+		autosave.snapshot( image );
+		autosave.flush();
+		REQUIRE( autosave.get_error().empty() );
+		REQUIRE( is_same_image( recover(), image ) );
+
+		image.layers[1]->remove( handles[3] );
+		autosave.snapshot( image );
+	}
+
+	REQUIRE( is_same_image( recover(), image ) );
+	ImgAutosave::remove_files( autosave_path );
+}
+
+
+
+TEST_CASE( "Autosave snapshot speed", "[.][benchmark]" )
+{
+	using seconds = std::chrono::duration<double>;
+
+	ImgAutosave::remove_files( autosave_path );
+
+	std::mt19937 random( 1 );
+	std::uniform_real_distribution<float> position( 0.f, 4000.f );
+	VectorImg image;
+	image.img_w = 4000;
+	image.img_h = 4000;
+	image.layers.emplace_back( new ImgLayer() );
+	auto &layer = *image.layers[0];
+	std::vector<ImgItemHandle> handles;
+	for( int i = 0; i < 200000; i++ )
+	{
+		handles.push_back( layer.add_line( position( random ), position( random ), position( random ), position( random ), 1.f ) );
+	}
+
+	ImgAutosave autosave( autosave_path );
+	auto start = std::chrono::steady_clock::now();
+	autosave.snapshot( image );
+	const seconds full_time = std::chrono::steady_clock::now() - start;
+	autosave.flush();
+	const seconds compaction_time = std::chrono::steady_clock::now() - start;
+
+	// A frame of dragging a few items
+	seconds edit_time( 0.0 );
+	for( int frame = 0; frame < 100; frame++ )
+	{
+		for( int i = 0; i < 10; i++ )
+		{
+			layer.move_item( handles[frame * 10 + i], 1.f, 1.f );
+		}
+		start = std::chrono::steady_clock::now();
+		autosave.snapshot( image );
+		edit_time += std::chrono::steady_clock::now() - start;
+	}
+
+	start = std::chrono::steady_clock::now();
+	autosave.snapshot( image );
+	const seconds unchanged_time = std::chrono::steady_clock::now() - start;
+
+	// The layer is handed to the thread as a whole
+	layer.translate( 1.f, 1.f );
+	start = std::chrono::steady_clock::now();
+	autosave.snapshot( image );
+	const seconds translated_time = std::chrono::steady_clock::now() - start;
+	autosave.flush();
+	REQUIRE( autosave.get_error().empty() );
+
+	start = std::chrono::steady_clock::now();
+	VectorImg recovered;
+	ImgAutosave::recover( autosave_path, recovered );
+	const seconds recover_time = std::chrono::steady_clock::now() - start;
+	REQUIRE( is_same_image( recovered, image ) );
+
+	std::wcout << "Autosaved 200000 lines\n"
+	           << "  first snapshot:           " << full_time.count() * 1000.0 << " ms\n"
+	           << "  first document, threaded: " << compaction_time.count() * 1000.0 << " ms\n"
+	           << "  snapshot of 10 moves:     " << edit_time.count() * 1000.0 / 100 << " ms\n"
+	           << "  unchanged snapshot:       " << unchanged_time.count() * 1000.0 << " ms\n"
+	           << "  snapshot of a translate:  " << translated_time.count() * 1000.0 << " ms\n"
+	           << "  recovering:               " << recover_time.count() * 1000.0 << " ms\n";
+
+	ImgAutosave::remove_files( autosave_path );
+}
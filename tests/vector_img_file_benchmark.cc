@@ -0,0 +1,350 @@
+#include "../src/vector_img_file.hh"
+
+#include <catch.hpp>
+#include <chrono>
+#include <random>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace vector_img;
+
+namespace
+{
+	const std::string document_path = "file_test.vdr";
+
+
+
+	// Random items over the area, a removed item every tenth
+	VectorImg make_test_image( size_t item_count, float size )
+	{
+		VectorImg image;
+		image.img_w = static_cast<size_t>( size );
+		image.img_h = static_cast<size_t>( size );
+		image.layers.emplace_back( new ImgLayer() );
+		auto &layer = *image.layers.back();
+
+		std::mt19937 random( 1 );
+		std::uniform_real_distribution<float> position( 0.f, size );
+		std::uniform_real_distribution<float> offset( -30.f, 30.f );
+		std::uniform_real_distribution<float> width( 0.5f, 4.f );
+
+		for( size_t i = 0; i < item_count; i++ )
+		{
+			const auto x = position( random );
+			const auto y = position( random );
+			const Color color = { uint8_t( i ), uint8_t( i >> 8 ), 200, 180 };
+
+			ImgItemHandle handle;
+			if( i % 5 == 0 )
+			{
+				handle = layer.add_control_point( x, y, color );
+			}
+			else if( i % 5 == 1 )
+			{
+				ImgPath path;
+				path.points = { { 0.f, 0.f }, { offset( random ), 0.f }, { 0.f, offset( random ) } };
+				path.contour_ends = { 3 };
+				path.rule = i % 2 ? EVEN_ODD : NON_ZERO;
+				handle = layer.add_fill( x, y, path, color );
+			}
+			else
+			{
+				ImgLineStyle style;
+				style.cap = static_cast<ImgLineCap>( i % 3 );
+				handle = layer.add_line( x, y, x + offset( random ), y + offset( random ), width( random ), color, style );
+			}
+
+			if( i % 10 == 9 )
+			{
+				layer.remove( handle );
+			}
+		}
+
+		// Layers without items are kept
+		image.layers.emplace_back( new ImgLayer() );
+		return image;
+	}
+
+
+
+	std::vector<char> read_file( const std::string &path )
+	{
+		std::ifstream stream( path, std::ios::binary );
+		return std::vector<char>( std::istreambuf_iterator<char>( stream ), std::istreambuf_iterator<char>() );
+	}
+
+
+
+	void write_file( const std::string &path, const std::vector<char> &data )
+	{
+		std::ofstream stream( path, std::ios::binary | std::ios::trunc );
+		stream.write( data.data(), data.size() );
+	}
+
+
+
+	// Loaded layers have no removed items
+	void require_same_items( const ImgLayer &loaded, const ImgLayer &layer, float tolerance )
+	{
+		REQUIRE( loaded.size() == layer.size() );
+
+		const auto &points = layer.control_points;
+		for( size_t i = 0, j = 0; i < points.size(); i++ )
+		{
+			if( points.is_removed( i ) )
+			{
+				continue;
+			}
+			REQUIRE( loaded.control_points.x[j] == Approx( points.x[i] ).margin( tolerance ) );
+			REQUIRE( loaded.control_points.y[j] == Approx( points.y[i] ).margin( tolerance ) );
+			REQUIRE( loaded.control_points.color[j].r == points.color[i].r );
+			j++;
+		}
+
+		const auto &lines = layer.lines;
+		for( size_t i = 0, j = 0; i < lines.size(); i++ )
+		{
+			if( lines.is_removed( i ) )
+			{
+				continue;
+			}
+			REQUIRE( loaded.lines.ax[j] == Approx( lines.ax[i] ).margin( tolerance ) );
+			REQUIRE( loaded.lines.by[j] == Approx( lines.by[i] ).margin( tolerance ) );
+			REQUIRE( loaded.lines.width[j] == Approx( lines.width[i] ).margin( tolerance ) );
+			REQUIRE( loaded.lines.style[j].cap == lines.style[i].cap );
+			REQUIRE( loaded.lines.color[j].g == lines.color[i].g );
+			j++;
+		}
+
+		const auto &fills = layer.fills;
+		for( size_t i = 0, j = 0; i < fills.size(); i++ )
+		{
+			if( fills.is_removed( i ) )
+			{
+				continue;
+			}
+
+			// Path points are floats in all the files
+			REQUIRE( loaded.fills.x[j] == Approx( fills.x[i] ).margin( tolerance ) );
+			REQUIRE( loaded.fills.y[j] == Approx( fills.y[i] ).margin( tolerance ) );
+			REQUIRE( loaded.fills.path[j].rule == fills.path[i].rule );
+			REQUIRE( loaded.fills.path[j].contour_ends == fills.path[i].contour_ends );
+			REQUIRE( loaded.fills.path[j].points[1].x == fills.path[i].points[1].x );
+			REQUIRE( loaded.fills.path[j].points[2].y == fills.path[i].points[2].y );
+			j++;
+		}
+	}
+
+
+
+	void sort_indices( ImgLayerIndices &indices )
+	{
+		std::sort( indices.control_points.begin(), indices.control_points.end() );
+		std::sort( indices.lines.begin(), indices.lines.end() );
+		std::sort( indices.fills.begin(), indices.fills.end() );
+	}
+}
+
+
+
+TEST_CASE( "Saved documents load as they were saved" )
+{
+	const auto image = make_test_image( 1000, 1000.f );
+	const auto &layer = *image.layers[0];
+
+	for( const auto quantize : { false, true } )
+	{
+		ImgSaveOptions options;
+		options.quantize = quantize;
+		save_document( image, document_path, options );
+
+		const ImgDocument document( document_path );
+		REQUIRE( document.get_width() == 1000 );
+		REQUIRE( document.get_height() == 1000 );
+		REQUIRE( document.is_quantized() == quantize );
+		REQUIRE_FALSE( document.is_packed() );
+		REQUIRE( document.verify() );
+		REQUIRE( document.get_layer_count() == 2 );
+		REQUIRE( document.get_layer( 1 ).get_line_count() == 0 );
+
+		// Quantized coordinates are within half a step, about 1000 / 65535 / 2
+		const auto tolerance = quantize ? 0.01f : 0.f;
+		VectorImg loaded;
+		document.load( loaded );
+		REQUIRE( loaded.img_w == 1000 );
+		REQUIRE( loaded.layers.size() == 2 );
+		REQUIRE( loaded.layers[1]->size() == 0 );
+		require_same_items( *loaded.layers[0], layer, tolerance );
+
+		// The records read one by one match the loaded items
+		const auto &document_layer = document.get_layer( 0 );
+		REQUIRE( document_layer.get_control_point_count() == loaded.layers[0]->control_points.size() );
+		REQUIRE( document_layer.get_line( 7 ).bx == loaded.layers[0]->lines.bx[7] );
+		const auto fill = document_layer.get_fill( 3 );
+		REQUIRE( fill.x == loaded.layers[0]->fills.x[3] );
+		REQUIRE( document_layer.get_fill_path( fill ).points.size() == 3 );
+
+		// Searching the records finds what the index of the loaded layer finds
+		std::mt19937 random( 2 );
+		std::uniform_real_distribution<float> position( -50.f, 1050.f );
+		for( int i = 0; i < 20; i++ )
+		{
+			const auto x = position( random );
+			const auto y = position( random );
+			const ImgBounds area = { x, y, x + 100.f, y + 50.f };
+
+			ImgLayerIndices found;
+			ImgLayerIndices expected;
+			document_layer.find_items_in( area, found );
+			loaded.layers[0]->find_visible( area, expected );
+			sort_indices( found );
+			sort_indices( expected );
+			REQUIRE( found.control_points == expected.control_points );
+			REQUIRE( found.lines == expected.lines );
+			REQUIRE( found.fills == expected.fills );
+		}
+
+		const auto &bounds = document_layer.get_bounds();
+		REQUIRE( bounds.min_x <= 0.f + 30.f );
+		REQUIRE( bounds.max_x >= 1000.f - 30.f );
+	}
+
+	std::remove( document_path.c_str() );
+}
+
+
+
+TEST_CASE( "Quantized documents keep the widths of thin lines" )
+{
+	// The steps of a layer 200000 units wide are about 3 units
+	VectorImg image;
+	image.img_w = 200000;
+	image.img_h = 1000;
+	image.layers.emplace_back( new ImgLayer() );
+	auto &layer = *image.layers[0];
+	const std::vector<float> widths = { 1.f, 0.001f, 0.5f, 1.5f, 3.25f, 1000.f, 1e-9f };
+	for( size_t i = 0; i < widths.size(); i++ )
+	{
+		const auto x = i * 30000.f;
+		layer.add_line( x, 10.f, x + 10.f, 10.f, widths[i] );
+	}
+
+	ImgSaveOptions options;
+	options.quantize = true;
+	save_document( image, document_path, options );
+
+	const ImgDocument document( document_path );
+	REQUIRE( document.is_quantized() );
+	VectorImg loaded;
+	document.load( loaded );
+
+	// Widths are half floats, precise to about a part in two thousand
+	const auto &lines = loaded.layers[0]->lines;
+	REQUIRE( lines.size() == widths.size() );
+	for( size_t i = 0; i + 1 < widths.size(); i++ )
+	{
+		REQUIRE( lines.width[i] == Approx( widths[i] ).epsilon( 0.001 ) );
+		REQUIRE( document.get_layer( 0 ).get_line( i ).width == lines.width[i] );
+	}
+
+	// Even the thinnest lines keep a width
+	REQUIRE( lines.width.back() > 0.f );
+
+	// Wider than the half floats reach is the widest they reach
+	layer.add_line( 0.f, 0.f, 1.f, 1.f, 1e6f );
+	save_document( image, document_path, options );
+	ImgDocument( document_path ).load( loaded );
+	REQUIRE( loaded.layers[0]->lines.width.back() == 65504.f );
+
+	std::remove( document_path.c_str() );
+}
+
+
+
+TEST_CASE( "Damaged documents are found out" )
+{
+	const auto image = make_test_image( 100, 100.f );
+	save_document( image, document_path );
+	REQUIRE( is_document( document_path ) );
+	const auto data = read_file( document_path );
+
+	// A damaged section opens, but doesn't verify
+	auto damaged = data;
+	damaged[sizeof( file_format::Header ) + 5] ^= 1;
+	write_file( document_path, damaged );
+	{
+		const ImgDocument document( document_path );
+		REQUIRE_FALSE( document.verify() );
+		REQUIRE_FALSE( document.get_layer( 0 ).verify() );
+		REQUIRE( document.get_layer( 1 ).verify() );
+	}
+
+	// A damaged layer table, a cut file and other files don't open
+	damaged = data;
+	damaged[damaged.size() - 10] ^= 1;
+	write_file( document_path, damaged );
+	REQUIRE_THROWS_AS( ImgDocument( document_path ), std::runtime_error );
+
+	for( const auto size : { data.size() - 1, data.size() / 2, size_t( 10 ), size_t( 0 ) } )
+	{
+		write_file( document_path, std::vector<char>( data.begin(), data.begin() + size ) );
+		REQUIRE_THROWS_AS( ImgDocument( document_path ), std::runtime_error );
+	}
+
+	write_file( document_path, std::vector<char>( 64, 'x' ) );
+	REQUIRE_FALSE( is_document( document_path ) );
+	REQUIRE_THROWS_AS( ImgDocument( document_path ), std::runtime_error );
+
+	std::remove( document_path.c_str() );
+	REQUIRE_FALSE( is_document( document_path ) );
+	REQUIRE_THROWS_AS( ImgDocument( document_path ), std::runtime_error );
+}
+
+
+
+TEST_CASE( "Document saving and loading speed", "[.][benchmark]" )
+{
+	using seconds = std::chrono::duration<double>;
+
+	const size_t item_count = 1000000;
+	const auto image = make_test_image( item_count, 4000.f );
+
+	for( const auto quantize : { false, true } )
+	{
+		ImgSaveOptions options;
+		options.quantize = quantize;
+
+		auto start = std::chrono::steady_clock::now();
+		save_document( image, document_path, options );
+		const seconds save_time = std::chrono::steady_clock::now() - start;
+
+		start = std::chrono::steady_clock::now();
+		const ImgDocument document( document_path );
+		const seconds open_time = std::chrono::steady_clock::now() - start;
+
+		start = std::chrono::steady_clock::now();
+		ImgLayerIndices found;
+		document.get_layer( 0 ).find_items_in( { 1000.f, 1000.f, 1100.f, 1100.f }, found );
+		const seconds find_time = std::chrono::steady_clock::now() - start;
+
+		start = std::chrono::steady_clock::now();
+		VectorImg loaded;
+		document.load( loaded );
+		const seconds load_time = std::chrono::steady_clock::now() - start;
+
+		REQUIRE( loaded.layers[0]->size() == image.layers[0]->size() );
+
+		std::wcout << (quantize ? "Quantized" : "Plain") << " document of " << item_count << " items, "
+		           << read_file( document_path ).size() / 1024 << " KiB\n"
+		           << "  save:          " << save_time.count() * 1000.0 << " ms\n"
+		           << "  open:          " << open_time.count() * 1000.0 << " ms\n"
+		           << "  find in area:  " << find_time.count() * 1000.0 << " ms\n"
+		           << "  load:          " << load_time.count() * 1000.0 << " ms\n";
+	}
+
+	std::remove( document_path.c_str() );
+}
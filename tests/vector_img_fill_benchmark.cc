@@ -0,0 +1,216 @@
+#include "../src/vector_img_fill.hh"
+#include "vector_img_test_helpers.hh"
+
+#include <catch.hpp>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <numeric>
+#include <iostream>
+
+using namespace vector_img;
+using namespace vector_img_tests;
+
+namespace
+{
+	bool is_in_triangles( const std::vector<ImgPoint> &triangles, float x, float y )
+	{
+		for( size_t i = 0; i + 2 < triangles.size(); i += 3 )
+		{
+			const auto &a = triangles[i];
+			const auto &b = triangles[i + 1];
+			const auto &c = triangles[i + 2];
+			const auto ab = (b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x);
+			const auto bc = (c.x - b.x) * (y - b.y) - (c.y - b.y) * (x - b.x);
+			const auto ca = (a.x - c.x) * (y - c.y) - (a.y - c.y) * (x - c.x);
+			if( (ab >= 0.f && bc >= 0.f && ca >= 0.f) || (ab <= 0.f && bc <= 0.f && ca <= 0.f) )
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+
+
+	void add_rectangle( ImgPath &path, float x, float y, float w, float h, bool clockwise )
+	{
+		if( clockwise )
+		{
+			path.points.insert( path.points.end(), { { x, y }, { x + w, y }, { x + w, y + h }, { x, y + h } } );
+		}
+		else
+		{
+			path.points.insert( path.points.end(), { { x, y }, { x, y + h }, { x + w, y + h }, { x + w, y } } );
+		}
+		path.contour_ends.push_back( static_cast<uint32_t>( path.points.size() ) );
+	}
+
+
+
+	float get_path_area( const ImgPath &path )
+	{
+		std::vector<ImgPoint> triangles;
+		tessellate_path( path, triangles );
+		return get_area( triangles );
+	}
+}
+
+
+
+TEST_CASE( "Paths are tessellated by their fill rule" )
+{
+	ImgPath path;
+	add_rectangle( path, 0.f, 0.f, 10.f, 10.f, true );
+	REQUIRE( get_path_area( path ) == Approx( 100.f ) );
+
+	// A hole going the other way is a hole by both rules
+	add_rectangle( path, 2.f, 2.f, 6.f, 6.f, false );
+	REQUIRE( get_path_area( path ) == Approx( 64.f ) );
+	path.rule = EVEN_ODD;
+	REQUIRE( get_path_area( path ) == Approx( 64.f ) );
+
+	// Going the same way, only by the even-odd rule
+	path.points.clear();
+	path.contour_ends.clear();
+	add_rectangle( path, 0.f, 0.f, 10.f, 10.f, true );
+	add_rectangle( path, 2.f, 2.f, 6.f, 6.f, true );
+	REQUIRE( get_path_area( path ) == Approx( 64.f ) );
+	path.rule = NON_ZERO;
+	REQUIRE( get_path_area( path ) == Approx( 100.f ) );
+
+	// Self intersecting polygons match ImgPath::contains()
+	std::mt19937 random( 1 );
+	std::uniform_real_distribution<float> position( 0.f, 100.f );
+	for( int polygon = 0; polygon < 20; polygon++ )
+	{
+		path.points.clear();
+		path.contour_ends.clear();
+		for( int i = 0; i < 12; i++ )
+		{
+			path.points.push_back( { position( random ), position( random ) } );
+		}
+		path.contour_ends.push_back( 12 );
+		path.rule = polygon % 2 ? EVEN_ODD : NON_ZERO;
+
+		std::vector<ImgPoint> triangles;
+		tessellate_path( path, triangles );
+
+		size_t mismatches = 0;
+		for( float y = 0.5f; y < 100.f; y += 1.f )
+		{
+			for( float x = 0.5f; x < 100.f; x += 1.f )
+			{
+				if( path.distance_to( x, y ) > 0.01f && path.contains( x, y ) != is_in_triangles( triangles, x, y ) )
+				{
+					mismatches++;
+				}
+			}
+		}
+		REQUIRE( mismatches == 0 );
+	}
+}
+
+
+
+TEST_CASE( "Fills are tessellated again only when their paths change" )
+{
+	ImgLayer layer;
+	ImgPath small;
+	add_rectangle( small, 0.f, 0.f, 10.f, 10.f, true );
+	const auto small_handle = layer.add_fill( 5.f, 5.f, small );
+
+	ImgPath large;
+	for( int i = 0; i < 100; i++ )
+	{
+		const auto angle = i * 0.0628318f;
+		large.points.push_back( { 50.f * std::cos( angle ), 50.f * std::sin( angle ) } );
+	}
+	large.contour_ends.push_back( 100 );
+	const auto large_handle = layer.add_fill( 100.f, 100.f, large );
+
+	std::vector<uint32_t> indices( layer.fills.size() );
+	std::iota( indices.begin(), indices.end(), 0 );
+
+	// The large fill goes to the threads
+	ImgFillCache cache( 50 );
+	cache.update( layer.fills, indices );
+	REQUIRE( cache.get_tessellated_count() == 2 );
+	REQUIRE( cache.get_triangles( layer.fills, 0 ).point_count > 0 );
+
+	REQUIRE( cache.get_changed_slots() == std::vector<uint32_t>{ small_handle.slot } );
+
+	// The triangles taken from the threads change the large fill
+	cache.wait();
+	cache.update( layer.fills, indices );
+	REQUIRE( cache.get_tessellated_count() == 0 );
+	REQUIRE( cache.get_changed_slots() == std::vector<uint32_t>{ large_handle.slot } );
+	REQUIRE( cache.get_triangles( layer.fills, 1 ).point_count > 0 );
+
+	layer.move_item( small_handle, 10.f, 0.f );
+	layer.move_item( large_handle, 10.f, 0.f );
+	cache.update( layer.fills, indices );
+	REQUIRE( cache.get_tessellated_count() == 0 );
+	REQUIRE( cache.get_changed_slots().empty() );
+
+	layer.fills.path[0].points[2].x = 20.f;
+	layer.item_changed( small_handle );
+	cache.update( layer.fills, indices );
+	REQUIRE( cache.get_tessellated_count() == 1 );
+
+	const auto triangles = cache.get_triangles( layer.fills, 0 );
+	REQUIRE( get_area( std::vector<ImgPoint>( triangles.points, triangles.points + triangles.point_count ) ) == Approx( 150.f ) );
+}
+
+
+
+TEST_CASE( "Tessellating fills speed", "[.][benchmark]" )
+{
+	using seconds = std::chrono::duration<double>;
+
+	// Imported map like outlines, wavy circles with a few holes
+	std::mt19937 random( 1 );
+	std::uniform_real_distribution<float> noise( 0.999f, 1.001f );
+	ImgLayer layer;
+	for( int fill = 0; fill < 8; fill++ )
+	{
+		ImgPath path;
+		for( int contour = 0; contour < 4; contour++ )
+		{
+			const auto radius = 1000.f / (contour + 1);
+			for( int i = 0; i < 25000; i++ )
+			{
+				const auto angle = i * (6.2831853f / 25000);
+				const auto wave = radius * (1.f + 0.05f * std::sin( angle * 37.f )) * noise( random );
+				path.points.push_back( { wave * std::cos( angle ), wave * std::sin( angle ) } );
+			}
+			path.contour_ends.push_back( static_cast<uint32_t>( path.points.size() ) );
+		}
+		path.rule = EVEN_ODD;
+		layer.add_fill( 0.f, 0.f, std::move( path ) );
+	}
+
+	std::vector<ImgPoint> triangles;
+	auto start = std::chrono::steady_clock::now();
+	tessellate_path( layer.fills.path[0], triangles );
+	const seconds tessellate_time = std::chrono::steady_clock::now() - start;
+
+	std::vector<uint32_t> indices( layer.fills.size() );
+	std::iota( indices.begin(), indices.end(), 0 );
+
+	ImgFillCache cache;
+	start = std::chrono::steady_clock::now();
+	cache.update( layer.fills, indices );
+	const seconds queue_time = std::chrono::steady_clock::now() - start;
+
+	cache.wait();
+	const seconds threaded_time = std::chrono::steady_clock::now() - start;
+	cache.update( layer.fills, indices );
+	REQUIRE( cache.get_triangles( layer.fills, 7 ).point_count > 0 );
+
+	std::wcout << "Tessellated fills of 100000 points\n"
+	           << "  one fill:          " << tessellate_time.count() * 1000.0 << " ms, " << triangles.size() / 3 << " triangles\n"
+	           << "  queueing 8 fills:  " << queue_time.count() * 1000.0 << " ms\n"
+	           << "  8 fills, threaded: " << threaded_time.count() * 1000.0 << " ms\n";
+}
@@ -0,0 +1,158 @@
+#include "../src/vector_img_history.hh"
+#include "vector_img_test_helpers.hh"
+
+#include <catch.hpp>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+
+using namespace vector_img;
+using namespace vector_img_tests;
+
+namespace
+{
+	// Handles of the items found in a few areas, for comparing the index
+	std::vector<uint32_t> find_test_items( const ImgLayer &layer )
+	{
+		std::vector<uint32_t> slots;
+		for( float position = 0.f; position < 2048.f; position += 256.f )
+		{
+			std::vector<ImgItemHandle> handles;
+			layer.find_items_in( ImgBounds{ position, position, position + 200.f, position + 100.f }, handles );
+			for( const auto handle : handles )
+			{
+				slots.push_back( handle.slot );
+			}
+		}
+
+		std::sort( slots.begin(), slots.end() );
+		return slots;
+	}
+}
+
+
+
+TEST_CASE( "Undoing and redoing restores the items and the index" )
+{
+	VectorImg image;
+	image.layers.emplace_back( new ImgLayer() );
+	auto &layer = *image.layers[0];
+	const auto handles = add_test_items( layer, 10000 );
+
+	ImgHistory history;
+	history.reset( image );
+	const auto items_before = find_test_items( layer );
+
+	layer.move_item( handles[1], 100.f, 100.f );
+	REQUIRE( history.commit( image ) );
+	const auto items_moved = find_test_items( layer );
+
+	// The moves of a drag become one step
+	for( int i = 0; i < 10; i++ )
+	{
+		layer.move_item( handles[2], 1.f, 0.f );
+		history.commit( image, i > 0 );
+	}
+	REQUIRE( history.get_step_count() == 3 );
+
+	for( size_t i = 0; i < handles.size(); i += 2 )
+	{
+		layer.remove( handles[i] );
+	}
+	REQUIRE( history.commit( image ) );
+	REQUIRE( !history.commit( image ) );
+	REQUIRE( layer.size() == 5000 );
+
+	// Undoing is a change like any other for what is cached of the layer
+	const auto version = layer.get_version();
+	REQUIRE( history.undo( image ) );
+	REQUIRE( layer.get_version() != version );
+	REQUIRE( layer.size() == 10000 );
+	REQUIRE( layer.contains( handles[0] ) );
+	REQUIRE( history.undo( image ) );
+	REQUIRE( find_test_items( layer ) == items_moved );
+	REQUIRE( history.undo( image ) );
+	REQUIRE( find_test_items( layer ) == items_before );
+	REQUIRE( !history.undo( image ) );
+
+	REQUIRE( history.redo( image ) );
+	REQUIRE( find_test_items( layer ) == items_moved );
+	REQUIRE( history.redo( image ) );
+	REQUIRE( history.redo( image ) );
+	REQUIRE( layer.size() == 5000 );
+	REQUIRE( !layer.contains( handles[0] ) );
+	REQUIRE( !history.redo( image ) );
+}
+
+
+
+TEST_CASE( "The oldest steps are dropped by the memory they take" )
+{
+	VectorImg image;
+	image.layers.emplace_back( new ImgLayer() );
+	auto &layer = *image.layers[0];
+	add_test_items( layer, 10000 );
+
+	// Moving every item keeps an index around each step
+	ImgHistory history;
+	history.reset( image );
+	for( int i = 0; i < 4; i++ )
+	{
+		layer.translate( 10.f, 0.f );
+		REQUIRE( history.commit( image ) );
+	}
+	REQUIRE( history.get_step_count() == 5 );
+
+	// The kept indices count as the memory of their steps,
+	// so only the steps over the limit are dropped
+	const auto memory_size = history.get_memory_size();
+	history.set_memory_limit( memory_size - 1 );
+	REQUIRE( history.get_step_count() == 4 );
+	REQUIRE( history.get_memory_size() <= memory_size - 1 );
+
+	history.set_memory_limit( memory_size * 3 / 4 );
+	REQUIRE( history.get_step_count() == 3 );
+	REQUIRE( history.get_memory_size() <= memory_size * 3 / 4 );
+
+	history.set_memory_limit( 0 );
+	REQUIRE( history.get_step_count() == 1 );
+	REQUIRE_FALSE( history.can_undo() );
+}
+
+
+
+TEST_CASE( "Undoing bulk changes speed", "[.][benchmark]" )
+{
+	using seconds = std::chrono::duration<double>;
+
+	VectorImg image;
+	image.layers.emplace_back( new ImgLayer() );
+	auto &layer = *image.layers[0];
+	add_test_items( layer, 500000 );
+
+	ImgHistory history;
+	history.reset( image );
+
+	const auto x = layer.lines.ax[1];
+	layer.translate( 10.f, 10.f );
+	auto start = std::chrono::steady_clock::now();
+	history.commit( image );
+	const seconds commit_time = std::chrono::steady_clock::now() - start;
+
+	start = std::chrono::steady_clock::now();
+	history.undo( image );
+	const seconds undo_time = std::chrono::steady_clock::now() - start;
+	REQUIRE( layer.lines.ax[1] == x );
+
+	start = std::chrono::steady_clock::now();
+	history.redo( image );
+	const seconds redo_time = std::chrono::steady_clock::now() - start;
+
+	REQUIRE( layer.lines.ax[1] == x + 10.f );
+
+	std::wcout << "Moved 500000 items\n"
+	           << "  commit: " << commit_time.count() * 1000.0 << " ms\n"
+	           << "  undo:   " << undo_time.count() * 1000.0 << " ms\n"
+	           << "  redo:   " << redo_time.count() * 1000.0 << " ms\n"
+	           << "  history memory: " << history.get_memory_size() / (1024 * 1024) << " MB\n";
+}
@@ -0,0 +1,265 @@
+#include "../src/vector_img_index.hh"
+
+#include <catch.hpp>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <algorithm>
+
+using namespace vector_img;
+
+namespace
+{
+	// Bounds of the items by their ids, removed ones are empty
+	struct BruteForceIndex
+	{
+		std::vector<ImgBounds> bounds;
+		std::vector<bool>      present;
+
+		void set( uint32_t id, const ImgBounds &item_bounds )
+		{
+			if( id >= bounds.size() )
+			{
+				bounds.resize( id + 1 );
+				present.resize( id + 1, false );
+			}
+			bounds[id] = item_bounds;
+			present[id] = true;
+		}
+
+		std::vector<uint32_t> find_in( const ImgBounds &area ) const
+		{
+			std::vector<uint32_t> ids;
+			for( uint32_t id = 0; id < bounds.size(); id++ )
+			{
+				if( present[id] && bounds[id].intersects( area ) )
+				{
+					ids.push_back( id );
+				}
+			}
+			return ids;
+		}
+	};
+
+
+
+	ImgBounds make_bounds( std::mt19937 &random, float size, float max_item_size )
+	{
+		std::uniform_real_distribution<float> position( 0.f, size );
+		std::uniform_real_distribution<float> item_size( 0.f, max_item_size );
+		const auto x = position( random );
+		const auto y = position( random );
+		return { x, y, x + item_size( random ), y + item_size( random ) };
+	}
+
+
+
+	std::vector<uint32_t> find_sorted( const ImgSpatialIndex &index, const ImgBounds &area )
+	{
+		std::vector<uint32_t> ids;
+		index.find_in( area, ids );
+		std::sort( ids.begin(), ids.end() );
+		return ids;
+	}
+
+
+
+	void require_same_items( const ImgSpatialIndex &index, const BruteForceIndex &expected, std::mt19937 &random, float size )
+	{
+		for( int i = 0; i < 50; i++ )
+		{
+			const auto area = make_bounds( random, size, size / 4.f );
+			REQUIRE( find_sorted( index, area ) == expected.find_in( area ) );
+		}
+	}
+}
+
+
+
+TEST_CASE( "Bounds intersect, contain and measure the distance" )
+{
+	const ImgBounds bounds = { 0.f, 0.f, 10.f, 5.f };
+
+	REQUIRE( bounds.intersects( { 10.f, 5.f, 20.f, 20.f } ) );
+	REQUIRE( bounds.intersects( { 2.f, 2.f, 3.f, 3.f } ) );
+	REQUIRE_FALSE( bounds.intersects( { 10.5f, 0.f, 20.f, 5.f } ) );
+
+	REQUIRE( bounds.contains( { 0.f, 0.f, 10.f, 5.f } ) );
+	REQUIRE_FALSE( bounds.contains( { 5.f, 0.f, 11.f, 5.f } ) );
+
+	REQUIRE( bounds.distance_to( 5.f, 2.f ) == 0.f );
+	REQUIRE( bounds.distance_to( 13.f, 9.f ) == 5.f );
+	REQUIRE( bounds.distance_to( 5.f, -2.f ) == 2.f );
+}
+
+
+
+TEST_CASE( "The index finds the items a full scan finds" )
+{
+	const float size = 1000.f;
+	std::mt19937 random( 1 );
+	ImgSpatialIndex index;
+	BruteForceIndex expected;
+
+	// Enough items to split the nodes many times, points and large items too
+	for( uint32_t id = 0; id < 5000; id++ )
+	{
+		auto bounds = make_bounds( random, size, id % 50 == 0 ? size / 2.f : 20.f );
+		if( id % 7 == 0 )
+		{
+			bounds.max_x = bounds.min_x;
+			bounds.max_y = bounds.min_y;
+		}
+		index.insert( id, bounds );
+		expected.set( id, bounds );
+	}
+	REQUIRE( index.size() == 5000 );
+	require_same_items( index, expected, random, size );
+
+	// Items added outside of the root grow it
+	const ImgBounds outside = { -5000.f, 3000.f, -4990.f, 3010.f };
+	index.insert( 5000, outside );
+	expected.set( 5000, outside );
+	REQUIRE( find_sorted( index, { -6000.f, 2000.f, -4000.f, 4000.f } ) == std::vector<uint32_t>{ 5000 } );
+	require_same_items( index, expected, random, size );
+
+	// Updated items move, removed ones are gone
+	for( uint32_t id = 0; id < 5000; id += 3 )
+	{
+		const auto bounds = make_bounds( random, size, 20.f );
+		index.update( id, bounds );
+		expected.set( id, bounds );
+	}
+	for( uint32_t id = 1; id < 5000; id += 4 )
+	{
+		index.remove( id );
+		expected.present[id] = false;
+	}
+	REQUIRE_FALSE( index.contains( 1 ) );
+	REQUIRE( index.contains( 2 ) );
+	REQUIRE( index.size() == 5001 - 1250 );
+	require_same_items( index, expected, random, size );
+
+	// Translating moves all the items
+	index.translate( 100.f, -50.f );
+	for( auto &bounds : expected.bounds )
+	{
+		bounds = { bounds.min_x + 100.f, bounds.min_y - 50.f, bounds.max_x + 100.f, bounds.max_y - 50.f };
+	}
+	require_same_items( index, expected, random, size );
+
+	// Removed ids can be inserted again
+	index.insert( 1, { 0.f, 0.f, 1.f, 1.f } );
+	REQUIRE( index.contains( 1 ) );
+
+	index.clear();
+	REQUIRE( index.size() == 0 );
+	REQUIRE_FALSE( index.contains( 2 ) );
+	REQUIRE( find_sorted( index, { -1e6f, -1e6f, 1e6f, 1e6f } ).empty() );
+}
+
+
+
+TEST_CASE( "The index finds the nearest item" )
+{
+	std::mt19937 random( 2 );
+	std::uniform_real_distribution<float> position( 0.f, 1000.f );
+
+	// Points, their distances are exact by their bounds
+	std::vector<std::pair<float, float>> points;
+	ImgSpatialIndex index;
+	for( uint32_t id = 0; id < 2000; id++ )
+	{
+		points.emplace_back( position( random ), position( random ) );
+		index.insert( id, { points[id].first, points[id].second, points[id].first, points[id].second } );
+	}
+
+	const auto distance = [&points]( float x, float y, uint32_t id )
+	{
+		return std::hypot( points[id].first - x, points[id].second - y );
+	};
+
+	for( int i = 0; i < 100; i++ )
+	{
+		const auto x = position( random );
+		const auto y = position( random );
+		const auto max_distance = i % 2 ? 1e6f : 10.f;
+
+		auto expected = ImgSpatialIndex::no_id;
+		auto expected_distance = max_distance;
+		for( uint32_t id = 0; id < points.size(); id++ )
+		{
+			if( distance( x, y, id ) <= expected_distance )
+			{
+				expected_distance = distance( x, y, id );
+				expected = id;
+			}
+		}
+
+		const auto nearest = index.find_nearest( x, y, max_distance, [&]( uint32_t id ) { return distance( x, y, id ); } );
+		if( expected == ImgSpatialIndex::no_id )
+		{
+			REQUIRE( nearest == ImgSpatialIndex::no_id );
+		}
+		else
+		{
+			REQUIRE( nearest != ImgSpatialIndex::no_id );
+			REQUIRE( distance( x, y, nearest ) == expected_distance );
+		}
+	}
+
+	ImgSpatialIndex empty;
+	REQUIRE( empty.find_nearest( 0.f, 0.f, 1e6f, []( uint32_t ) { return 0.f; } ) == ImgSpatialIndex::no_id );
+}
+
+
+
+TEST_CASE( "Spatial index speed", "[.][benchmark]" )
+{
+	using seconds = std::chrono::duration<double>;
+
+	const float size = 10000.f;
+	const uint32_t item_count = 1000000;
+	std::mt19937 random( 1 );
+	std::vector<ImgBounds> bounds;
+	for( uint32_t id = 0; id < item_count; id++ )
+	{
+		bounds.push_back( make_bounds( random, size, 20.f ) );
+	}
+
+	ImgSpatialIndex index;
+	auto start = std::chrono::steady_clock::now();
+	for( uint32_t id = 0; id < item_count; id++ )
+	{
+		index.insert( id, bounds[id] );
+	}
+	const seconds insert_time = std::chrono::steady_clock::now() - start;
+
+	const int query_count = 10000;
+	size_t found_count = 0;
+	std::vector<uint32_t> ids;
+	start = std::chrono::steady_clock::now();
+	for( int i = 0; i < query_count; i++ )
+	{
+		ids.clear();
+		index.find_in( make_bounds( random, size, 200.f ), ids );
+		found_count += ids.size();
+	}
+	const seconds find_time = std::chrono::steady_clock::now() - start;
+
+	start = std::chrono::steady_clock::now();
+	for( uint32_t id = 0; id < item_count; id += 10 )
+	{
+		index.update( id, make_bounds( random, size, 20.f ) );
+	}
+	const seconds update_time = std::chrono::steady_clock::now() - start;
+
+	REQUIRE( index.size() == item_count );
+
+	std::wcout << "Indexed " << item_count << " items, " << index.get_memory_size() / 1024 << " KiB\n"
+	           << "  insert:          " << insert_time.count() * 1000.0 << " ms\n"
+	           << "  find in area:    " << find_time.count() * 1e6 / query_count << " us, "
+	           << found_count / query_count << " items\n"
+	           << "  update a tenth:  " << update_time.count() * 1000.0 << " ms\n";
+}
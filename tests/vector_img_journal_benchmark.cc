@@ -0,0 +1,108 @@
+#include "../src/vector_img_history.hh"
+#include "vector_img_test_helpers.hh"
+
+#include <catch.hpp>
+#include <chrono>
+#include <iostream>
+
+using namespace vector_img;
+using namespace vector_img_tests;
+
+
+
+TEST_CASE( "The journal gives the changes since a version" )
+{
+	VectorImg image;
+	image.layers.emplace_back( new ImgLayer() );
+	auto &layer = *image.layers[0];
+	const auto created_version = layer.get_version();
+	const auto handles = add_test_items( layer, 100 );
+
+	ImgHistory history;
+	history.reset( image );
+
+	// The journal reaches back to the new layer, not past it
+	std::vector<ImgChange> changes;
+	REQUIRE_FALSE( layer.get_changes( 0, changes ) );
+	REQUIRE( layer.get_changes( created_version, changes ) );
+	REQUIRE( changes.size() == 100 );
+	REQUIRE( changes[0].type == ITEM_ADDED );
+	REQUIRE( layer.get_item_version( handles[99] ) == layer.get_version() );
+
+	const auto version = layer.get_version();
+	const auto reordered_x = layer.lines.ax[layer.get_index( handles[3] )];
+	layer.move_item( handles[1], 1.f, 0.f );
+	layer.remove( handles[2] );
+	REQUIRE( layer.bring_to_front( handles[3] ) );
+	const auto added = layer.add_control_point( 0.f, 0.f );
+
+	changes.clear();
+	REQUIRE( layer.get_changes( version, changes ) );
+	REQUIRE( changes.size() == 4 );
+	REQUIRE( changes[0].type == ITEM_MODIFIED );
+	REQUIRE( changes[1].type == ITEM_REMOVED );
+	REQUIRE( changes[2].type == ITEM_REORDERED );
+	REQUIRE( changes[3].type == ITEM_ADDED );
+	REQUIRE( changes[3].handle.slot == added.slot );
+	REQUIRE( changes[3].version == layer.get_version() );
+	REQUIRE( layer.get_item_version( handles[1] ) == changes[0].version );
+	REQUIRE( layer.get_item_version( handles[2] ) == 0 );
+	REQUIRE( layer.get_item_version( handles[4] ) <= version );
+
+	// The reordered line is drawn last and keeps its handle
+	REQUIRE( layer.get_index( handles[3] ) == layer.lines.size() - 1 );
+	REQUIRE( layer.lines.ax[layer.get_index( handles[3] )] == reordered_x );
+
+	changes.clear();
+	REQUIRE( layer.get_changes( layer.get_version(), changes ) );
+	REQUIRE( changes.empty() );
+
+	// After an undo anything may have changed
+	history.commit( image );
+	REQUIRE( history.undo( image ) );
+	REQUIRE( !layer.get_changes( version, changes ) );
+	REQUIRE( layer.get_changes( layer.get_version(), changes ) );
+
+	// Only the latest changes are kept
+	const auto old_version = layer.get_version();
+	for( size_t i = 0; i <= ImgLayer::journal_size; i++ )
+	{
+		layer.move_item( handles[1], 1.f, 0.f );
+	}
+	REQUIRE( !layer.get_changes( old_version, changes ) );
+}
+
+
+
+TEST_CASE( "Reading the journal speed", "[.][benchmark]" )
+{
+	using seconds = std::chrono::duration<double>;
+
+	ImgLayer layer;
+	const auto handles = add_test_items( layer, 500000 );
+
+	// A frame of dragging a few items, read back like a cache updates itself
+	const int frame_count = 1000;
+	size_t change_count = 0;
+	std::vector<ImgChange> changes;
+	seconds read_time( 0.0 );
+	for( int frame = 0; frame < frame_count; frame++ )
+	{
+		const auto version = layer.get_version();
+		for( size_t i = 0; i < 10; i++ )
+		{
+			layer.move_item( handles[(frame * 10 + i) % handles.size()], 1.f, 1.f );
+		}
+
+		const auto start = std::chrono::steady_clock::now();
+		changes.clear();
+		REQUIRE( layer.get_changes( version, changes ) );
+		read_time += std::chrono::steady_clock::now() - start;
+		change_count += changes.size();
+	}
+
+	REQUIRE( change_count == frame_count * 10 );
+
+	std::wcout << "Read the journal of a layer of 500000 items\n"
+	           << "  changes of a frame of 10 moves: " << read_time.count() * 1e6 / frame_count << " us\n";
+}
@@ -0,0 +1,212 @@
+#include "../src/vector_img_lod.hh"
+#include "../src/vector_img_stroke.hh"
+#include "vector_img_test_helpers.hh"
+
+#include <catch.hpp>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <iostream>
+
+using namespace vector_img;
+using namespace vector_img_tests;
+
+namespace
+{
+	float get_distance( ImgPoint p, ImgPoint a, ImgPoint b )
+	{
+		const auto dx = b.x - a.x;
+		const auto dy = b.y - a.y;
+		const auto t = std::min( std::max( ((p.x - a.x) * dx + (p.y - a.y) * dy) / (dx * dx + dy * dy), 0.f ), 1.f );
+		return std::hypot( a.x + t * dx - p.x, a.y + t * dy - p.y );
+	}
+}
+
+
+
+TEST_CASE( "Simplified polylines stay within the tolerance" )
+{
+	std::mt19937 random( 1 );
+	std::uniform_real_distribution<float> noise( -0.1f, 0.1f );
+
+	// A corner with noise along its sides
+	std::vector<ImgPoint> points;
+	for( int i = 0; i <= 100; i++ )
+	{
+		points.push_back( { static_cast<float>( i ), noise( random ) } );
+	}
+	for( int i = 1; i <= 100; i++ )
+	{
+		points.push_back( { 100.f + noise( random ), static_cast<float>( i ) } );
+	}
+
+	std::vector<ImgPoint> simplified;
+	simplify_polyline( points.data(), points.size(), 0.5f, simplified );
+	REQUIRE( simplified.size() >= 3 );
+	REQUIRE( simplified.size() < 10 );
+	REQUIRE( simplified.front().x == points.front().x );
+	REQUIRE( simplified.back().y == points.back().y );
+
+	for( const auto &point : points )
+	{
+		auto distance = INFINITY;
+		for( size_t i = 0; i + 1 < simplified.size(); i++ )
+		{
+			distance = std::min( distance, get_distance( point, simplified[i], simplified[i + 1] ) );
+		}
+		REQUIRE( distance <= 0.5f );
+	}
+
+	// Nothing is left out within the tolerance of nothing
+	simplified.clear();
+	simplify_polyline( points.data(), points.size(), 0.f, simplified );
+	REQUIRE( simplified.size() == points.size() );
+}
+
+
+
+TEST_CASE( "Levels of detail get coarser and are drawn zoomed out" )
+{
+	std::mt19937 random( 1 );
+	std::uniform_real_distribution<float> position( 0.f, 1000.f );
+
+	// A long polyline, specks smaller than a pixel and a fill with a round hole
+	ImgLayer layer;
+	add_polyline( layer, random, 5000, 0.1f, 500.f, 500.f );
+	for( int i = 0; i < 5000; i++ )
+	{
+		const auto x = position( random );
+		const auto y = position( random );
+		layer.add_line( x, y, x + 0.1f, y + 0.1f, 0.1f, Color{ 255, 0, 0, 255 } );
+	}
+
+	ImgPath path;
+	path.points = { { 0.f, 0.f }, { 1000.f, 0.f }, { 1000.f, 1000.f }, { 0.f, 1000.f } };
+	for( int i = 0; i < 360; i++ )
+	{
+		const auto angle = i * 3.14159265f / 180.f;
+		path.points.push_back( { 500.f + 100.f * std::cos( angle ), 500.f + 100.f * std::sin( angle ) } );
+	}
+	path.contour_ends = { 4, 364 };
+	path.rule = EVEN_ODD;
+	layer.add_fill( 0.f, 0.f, path, Color{ 0, 0, 255, 128 } );
+
+	std::vector<ImgLodLevel> levels;
+	build_lod_levels( layer.lines, layer.fills, levels );
+
+	// From 4096 pixels down to 64 for a layer about 1000 units wide
+	REQUIRE( levels.size() == 6 );
+	REQUIRE( levels[0].scale == 4.f );
+	for( size_t i = 0; i < levels.size(); i++ )
+	{
+		const auto &level = levels[i];
+		REQUIRE( level.triangles.size() == level.colors.size() * 3 );
+		if( i > 0 )
+		{
+			REQUIRE( level.scale == levels[i - 1].scale / 2.f );
+			REQUIRE( level.triangles.size() < levels[i - 1].triangles.size() );
+			REQUIRE( level.id != levels[i - 1].id );
+		}
+
+		// The squares of the specks are fainter than the specks
+		for( const auto &color : level.colors )
+		{
+			REQUIRE( (color.r != 255 || color.a < 255) );
+		}
+	}
+
+	ImgStrokeCache stroke_cache;
+	ImgLayerIndices indices;
+	layer.find_visible( { -100.f, -100.f, 1100.f, 1100.f }, indices );
+	stroke_cache.update( layer.lines, indices.lines );
+	size_t full_count = 0;
+	for( const auto i : indices.lines )
+	{
+		full_count += stroke_cache.get_triangles( layer.lines, i ).point_count;
+	}
+	REQUIRE( levels.back().triangles.size() * 20 < full_count );
+
+	// The thread builds the levels, older levels are drawn until the new ones are ready
+	ImgLodCache lod_cache( 1000 );
+	lod_cache.update( layer );
+	REQUIRE( lod_cache.get_level( 1.f ) == nullptr );
+	lod_cache.wait();
+	lod_cache.update( layer );
+	REQUIRE( lod_cache.get_level_count() == levels.size() );
+	REQUIRE( lod_cache.get_level( 8.f ) == nullptr );
+	REQUIRE( lod_cache.get_level( 4.f )->scale == 4.f );
+	REQUIRE( lod_cache.get_level( 0.3f )->scale == 0.5f );
+	REQUIRE( lod_cache.get_level( 0.01f )->scale == 0.125f );
+
+	const auto old_id = lod_cache.get_level( 1.f )->id;
+	layer.translate( 10.f, 0.f );
+	lod_cache.update( layer );
+	REQUIRE( lod_cache.get_level( 1.f )->id == old_id );
+	lod_cache.wait();
+	lod_cache.update( layer );
+	REQUIRE( lod_cache.get_level( 1.f )->id != old_id );
+	REQUIRE_FALSE( lod_cache.is_busy() );
+
+	// Small layers are drawn in full detail
+	layer.clear();
+	layer.add_line( 0.f, 0.f, 10.f, 10.f, 1.f );
+	lod_cache.update( layer );
+	REQUIRE( lod_cache.get_level( 0.01f ) == nullptr );
+}
+
+
+
+TEST_CASE( "Levels of detail speed", "[.][benchmark]" )
+{
+	using seconds = std::chrono::duration<double>;
+
+	// A map of a million lines, and a hundred thousand specks
+	std::mt19937 random( 1 );
+	std::uniform_real_distribution<float> position( 0.f, 4000.f );
+	ImgLayer layer;
+	for( int polyline = 0; polyline < 100; polyline++ )
+	{
+		add_polyline( layer, random, 10000, 1.5f, position( random ), position( random ) );
+	}
+	for( int i = 0; i < 100000; i++ )
+	{
+		const auto x = position( random );
+		const auto y = position( random );
+		layer.add_line( x, y, x + 0.5f, y, 0.5f );
+	}
+
+	ImgStrokeCache stroke_cache;
+	ImgLayerIndices indices;
+	layer.find_visible( { -1e6f, -1e6f, 1e6f, 1e6f }, indices );
+	auto start = std::chrono::steady_clock::now();
+	stroke_cache.update( layer.lines, indices.lines );
+	const seconds full_time = std::chrono::steady_clock::now() - start;
+	size_t full_count = 0;
+	for( const auto i : indices.lines )
+	{
+		full_count += stroke_cache.get_triangles( layer.lines, i ).point_count / 3;
+	}
+
+	ImgLodCache lod_cache;
+	start = std::chrono::steady_clock::now();
+	lod_cache.update( layer );
+	const seconds queue_time = std::chrono::steady_clock::now() - start;
+	lod_cache.wait();
+	const seconds build_time = std::chrono::steady_clock::now() - start;
+	lod_cache.update( layer );
+	REQUIRE( lod_cache.get_level_count() > 0 );
+
+	std::wcout << "Levels of detail of 1100000 lines\n"
+	           << "  full detail:        " << full_count << " triangles, " << full_time.count() * 1000.0 << " ms\n"
+	           << "  copying the layer:  " << queue_time.count() * 1000.0 << " ms\n"
+	           << "  building, threaded: " << build_time.count() * 1000.0 << " ms, " << lod_cache.get_memory_size() / 1e6 << " MB\n";
+
+	for( auto scale = 4.f; scale > 0.001f; scale /= 2.f )
+	{
+		const auto level = lod_cache.get_level( scale );
+		if( level && level->scale == scale )
+		{
+			std::wcout << "  at scale " << scale << ":\t" << level->colors.size() << " triangles\n";
+		}
+	}
+}
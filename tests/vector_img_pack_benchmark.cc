@@ -0,0 +1,242 @@
+#include "../src/vector_img_pack.hh"
+#include "../src/vector_img_file.hh"
+#include "vector_img_test_helpers.hh"
+
+#include <catch.hpp>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <iostream>
+
+using namespace vector_img;
+using namespace vector_img_tests;
+
+namespace
+{
+	bool is_within( float a, float b, float distance )
+	{
+		return std::fabs( a - b ) <= distance;
+	}
+}
+
+
+
+TEST_CASE( "Packed columns unpack to the same values" )
+{
+	std::mt19937 random( 1 );
+	std::uniform_int_distribution<uint32_t> any_value;
+	std::uniform_int_distribution<uint32_t> small_change( 0, 300 );
+
+	for( size_t count = 0; count < 70; count++ )
+	{
+		std::vector<uint32_t> values;
+		uint32_t value = 0;
+		for( size_t i = 0; i < count; i++ )
+		{
+			value = i % 7 == 3 ? any_value( random ) : value + small_change( random ) - 150;
+			values.push_back( value );
+		}
+
+		// Bytes after the column don't matter
+		std::vector<char> data;
+		pack_column( values.data(), values.size(), data );
+		const auto column_size = data.size();
+		data.resize( data.size() + 20, 'x' );
+
+		std::vector<uint32_t> unpacked( count );
+		REQUIRE( unpack_column( data.data(), data.size(), count, unpacked.data() ) == column_size );
+		REQUIRE( unpacked == values );
+		REQUIRE( unpack_column( data.data(), column_size, count, unpacked.data() ) == column_size );
+		REQUIRE( unpacked == values );
+		if( count )
+		{
+			REQUIRE( unpack_column( data.data(), column_size - 1, count, unpacked.data() ) == 0 );
+		}
+	}
+}
+
+
+
+TEST_CASE( "Packed layers keep the items within half a step" )
+{
+	const auto step = 1.f / 16.f;
+
+	ImgLayer layer;
+	layer.add_control_point( 10.f, 20.f, Color{ 1, 2, 3, 4 } );
+	const auto removed = layer.add_control_point( 11.f, 21.f );
+	layer.add_control_point( -3.3f, 7.77f );
+	layer.remove( removed );
+
+	ImgLineStyle round_style;
+	round_style.cap = ROUND_CAP;
+	round_style.join = ROUND_JOIN;
+	layer.add_line( 0.f, 0.f, 10.f, 10.f, 2.f );
+	layer.add_line( 10.f, 10.f, 20.f, 5.f, 2.f );
+	layer.add_line( 30.f, 30.f, 40.f, 40.f, 4.f, Color{ 255, 0, 0, 255 }, round_style );
+
+	ImgPath path;
+	path.points = { { 0.f, 0.f }, { 10.f, 0.f }, { 10.f, 10.f }, { 0.f, 10.f }, { 2.f, 2.f }, { 2.f, 8.f }, { 8.f, 8.f } };
+	path.contour_ends = { 4, 7 };
+	path.rule = EVEN_ODD;
+	layer.add_fill( 50.f, 50.f, path, Color{ 0, 255, 0, 128 } );
+	layer.add_fill( 70.f, 70.f );
+
+	std::vector<char> data;
+	const auto header = pack_layer( layer, step, data );
+	REQUIRE( header.control_point_count == 2 );
+	REQUIRE( header.line_count == 3 );
+	REQUIRE( header.fill_count == 2 );
+	REQUIRE( header.contour_count == 2 );
+	REQUIRE( header.path_point_count == 7 );
+
+	ImgLayer unpacked;
+	unpack_layer( data.data(), data.size(), unpacked );
+	REQUIRE( unpacked.size() == layer.size() );
+
+	const auto &points = unpacked.control_points;
+	REQUIRE( is_within( points.x[0], 10.f, step / 2.f ) );
+	REQUIRE( is_within( points.y[1], 7.77f, step / 2.f ) );
+	REQUIRE( points.color[0].a == 4 );
+
+	// The joined lines still meet
+	const auto &lines = unpacked.lines;
+	REQUIRE( lines.ax[1] == lines.bx[0] );
+	REQUIRE( lines.ay[1] == lines.by[0] );
+	REQUIRE( is_within( lines.bx[1], 20.f, step / 2.f ) );
+	REQUIRE( is_within( lines.ax[2], 30.f, step / 2.f ) );
+	REQUIRE( lines.width[2] == 4.f );
+	REQUIRE( lines.style[2].join == ROUND_JOIN );
+	REQUIRE( lines.color[2].r == 255 );
+
+	const auto &fills = unpacked.fills;
+	REQUIRE( fills.path[0].contour_ends == path.contour_ends );
+	REQUIRE( fills.path[0].rule == EVEN_ODD );
+	REQUIRE( fills.path[0].points[5].y == 8.f );
+	REQUIRE( fills.path[1].points.empty() );
+	REQUIRE( fills.color[0].a == 128 );
+
+	// The bounds are of the unpacked items
+	const auto &bounds = header.bounds;
+	const auto reach = ImgLineStyle().get_reach( 2.f );
+	REQUIRE( bounds.min_x == std::min( points.x[1], lines.ax[0] - reach ) );
+	REQUIRE( bounds.min_y == lines.ay[0] - reach );
+	REQUIRE( bounds.max_x == unpacked.fills.x[1] );
+
+	// Broken data isn't read past and adds nothing
+	REQUIRE_THROWS_AS( unpack_layer( data.data(), data.size() - 3, unpacked ), std::runtime_error );
+	REQUIRE( unpacked.size() == layer.size() );
+
+	// Packed documents load like others, the records aren't read one by one
+	VectorImg image;
+	image.img_w = 100;
+	image.img_h = 100;
+	image.layers.emplace_back( new ImgLayer() );
+	unpack_layer( data.data(), data.size(), *image.layers[0] );
+
+	ImgSaveOptions options;
+	options.pack = true;
+	options.pack_step = step;
+	save_document( image, "pack_test.vdr", options );
+	{
+		const ImgDocument document( "pack_test.vdr" );
+		REQUIRE( document.is_packed() );
+		REQUIRE( document.verify() );
+		REQUIRE_THROWS_AS( document.get_layer( 0 ).get_line( 0 ), std::runtime_error );
+
+		VectorImg loaded;
+		document.load( loaded );
+		REQUIRE( loaded.layers[0]->lines.ax == lines.ax );
+		REQUIRE( loaded.layers[0]->fills.path[0].points[2].x == 10.f );
+	}
+	std::remove( "pack_test.vdr" );
+}
+
+
+
+TEST_CASE( "Packing layers speed", "[.][benchmark]" )
+{
+	using seconds = std::chrono::duration<double>;
+
+	std::mt19937 random( 1 );
+	VectorImg image;
+	image.img_w = 4000;
+	image.img_h = 4000;
+	image.layers.emplace_back( new ImgLayer() );
+	auto &layer = *image.layers[0];
+	for( int polyline = 0; polyline < 100; polyline++ )
+	{
+		add_polyline( layer, random, 10000, 1.5f, 500.f, 500.f );
+	}
+
+	std::vector<char> data;
+	auto start = std::chrono::steady_clock::now();
+	pack_layer( layer, default_pack_step, data );
+	const seconds pack_time = std::chrono::steady_clock::now() - start;
+
+	ImgLayer unpacked;
+	start = std::chrono::steady_clock::now();
+	unpack_layer( data.data(), data.size(), unpacked );
+	const seconds unpack_time = std::chrono::steady_clock::now() - start;
+	REQUIRE( unpacked.size() == layer.size() );
+
+	// The ends of the lines as one column, unpacked many times
+	std::vector<uint32_t> values;
+	for( size_t i = 0; i < layer.lines.size(); i++ )
+	{
+		values.push_back( static_cast<uint32_t>( std::lround( layer.lines.bx[i] * 64.f ) ) );
+	}
+	std::vector<char> column;
+	pack_column( values.data(), values.size(), column );
+
+	std::vector<uint32_t> unpacked_values( values.size() );
+	const auto repeat_count = 20;
+	start = std::chrono::steady_clock::now();
+	for( int i = 0; i < repeat_count; i++ )
+	{
+		unpack_column( column.data(), column.size(), values.size(), unpacked_values.data() );
+	}
+	const seconds column_time = std::chrono::steady_clock::now() - start;
+	REQUIRE( unpacked_values == values );
+
+	ImgSaveOptions quantized;
+	quantized.quantize = true;
+	ImgSaveOptions packed;
+	packed.pack = true;
+
+	const auto get_file_size = []( const char *path )
+	{
+		std::ifstream stream( path, std::ios::binary | std::ios::ate );
+		return static_cast<double>( stream.tellg() );
+	};
+	save_document( image, "pack_benchmark_plain.vdr" );
+	save_document( image, "pack_benchmark_quantized.vdr", quantized );
+	save_document( image, "pack_benchmark_packed.vdr", packed );
+	const auto plain_size = get_file_size( "pack_benchmark_plain.vdr" );
+
+	VectorImg loaded;
+	start = std::chrono::steady_clock::now();
+	ImgDocument( "pack_benchmark_plain.vdr" ).load( loaded );
+	const seconds plain_load_time = std::chrono::steady_clock::now() - start;
+	start = std::chrono::steady_clock::now();
+	ImgDocument( "pack_benchmark_packed.vdr" ).load( loaded );
+	const seconds packed_load_time = std::chrono::steady_clock::now() - start;
+
+	const auto megabytes = column.size() * repeat_count / 1e6;
+	std::wcout << "Packed 1000000 lines\n"
+	           << "  packing:              " << pack_time.count() * 1000.0 << " ms, " << data.size() / 1e6 << " MB\n"
+	           << "  unpacking the layer:  " << unpack_time.count() * 1000.0 << " ms\n"
+	           << "  unpacking a column:   " << megabytes / column_time.count() << " MB/s, "
+	           << values.size() * repeat_count / column_time.count() / 1e6 << " M values/s\n"
+	           << "  quantized file:       " << plain_size / get_file_size( "pack_benchmark_quantized.vdr" ) << "x smaller\n"
+	           << "  packed file:          " << plain_size / get_file_size( "pack_benchmark_packed.vdr" ) << "x smaller\n"
+	           << "  loading, plain:       " << plain_load_time.count() * 1000.0 << " ms\n"
+	           << "  loading, packed:      " << packed_load_time.count() * 1000.0 << " ms\n";
+
+	std::remove( "pack_benchmark_plain.vdr" );
+	std::remove( "pack_benchmark_quantized.vdr" );
+	std::remove( "pack_benchmark_packed.vdr" );
+}
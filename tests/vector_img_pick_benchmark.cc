@@ -0,0 +1,112 @@
+#include "../src/vector_img_pick.hh"
+
+#include <catch.hpp>
+#include <chrono>
+#include <random>
+#include <iostream>
+
+using namespace vector_img;
+
+namespace
+{
+	// Pixel of the id as it is drawn to the buffer and read back
+	std::vector<uint8_t> to_pixel( uint32_t id )
+	{
+		const auto color = get_pick_color( id );
+		return { color.r, color.g, color.b, color.a };
+	}
+}
+
+
+
+TEST_CASE( "Pick ids go through the pixels and back to their layers and slots" )
+{
+	const std::pair<size_t, uint32_t> items[] = {
+		{ 0, 0 }, { 0, 1 }, { 1, 0 }, { 3, 0xff }, { 7, 0x100 }, { 12, 0x12345 },
+		{ 0, max_pick_slot }, { max_pick_layers - 1, 0 }, { max_pick_layers - 1, max_pick_slot }
+	};
+
+	for( const auto &item : items )
+	{
+		const auto id = get_pick_id( item.first, item.second );
+		REQUIRE( id != 0 );
+
+		const auto pixel = to_pixel( id );
+		REQUIRE( pixel[3] == item.first );
+		REQUIRE( read_pick_id( pixel.data() ) == id );
+
+		const auto picked = decode_pick_id( read_pick_id( pixel.data() ) );
+		REQUIRE( picked.layer == item.first );
+		REQUIRE( picked.slot == item.second );
+	}
+}
+
+
+
+TEST_CASE( "Items beyond the pick ids can't be picked" )
+{
+	REQUIRE( get_pick_id( 0, max_pick_slot + 1 ) == 0 );
+	REQUIRE( get_pick_id( 5, ImgItemHandle::no_slot ) == 0 );
+	REQUIRE( get_pick_id( max_pick_layers, 0 ) == 0 );
+	REQUIRE( get_pick_id( max_pick_layers + 1, 10 ) == 0 );
+
+	// The empty pixels of the buffer are no item, in any layer byte
+	const auto empty = to_pixel( 0 );
+	REQUIRE( empty == std::vector<uint8_t>( 4, 0 ) );
+	REQUIRE( decode_pick_id( 0 ).slot == ImgItemHandle::no_slot );
+	REQUIRE( decode_pick_id( 0x05000000 ).slot == ImgItemHandle::no_slot );
+}
+
+
+
+TEST_CASE( "The ids of a read back area are sorted and unique" )
+{
+	std::vector<uint8_t> pixels;
+	for( const auto id : { 0u, get_pick_id( 2, 9 ), get_pick_id( 2, 9 ), 0u, get_pick_id( 0, 4 ), get_pick_id( 255, 0 ), get_pick_id( 2, 9 ) } )
+	{
+		const auto pixel = to_pixel( id );
+		pixels.insert( pixels.end(), pixel.begin(), pixel.end() );
+	}
+
+	// A partial pixel at the end is left out
+	pixels.push_back( 1 );
+
+	std::vector<uint32_t> ids = { 42 };
+	find_pick_ids( pixels, ids );
+	REQUIRE( ids == std::vector<uint32_t>{ get_pick_id( 0, 4 ), get_pick_id( 2, 9 ), get_pick_id( 255, 0 ) } );
+
+	find_pick_ids( std::vector<uint8_t>( 64, 0 ), ids );
+	REQUIRE( ids.empty() );
+}
+
+
+
+TEST_CASE( "Pick id speed", "[.][benchmark]" )
+{
+	using seconds = std::chrono::duration<double>;
+
+	// A rubber band over a full HD buffer of small items
+	const size_t pixel_count = 1920 * 1080;
+	std::mt19937 random( 1 );
+	std::uniform_int_distribution<uint32_t> slot( 0, 20000 );
+	std::vector<uint8_t> pixels;
+	pixels.reserve( pixel_count * 4 );
+	for( size_t i = 0; i < pixel_count; i += 16 )
+	{
+		const auto pixel = to_pixel( get_pick_id( i % 3, slot( random ) ) );
+		for( int j = 0; j < 16; j++ )
+		{
+			pixels.insert( pixels.end(), pixel.begin(), pixel.end() );
+		}
+	}
+
+	std::vector<uint32_t> ids;
+	const auto start = std::chrono::steady_clock::now();
+	find_pick_ids( pixels, ids );
+	const seconds find_time = std::chrono::steady_clock::now() - start;
+
+	REQUIRE( !ids.empty() );
+
+	std::wcout << "Pick ids of " << pixel_count << " pixels, " << ids.size() << " items\n"
+	           << "  find: " << find_time.count() * 1000.0 << " ms\n";
+}
@@ -0,0 +1,221 @@
+#include "../src/vector_img_raster.hh"
+
+#include <catch.hpp>
+#include <chrono>
+#include <random>
+#include <iostream>
+
+using namespace vector_img;
+
+namespace
+{
+	// Short lines of varying width with a control point every fourth item
+	VectorImg make_test_image( size_t item_count, float size )
+	{
+		VectorImg image;
+		image.img_w = size;
+		image.img_h = size;
+		image.layers.emplace_back( new ImgLayer() );
+		auto &layer = *image.layers.back();
+
+		std::mt19937 random( 1 );
+		std::uniform_real_distribution<float> position( 0.f, size );
+		std::uniform_real_distribution<float> offset( -30.f, 30.f );
+		std::uniform_real_distribution<float> width( 0.5f, 4.f );
+
+		for( size_t i = 0; i < item_count; i++ )
+		{
+			const auto x = position( random );
+			const auto y = position( random );
+			const Color color = { uint8_t( i ), uint8_t( i >> 8 ), 200, 180 };
+
+			if( i % 4 == 0 )
+			{
+				layer.add_control_point( x, y, color );
+			}
+			else
+			{
+				layer.add_line( x, y, x + offset( random ), y + offset( random ), width( random ), color );
+			}
+		}
+
+		return image;
+	}
+
+
+
+	const uint8_t* get_pixel( const ImgRaster &raster, size_t x, size_t y )
+	{
+		return &raster.pixels[(y * raster.width + x) * 4];
+	}
+}
+
+
+
+TEST_CASE( "Rasterized items cover the pixels they overlap" )
+{
+	VectorImg image;
+	image.img_w = 64;
+	image.img_h = 32;
+	image.layers.emplace_back( new ImgLayer() );
+	image.layers.back()->add_line( 10.f, 10.5f, 50.f, 10.5f, 4.f, Color{ 255, 0, 0, 255 } );
+	image.layers.emplace_back( new ImgLayer() );
+	image.layers.back()->add_line( 30.f, 0.f, 30.f, 32.f, 2.f, Color{ 0, 0, 255, 255 } );
+
+	RasterOptions options;
+	options.tile_size = 16;
+	options.thread_count = 1;
+	const auto raster = rasterize( image, options );
+
+	REQUIRE( raster.width == 64 );
+	REQUIRE( raster.height == 32 );
+
+	// Rows 8 and 12 are half covered by the edges of the line
+	REQUIRE( get_pixel( raster, 20, 7 )[3] == 0 );
+	REQUIRE( get_pixel( raster, 20, 8 )[3] == 128 );
+	REQUIRE( get_pixel( raster, 20, 10 )[0] == 255 );
+	REQUIRE( get_pixel( raster, 20, 10 )[3] == 255 );
+	REQUIRE( get_pixel( raster, 20, 12 )[3] == 128 );
+	REQUIRE( get_pixel( raster, 9, 10 )[3] == 0 );
+
+	// The upper layer covers the lower one
+	REQUIRE( get_pixel( raster, 29, 10 )[2] == 255 );
+	REQUIRE( get_pixel( raster, 29, 10 )[0] == 0 );
+
+	// Tiles and threads don't change the result
+	options.tile_size = 13;
+	options.thread_count = 3;
+	REQUIRE( rasterize( image, options ).pixels == raster.pixels );
+}
+
+
+
+TEST_CASE( "Rasterized fills follow their fill rules" )
+{
+	// Two squares with a square hole, the holes wind the same way as the outsides
+	ImgPath path;
+	path.points = {
+		{ 0.f, 0.f }, { 20.f, 0.f }, { 20.f, 20.f }, { 0.f, 20.f },
+		{ 5.f, 5.f }, { 15.f, 5.f }, { 15.f, 15.f }, { 5.f, 15.f }
+	};
+	path.contour_ends = { 4, 8 };
+
+	VectorImg image;
+	image.img_w = 64;
+	image.img_h = 32;
+	image.layers.emplace_back( new ImgLayer() );
+	auto &layer = *image.layers.back();
+	layer.add_fill( 2.f, 4.f, path, Color{ 0, 255, 0, 255 } );
+	path.rule = EVEN_ODD;
+	layer.add_fill( 32.5f, 4.f, path, Color{ 0, 255, 0, 255 } );
+
+	// Lines are drawn over the fills of their layer
+	layer.add_line( 0.f, 6.f, 64.f, 6.f, 2.f, Color{ 255, 0, 0, 255 } );
+
+	RasterOptions options;
+	options.tile_size = 16;
+	options.thread_count = 1;
+	const auto raster = rasterize( image, options );
+
+	REQUIRE( get_pixel( raster, 1, 10 )[3] == 0 );
+	REQUIRE( get_pixel( raster, 3, 10 )[1] == 255 );
+	REQUIRE( get_pixel( raster, 3, 10 )[3] == 255 );
+
+	// Non-zero fills the hole, even-odd leaves it empty
+	REQUIRE( get_pixel( raster, 12, 14 )[3] == 255 );
+	REQUIRE( get_pixel( raster, 44, 14 )[3] == 0 );
+	REQUIRE( get_pixel( raster, 34, 14 )[1] == 255 );
+
+	// The fill on the right starts half way into a pixel
+	REQUIRE( get_pixel( raster, 32, 14 )[3] == 128 );
+
+	REQUIRE( get_pixel( raster, 3, 6 )[0] == 255 );
+	REQUIRE( get_pixel( raster, 3, 6 )[1] == 0 );
+
+	options.tile_size = 7;
+	options.thread_count = 3;
+	REQUIRE( rasterize( image, options ).pixels == raster.pixels );
+}
+
+
+
+TEST_CASE( "Rasterized lines have the caps and joins of the canvas" )
+{
+	VectorImg image;
+	image.img_w = 64;
+	image.img_h = 96;
+	image.layers.emplace_back( new ImgLayer() );
+	auto &layer = *image.layers.back();
+	const Color red = { 255, 0, 0, 255 };
+	layer.add_line( 10.f, 8.f, 30.f, 8.f, 8.f, red, ImgLineStyle{ BUTT_CAP, MITER_JOIN } );
+	layer.add_line( 10.f, 24.f, 30.f, 24.f, 8.f, red, ImgLineStyle{ ROUND_CAP, MITER_JOIN } );
+	layer.add_line( 10.f, 40.f, 30.f, 40.f, 8.f, red, ImgLineStyle{ SQUARE_CAP, MITER_JOIN } );
+
+	// Right angled corners of half transparent polylines
+	const Color blue = { 0, 0, 255, 128 };
+	const float corner_ys[] = { 60.f, 76.f, 92.f };
+	const ImgLineJoin joins[] = { MITER_JOIN, BEVEL_JOIN, ROUND_JOIN };
+	for( int i = 0; i < 3; i++ )
+	{
+		image.layers.emplace_back( new ImgLayer() );
+		const auto y = corner_ys[i];
+		image.layers.back()->add_line( 40.f, y - 20.f, 56.f, y - 20.f, 8.f, blue, ImgLineStyle{ BUTT_CAP, joins[i] } );
+		image.layers.back()->add_line( 56.f, y - 20.f, 56.f, y - 10.f, 8.f, blue, ImgLineStyle{ BUTT_CAP, joins[i] } );
+	}
+
+	RasterOptions options;
+	options.tile_size = 16;
+	options.thread_count = 1;
+	const auto raster = rasterize( image, options );
+
+	// Butt caps end at the ends, round caps are half circles around them
+	// and square caps reach past them by half of the width
+	REQUIRE( get_pixel( raster, 10, 8 )[3] == 255 );
+	REQUIRE( get_pixel( raster, 7, 8 )[3] == 0 );
+	REQUIRE( get_pixel( raster, 7, 24 )[3] == 255 );
+	REQUIRE( get_pixel( raster, 6, 20 )[3] == 0 );
+	REQUIRE( get_pixel( raster, 7, 40 )[3] == 255 );
+	REQUIRE( get_pixel( raster, 6, 36 )[3] == 255 );
+	REQUIRE( get_pixel( raster, 32, 24 )[3] == 255 );
+	REQUIRE( get_pixel( raster, 32, 8 )[3] == 0 );
+
+	// Miter joins fill the outer corner, bevel and round joins cut it,
+	// all of them cover the inside of the bend
+	REQUIRE( get_pixel( raster, 59, 36 )[3] == 128 );
+	REQUIRE( get_pixel( raster, 59, 52 )[3] == 0 );
+	REQUIRE( get_pixel( raster, 59, 68 )[3] == 0 );
+	for( const auto y : corner_ys )
+	{
+		const auto row = static_cast<size_t>( y ) - 20;
+		REQUIRE( get_pixel( raster, 57, row - 2 )[3] == 128 );
+		REQUIRE( get_pixel( raster, 56, row )[2] == 255 );
+
+		// The overlap of the lines and their join isn't blended twice
+		REQUIRE( get_pixel( raster, 56, row )[3] == 128 );
+		REQUIRE( get_pixel( raster, 54, row + 2 )[3] == 128 );
+	}
+
+	options.tile_size = 7;
+	options.thread_count = 3;
+	REQUIRE( rasterize( image, options ).pixels == raster.pixels );
+}
+
+
+
+TEST_CASE( "Rasterizing speed", "[.][benchmark]" )
+{
+	for( const size_t item_count : { 10000, 100000, 1000000 } )
+	{
+		const auto image = make_test_image( item_count, 2048.f );
+
+		const auto start = std::chrono::steady_clock::now();
+		const auto raster = rasterize( image );
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		REQUIRE( raster.pixels.size() == 2048 * 2048 * 4 );
+
+		std::wcout << "Rasterized " << item_count << " items in " << elapsed.count() << " s\n"
+		           << "  items/s: " << item_count / elapsed.count() << "\n"
+		           << "  MPix/s:  " << raster.width * raster.height / elapsed.count() / 1e6 << "\n";
+	}
+}
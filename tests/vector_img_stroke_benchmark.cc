@@ -0,0 +1,150 @@
+#include "../src/vector_img_stroke.hh"
+#include "vector_img_test_helpers.hh"
+
+#include <catch.hpp>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <numeric>
+#include <algorithm>
+#include <iostream>
+
+using namespace vector_img;
+using namespace vector_img_tests;
+
+namespace
+{
+	float get_line_area( float length, float width, ImgLineStyle style )
+	{
+		std::vector<ImgPoint> triangles;
+		tessellate_line( { 10.f, 10.f }, { 10.f + length, 10.f }, nullptr, false, width, style, triangles );
+		return get_area( triangles );
+	}
+}
+
+
+
+TEST_CASE( "Lines are tessellated with their caps and joins" )
+{
+	ImgLineStyle style;
+	REQUIRE( get_line_area( 100.f, 4.f, style ) == Approx( 400.f ) );
+
+	style.cap = SQUARE_CAP;
+	REQUIRE( get_line_area( 100.f, 4.f, style ) == Approx( 416.f ) );
+
+	style.cap = ROUND_CAP;
+	REQUIRE( get_line_area( 100.f, 4.f, style ) == Approx( 400.f + 3.14159f * 4.f ).epsilon( 0.02 ) );
+	REQUIRE( get_line_area( 0.f, 40.f, style ) == Approx( 3.14159f * 400.f ).epsilon( 0.02 ) );
+
+	// Right angle corner, the miter fills the outer square of the corner
+	const ImgPoint previous = { 0.f, 0.f };
+	std::vector<ImgPoint> triangles;
+	tessellate_line( { 10.f, 0.f }, { 10.f, 10.f }, &previous, false, 2.f, ImgLineStyle(), triangles );
+	REQUIRE( get_area( triangles ) == Approx( 21.f ) );
+
+	style.cap  = BUTT_CAP;
+	style.join = BEVEL_JOIN;
+	triangles.clear();
+	tessellate_line( { 10.f, 0.f }, { 10.f, 10.f }, &previous, false, 2.f, style, triangles );
+	REQUIRE( get_area( triangles ) == Approx( 20.5f ) );
+
+	// Too sharp for the miter limit
+	const ImgPoint sharp_previous = { 20.f, 1.f };
+	style.join = MITER_JOIN;
+	triangles.clear();
+	tessellate_line( { 0.f, 0.f }, { 20.f, 0.f }, &sharp_previous, false, 2.f, style, triangles );
+	auto min_x = 0.f;
+	for( const auto &point : triangles )
+	{
+		min_x = std::min( min_x, point.x );
+	}
+	REQUIRE( min_x > -1.f );
+}
+
+
+
+TEST_CASE( "Only the changed lines are tessellated again" )
+{
+	ImgLayer layer;
+	ImgLineStyle style;
+	style.join = ROUND_JOIN;
+	std::vector<ImgItemHandle> handles;
+	for( int i = 0; i < 100; i++ )
+	{
+		handles.push_back( layer.add_line( i * 10.f, (i % 2) * 10.f, (i + 1) * 10.f, ((i + 1) % 2) * 10.f, 3.f, ImgLayer::default_color, style ) );
+	}
+
+	std::vector<uint32_t> indices( layer.lines.size() );
+	std::iota( indices.begin(), indices.end(), 0 );
+
+	ImgStrokeCache cache;
+	cache.update( layer.lines, indices );
+	REQUIRE( cache.get_tessellated_count() == 100 );
+	cache.update( layer.lines, indices );
+	REQUIRE( cache.get_tessellated_count() == 0 );
+
+	// Lines 40 and 50 are separate, their neighbours lose the join
+	layer.move_item( handles[50], 0.f, 5.f );
+	layer.remove( handles[40] );
+	cache.update( layer.lines, indices );
+	REQUIRE( cache.get_tessellated_count() == 5 );
+	auto changed_slots = cache.get_changed_slots();
+	std::sort( changed_slots.begin(), changed_slots.end() );
+	REQUIRE( changed_slots == std::vector<uint32_t>{ handles[39].slot, handles[41].slot, handles[49].slot, handles[50].slot, handles[51].slot } );
+	REQUIRE( cache.get_triangles( layer.lines, 40 ).point_count == 0 );
+	REQUIRE( cache.get_triangles( layer.lines, 41 ).point_count > 0 );
+
+	std::vector<ImgPoint> expected;
+	tessellate_line( { 500.f, 5.f }, { 510.f, 15.f }, nullptr, false, 3.f, style, expected );
+	const auto triangles = cache.get_triangles( layer.lines, 50 );
+	REQUIRE( triangles.point_count == expected.size() );
+	REQUIRE( triangles.points[0].x == expected[0].x );
+}
+
+
+
+TEST_CASE( "Tessellating lines speed", "[.][benchmark]" )
+{
+	using seconds = std::chrono::duration<double>;
+
+	std::mt19937 random( 1 );
+	std::uniform_real_distribution<float> position( 0.f, 2048.f );
+	std::uniform_real_distribution<float> step( -20.f, 20.f );
+
+	// Polylines of 100 thick round joined lines
+	ImgLayer layer;
+	ImgLineStyle style;
+	style.cap  = ROUND_CAP;
+	style.join = ROUND_JOIN;
+	ImgPoint point = { 0.f, 0.f };
+	for( size_t i = 0; i < 200000; i++ )
+	{
+		if( i % 100 == 0 )
+		{
+			point = { position( random ), position( random ) };
+		}
+
+		const ImgPoint next = { point.x + step( random ), point.y + step( random ) };
+		layer.add_line( point.x, point.y, next.x, next.y, 8.f, ImgLayer::default_color, style );
+		point = next;
+	}
+
+	std::vector<uint32_t> indices( layer.lines.size() );
+	std::iota( indices.begin(), indices.end(), 0 );
+
+	ImgStrokeCache cache;
+	auto start = std::chrono::steady_clock::now();
+	cache.update( layer.lines, indices );
+	const seconds tessellate_time = std::chrono::steady_clock::now() - start;
+	REQUIRE( cache.get_tessellated_count() == 200000 );
+
+	start = std::chrono::steady_clock::now();
+	cache.update( layer.lines, indices );
+	const seconds cached_time = std::chrono::steady_clock::now() - start;
+	REQUIRE( cache.get_tessellated_count() == 0 );
+
+	std::wcout << "Tessellated 200000 lines\n"
+	           << "  first update:  " << tessellate_time.count() * 1000.0 << " ms\n"
+	           << "  cached update: " << cached_time.count() * 1000.0 << " ms\n"
+	           << "  cache memory:  " << cache.get_memory_size() / (1024 * 1024) << " MB\n";
+}
@@ -0,0 +1,323 @@
+#include "../src/vector_img_svg.hh"
+#include "vector_img_test_helpers.hh"
+
+#include <catch.hpp>
+#include <chrono>
+#include <random>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+using namespace vector_img;
+using namespace vector_img_tests;
+
+namespace
+{
+	const std::string svg_path = "svg_test.svg";
+
+
+
+	void write_file( const std::string &path, const std::string &text )
+	{
+		std::ofstream stream( path, std::ios::binary | std::ios::trunc );
+		stream << text;
+	}
+
+
+
+	VectorImg import_text( const std::string &text )
+	{
+		write_file( svg_path, text );
+		VectorImg image;
+		import_svg( svg_path, image );
+		return image;
+	}
+
+
+
+	bool is_same_color( Color a, Color b )
+	{
+		return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+	}
+}
+
+
+
+TEST_CASE( "Exported images are imported back as they were" )
+{
+	VectorImg image;
+	image.img_w = 200;
+	image.img_h = 100;
+	image.layers.emplace_back( new ImgLayer() );
+	auto &first = *image.layers.back();
+
+	// The hole is the second contour, the position of the fill is the corner of its bounds
+	auto path = make_square( 20.f );
+	path.points.insert( path.points.end(), { { 5.f, 5.f }, { 15.f, 5.f }, { 15.f, 15.f }, { 5.f, 15.f } } );
+	path.contour_ends.push_back( 8 );
+	path.rule = EVEN_ODD;
+	first.add_fill( 10.f, 20.5f, path, Color{ 10, 20, 30, 128 } );
+	first.add_line( 1.f, 2.f, 30.25f, 40.5f, 3.f, Color{ 255, 0, 0, 255 }, ImgLineStyle{ ROUND_CAP, BEVEL_JOIN } );
+	first.add_control_point( 50.f, 60.f, Color{ 0, 0, 255, 255 } );
+
+	image.layers.emplace_back( new ImgLayer() );
+	image.layers.back()->add_fill( 100.f, 50.f, make_square( 8.f ) );
+
+	export_svg( image, svg_path );
+	VectorImg imported;
+	import_svg( svg_path, imported );
+
+	REQUIRE( imported.img_w == 200 );
+	REQUIRE( imported.img_h == 100 );
+	REQUIRE( imported.layers.size() == 2 );
+
+	const auto &fills = imported.layers[0]->fills;
+	REQUIRE( fills.size() == 1 );
+	REQUIRE( fills.x[0] == 10.f );
+	REQUIRE( fills.y[0] == 20.5f );
+	REQUIRE( is_same_color( fills.color[0], Color{ 10, 20, 30, 128 } ) );
+	REQUIRE( fills.path[0].rule == EVEN_ODD );
+	REQUIRE( fills.path[0].contour_ends == path.contour_ends );
+	for( size_t i = 0; i < path.points.size(); i++ )
+	{
+		REQUIRE( fills.path[0].points[i].x == path.points[i].x );
+		REQUIRE( fills.path[0].points[i].y == path.points[i].y );
+	}
+
+	const auto &lines = imported.layers[0]->lines;
+	REQUIRE( lines.size() == 1 );
+	REQUIRE( lines.ax[0] == 1.f );
+	REQUIRE( lines.ay[0] == 2.f );
+	REQUIRE( lines.bx[0] == 30.25f );
+	REQUIRE( lines.by[0] == 40.5f );
+	REQUIRE( lines.width[0] == 3.f );
+	REQUIRE( is_same_color( lines.color[0], Color{ 255, 0, 0, 255 } ) );
+	REQUIRE( lines.style[0].cap == ROUND_CAP );
+	REQUIRE( lines.style[0].join == BEVEL_JOIN );
+
+	const auto &points = imported.layers[0]->control_points;
+	REQUIRE( points.size() == 1 );
+	REQUIRE( points.x[0] == 50.f );
+	REQUIRE( points.y[0] == 60.f );
+	REQUIRE( is_same_color( points.color[0], Color{ 0, 0, 255, 255 } ) );
+
+	REQUIRE( imported.layers[1]->fills.size() == 1 );
+	REQUIRE( imported.layers[1]->fills.x[0] == 100.f );
+	REQUIRE( imported.layers[1]->size() == 1 );
+
+	std::remove( svg_path.c_str() );
+}
+
+
+
+TEST_CASE( "Top level groups of imported files become layers" )
+{
+	const auto image = import_text(
+		"<?xml version=\"1.0\"?>\n"
+		"<!-- Items before the groups -->\n"
+		"<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"100\" height=\"50\">\n"
+		"  <line x1=\"0\" y1=\"0\" x2=\"10\" y2=\"10\" stroke=\"black\"/>\n"
+		"  <g stroke=\"red\" transform=\"translate(10 20)\">\n"
+		"    <g><line x1=\"0\" y1=\"0\" x2=\"5\" y2=\"0\"/></g>\n"
+		"    <circle cx=\"1\" cy=\"2\" r=\"3\"/>\n"
+		"  </g>\n"
+		"  <g display=\"none\"><line x1=\"0\" y1=\"0\" x2=\"5\" y2=\"5\" stroke=\"black\"/></g>\n"
+		"  <defs><rect width=\"5\" height=\"5\"/></defs>\n"
+		"  <g><rect x=\"1\" y=\"2\" width=\"3\" height=\"4\" fill=\"#00ff00\"/></g>\n"
+		"  <polyline points=\"0,0 10,0 10,10\" fill=\"none\" stroke=\"blue\"/>\n"
+		"</svg>\n" );
+
+	REQUIRE( image.img_w == 100 );
+	REQUIRE( image.img_h == 50 );
+
+	// The items between the groups have layers of their own, hidden groups have none
+	REQUIRE( image.layers.size() == 4 );
+	REQUIRE( image.layers[0]->lines.size() == 1 );
+
+	// Nested groups stay in the layer of their top level group
+	const auto &group = *image.layers[1];
+	REQUIRE( group.lines.size() == 1 );
+	REQUIRE( group.lines.ax[0] == 10.f );
+	REQUIRE( group.lines.by[0] == 20.f );
+	REQUIRE( group.lines.color[0].r == 255 );
+	REQUIRE( group.control_points.size() == 1 );
+	REQUIRE( group.control_points.x[0] == 11.f );
+	REQUIRE( group.control_points.y[0] == 22.f );
+
+	const auto &rect = *image.layers[2];
+	REQUIRE( rect.size() == 1 );
+	REQUIRE( rect.fills.x[0] == 1.f );
+	REQUIRE( rect.fills.y[0] == 2.f );
+	REQUIRE( rect.fills.color[0].g == 255 );
+	REQUIRE( rect.fills.path[0].contour_ends == std::vector<uint32_t>{ 4 } );
+
+	// Unfilled polylines are only their lines
+	REQUIRE( image.layers[3]->fills.size() == 0 );
+	REQUIRE( image.layers[3]->lines.size() == 2 );
+
+	std::remove( svg_path.c_str() );
+}
+
+
+
+TEST_CASE( "Imported paths keep their fill rules" )
+{
+	const auto image = import_text(
+		"<svg xmlns=\"http://www.w3.org/2000/svg\" viewBox=\"0 0 40 20\">"
+		"<path d=\"M0 0h20v20h-20z M5 5h10v10h-10z\" fill-rule=\"evenodd\"/>"
+		"<path style=\"fill:#0000ff;fill-rule:nonzero\" d=\"M20 0L40 0L40 20L20 20Z\"/>"
+		"<polygon points=\"0,0 4,0 4,4\" fill-rule=\"evenodd\" fill-opacity=\"0.5\"/>"
+		"</svg>" );
+
+	REQUIRE( image.img_w == 40 );
+	REQUIRE( image.img_h == 20 );
+	REQUIRE( image.layers.size() == 1 );
+
+	const auto &fills = image.layers[0]->fills;
+	REQUIRE( fills.size() == 3 );
+	REQUIRE( fills.path[0].rule == EVEN_ODD );
+	REQUIRE( fills.path[0].contour_ends == std::vector<uint32_t>{ 4, 8 } );
+
+	// Even-odd leaves the hole empty
+	REQUIRE( fills.path[0].contains( 2.f, 2.f ) );
+	REQUIRE_FALSE( fills.path[0].contains( 10.f, 10.f ) );
+
+	REQUIRE( fills.path[1].rule == NON_ZERO );
+	REQUIRE( fills.x[1] == 20.f );
+	REQUIRE( fills.color[1].b == 255 );
+
+	REQUIRE( fills.path[2].rule == EVEN_ODD );
+	REQUIRE( fills.color[2].a == 128 );
+
+	std::remove( svg_path.c_str() );
+}
+
+
+
+TEST_CASE( "Imported items that would be drawn under earlier items start a new layer" )
+{
+	const auto image = import_text(
+		"<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"100\" height=\"100\">\n"
+		"  <g stroke-width=\"2\">\n"
+		"    <line x1=\"0\" y1=\"0\" x2=\"20\" y2=\"0\" stroke=\"black\"/>\n"
+		"    <rect x=\"50\" y=\"50\" width=\"10\" height=\"10\" fill=\"#00ff00\"/>\n"
+		"    <rect x=\"5\" y=\"-5\" width=\"10\" height=\"10\" fill=\"#0000ff\"/>\n"
+		"    <circle cx=\"8\" cy=\"0\" r=\"1\" fill=\"red\"/>\n"
+		"    <line x1=\"30\" y1=\"0\" x2=\"40\" y2=\"0\" stroke=\"black\"/>\n"
+		"    <line x1=\"0\" y1=\"0\" x2=\"20\" y2=\"0\" stroke=\"black\"/>\n"
+		"  </g>\n"
+		"</svg>\n" );
+
+	// Items apart from the ones of the later types stay on the layer
+	REQUIRE( image.layers.size() == 3 );
+	REQUIRE( image.layers[0]->lines.size() == 1 );
+	REQUIRE( image.layers[0]->fills.size() == 1 );
+	REQUIRE( image.layers[0]->fills.color[0].g == 255 );
+
+	const auto &second = *image.layers[1];
+	REQUIRE( second.fills.size() == 1 );
+	REQUIRE( second.fills.color[0].b == 255 );
+	REQUIRE( second.control_points.size() == 1 );
+	REQUIRE( second.lines.size() == 1 );
+	REQUIRE( second.lines.ax[0] == 30.f );
+
+	REQUIRE( image.layers[2]->size() == 1 );
+	REQUIRE( image.layers[2]->lines.ax[0] == 0.f );
+
+	// Control points are always drawn on top, the other types
+	// only over the items of the types drawn after them
+	REQUIRE( second.is_drawn_on_top( CONTROL_POINT, { 0.f, -5.f, 20.f, 5.f } ) );
+	REQUIRE( second.is_drawn_on_top( FILL, { 31.f, -1.f, 39.f, 1.f } ) == false );
+	REQUIRE( second.is_drawn_on_top( FILL, { 60.f, 60.f, 70.f, 70.f } ) );
+	REQUIRE( second.is_drawn_on_top( LINE, { 0.f, 0.f, 5.f, 5.f } ) );
+	REQUIRE( second.is_drawn_on_top( LINE, { 7.f, -1.f, 9.f, 1.f } ) == false );
+	REQUIRE( image.layers[2]->is_drawn_on_top( LINE, { 7.f, -1.f, 9.f, 1.f } ) );
+
+	std::remove( svg_path.c_str() );
+}
+
+
+
+TEST_CASE( "Truncated files import the items read before the end" )
+{
+	const std::string text =
+		"<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"100\" height=\"100\">"
+		"<g><line x1=\"0\" y1=\"0\" x2=\"10\" y2=\"10\" stroke=\"black\"/>"
+		"<line x1=\"20\" y1=\"20\" x2=\"30\" y2=\"30\" stroke=\"black\"/>"
+		"<!-- a comment with <line x1=\"0\"/> in it -->"
+		"<line x1=\"40\" y1=\"40\" x2=\"50\" y2=\"50\" stroke=\"black\"/></g></svg>";
+
+	// Every cut gives the complete items before it, cut tags are left out
+	size_t previous_count = 0;
+	for( size_t length = 0; length <= text.size(); length++ )
+	{
+		const auto image = import_text( text.substr( 0, length ) );
+		const auto count = image.layers.empty() ? 0 : image.layers[0]->lines.size();
+		REQUIRE( count >= previous_count );
+		REQUIRE( count <= 3 );
+		previous_count = count;
+	}
+	REQUIRE( previous_count == 3 );
+
+	// The cut inside the comment still has the first two lines
+	const auto comment = text.find( "<!--" );
+	const auto image = import_text( text.substr( 0, comment + 20 ) );
+	REQUIRE( image.layers.size() == 1 );
+	REQUIRE( image.layers[0]->lines.size() == 2 );
+
+	// Missing files throw, empty ones are empty images
+	std::remove( svg_path.c_str() );
+	VectorImg missing;
+	REQUIRE_THROWS_AS( import_svg( svg_path, missing ), std::runtime_error );
+
+	REQUIRE( import_text( "" ).layers.empty() );
+	std::remove( svg_path.c_str() );
+}
+
+
+
+TEST_CASE( "SVG import and export speed", "[.][benchmark]" )
+{
+	using seconds = std::chrono::duration<double>;
+
+	std::mt19937 random( 1 );
+	std::uniform_real_distribution<float> position( 0.f, 4000.f );
+	VectorImg image;
+	image.img_w = 4000;
+	image.img_h = 4000;
+	image.layers.emplace_back( new ImgLayer() );
+	auto &layer = *image.layers[0];
+	const size_t item_count = 200000;
+	for( size_t i = 0; i < item_count; i++ )
+	{
+		const auto x = position( random );
+		const auto y = position( random );
+		if( i % 8 == 0 )
+		{
+			layer.add_fill( x, y, make_square( 10.f ) );
+		}
+		else
+		{
+			layer.add_line( x, y, position( random ), position( random ), 1.f );
+		}
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	export_svg( image, svg_path );
+	const seconds export_time = std::chrono::steady_clock::now() - start;
+
+	start = std::chrono::steady_clock::now();
+	VectorImg imported;
+	import_svg( svg_path, imported );
+	const seconds import_time = std::chrono::steady_clock::now() - start;
+
+	REQUIRE( imported.layers.size() == 1 );
+	REQUIRE( imported.layers[0]->size() == item_count );
+
+	std::wcout << "SVG of " << item_count << " items\n"
+	           << "  export: " << export_time.count() * 1000.0 << " ms\n"
+	           << "  import: " << import_time.count() * 1000.0 << " ms\n";
+
+	std::remove( svg_path.c_str() );
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "../src/vector_img.hh"
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+// Items and measures shared by the vector image tests
+namespace vector_img_tests
+{
+using namespace vector_img;
+
+
+
+// A wandering polyline of short lines, like drawn by hand or traced from a map
+inline void add_polyline( ImgLayer &layer, std::mt19937 &random, size_t line_count, float length, float x, float y )
+{
+	std::uniform_real_distribution<float> turn( -0.3f, 0.3f );
+	auto angle = 0.f;
+	for( size_t i = 0; i < line_count; i++ )
+	{
+		angle += turn( random );
+		const auto next_x = x + length * std::cos( angle );
+		const auto next_y = y + length * std::sin( angle );
+		layer.add_line( x, y, next_x, next_y, 2.f, Color{ 10, 20, 30, 255 } );
+		x = next_x;
+		y = next_y;
+	}
+}
+
+
+
+inline ImgPath make_square( float size )
+{
+	ImgPath path;
+	path.points = { { 0.f, 0.f }, { size, 0.f }, { size, size }, { 0.f, size } };
+	path.contour_ends = { 4 };
+	return path;
+}
+
+
+
+// Short lines with a control point every fourth item
+inline std::vector<ImgItemHandle> add_test_items( ImgLayer &layer, size_t item_count )
+{
+	std::mt19937 random( 1 );
+	std::uniform_real_distribution<float> position( 0.f, 2048.f );
+
+	std::vector<ImgItemHandle> handles;
+	for( size_t i = 0; i < item_count; i++ )
+	{
+		const auto x = position( random );
+		const auto y = position( random );
+		if( i % 4 == 0 )
+		{
+			handles.push_back( layer.add_control_point( x, y ) );
+		}
+		else
+		{
+			handles.push_back( layer.add_line( x, y, x + 5.f, y + 3.f, 1.f ) );
+		}
+	}
+
+	return handles;
+}
+
+
+
+// Area covered by a triangle list, overlaps are counted twice
+inline float get_area( const std::vector<ImgPoint> &triangles )
+{
+	auto area = 0.f;
+	for( size_t i = 0; i + 2 < triangles.size(); i += 3 )
+	{
+		const auto &a = triangles[i];
+		const auto &b = triangles[i + 1];
+		const auto &c = triangles[i + 2];
+		area += std::fabs( (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y) ) / 2.f;
+	}
+
+	return area;
+}
+
+
+};